@@ -31,6 +31,7 @@ class ObjectMesherLcm final {
     bool visualize = true;
     bool expect_shm_images = true;
     int mesher_input_height = 480;    // Downsample images to have this height.
+    int decode_scale = 1;             // Downsample JPGs by 1, 2, 4 or 8 while decoding (cheaper than resizing).
 
     ObjectMesher::Params mesher_params;
 
@@ -42,6 +43,9 @@ class ObjectMesherLcm final {
       parser.GetParam("visualize", &visualize);
       parser.GetParam("expect_shm_images", &expect_shm_images);
       parser.GetParam("mesher_input_height", &mesher_input_height);
+      parser.GetParam("decode_scale", &decode_scale);
+      CHECK(decode_scale == 1 || decode_scale == 2 || decode_scale == 4 || decode_scale == 8)
+          << "decode_scale must be 1, 2, 4 or 8, got " << decode_scale << std::endl;
       mesher_params = ObjectMesher::Params(parser.Subtree("ObjectMesher"));
     }
   };
@@ -49,7 +53,7 @@ class ObjectMesherLcm final {
   ObjectMesherLcm(const Params& params)
       : params_(params),
         mesher_(params.mesher_params),
-        sub_(lcm_, params_.channel_input_stereo, params_.expect_shm_images)
+        sub_(lcm_, params_.channel_input_stereo, params_.expect_shm_images, DecodeOptions(true, params_.decode_scale))
   {
     if (!lcm_.good()) {
       LOG(WARNING) << "Failed to initialize LCM" << std::endl;
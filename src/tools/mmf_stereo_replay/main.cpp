@@ -0,0 +1,73 @@
+#include <glog/logging.h>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include "core/macros.hpp"
+#include "core/path_util.hpp"
+#include "params/params_base.hpp"
+#include "dataset/euroc_dataset.hpp"
+#include "lcm_util/mmf_stereo_publisher.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+// Replays the stereo images from a EuRoC-format dataset through an MmfStereoPublisher. This is a
+// local stand-in for the camera driver, so that we can measure the latency from "camera" to
+// StateEstimator::ReceiveStereo on one machine (see the "mmf_latency" stats in ImageSubscriber).
+struct MmfStereoReplayParams : public ParamsBase
+{
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(MmfStereoReplayParams);
+  std::string folder;
+  std::string channel_output_stereo;
+  std::string mm_filename = "/dev/shm/mmf_stereo_replay";
+  int num_slots = 4;
+  int max_image_bytes = 1280 * 720;
+  float playback_speed = 1.0;
+
+ private:
+  void LoadParams(const YamlParser& parser) override
+  {
+    folder = YamlToString(parser.GetNode("folder"));
+    channel_output_stereo = YamlToString(parser.GetNode("channel_output_stereo"));
+    mm_filename = YamlToString(parser.GetNode("mm_filename"));
+    parser.GetParam("num_slots", &num_slots);
+    parser.GetParam("max_image_bytes", &max_image_bytes);
+    parser.GetParam("playback_speed", &playback_speed);
+  }
+};
+
+
+int main(int argc, char const *argv[])
+{
+  google::InitGoogleLogging(argv[0]);
+  FLAGS_logtostderr = 1;
+
+  lcm::LCM lcm;
+  if (!lcm.good()) {
+    LOG(WARNING) << "Failed to initialize LCM" << std::endl;
+    return 1;
+  }
+
+  MmfStereoReplayParams params(tools_path("mmf_stereo_replay/config/MmfStereoReplay.yaml"));
+
+  MmfStereoPublisher publisher(lcm,
+                               params.channel_output_stereo,
+                               params.mm_filename,
+                               static_cast<size_t>(params.num_slots),
+                               static_cast<size_t>(params.max_image_bytes));
+
+  // Only stereo callbacks are registered, but playback still follows the dataset's timestamps.
+  dataset::EurocDataset dataset(params.folder);
+  dataset::StereoCallback1b stereo_callback = [&publisher](const StereoImage1b& stereo_pair)
+  {
+    publisher.Publish(stereo_pair);
+  };
+  dataset.RegisterStereoCallback(stereo_callback);
+
+  dataset.Playback(params.playback_speed, false);
+
+  LOG(INFO) << "DONE" << std::endl;
+
+  return 0;
+}
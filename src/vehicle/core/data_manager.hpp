@@ -1,123 +1,102 @@
 #pragma once
 
-#include <typeinfo>
+#include <vector>
 
 #include "core/macros.hpp"
 #include "core/timestamp.hpp"
-#include "core/thread_safe_queue.hpp"
+#include "core/sensor_bus.hpp"
 
 namespace bm {
 namespace core {
 
 
+// A time-ordered queue of sensor measurements, implemented as one reader of a SensorBus.
+//
+// By default, a DataManager owns a private bus. Several DataManagers can instead share a bus, so
+// that each measurement is only stored once. In that case Push() (on the bus or any DataManager)
+// delivers the measurement to all of them, and Pop(), DiscardBefore(), etc. only move this
+// DataManager's own read cursor.
 template <typename DataType>
 class DataManager {
  public:
   MACRO_DELETE_DEFAULT_CONSTRUCTOR(DataManager);
   MACRO_DELETE_COPY_CONSTRUCTORS(DataManager);
 
+  // Construct with a private bus.
   DataManager(size_t max_queue_size,
               bool drop_old,
               const std::string& queue_name = "")
-      : queue_(max_queue_size, drop_old, queue_name) {}
+      : bus_(std::make_shared<SensorBus<DataType>>(max_queue_size, drop_old, queue_name)),
+        reader_(bus_->AddReader()) {}
 
-  void Push(const DataType& item)
-  {
-    // NOTE(milo): Cannot use the lock here! It will enter a race with Newest().
-    lock_.lock();
-    const seconds_t timestamp = MaybeConvertToSeconds(item.timestamp);
-
-    // Always push if queue is empty.
-    if (queue_.Empty()) {
-      queue_.Push(std::move(item));
-    } else {
-      const timestamp_t newest = Newest(false); // Grab timestamp once to make sure it's consistent.
-      CHECK(newest == kMaxSeconds || timestamp >= newest)
-          << "Tried to add measurement out of order."
-          << "\n  timestamp=" << timestamp
-          << "\n  newest=" << newest << std::endl;
-      queue_.Push(std::move(item));
-    }
-    lock_.unlock();
-  }
+  // Construct as a new reader of a shared bus. Only measurements pushed after this are visible.
+  explicit DataManager(const typename SensorBus<DataType>::Ptr& bus)
+      : bus_(bus),
+        reader_(bus_->AddReader()) {}
+
+  ~DataManager() { bus_->RemoveReader(reader_); }
 
-  bool Empty() { return queue_.Empty(); }
-  size_t Size() { return queue_.Size(); }
+  void Push(const DataType& item) { bus_->Push(item); }
+
+  bool Empty() { return Size() == 0; }
+  size_t Size() { return bus_->Size(reader_); }
 
   // Get the oldest measurement (first in) from the queue.
-  DataType Pop() { return queue_.Pop(); }
+  DataType Pop() { return bus_->Pop(reader_); }
 
   // Get the newest measurement (last in) from the queue. This will discard all measurements except
   // the newest one.
-  DataType PopNewest()
-  {
-    lock_.lock();
-    CHECK(queue_.Size() >= 1);
-    while (queue_.Size() > 1) {
-      queue_.Pop();
-    }
-    DataType item = queue_.Pop();
-    lock_.unlock();
-    return item;
-  }
+  DataType PopNewest() { return bus_->PopNewest(reader_); }
 
   // Pop measurements and put them in "out" until the next item exceeds the timestamp.
   void PopUntil(seconds_t timestamp, std::vector<DataType>& out)
   {
-    lock_.lock();
-    while (!queue_.Empty() && (MaybeConvertToSeconds(queue_.PeekFront().timestamp) <= timestamp)) {
-      out.emplace_back(std::move(queue_.Pop()));
-    }
-    lock_.unlock();
+    bus_->PopUntil(reader_, timestamp, out);
   }
 
   // Throw away measurements before (but NOT equal to) timestamp. If save_at_least_one is true,
   // we don't pop the only remaining item, no matter what timestamp it has.
   void DiscardBefore(seconds_t timestamp, bool save_at_least_one = false)
   {
-    lock_.lock();
-    while (!queue_.Empty() &&
-           !(queue_.Size() == 1 && save_at_least_one) &&
-           (MaybeConvertToSeconds(queue_.PeekFront().timestamp) < timestamp)) {
-      queue_.Pop();
-    }
-    lock_.unlock();
+    bus_->DiscardBefore(reader_, timestamp, save_at_least_one);
   }
 
   // Timestamp of the newest measurement in the queue. If empty, returns kMaxSeconds.
-  seconds_t Newest(bool lock = true)
-  {
-    if (lock) lock_.lock();
-    const seconds_t t = queue_.Empty() ? kMaxSeconds : MaybeConvertToSeconds(queue_.PeekBack().timestamp);
-    if (lock) lock_.unlock();
-    return t;
-  }
+  seconds_t Newest() { return bus_->Newest(reader_); }
 
   // Timestamp of the oldest measurement in the queue. If empty, returns kMinSeconds.
-  seconds_t Oldest(bool lock = false)
-  {
-    if (lock) lock_.lock();
-    const seconds_t t = queue_.Empty() ? kMinSeconds : MaybeConvertToSeconds(queue_.PeekFront().timestamp);
-    if (lock) lock_.unlock();
-    return t;
-  }
+  seconds_t Oldest() { return bus_->Oldest(reader_); }
 
- private:
-  std::mutex lock_;
-  ThreadsafeQueue<DataType> queue_;
+  // Timestamp of the first measurement >= timestamp. If there isn't one, returns kMaxSeconds.
+  seconds_t FirstAtOrAfter(seconds_t timestamp) { return bus_->FirstAtOrAfter(reader_, timestamp); }
 
- private:
-  seconds_t MaybeConvertToSeconds(timestamp_t t) const
+  // Calls f(const DataType&) on each measurement with t0 <= timestamp <= t1, in time order, without
+  // removing them. Returns the number of measurements visited.
+  // NOTE(milo): The lock is held while f runs, so keep it fast and don't call back into this object.
+  template <typename Function>
+  size_t ForEachInRange(seconds_t t0, seconds_t t1, Function f)
   {
-    return ConvertToSeconds(t);
+    return bus_->ForEachInRange(reader_, t0, t1, f);
   }
 
-  // Let the compiler decide which of these functions to use, depending on whether the undelying
-  // DataType uses timestamp_t or seconds_t timestamps.
-  static seconds_t MaybeConvertToSeconds(seconds_t t)
+  // Copies the measurements with t0 <= timestamp <= t1 into "out", without removing them.
+  void CopyRange(seconds_t t0, seconds_t t1, std::vector<DataType>& out)
   {
-    return t;
+    ForEachInRange(t0, t1, [&out](const DataType& item) { out.emplace_back(item); });
   }
+
+  // Blocks until a measurement arrives or timeout_sec elapses. Returns false on timeout/shutdown.
+  bool WaitUntilNonEmpty(double timeout_sec) { return bus_->WaitUntilNonEmpty(reader_, timeout_sec); }
+
+  // Waits up to timeout_sec for the oldest measurement. Returns false on timeout/shutdown.
+  bool WaitPop(DataType& item, double timeout_sec) { return bus_->WaitPop(reader_, item, timeout_sec); }
+
+  // Interrupts any waiting consumer. NOTE(milo): This shuts down the whole bus, not just this reader.
+  void Shutdown() { bus_->Shutdown(); }
+
+ private:
+  typename SensorBus<DataType>::Ptr bus_;
+  size_t reader_;
 };
 
 
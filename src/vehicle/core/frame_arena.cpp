@@ -0,0 +1,81 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "core/frame_arena.hpp"
+
+namespace bm {
+namespace core {
+
+
+FrameArena::FrameArena(size_t initial_bytes)
+{
+  CHECK_GT(initial_bytes, 0ul);
+
+  // NOTE(milo): Reserve a few entries so that growing the block list itself doesn't allocate.
+  blocks_.reserve(8);
+  AddBlock(initial_bytes);
+}
+
+
+void* FrameArena::Allocate(size_t bytes, size_t alignment)
+{
+  CHECK(alignment > 0 && (alignment & (alignment - 1)) == 0) << "Alignment must be a power of 2" << std::endl;
+
+  Block& block = blocks_.back();
+  uintptr_t start = reinterpret_cast<uintptr_t>(block.data.get()) + offset_;
+  size_t padding = (alignment - (start % alignment)) % alignment;
+
+  // Not enough room in this block, so start a new one that is at least double the size.
+  if ((offset_ + padding + bytes) > block.size) {
+    AddBlock(std::max(2 * block.size, bytes + alignment));
+    start = reinterpret_cast<uintptr_t>(blocks_.back().data.get());
+    padding = (alignment - (start % alignment)) % alignment;
+  }
+
+  offset_ += padding + bytes;
+  bytes_used_ += padding + bytes;
+
+  return reinterpret_cast<void*>(start + padding);
+}
+
+
+void FrameArena::Reset()
+{
+  // Merge everything into one block, so that a frame like the last one won't need the heap.
+  if (blocks_.size() > 1) {
+    const size_t total = capacity_;
+    blocks_.clear();
+    capacity_ = 0;
+    AddBlock(total);
+  }
+
+  offset_ = 0;
+  bytes_used_ = 0;
+}
+
+
+void FrameArena::Reserve(size_t bytes)
+{
+  // Reset() merges all of the blocks into one, so just make up the difference.
+  if (capacity_ < bytes) {
+    AddBlock(bytes - capacity_);
+  }
+}
+
+
+void FrameArena::AddBlock(size_t bytes)
+{
+  Block block;
+  block.data = std::unique_ptr<uint8_t[]>(new uint8_t[bytes]);
+  block.size = bytes;
+  blocks_.emplace_back(std::move(block));
+
+  offset_ = 0;
+  capacity_ += bytes;
+  ++num_heap_allocations_;
+}
+
+
+}
+}
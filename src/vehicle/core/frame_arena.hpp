@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A monotonic arena for temporaries that only live for one frame (one call of a tracking function).
+// Allocate() just bumps a pointer, freeing does nothing, and Reset() frees everything at once.
+//
+// If a frame needs more than the current block, more blocks are allocated. Then on the next
+// Reset(), they're merged into one block that's big enough for the whole frame. So once the
+// temporaries stop growing, frames don't touch the heap at all.
+//
+// NOTE(milo): Not thread-safe. Containers that are filled from worker threads should reserve()
+// enough capacity on the owning thread first.
+class FrameArena final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(FrameArena);
+
+  explicit FrameArena(size_t initial_bytes = 64 * 1024);
+
+  // Get "bytes" of memory aligned to "alignment" (a power of 2). Valid until the next Reset().
+  void* Allocate(size_t bytes, size_t alignment);
+
+  // Frees everything that was allocated since the last Reset().
+  void Reset();
+
+  // Makes sure that there is one block of at least "bytes" after the next Reset(), e.g when the
+  // owner knows that later frames will need more than the ones so far.
+  void Reserve(size_t bytes);
+
+  // Bytes handed out since the last Reset(), and the total size of all blocks.
+  size_t BytesUsed() const { return bytes_used_; }
+  size_t Capacity() const { return capacity_; }
+
+  // Number of times that a block was allocated on the heap (including the first one).
+  size_t NumHeapAllocations() const { return num_heap_allocations_; }
+
+ private:
+  void AddBlock(size_t bytes);
+
+ private:
+  struct Block
+  {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size;
+  };
+
+  std::vector<Block> blocks_;
+  size_t offset_ = 0;       // Next free byte in blocks_.back().
+  size_t bytes_used_ = 0;
+  size_t capacity_ = 0;
+  size_t num_heap_allocations_ = 0;
+};
+
+
+// A std::allocator replacement that gets memory from a FrameArena.
+// NOTE(milo): Not "final", since std::vector derives from its allocator.
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+
+  explicit ArenaAllocator(FrameArena& arena) : arena_(&arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena_) {}
+
+  T* allocate(size_t n) { return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T))); }
+  void deallocate(T*, size_t) {}
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const { return arena_ == other.arena_; }
+
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const { return arena_ != other.arena_; }
+
+ private:
+  template <typename U> friend class ArenaAllocator;
+
+  FrameArena* arena_;
+};
+
+
+// A vector that lives in a FrameArena, i.e ArenaVector<int> v(ArenaAllocator<int>(arena));
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+
+}
+}
@@ -24,6 +24,14 @@ inline int NextOddInt(int x)
   return x + (1 - x % 2);
 }
 
+// Smallest power of two that is >= x (returns 1 for x == 0).
+inline size_t NextPowerOfTwo(size_t x)
+{
+  size_t p = 1;
+  while (p < x) { p <<= 1; }
+  return p;
+}
+
 
 // Modulo operation that works for positive and negative integers (like in Python).
 // Example 1: WrapInt(4, 3) == 1
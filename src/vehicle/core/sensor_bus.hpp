@@ -0,0 +1,364 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "core/macros.hpp"
+#include "core/math_util.hpp"
+#include "core/timestamp.hpp"
+
+namespace bm {
+namespace core {
+
+
+// An append-only, time-ordered store of sensor measurements that several consumers can read from.
+// Each measurement is stored ONCE, and each reader (e.g the smoother, the filter, a logger) has its
+// own read cursor. A measurement is freed once every reader has moved past it.
+//
+// Measurements live in a contiguous circular buffer, and timestamps are kept in their own array, so
+// lookups like "first item >= t" are a binary search and consuming a prefix just moves a cursor.
+// Every method takes the lock ONCE, no matter how many measurements it touches.
+//
+// Readers are usually accessed through a DataManager, which wraps a (bus, reader) pair.
+template <typename DataType>
+class SensorBus final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(SensorBus);
+  MACRO_DELETE_COPY_CONSTRUCTORS(SensorBus);
+  MACRO_SHARED_POINTER_TYPEDEFS(SensorBus);
+
+  // Holds at most max_size measurements. If the bus is full (because the slowest reader is behind),
+  // either the oldest measurement is dropped (drop_old) or the new one is.
+  SensorBus(size_t max_size,
+            bool drop_old,
+            const std::string& name = "")
+      : max_size_(max_size),
+        drop_old_(drop_old),
+        name_(name),
+        num_slots_(NextPowerOfTwo(max_size)),
+        mask_(num_slots_ - 1),
+        items_(new Storage[num_slots_]),
+        times_(new seconds_t[num_slots_])
+  {
+    CHECK_GT(max_size, 0ul) << "SensorBus must be bounded!" << "\n  Bus=" << name_ << std::endl;
+  }
+
+  ~SensorBus()
+  {
+    DestroyUntil(end_);
+  }
+
+  // Adds a reader whose cursor starts after the newest measurement. Returns the reader's id.
+  size_t AddReader()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t r = 0; r < cursors_.size(); ++r) {
+      if (cursors_.at(r) == kNoReader) {
+        cursors_.at(r) = end_;
+        return r;
+      }
+    }
+    cursors_.emplace_back(end_);
+    return cursors_.size() - 1;
+  }
+
+  // Removes a reader, so that it no longer holds back garbage collection.
+  void RemoveReader(size_t reader)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CursorFor(reader) = kNoReader;
+    CollectGarbage();
+  }
+
+  // Appends a measurement for all readers. Measurements must arrive in time order.
+  void Push(const DataType& item)
+  {
+    const seconds_t timestamp = MaybeConvertToSeconds(item.timestamp);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    // Always push if the bus is empty.
+    if (end_ > begin_) {
+      const seconds_t newest = TimeAt(end_ - 1);
+      CHECK(timestamp >= newest)
+          << "Tried to add measurement out of order."
+          << "\n  timestamp=" << timestamp
+          << "\n  newest=" << newest << std::endl;
+    }
+
+    if ((end_ - begin_) >= max_size_) {
+      if (!drop_old_) {
+        return;
+      }
+      LOG(WARNING) << "Dropping item from SensorBus!"
+          << "\n  Bus=" << name_
+          << "\n  Item=" << typeid(DataType).name() << std::endl;
+      DestroyUntil(begin_ + 1);
+
+      // Any reader that hadn't read the dropped measurement skips it.
+      for (uint64_t& cursor : cursors_) {
+        if (cursor != kNoReader) { cursor = std::max(cursor, begin_); }
+      }
+    }
+
+    const size_t idx = end_ & mask_;
+    new (&items_[idx]) DataType(item);
+    times_[idx] = timestamp;
+    ++end_;
+
+    lock.unlock();
+    cv_.notify_all();
+  }
+
+  // Number of measurements held in memory (unread by at least one reader).
+  size_t StoredSize()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<size_t>(end_ - begin_);
+  }
+
+  // Number of measurements that a reader hasn't consumed yet.
+  size_t Size(size_t reader)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<size_t>(end_ - CursorFor(reader));
+  }
+
+  // Consume the oldest unread measurement.
+  DataType Pop(size_t reader)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t& cursor = CursorFor(reader);
+    CHECK_GT(end_, cursor) << "Tried to pop from empty SensorBus reader!"
+        << "\n  Bus=" << name_
+        << "\n  Item=" << typeid(DataType).name() << std::endl;
+    DataType item = ItemAt(cursor);
+    Advance(cursor, cursor + 1);
+    return item;
+  }
+
+  // Consume all unread measurements, and return the newest one.
+  DataType PopNewest(size_t reader)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t& cursor = CursorFor(reader);
+    CHECK(end_ > cursor);
+    DataType item = ItemAt(end_ - 1);
+    Advance(cursor, end_);
+    return item;
+  }
+
+  // Consume measurements and put them in "out" until the next item exceeds the timestamp.
+  void PopUntil(size_t reader, seconds_t timestamp, std::vector<DataType>& out)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t& cursor = CursorFor(reader);
+    const uint64_t last = UpperBound(cursor, timestamp);
+    out.reserve(out.size() + (last - cursor));
+    for (uint64_t s = cursor; s < last; ++s) {
+      out.emplace_back(ItemAt(s));
+    }
+    Advance(cursor, last);
+  }
+
+  // Skip unread measurements before (but NOT equal to) timestamp. If save_at_least_one is true,
+  // we don't skip the only remaining item, no matter what timestamp it has.
+  void DiscardBefore(size_t reader, seconds_t timestamp, bool save_at_least_one)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t& cursor = CursorFor(reader);
+    uint64_t first = LowerBound(cursor, timestamp);
+    if (save_at_least_one && first == end_ && end_ > cursor) {
+      --first;
+    }
+    Advance(cursor, first);
+  }
+
+  // Timestamp of the newest unread measurement. If there isn't one, returns kMaxSeconds.
+  seconds_t Newest(size_t reader)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (end_ == CursorFor(reader)) ? kMaxSeconds : TimeAt(end_ - 1);
+  }
+
+  // Timestamp of the oldest unread measurement. If there isn't one, returns kMinSeconds.
+  seconds_t Oldest(size_t reader)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const uint64_t cursor = CursorFor(reader);
+    return (end_ == cursor) ? kMinSeconds : TimeAt(cursor);
+  }
+
+  // Timestamp of the first unread measurement >= timestamp. If there isn't one, returns kMaxSeconds.
+  seconds_t FirstAtOrAfter(size_t reader, seconds_t timestamp)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const uint64_t s = LowerBound(CursorFor(reader), timestamp);
+    return (s == end_) ? kMaxSeconds : TimeAt(s);
+  }
+
+  // Calls f(const DataType&) on each unread measurement with t0 <= timestamp <= t1, in time order,
+  // without consuming them. Returns the number of measurements visited.
+  // NOTE(milo): The lock is held while f runs, so keep it fast and don't call back into the bus.
+  template <typename Function>
+  size_t ForEachInRange(size_t reader, seconds_t t0, seconds_t t1, Function f)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const uint64_t cursor = CursorFor(reader);
+    const uint64_t first = LowerBound(cursor, t0);
+    const uint64_t last = UpperBound(cursor, t1);
+    for (uint64_t s = first; s < last; ++s) {
+      f(ItemAt(s));
+    }
+    return (last > first) ? static_cast<size_t>(last - first) : 0;
+  }
+
+  // Blocks until the reader has an unread measurement or timeout_sec elapses. Returns false on
+  // timeout/shutdown.
+  bool WaitUntilNonEmpty(size_t reader, double timeout_sec)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait_for(lock, std::chrono::duration<double>(timeout_sec),
+                 [this, reader]{ return end_ > CursorFor(reader) || is_shutdown_; });
+    return end_ > CursorFor(reader) && !is_shutdown_;
+  }
+
+  // Waits up to timeout_sec for the oldest unread measurement. Returns false on timeout/shutdown.
+  bool WaitPop(size_t reader, DataType& item, double timeout_sec)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait_for(lock, std::chrono::duration<double>(timeout_sec),
+                 [this, reader]{ return end_ > CursorFor(reader) || is_shutdown_; });
+    uint64_t& cursor = CursorFor(reader);
+    if (end_ == cursor || is_shutdown_) {
+      return false;
+    }
+    item = ItemAt(cursor);
+    Advance(cursor, cursor + 1);
+    return true;
+  }
+
+  // Wakes up any readers blocked in WaitUntilNonEmpty() or WaitPop(). All later waits return false
+  // immediately.
+  void Shutdown()
+  {
+    mutex_.lock();
+    is_shutdown_ = true;
+    mutex_.unlock();
+    cv_.notify_all();
+  }
+
+ private:
+  typedef typename std::aligned_storage<sizeof(DataType), alignof(DataType)>::type Storage;
+  static constexpr uint64_t kNoReader = std::numeric_limits<uint64_t>::max();
+
+  // All of these helpers expect the caller to hold the lock. Measurements are addressed by their
+  // sequence number s (the number of measurements pushed before them).
+  const DataType& ItemAt(uint64_t s) const { return *reinterpret_cast<const DataType*>(&items_[s & mask_]); }
+  seconds_t TimeAt(uint64_t s) const { return times_[s & mask_]; }
+
+  uint64_t& CursorFor(size_t reader)
+  {
+    CHECK(reader < cursors_.size() && cursors_.at(reader) != kNoReader)
+        << "Invalid SensorBus reader " << reader << "\n  Bus=" << name_ << std::endl;
+    return cursors_.at(reader);
+  }
+
+  // First measurement in [from, end_) with timestamp >= t (or end_ if none).
+  uint64_t LowerBound(uint64_t from, seconds_t t) const
+  {
+    uint64_t lo = from, hi = end_;
+    while (lo < hi) {
+      const uint64_t mid = lo + (hi - lo) / 2;
+      if (TimeAt(mid) < t) { lo = mid + 1; } else { hi = mid; }
+    }
+    return lo;
+  }
+
+  // First measurement in [from, end_) with timestamp > t (or end_ if none).
+  uint64_t UpperBound(uint64_t from, seconds_t t) const
+  {
+    uint64_t lo = from, hi = end_;
+    while (lo < hi) {
+      const uint64_t mid = lo + (hi - lo) / 2;
+      if (TimeAt(mid) <= t) { lo = mid + 1; } else { hi = mid; }
+    }
+    return lo;
+  }
+
+  // Move a reader's cursor forward, and free anything that all readers have passed.
+  void Advance(uint64_t& cursor, uint64_t to)
+  {
+    cursor = to;
+    CollectGarbage();
+  }
+
+  void CollectGarbage()
+  {
+    uint64_t oldest_cursor = end_;
+    for (const uint64_t cursor : cursors_) {
+      oldest_cursor = std::min(oldest_cursor, cursor);
+    }
+    DestroyUntil(oldest_cursor);
+  }
+
+  // Free all measurements before sequence number s. For trivially destructible measurements (all
+  // of our sensor types) this is O(1), since we only need to move the start index.
+  void DestroyUntil(uint64_t s)
+  {
+    if (!std::is_trivially_destructible<DataType>::value) {
+      for (uint64_t i = begin_; i < s; ++i) {
+        reinterpret_cast<DataType*>(&items_[i & mask_])->~DataType();
+      }
+    }
+    begin_ = std::max(begin_, s);
+  }
+
+  seconds_t MaybeConvertToSeconds(timestamp_t t) const
+  {
+    return ConvertToSeconds(t);
+  }
+
+  // Let the compiler decide which of these functions to use, depending on whether the undelying
+  // DataType uses timestamp_t or seconds_t timestamps.
+  static seconds_t MaybeConvertToSeconds(seconds_t t)
+  {
+    return t;
+  }
+
+ private:
+  size_t max_size_;
+  bool drop_old_;
+  std::string name_;
+
+  size_t num_slots_;
+  size_t mask_;
+  std::unique_ptr<Storage[]> items_;
+  std::unique_ptr<seconds_t[]> times_;
+
+  uint64_t begin_ = 0;              // Sequence number of the oldest stored measurement.
+  uint64_t end_ = 0;                // Sequence number of the next measurement to be pushed.
+  std::vector<uint64_t> cursors_;   // Next unread sequence number for each reader.
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool is_shutdown_ = false;
+};
+
+
+template <typename DataType>
+constexpr uint64_t SensorBus<DataType>::kNoReader;
+
+
+}
+}
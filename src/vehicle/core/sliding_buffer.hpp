@@ -34,7 +34,18 @@ class SlidingBuffer {
   // Adds an item at the head of the buffer, pushing out the oldest item.
   void Add(const Item& item)
   {
-    cbuffer_.at(head_index_) = item;
+    NextSlot() = item;
+    Advance();
+  }
+
+  // The slot that the next item will go in (the oldest item, once the buffer is full). Filling it in
+  // place and then calling Advance() is the same as Add(), but reuses the memory of the item that
+  // gets pushed out.
+  Item& NextSlot() { return cbuffer_.at(head_index_); }
+
+  // Makes NextSlot() the head.
+  void Advance()
+  {
     head_index_ = (head_index_ + 1) % (int)cbuffer_.size();
     ++num_added_;
   }
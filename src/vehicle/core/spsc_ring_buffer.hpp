@@ -0,0 +1,283 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "core/macros.hpp"
+#include "core/math_util.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Keep the producer and consumer indices on separate cache lines to avoid false sharing.
+static constexpr size_t kCacheLineBytes = 64;
+
+
+// A bounded, lock-free queue for exactly ONE producer thread and ONE consumer thread. It has the
+// same interface and drop policy as ThreadsafeQueue, but Push() and Pop() never take a lock.
+//
+// Producer-only: Push()
+// Consumer-only: Pop(), PopIfNonEmpty(), PeekFront(), WaitUntilNonEmpty(), WaitPop()
+// Any thread:    Size(), Empty() (these are a snapshot, and may be stale by the time they return)
+//                Shutdown()
+//
+// Each slot stores a sequence number (see Vyukov's bounded queue). When the queue is full and
+// drop_oldest_if_full is set, the producer claims the oldest slot just like a consumer would, so
+// it can never overwrite an item that the consumer is in the middle of reading.
+//
+// NOTE(milo): PeekFront() moves the front item out of the ring into a consumer-owned cache, so the
+// returned reference stays valid even if the producer drops items in the meantime. That item no
+// longer counts toward max_queue_size, so the queue can briefly hold max_queue_size + 1 items.
+template <typename Item>
+class SpscRingBuffer {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(SpscRingBuffer);
+  MACRO_DELETE_COPY_CONSTRUCTORS(SpscRingBuffer);
+
+  // Construct the queue with a max size and drop policy. The underlying storage is rounded up to
+  // a power of two, but at most max_queue_size items are kept in the ring.
+  SpscRingBuffer(size_t max_queue_size,
+                 bool drop_oldest_if_full = true,
+                 const std::string& queue_name = "")
+      : max_queue_size_(max_queue_size),
+        drop_oldest_if_full_(drop_oldest_if_full),
+        queue_name_(queue_name),
+        num_slots_(NextPowerOfTwo(max_queue_size)),
+        mask_(num_slots_ - 1),
+        slots_(new Slot[num_slots_])
+  {
+    CHECK_GT(max_queue_size, 0ul) << "SpscRingBuffer must be bounded!" << "\n  Queue=" << queue_name_ << std::endl;
+    for (size_t i = 0; i < num_slots_; ++i) {
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~SpscRingBuffer()
+  {
+    if (has_front_.load(std::memory_order_relaxed)) {
+      FrontPtr()->~Item();
+    }
+    const size_t head = head_.load(std::memory_order_relaxed);
+    for (size_t t = tail_.load(std::memory_order_relaxed); t < head; ++t) {
+      slots_[t & mask_].Ptr()->~Item();
+    }
+  }
+
+  // Push an item onto the queue. Returns false if the queue was full and the item was dropped.
+  // NOTE(milo): If Item has a move constructor, this avoids a copy.
+  bool Push(Item item)
+  {
+    const size_t pos = head_.load(std::memory_order_relaxed);
+    Slot& slot = slots_[pos & mask_];
+
+    while (true) {
+      size_t tail = tail_.load(std::memory_order_acquire);
+
+      // Full: drop the oldest item by claiming its slot, or drop this item.
+      if ((pos - tail) >= max_queue_size_) {
+        if (!drop_oldest_if_full_) {
+          return false;
+        }
+        if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+          LOG(WARNING) << "Dropping item from SpscRingBuffer!"
+              << "\n  Queue=" << queue_name_
+              << "\n  Item=" << typeid(Item).name() << std::endl;
+          Slot& oldest = slots_[tail & mask_];
+          oldest.Ptr()->~Item();
+          oldest.seq.store(tail + num_slots_, std::memory_order_release);
+        }
+        continue;
+      }
+
+      // The consumer might still be moving an old item out of this slot; wait for it to finish.
+      if (slot.seq.load(std::memory_order_acquire) == pos) {
+        break;
+      }
+      std::this_thread::yield();
+    }
+
+    new (&slot.storage) Item(std::move(item));
+    slot.seq.store(pos + 1, std::memory_order_release);
+    head_.store(pos + 1, std::memory_order_release);
+
+    // Wake up the consumer if it's blocked in WaitUntilNonEmpty(). The fence pairs with the one in
+    // WaitUntilNonEmpty() so that at least one side sees the other's write.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (consumer_waiting_.load(std::memory_order_relaxed)) {
+      { std::lock_guard<std::mutex> lock(wait_mutex_); }
+      wait_cv_.notify_one();
+    }
+
+    return true;
+  }
+
+  // Pop the item at the front of the queue (oldest). Consumer thread only.
+  Item Pop()
+  {
+    CHECK(LoadFront()) << "Tried to pop from empty SpscRingBuffer!"
+        << "\n  Queue=" << queue_name_
+        << "\n  Item=" << typeid(Item).name() << std::endl;
+    return TakeFront();
+  }
+
+  // Pop the front item into "item" if the queue is non-empty. Consumer thread only.
+  bool PopIfNonEmpty(Item& item)
+  {
+    if (!LoadFront()) {
+      return false;
+    }
+    item = TakeFront();
+    return true;
+  }
+
+  // Returns a reference to the oldest item. It stays valid until the next Pop(). Consumer only.
+  const Item& PeekFront()
+  {
+    CHECK(LoadFront()) << "Tried to PeekFront() from empty SpscRingBuffer!"
+        << "\n  Queue=" << queue_name_
+        << "\n  Item=" << typeid(Item).name() << std::endl;
+    return *FrontPtr();
+  }
+
+  // Blocks until an item is available or timeout_sec elapses. Returns false if the wait timed out
+  // or the queue was shut down. Consumer thread only.
+  bool WaitUntilNonEmpty(double timeout_sec)
+  {
+    if (is_shutdown_.load()) {
+      return false;
+    }
+    if (!Empty()) {
+      return true;
+    }
+
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    consumer_waiting_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wait_cv_.wait_for(lock, std::chrono::duration<double>(timeout_sec),
+                      [this]{ return !Empty() || is_shutdown_.load(); });
+    consumer_waiting_.store(false, std::memory_order_relaxed);
+    return !Empty() && !is_shutdown_.load();
+  }
+
+  // Waits up to timeout_sec for an item, and pops it into "item" if one arrived. Returns false if
+  // the wait timed out or the queue was shut down. Consumer thread only.
+  bool WaitPop(Item& item, double timeout_sec)
+  {
+    return WaitUntilNonEmpty(timeout_sec) && PopIfNonEmpty(item);
+  }
+
+  // Wakes up the consumer if it's blocked in WaitUntilNonEmpty() or WaitPop(). All later waits
+  // return false immediately.
+  void Shutdown()
+  {
+    {
+      std::lock_guard<std::mutex> lock(wait_mutex_);
+      is_shutdown_.store(true);
+    }
+    wait_cv_.notify_all();
+  }
+
+  // Return the current size of the queue.
+  size_t Size() const
+  {
+    // Read the tail first so that the difference can't underflow.
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    const size_t head = head_.load(std::memory_order_acquire);
+    return (head - tail) + (has_front_.load(std::memory_order_acquire) ? 1 : 0);
+  }
+
+  bool Empty() const { return Size() == 0; }
+
+  // Number of slots in the underlying storage (always a power of two).
+  size_t Capacity() const { return num_slots_; }
+
+ private:
+  struct Slot
+  {
+    Item* Ptr() { return reinterpret_cast<Item*>(&storage); }
+
+    std::atomic<size_t> seq;
+    typename std::aligned_storage<sizeof(Item), alignof(Item)>::type storage;
+  };
+
+  Item* FrontPtr() { return reinterpret_cast<Item*>(&front_); }
+
+  // Make sure the oldest item is in the front cache. Returns false if the queue is empty.
+  bool LoadFront()
+  {
+    if (has_front_.load(std::memory_order_relaxed)) {
+      return true;
+    }
+
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[tail & mask_];
+      const size_t seq = slot.seq.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(tail + 1);
+
+      // The producer hasn't written this slot yet, so the ring is empty.
+      if (diff < 0) {
+        return false;
+      }
+
+      // Claim the slot. This can only fail if the producer dropped it first (tail is updated).
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+          new (&front_) Item(std::move(*slot.Ptr()));
+          slot.Ptr()->~Item();
+          slot.seq.store(tail + num_slots_, std::memory_order_release);
+          has_front_.store(true, std::memory_order_release);
+          return true;
+        }
+      } else {
+        tail = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Move the cached front item out. Must only be called after LoadFront() returned true.
+  Item TakeFront()
+  {
+    Item item(std::move(*FrontPtr()));
+    FrontPtr()->~Item();
+    has_front_.store(false, std::memory_order_release);
+    return item;
+  }
+
+ private:
+  size_t max_queue_size_;
+  bool drop_oldest_if_full_ = true;
+  std::string queue_name_;
+
+  size_t num_slots_;
+  size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+
+  alignas(kCacheLineBytes) std::atomic<size_t> head_{0};   // Written by the producer.
+  alignas(kCacheLineBytes) std::atomic<size_t> tail_{0};   // Written by the consumer (and producer when dropping).
+
+  // The consumer-owned front item (see PeekFront).
+  std::atomic<bool> has_front_{false};
+  typename std::aligned_storage<sizeof(Item), alignof(Item)>::type front_;
+
+  alignas(kCacheLineBytes) std::atomic<bool> consumer_waiting_{false};
+  std::atomic<bool> is_shutdown_{false};
+  std::mutex wait_mutex_;
+  std::condition_variable wait_cv_;
+};
+
+
+}
+}
@@ -13,6 +13,7 @@ StatsTracker::StatsTracker(const std::string& tracker_name, size_t k)
 
 void StatsTracker::Add(const std::string& name, float value)
 {
+  std::lock_guard<std::mutex> lock(mutex_);
   if (stats_.count(name) == 0) {
     stats_.emplace(name, StatsBuffer<float>(k_));
   }
@@ -24,24 +25,74 @@ void StatsTracker::Print(const std::string& name,
                          const std::string& units,
                          float print_interval_sec)
 {
+  std::lock_guard<std::mutex> lock(mutex_);
+
   // Can't print stats for nonexistent scalar.
   if (stats_.count(name) == 0) {
     return;
   }
 
-  if (timers_.count(name) == 0) {
-    timers_.emplace(name, Timer(true));
-  }
-
   // If a time interval was specified, only print if that interval has elapsed.
-  if (timers_.at(name).Elapsed().seconds() >= print_interval_sec) {
+  if (ShouldPrint(name, print_interval_sec)) {
     int N;
     float min, max, mean;
     stats_.at(name).MinMaxMean(N, min, max, mean);
     printf("[ %s/%s ] MIN=%f %s MAX=%f %s MEAN=%f %s (N=%d)\n",
         tracker_name_.c_str(), name.c_str(), min, units.c_str(), max, units.c_str(), mean, units.c_str(), N);
+  }
+}
+
+
+void StatsTracker::AddBusyIdle(const std::string& name,
+                               double busy_ms,
+                               double idle_ms)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  BusyIdleCounter& counter = busy_idle_[name];
+  counter.busy_ms += busy_ms;
+  counter.idle_ms += idle_ms;
+  ++counter.num_loops;
+}
+
+
+BusyIdleCounter StatsTracker::GetBusyIdle(const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return (busy_idle_.count(name) == 0) ? BusyIdleCounter() : busy_idle_.at(name);
+}
+
+
+void StatsTracker::PrintBusyIdle(const std::string& name, float print_interval_sec)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (busy_idle_.count(name) == 0) {
+    return;
+  }
+
+  // NOTE(milo): Use a separate timer key so that this doesn't interfere with Print(name).
+  if (ShouldPrint(name + "/busy_idle", print_interval_sec)) {
+    BusyIdleCounter& counter = busy_idle_.at(name);
+    printf("[ %s/%s ] BUSY=%f ms IDLE=%f ms (BUSY %.1f%%) (N=%d)\n",
+        tracker_name_.c_str(), name.c_str(), counter.busy_ms, counter.idle_ms,
+        100.0 * counter.BusyFraction(), counter.num_loops);
+    counter = BusyIdleCounter();
+  }
+}
+
+
+bool StatsTracker::ShouldPrint(const std::string& name, float print_interval_sec)
+{
+  if (timers_.count(name) == 0) {
+    timers_.emplace(name, Timer(true));
+  }
+
+  if (timers_.at(name).Elapsed().seconds() >= print_interval_sec) {
     timers_.at(name).Reset();
+    return true;
   }
+
+  return false;
 }
 
 
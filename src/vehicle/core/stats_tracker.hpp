@@ -1,5 +1,6 @@
 #pragma once
 
+#include <mutex>
 #include <unordered_map>
 
 #include "core/macros.hpp"
@@ -35,9 +36,26 @@ class StatsBuffer : public SlidingBuffer<Item> {
 };
 
 
+// Accumulated busy and idle time for a named loop (e.g a thread that waits for work).
+struct BusyIdleCounter final
+{
+  double busy_ms = 0;
+  double idle_ms = 0;
+  int num_loops = 0;    // Number of AddBusyIdle() calls (e.g wakeups of the loop).
+
+  // Fraction of time spent doing work (0 if nothing has been recorded yet).
+  double BusyFraction() const
+  {
+    const double total = busy_ms + idle_ms;
+    return (total > 0) ? (busy_ms / total) : 0;
+  }
+};
+
+
 // Stores the k latest scalar measurements for various named parameters so that we can print out
 // basic stats about them. For example, this is useful for profiling various functions and
 // tracking how their runtime changes online.
+// NOTE(milo): All methods are threadsafe, so multiple threads can share a StatsTracker.
 class StatsTracker final {
  public:
   MACRO_DELETE_COPY_CONSTRUCTORS(StatsTracker)
@@ -51,11 +69,30 @@ class StatsTracker final {
              const std::string& units = "",
              float print_interval_sec = 0);
 
+  // Accumulate time that a loop spent doing work (busy) vs. waiting for work (idle).
+  void AddBusyIdle(const std::string& name,
+                   double busy_ms,
+                   double idle_ms);
+
+  // Returns the accumulated busy/idle time for a loop (zeros if it doesn't exist).
+  BusyIdleCounter GetBusyIdle(const std::string& name);
+
+  // Prints the accumulated busy/idle time for a loop. The counter is reset after printing, so that
+  // each line reflects the duty cycle since the last print.
+  void PrintBusyIdle(const std::string& name,
+                     float print_interval_sec = 0);
+
+ private:
+  // Returns true (and resets the timer) if print_interval_sec has elapsed for this name.
+  bool ShouldPrint(const std::string& name, float print_interval_sec);
+
  private:
   std::string tracker_name_;
   size_t k_;
+  std::mutex mutex_;
   std::unordered_map<std::string, Timer> timers_;
   std::unordered_map<std::string, StatsBuffer<float>> stats_;
+  std::unordered_map<std::string, BusyIdleCounter> busy_idle_;
 };
 
 
@@ -0,0 +1,119 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "core/thread_pool.hpp"
+
+namespace bm {
+namespace core {
+
+
+ThreadPool::ThreadPool(size_t num_threads, const std::string& name)
+    : name_(name)
+{
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+  }
+}
+
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_shutdown_ = true;
+  }
+  cv_.notify_all();
+
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+
+std::future<void> ThreadPool::Enqueue(std::function<void()> task)
+{
+  // NOTE(milo): std::function must be copyable, so the packaged_task is held by a shared_ptr.
+  auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+  std::future<void> future = packaged->get_future();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK(!is_shutdown_) << "Tried to enqueue a task after ThreadPool shutdown: " << name_ << std::endl;
+    tasks_.emplace([packaged]() { (*packaged)(); });
+  }
+  cv_.notify_one();
+
+  return future;
+}
+
+
+void ThreadPool::ParallelFor(size_t n, const std::function<void(size_t)>& f)
+{
+  if (n == 0) {
+    return;
+  }
+
+  // Helpers might only start after the calling thread has finished everything (and returned), so
+  // the state they share has to outlive this call.
+  struct SharedState
+  {
+    explicit SharedState(size_t n, const std::function<void(size_t)>& f) : n(n), f(f) {}
+
+    const size_t n;
+    const std::function<void(size_t)> f;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> num_done{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+  };
+
+  auto state = std::make_shared<SharedState>(n, f);
+
+  // Grab indices until there are none left. Returns after the last f(i) that this thread ran.
+  const auto run = [](const std::shared_ptr<SharedState>& s)
+  {
+    size_t i;
+    while ((i = s->next.fetch_add(1)) < s->n) {
+      s->f(i);
+      if ((s->num_done.fetch_add(1) + 1) == s->n) {
+        { std::lock_guard<std::mutex> lock(s->mutex); }
+        s->cv.notify_all();
+      }
+    }
+  };
+
+  const size_t num_helpers = std::min(n - 1, workers_.size());
+  for (size_t h = 0; h < num_helpers; ++h) {
+    Enqueue([state, run]() { run(state); });
+  }
+
+  run(state);
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cv.wait(lock, [&state]() { return state->num_done.load() == state->n; });
+}
+
+
+void ThreadPool::WorkerLoop()
+{
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return is_shutdown_ || !tasks_.empty(); });
+
+      // Only exit once the queue has been drained.
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop();
+    }
+    task();
+  }
+}
+
+
+}
+}
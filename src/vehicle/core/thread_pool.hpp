@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/macros.hpp"
+
+namespace bm {
+namespace core {
+
+
+// A small, fixed-size pool of worker threads that run queued tasks in FIFO order.
+class ThreadPool final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(ThreadPool);
+  MACRO_DELETE_COPY_CONSTRUCTORS(ThreadPool);
+
+  // Start num_threads workers (zero is allowed, then ParallelFor() runs on the calling thread).
+  explicit ThreadPool(size_t num_threads, const std::string& name = "");
+
+  // Finishes all queued tasks, then joins the workers.
+  ~ThreadPool();
+
+  // Queue a task to run on one of the workers. The future is ready once the task has finished.
+  std::future<void> Enqueue(std::function<void()> task);
+
+  // Calls f(i) for each i in [0, n), spread across the workers AND the calling thread, and blocks
+  // until all of them are done. The order of the calls is not defined, so each f(i) should write
+  // to its own output slot if the result needs to be deterministic.
+  // NOTE(milo): It's safe to call this from inside of a task, since the calling thread keeps doing
+  // work itself instead of waiting for a worker to become available.
+  void ParallelFor(size_t n, const std::function<void(size_t)>& f);
+
+  size_t NumThreads() const { return workers_.size(); }
+
+ private:
+  void WorkerLoop();
+
+ private:
+  std::string name_;
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::queue<std::function<void()>> tasks_;
+  bool is_shutdown_ = false;
+};
+
+
+}
+}
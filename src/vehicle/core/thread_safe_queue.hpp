@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <queue>
 #include <utility>
@@ -44,6 +46,10 @@ class ThreadsafeQueue {
       did_push = true;
     }
     lock_.unlock();
+
+    if (did_push) {
+      cv_.notify_all();
+    }
     return did_push;
   }
 
@@ -77,6 +83,41 @@ class ThreadsafeQueue {
     return nonempty;
   }
 
+  // Blocks until the queue is non-empty or timeout_sec elapses. Returns false if the wait timed out
+  // or the queue was shut down.
+  bool WaitUntilNonEmpty(double timeout_sec)
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    cv_.wait_for(lock, std::chrono::duration<double>(timeout_sec),
+                 [this]{ return !q_.empty() || is_shutdown_; });
+    return !q_.empty() && !is_shutdown_;
+  }
+
+  // Waits up to timeout_sec for an item, and pops it into "item" if one arrived. Returns false if
+  // the wait timed out or the queue was shut down. Safe to use with multiple consumers.
+  bool WaitPop(Item& item, double timeout_sec)
+  {
+    std::unique_lock<std::mutex> lock(lock_);
+    cv_.wait_for(lock, std::chrono::duration<double>(timeout_sec),
+                 [this]{ return !q_.empty() || is_shutdown_; });
+    if (q_.empty() || is_shutdown_) {
+      return false;
+    }
+    item = std::move(q_.front());
+    q_.pop();
+    return true;
+  }
+
+  // Wakes up any threads blocked in WaitUntilNonEmpty() or WaitPop(). All later waits return false
+  // immediately.
+  void Shutdown()
+  {
+    lock_.lock();
+    is_shutdown_ = true;
+    lock_.unlock();
+    cv_.notify_all();
+  }
+
   // Return the current size of the queue.
   size_t Size()
   {
@@ -118,6 +159,8 @@ class ThreadsafeQueue {
   // http://eigen.tuxfamily.org/dox-devel/group__TopicStlContainers.html
   std::queue<Item, std::deque<Item, Eigen::aligned_allocator<Item>>> q_;
   std::mutex lock_;
+  std::condition_variable cv_;
+  bool is_shutdown_ = false;
 };
 
 }
@@ -0,0 +1,175 @@
+#include <thread>
+
+#include <glog/logging.h>
+
+#include "core/tile_scheduler.hpp"
+
+namespace bm {
+namespace core {
+
+
+TileScheduler::TileScheduler(ThreadPool* pool)
+    : pool_(pool)
+{
+  const size_t num_workers = (pool_ != nullptr) ? (pool_->NumThreads() + 1) : 1;
+  for (size_t i = 0; i < num_workers; ++i) {
+    queues_.emplace_back(new WorkerQueue());
+  }
+}
+
+
+void TileScheduler::Run(int tile_rows, int tile_cols, Order order, const TileFunction& f)
+{
+  CHECK_GE(tile_rows, 0);
+  CHECK_GE(tile_cols, 0);
+
+  const int num_tiles = tile_rows * tile_cols;
+  if (num_tiles == 0) {
+    return;
+  }
+
+  // Without helper threads, the raster order already satisfies the dependencies.
+  if (pool_ == nullptr || pool_->NumThreads() == 0) {
+    if (order == Order::WAVEFRONT_REVERSE) {
+      for (int r = tile_rows - 1; r >= 0; --r) {
+        for (int c = tile_cols - 1; c >= 0; --c) {
+          f(r, c);
+        }
+      }
+    } else {
+      for (int r = 0; r < tile_rows; ++r) {
+        for (int c = 0; c < tile_cols; ++c) {
+          f(r, c);
+        }
+      }
+    }
+    return;
+  }
+
+  tile_rows_ = tile_rows;
+  tile_cols_ = tile_cols;
+  order_ = order;
+  f_ = &f;
+
+  if (num_waiting_on_size_ < static_cast<size_t>(num_tiles)) {
+    num_waiting_on_ = std::unique_ptr<std::atomic<int>[]>(new std::atomic<int>[num_tiles]);
+    num_waiting_on_size_ = static_cast<size_t>(num_tiles);
+  }
+
+  for (int r = 0; r < tile_rows; ++r) {
+    for (int c = 0; c < tile_cols; ++c) {
+      int num_deps = 0;
+      if (order == Order::WAVEFRONT_FORWARD) {
+        num_deps = (r > 0 ? 1 : 0) + (c > 0 ? 1 : 0);
+      } else if (order == Order::WAVEFRONT_REVERSE) {
+        num_deps = (r < (tile_rows - 1) ? 1 : 0) + (c < (tile_cols - 1) ? 1 : 0);
+      }
+      num_waiting_on_[r * tile_cols + c].store(num_deps);
+    }
+  }
+
+  num_remaining_.store(num_tiles);
+
+  // Independent tiles are handed out in contiguous chunks (for locality), and the others have to
+  // steal them. A wavefront starts from a single corner tile.
+  const size_t num_workers = queues_.size();
+  if (order == Order::ANY) {
+    for (size_t w = 0; w < num_workers; ++w) {
+      const int begin = static_cast<int>(w * num_tiles / num_workers);
+      const int end = static_cast<int>((w + 1) * num_tiles / num_workers);
+      for (int t = end - 1; t >= begin; --t) {
+        queues_.at(w)->tiles.emplace_back(t);
+      }
+    }
+  } else {
+    queues_.at(0)->tiles.emplace_back(order == Order::WAVEFRONT_FORWARD ? 0 : (num_tiles - 1));
+  }
+
+  pool_->ParallelFor(num_workers, [this](size_t w) { WorkerLoop(w); });
+
+  f_ = nullptr;
+}
+
+
+void TileScheduler::WorkerLoop(size_t worker)
+{
+  int tile;
+  while (num_remaining_.load() > 0) {
+    if (!PopOrSteal(worker, tile)) {
+      // NOTE(milo): Nothing is ready yet, but some tile that's running will release more soon.
+      std::this_thread::yield();
+      continue;
+    }
+
+    (*f_)(tile / tile_cols_, tile % tile_cols_);
+    ReleaseDependents(worker, tile);
+    num_remaining_.fetch_sub(1);
+  }
+}
+
+
+void TileScheduler::ReleaseDependents(size_t worker, int tile)
+{
+  if (order_ == Order::ANY) {
+    return;
+  }
+
+  const int r = tile / tile_cols_;
+  const int c = tile % tile_cols_;
+  const int step = (order_ == Order::WAVEFRONT_FORWARD) ? 1 : -1;
+
+  // The tile to the right (left) of this one, then below (above).
+  const int next_c = c + step;
+  if (next_c >= 0 && next_c < tile_cols_) {
+    const int next = r * tile_cols_ + next_c;
+    if (num_waiting_on_[next].fetch_sub(1) == 1) {
+      Push(worker, next);
+    }
+  }
+
+  const int next_r = r + step;
+  if (next_r >= 0 && next_r < tile_rows_) {
+    const int next = next_r * tile_cols_ + c;
+    if (num_waiting_on_[next].fetch_sub(1) == 1) {
+      Push(worker, next);
+    }
+  }
+}
+
+
+void TileScheduler::Push(size_t worker, int tile)
+{
+  WorkerQueue& queue = *queues_.at(worker);
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  queue.tiles.emplace_back(tile);
+}
+
+
+bool TileScheduler::PopOrSteal(size_t worker, int& tile)
+{
+  {
+    WorkerQueue& own = *queues_.at(worker);
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tiles.empty()) {
+      tile = own.tiles.back();
+      own.tiles.pop_back();
+      return true;
+    }
+  }
+
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    WorkerQueue& victim = *queues_.at((worker + i) % queues_.size());
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tiles.empty()) {
+      tile = victim.tiles.front();
+      victim.tiles.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+}
+}
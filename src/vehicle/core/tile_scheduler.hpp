@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/thread_pool.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Runs a function on every tile of a 2D grid, using the threads of a ThreadPool and the calling
+// thread. Each thread has its own deque of tiles that are ready to run. It takes tiles from the back
+// of its own deque, and when that's empty, steals from the front of the others.
+//
+// Tiles can also depend on their neighbors, for sweeps where each pixel needs the (already updated)
+// pixels to its left and above it. Then a tile is ready once the tiles to its left and above are
+// done, so tiles run along anti-diagonals (a "wavefront").
+class TileScheduler final {
+ public:
+  enum class Order
+  {
+    ANY,                // Tiles don't depend on each other.
+    WAVEFRONT_FORWARD,  // Tile (r, c) runs after (r - 1, c) and (r, c - 1).
+    WAVEFRONT_REVERSE   // Tile (r, c) runs after (r + 1, c) and (r, c + 1).
+  };
+
+  // Called as f(tile_row, tile_col).
+  typedef std::function<void(int, int)> TileFunction;
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(TileScheduler);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(TileScheduler);
+
+  // If pool is nullptr, tiles run on the calling thread in raster order (reversed for
+  // WAVEFRONT_REVERSE). The pool must outlive the scheduler.
+  explicit TileScheduler(ThreadPool* pool);
+
+  // Calls f on each tile once, and returns when all of them are done. Not reentrant.
+  void Run(int tile_rows, int tile_cols, Order order, const TileFunction& f);
+
+ private:
+  void WorkerLoop(size_t worker);
+
+  // Tiles that were waiting on this one, which are ready once their count drops to zero.
+  void ReleaseDependents(size_t worker, int tile);
+
+  void Push(size_t worker, int tile);
+  bool PopOrSteal(size_t worker, int& tile);
+
+ private:
+  ThreadPool* pool_;
+
+  struct WorkerQueue final
+  {
+    std::mutex mutex;
+    std::deque<int> tiles;
+  };
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+
+  // Number of unfinished tiles that each tile is waiting on. Kept between calls to reuse the memory.
+  std::unique_ptr<std::atomic<int>[]> num_waiting_on_;
+  size_t num_waiting_on_size_ = 0;
+
+  std::atomic<int> num_remaining_{0};
+
+  // The current Run() call.
+  int tile_rows_ = 0;
+  int tile_cols_ = 0;
+  Order order_ = Order::ANY;
+  const TileFunction* f_ = nullptr;
+};
+
+
+}
+}
@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <glog/logging.h>
+
+#include "feature_tracking/fast_detector.hpp"
+
+namespace bm {
+namespace ft {
+
+
+// Offsets of the 16 pixels on a Bresenham circle of radius 3, clockwise from the top.
+static const int kCircleX[16] = { 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3, -3, -3, -2, -1 };
+static const int kCircleY[16] = { -3, -3, -2, -1, 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3 };
+
+
+// Returns whether a 16-bit mask (wrapping around) has at least 9 consecutive bits set.
+static inline bool HasArc9(uint32_t m)
+{
+  m |= (m << 16);
+  uint32_t run = m & (m >> 1);    // Bit i set if bits [i, i+1] are set.
+  run &= (run >> 2);              // [i, i+3]
+  run &= (run >> 4);              // [i, i+7]
+  run &= (m >> 8);                // [i, i+8]
+  return run != 0;
+}
+
+
+// Full FAST-9 segment test for the pixel at p.
+static inline bool IsFast9Corner(const uint8_t* p, const int* offsets, int threshold)
+{
+  const int c = p[0];
+  uint32_t brighter = 0;
+  uint32_t darker = 0;
+  for (int i = 0; i < 16; ++i) {
+    const int v = p[offsets[i]];
+    brighter |= static_cast<uint32_t>(v > (c + threshold)) << i;
+    darker |= static_cast<uint32_t>(v < (c - threshold)) << i;
+  }
+  return HasArc9(brighter) || HasArc9(darker);
+}
+
+
+// Any arc of 9 (out of 16) contains two neighboring compass pixels (0, 4, 8, 12), so this rules out
+// most pixels before doing the full test.
+static inline bool PassesCompassTest(const uint8_t* p, const int* offsets, int threshold)
+{
+  const int c = p[0];
+  const int hi = c + threshold;
+  const int lo = c - threshold;
+  const int p0 = p[offsets[0]], p4 = p[offsets[4]], p8 = p[offsets[8]], p12 = p[offsets[12]];
+
+  const bool b0 = p0 > hi, b4 = p4 > hi, b8 = p8 > hi, b12 = p12 > hi;
+  const bool d0 = p0 < lo, d4 = p4 < lo, d8 = p8 < lo, d12 = p12 < lo;
+
+  return (b0 && b4) || (b4 && b8) || (b8 && b12) || (b12 && b0) ||
+         (d0 && d4) || (d4 && d8) || (d8 && d12) || (d12 && d0);
+}
+
+
+FastDetector::FastDetector(int threshold,
+                           double quality_level,
+                           int min_distance,
+                           int block_size,
+                           bool use_harris,
+                           double harris_k)
+    : threshold_(threshold),
+      quality_level_(quality_level),
+      min_distance_(min_distance),
+      block_size_(block_size),
+      use_harris_(use_harris),
+      harris_k_(harris_k)
+{
+  CHECK(threshold_ > 0 && threshold_ < 255) << "FAST threshold must be in (0, 255)" << std::endl;
+  CHECK_GE(quality_level_, 0.0);
+  CHECK_GE(block_size_, 3);
+}
+
+
+float FastDetector::Score(const Image1b& img, int x, int y) const
+{
+  const int r = block_size_ / 2;
+
+  // Structure tensor from central differences over the block.
+  float sxx = 0, sxy = 0, syy = 0;
+  for (int v = y - r; v <= y + r; ++v) {
+    const uint8_t* row = img.ptr<uint8_t>(v);
+    const uint8_t* row_up = img.ptr<uint8_t>(v - 1);
+    const uint8_t* row_down = img.ptr<uint8_t>(v + 1);
+    for (int u = x - r; u <= x + r; ++u) {
+      const float gx = static_cast<float>(row[u + 1] - row[u - 1]);
+      const float gy = static_cast<float>(row_down[u] - row_up[u]);
+      sxx += gx * gx;
+      sxy += gx * gy;
+      syy += gy * gy;
+    }
+  }
+
+  if (use_harris_) {
+    const float trace = sxx + syy;
+    return (sxx * syy - sxy * sxy) - static_cast<float>(harris_k_) * trace * trace;
+  }
+
+  // Smaller eigenvalue of [sxx sxy; sxy syy].
+  const float half_diff = 0.5f * (sxx - syy);
+  return 0.5f * (sxx + syy) - std::sqrt(half_diff * half_diff + sxy * sxy);
+}
+
+
+void FastDetector::Detect(const Image1b& img, const Image1b& mask, int max_corners, VecPoint2f& corners)
+{
+  corners.clear();
+  candidates_.clear();
+
+  CHECK(mask.empty() || (mask.rows == img.rows && mask.cols == img.cols))
+      << "Mask must be empty or the same size as the image" << std::endl;
+
+  // Stay far enough from the edge for the circle (radius 3) and the score window (+1 for gradients).
+  const int border = std::max(3, block_size_ / 2 + 1);
+  if (img.rows <= 2*border || img.cols <= 2*border || max_corners <= 0) {
+    return;
+  }
+
+  const int step = static_cast<int>(img.step[0]);
+  int offsets[16];
+  for (int i = 0; i < 16; ++i) {
+    offsets[i] = kCircleY[i] * step + kCircleX[i];
+  }
+
+  const int x_end = img.cols - border;
+
+  for (int y = border; y < (img.rows - border); ++y) {
+    const uint8_t* row = img.ptr<uint8_t>(y);
+    const uint8_t* mask_row = mask.empty() ? nullptr : mask.ptr<uint8_t>(y);
+    int x = border;
+
+#if defined(__SSE2__)
+    // Compass test for 16 pixels at a time. Saturating arithmetic handles the [0, 255] limits:
+    // v > c + t  <=>  (v -sat (c +sat t)) != 0, and v < c - t  <=>  ((c -sat t) -sat v) != 0.
+    const __m128i t = _mm_set1_epi8(static_cast<char>(threshold_));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8(static_cast<char>(0xFF));
+
+    for (; (x + 16) <= x_end; x += 16) {
+      const uint8_t* p = row + x;
+
+      __m128i allowed = ones;
+      if (mask_row != nullptr) {
+        allowed = _mm_xor_si128(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(mask_row + x)), zero), ones);
+        if (_mm_movemask_epi8(allowed) == 0) {
+          continue;
+        }
+      }
+
+      const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      const __m128i hi = _mm_adds_epu8(c, t);
+      const __m128i lo = _mm_subs_epu8(c, t);
+
+      __m128i b[4], d[4];
+      for (int j = 0; j < 4; ++j) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + offsets[4*j]));
+        b[j] = _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(v, hi), zero), ones);
+        d[j] = _mm_xor_si128(_mm_cmpeq_epi8(_mm_subs_epu8(lo, v), zero), ones);
+      }
+
+      const __m128i bright = _mm_or_si128(
+          _mm_or_si128(_mm_and_si128(b[0], b[1]), _mm_and_si128(b[1], b[2])),
+          _mm_or_si128(_mm_and_si128(b[2], b[3]), _mm_and_si128(b[3], b[0])));
+      const __m128i dark = _mm_or_si128(
+          _mm_or_si128(_mm_and_si128(d[0], d[1]), _mm_and_si128(d[1], d[2])),
+          _mm_or_si128(_mm_and_si128(d[2], d[3]), _mm_and_si128(d[3], d[0])));
+
+      int bits = _mm_movemask_epi8(_mm_and_si128(_mm_or_si128(bright, dark), allowed));
+      while (bits != 0) {
+        const int i = __builtin_ctz(bits);
+        bits &= (bits - 1);
+        if (IsFast9Corner(p + i, offsets, threshold_)) {
+          candidates_.push_back(Candidate{ 0.0f, x + i, y });
+        }
+      }
+    }
+#elif defined(__ARM_NEON)
+    // Compass test for 16 pixels at a time. NEON has unsigned compares, so only the thresholds saturate.
+    const uint8x16_t t = vdupq_n_u8(static_cast<uint8_t>(threshold_));
+    uint8_t lanes[16];
+
+    for (; (x + 16) <= x_end; x += 16) {
+      const uint8_t* p = row + x;
+
+      uint8x16_t allowed = vdupq_n_u8(0xFF);
+      if (mask_row != nullptr) {
+        allowed = vtstq_u8(vld1q_u8(mask_row + x), vdupq_n_u8(0xFF));
+        const uint64x2_t any = vreinterpretq_u64_u8(allowed);
+        if ((vgetq_lane_u64(any, 0) | vgetq_lane_u64(any, 1)) == 0) {
+          continue;
+        }
+      }
+
+      const uint8x16_t c = vld1q_u8(p);
+      const uint8x16_t hi = vqaddq_u8(c, t);
+      const uint8x16_t lo = vqsubq_u8(c, t);
+
+      uint8x16_t b[4], d[4];
+      for (int j = 0; j < 4; ++j) {
+        const uint8x16_t v = vld1q_u8(p + offsets[4*j]);
+        b[j] = vcgtq_u8(v, hi);
+        d[j] = vcltq_u8(v, lo);
+      }
+
+      const uint8x16_t bright = vorrq_u8(vorrq_u8(vandq_u8(b[0], b[1]), vandq_u8(b[1], b[2])),
+                                         vorrq_u8(vandq_u8(b[2], b[3]), vandq_u8(b[3], b[0])));
+      const uint8x16_t dark = vorrq_u8(vorrq_u8(vandq_u8(d[0], d[1]), vandq_u8(d[1], d[2])),
+                                       vorrq_u8(vandq_u8(d[2], d[3]), vandq_u8(d[3], d[0])));
+
+      vst1q_u8(lanes, vandq_u8(vorrq_u8(bright, dark), allowed));
+      for (int i = 0; i < 16; ++i) {
+        if (lanes[i] != 0 && IsFast9Corner(p + i, offsets, threshold_)) {
+          candidates_.push_back(Candidate{ 0.0f, x + i, y });
+        }
+      }
+    }
+#endif
+
+    // Leftover pixels (or everything, if there's no SIMD support).
+    for (; x < x_end; ++x) {
+      if (mask_row != nullptr && mask_row[x] == 0) {
+        continue;
+      }
+      if (PassesCompassTest(row + x, offsets, threshold_) && IsFast9Corner(row + x, offsets, threshold_)) {
+        candidates_.push_back(Candidate{ 0.0f, x, y });
+      }
+    }
+  }
+
+  if (candidates_.empty()) {
+    return;
+  }
+
+  // Only score the pixels that passed the segment test.
+  float max_score = -std::numeric_limits<float>::max();
+  for (Candidate& c : candidates_) {
+    c.score = Score(img, c.x, c.y);
+    max_score = std::max(max_score, c.score);
+  }
+
+  const float min_score = static_cast<float>(quality_level_) * max_score;
+  candidates_.erase(std::remove_if(candidates_.begin(), candidates_.end(),
+      [min_score](const Candidate& c) { return c.score < min_score; }), candidates_.end());
+
+  // Strongest first. Ties are broken by position so that the output is deterministic.
+  std::sort(candidates_.begin(), candidates_.end(), [](const Candidate& a, const Candidate& b)
+  {
+    if (a.score != b.score) { return a.score > b.score; }
+    return (a.y != b.y) ? (a.y < b.y) : (a.x < b.x);
+  });
+
+  SelectCorners(img.rows, img.cols, max_corners, corners);
+}
+
+
+void FastDetector::SelectCorners(int rows, int cols, int max_corners, VecPoint2f& corners)
+{
+  if (min_distance_ <= 0) {
+    const size_t n = std::min(candidates_.size(), static_cast<size_t>(max_corners));
+    for (size_t i = 0; i < n; ++i) {
+      corners.emplace_back(candidates_[i].x, candidates_[i].y);
+    }
+    return;
+  }
+
+  // Bucket kept corners into cells of size min_distance, so that each candidate only needs to be
+  // checked against the corners in its 3x3 neighborhood of cells.
+  const int cell = min_distance_;
+  const int grid_cols = (cols + cell - 1) / cell;
+  const int grid_rows = (rows + cell - 1) / cell;
+  selection_grid_.resize(grid_rows * grid_cols);
+  for (VecPoint2f& bucket : selection_grid_) {
+    bucket.clear();
+  }
+
+  const float min_dist2 = static_cast<float>(min_distance_ * min_distance_);
+
+  for (const Candidate& c : candidates_) {
+    const int gx = c.x / cell;
+    const int gy = c.y / cell;
+
+    bool too_close = false;
+    for (int v = std::max(0, gy - 1); v <= std::min(grid_rows - 1, gy + 1) && !too_close; ++v) {
+      for (int u = std::max(0, gx - 1); u <= std::min(grid_cols - 1, gx + 1) && !too_close; ++u) {
+        for (const cv::Point2f& kept : selection_grid_[v * grid_cols + u]) {
+          const float dx = kept.x - c.x;
+          const float dy = kept.y - c.y;
+          if ((dx*dx + dy*dy) < min_dist2) {
+            too_close = true;
+            break;
+          }
+        }
+      }
+    }
+
+    if (too_close) {
+      continue;
+    }
+
+    selection_grid_[gy * grid_cols + gx].emplace_back(c.x, c.y);
+    corners.emplace_back(c.x, c.y);
+
+    if ((int)corners.size() >= max_corners) {
+      break;
+    }
+  }
+}
+
+
+}
+}
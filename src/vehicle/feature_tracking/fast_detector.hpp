@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+
+#include "core/macros.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+
+// FAST-9 corner detector that scores the corners with Shi-Tomasi (or Harris), and then keeps the
+// strongest ones that are at least min_distance apart (the same selection as GFTT).
+//
+// NOTE(milo): The segment test is vectorized (SSE2 or NEON), and only pixels that pass it get a
+// corner score, instead of computing eigenvalues over the whole image. Scratch buffers are kept
+// between calls, so this isn't thread-safe.
+class FastDetector final {
+ public:
+  MACRO_DELETE_COPY_CONSTRUCTORS(FastDetector);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(FastDetector);
+
+  // threshold: intensity difference for a circle pixel to count as brighter/darker than the center.
+  // quality_level: drop corners with a score below quality_level * (best score).
+  // block_size: window for computing the corner score.
+  FastDetector(int threshold,
+               double quality_level,
+               int min_distance,
+               int block_size,
+               bool use_harris,
+               double harris_k);
+
+  // Detect up to max_corners corners, strongest first. If mask isn't empty, only pixels where it's
+  // nonzero are considered (same as OpenCV detectors).
+  void Detect(const Image1b& img, const Image1b& mask, int max_corners, VecPoint2f& corners);
+
+ private:
+  struct Candidate
+  {
+    float score;
+    int x;
+    int y;
+  };
+
+  float Score(const Image1b& img, int x, int y) const;
+
+  // Greedily keep the strongest candidates that aren't within min_distance of a kept one.
+  void SelectCorners(int rows, int cols, int max_corners, VecPoint2f& corners);
+
+ private:
+  int threshold_;
+  double quality_level_;
+  int min_distance_;
+  int block_size_;
+  bool use_harris_;
+  double harris_k_;
+
+  std::vector<Candidate> candidates_;
+  std::vector<VecPoint2f> selection_grid_;
+};
+
+
+}
+}
@@ -1,9 +1,13 @@
+#include <algorithm>
+#include <cmath>
 #include <numeric>
+#include <string>
 
 #include <opencv2/imgproc.hpp>
 #include <glog/logging.h>
 
 #include "feature_tracking/feature_detector.hpp"
+#include "feature_tracking/subpixel.hpp"
 #include "anms/anms.h"
 
 namespace bm {
@@ -33,11 +37,31 @@ static VecPoint2f CvKeyPointToPoint(const std::vector<cv::KeyPoint>& input)
 
 void FeatureDetector::Params::LoadParams(const YamlParser& parser)
 {
+  std::string algorithm_name;
+  parser.GetParam("algorithm", &algorithm_name);
+  if (algorithm_name == "GFTT") {
+    algorithm = FeatureAlgorithm::GFTT;
+  } else if (algorithm_name == "FAST") {
+    algorithm = FeatureAlgorithm::FAST;
+  } else {
+    LOG(FATAL) << "Unsupported feature detection algorithm: " << algorithm_name << std::endl;
+  }
+
   parser.GetParam("max_features_per_frame", &max_features_per_frame);
   parser.GetParam("min_distance_btw_tracked_and_detected_features", &min_distance_btw_tracked_and_detected_features);
   parser.GetParam("gftt_quality_level", &gftt_quality_level);
   parser.GetParam("gftt_block_size", &gftt_block_size);
   parser.GetParam("gftt_use_harris_corner_detector", &gftt_use_harris_corner_detector);
+  parser.GetParam("subpixel_corners", &subpixel_corners);
+  parser.GetParam("fast_threshold", &fast_threshold);
+  parser.GetParam("grid_detection", &grid_detection);
+  parser.GetParam("grid_rows", &grid_rows);
+  parser.GetParam("grid_cols", &grid_cols);
+  parser.GetParam("grid_num_threads", &grid_num_threads);
+
+  CHECK_GE(grid_rows, 1);
+  CHECK_GE(grid_cols, 1);
+  CHECK_GE(grid_num_threads, 1);
 }
 
 
@@ -51,9 +75,29 @@ FeatureDetector::FeatureDetector(const Params& params) : params_(params)
       params_.gftt_block_size,
       params_.gftt_use_harris_corner_detector,
       params_.gftt_k);
+  } else if (params_.algorithm == FeatureAlgorithm::FAST) {
+    fast_detector_ = std::unique_ptr<FastDetector>(new FastDetector(
+      params_.fast_threshold,
+      params_.gftt_quality_level,
+      params_.min_distance_btw_tracked_and_detected_features,
+      params_.gftt_block_size,
+      params_.gftt_use_harris_corner_detector,
+      params_.gftt_k));
   } else {
     throw std::runtime_error("Unsupported feature detection algorithm!");
   }
+
+  if (params_.grid_detection) {
+    grid_cell_scores_.resize(params_.grid_rows * params_.grid_cols);
+    grid_cell_dilated_.resize(params_.grid_rows * params_.grid_cols);
+    grid_cell_corners_.resize(params_.grid_rows * params_.grid_cols);
+    grid_cell_budget_.resize(params_.grid_rows * params_.grid_cols);
+
+    // NOTE(milo): The calling thread also does work in ParallelFor(), so it counts as one thread.
+    if (params_.grid_num_threads > 1) {
+      grid_pool_ = std::unique_ptr<ThreadPool>(new ThreadPool(params_.grid_num_threads - 1, "FeatureDetector"));
+    }
+  }
 }
 
 
@@ -92,6 +136,25 @@ void FeatureDetector::Detect(const Image1b& img,
 {
   new_kp.clear();
 
+  if (params_.algorithm == FeatureAlgorithm::FAST) {
+    DetectFast(img, tracked_kp, new_kp);
+  } else if (params_.grid_detection) {
+    DetectGrid(img, tracked_kp, new_kp);
+  } else {
+    DetectAnms(img, tracked_kp, new_kp);
+  }
+
+  // Optionally do sub-pixel refinement on keypoint locations.
+  if (params_.subpixel_corners) {
+    RefineCornersSubpixel(img, params_.subpix_winsize, params_.subpix_maxiters, new_kp);
+  }
+}
+
+
+void FeatureDetector::DetectAnms(const Image1b& img,
+                                 const VecPoint2f& tracked_kp,
+                                 VecPoint2f& new_kp)
+{
   // Only detect keypoints that a minimum distance from existing tracked keypoints.
   cv::Mat mask(img.size(), CV_8U, cv::Scalar(255));
   for (size_t i = 0; i < tracked_kp.size(); ++i) {
@@ -107,17 +170,211 @@ void FeatureDetector::Detect(const Image1b& img,
 
   new_kp_cv = ANMSRangeTree(new_kp_cv, num_to_keep, 0.1f, img.cols, img.rows);
   new_kp = CvKeyPointToPoint(new_kp_cv);
+}
 
-  // Optionally do sub-pixel refinement on keypoint locations.
-  // https://docs.opencv.org/master/dd/d1a/group__imgproc__feature.html#ga354e0d7c86d0d9da75de9b9701a9a87e
-  if (params_.subpixel_corners) {
-    cv::TermCriteria term_criteria;
-    term_criteria.type = cv::TermCriteria::EPS + cv::TermCriteria::COUNT;
-    term_criteria.epsilon = params_.subpix_epsilon;
-    term_criteria.maxCount = params_.subpix_maxiters;
-    const cv::Size winsize(params_.subpix_winsize, params_.subpix_winsize);
-    const cv::Size zerozone(params_.subpix_zerozone, params_.subpix_zerozone);
-    cv::cornerSubPix(img, new_kp, winsize, zerozone, term_criteria);
+
+void FeatureDetector::DetectFast(const Image1b& img,
+                                 const VecPoint2f& tracked_kp,
+                                 VecPoint2f& new_kp)
+{
+  const int num_to_keep = std::max(0, params_.max_features_per_frame - (int)tracked_kp.size());
+  if (num_to_keep == 0) {
+    return;
+  }
+
+  if (tracked_kp.empty()) {
+    fast_detector_->Detect(img, Image1b(), num_to_keep, new_kp);
+    return;
+  }
+
+  // Expand the occupancy bitmap into a full-resolution mask. The FAST kernel skips masked out
+  // pixels 16 at a time, so regions that are already tracked cost almost nothing.
+  BuildOccupancyBitmap(img.size(), tracked_kp);
+  fast_mask_.create(img.rows, img.cols);
+
+  for (int y = 0; y < img.rows; ++y) {
+    const uint8_t* occupied = &occupancy_[(y / occupancy_cell_size_) * occupancy_cols_];
+    uint8_t* mask_row = fast_mask_.ptr<uint8_t>(y);
+    for (int x = 0; x < img.cols; ++x) {
+      mask_row[x] = occupied[x / occupancy_cell_size_] ? 0 : 255;
+    }
+  }
+
+  fast_detector_->Detect(img, fast_mask_, num_to_keep, new_kp);
+}
+
+
+void FeatureDetector::BuildOccupancyBitmap(const cv::Size& img_size, const VecPoint2f& tracked_kp)
+{
+  const int min_dist = params_.min_distance_btw_tracked_and_detected_features;
+
+  // NOTE(milo): Cells of 1/4 the suppression radius approximate a disk well enough, and there are
+  // ~16x fewer of them to mark than pixels in a full-resolution mask.
+  occupancy_cell_size_ = std::max(1, min_dist / 4);
+  occupancy_cols_ = (img_size.width + occupancy_cell_size_ - 1) / occupancy_cell_size_;
+  occupancy_rows_ = (img_size.height + occupancy_cell_size_ - 1) / occupancy_cell_size_;
+  occupancy_.assign(occupancy_rows_ * occupancy_cols_, 0);
+
+  for (const cv::Point2f& pt : tracked_kp) {
+    MarkOccupied(pt);
+  }
+}
+
+
+void FeatureDetector::MarkOccupied(const cv::Point2f& pt)
+{
+  const int min_dist = params_.min_distance_btw_tracked_and_detected_features;
+  if (min_dist <= 0) {
+    return;
+  }
+
+  const float half_cell = 0.5f * occupancy_cell_size_;
+  const float min_dist2 = static_cast<float>(min_dist * min_dist);
+
+  const int ox0 = std::max(0, static_cast<int>(pt.x - min_dist) / occupancy_cell_size_);
+  const int oy0 = std::max(0, static_cast<int>(pt.y - min_dist) / occupancy_cell_size_);
+  const int ox1 = std::min(occupancy_cols_ - 1, static_cast<int>(pt.x + min_dist) / occupancy_cell_size_);
+  const int oy1 = std::min(occupancy_rows_ - 1, static_cast<int>(pt.y + min_dist) / occupancy_cell_size_);
+
+  // Mark the cells whose center is inside of the suppression radius.
+  for (int oy = oy0; oy <= oy1; ++oy) {
+    const float dy = oy * occupancy_cell_size_ + half_cell - pt.y;
+    for (int ox = ox0; ox <= ox1; ++ox) {
+      const float dx = ox * occupancy_cell_size_ + half_cell - pt.x;
+      if ((dx*dx + dy*dy) <= min_dist2) {
+        occupancy_[oy * occupancy_cols_ + ox] = 1;
+      }
+    }
+  }
+}
+
+
+void FeatureDetector::DetectGrid(const Image1b& img,
+                                 const VecPoint2f& tracked_kp,
+                                 VecPoint2f& new_kp)
+{
+  const int rows = params_.grid_rows;
+  const int cols = params_.grid_cols;
+  const int num_cells = rows * cols;
+  const int cell_w = (img.cols + cols - 1) / cols;
+  const int cell_h = (img.rows + rows - 1) / rows;
+
+  const int num_to_keep = std::max(0, params_.max_features_per_frame - (int)tracked_kp.size());
+  if (num_to_keep == 0) {
+    return;
+  }
+
+  BuildOccupancyBitmap(img.size(), tracked_kp);
+
+  // Every cell gets an equal share of the features, minus the tracked keypoints already in it.
+  const int share = (params_.max_features_per_frame + num_cells - 1) / num_cells;
+  std::fill(grid_cell_budget_.begin(), grid_cell_budget_.end(), share);
+  for (const cv::Point2f& pt : tracked_kp) {
+    const int cx = std::min(cols - 1, std::max(0, static_cast<int>(pt.x) / cell_w));
+    const int cy = std::min(rows - 1, std::max(0, static_cast<int>(pt.y) / cell_h));
+    --grid_cell_budget_[cy * cols + cx];
+  }
+
+  const float min_dist = static_cast<float>(params_.min_distance_btw_tracked_and_detected_features);
+
+  // Strongest first. Ties are broken by position, so that the order doesn't depend on the sort.
+  const auto stronger = [](const GridCorner& a, const GridCorner& b)
+  {
+    if (a.score != b.score) { return a.score > b.score; }
+    if (a.pt.y != b.pt.y) { return a.pt.y < b.pt.y; }
+    return a.pt.x < b.pt.x;
+  };
+
+  // Same steps as cv::goodFeaturesToTrack, but keeping the scores so that cells can be merged by
+  // strength: score every pixel, keep local maxima above the quality level, and space them out.
+  const auto detect_cell = [&](size_t i)
+  {
+    std::vector<GridCorner>& corners = grid_cell_corners_[i];
+    corners.clear();
+
+    const int budget = grid_cell_budget_[i];
+    if (budget <= 0) {
+      return;
+    }
+
+    const int cx = static_cast<int>(i) % cols;
+    const int cy = static_cast<int>(i) / cols;
+    const cv::Rect roi = cv::Rect(cx * cell_w, cy * cell_h, cell_w, cell_h) & cv::Rect(0, 0, img.cols, img.rows);
+    if (roi.width < 3 || roi.height < 3) {
+      return;
+    }
+
+    Image1f& scores = grid_cell_scores_[i];
+    Image1f& dilated = grid_cell_dilated_[i];
+    if (params_.gftt_use_harris_corner_detector) {
+      cv::cornerHarris(img(roi), scores, params_.gftt_block_size, 3, params_.gftt_k);
+    } else {
+      cv::cornerMinEigenVal(img(roi), scores, params_.gftt_block_size, 3);
+    }
+
+    double max_score = 0;
+    cv::minMaxLoc(scores, nullptr, &max_score);
+    const float threshold = static_cast<float>(params_.gftt_quality_level * max_score);
+    cv::dilate(scores, dilated, cv::Mat());
+
+    for (int y = 1; y < (roi.height - 1); ++y) {
+      const float* score_row = scores.ptr<float>(y);
+      const float* dilated_row = dilated.ptr<float>(y);
+      for (int x = 1; x < (roi.width - 1); ++x) {
+        const float v = score_row[x];
+        if (v > threshold && v == dilated_row[x]) {
+          const cv::Point2f pt(static_cast<float>(x + roi.x), static_cast<float>(y + roi.y));
+          if (!IsOccupied(pt)) {
+            corners.push_back(GridCorner{pt, v, static_cast<int>(i)});
+          }
+        }
+      }
+    }
+
+    std::sort(corners.begin(), corners.end(), stronger);
+
+    // NOTE(milo): Keep some extra corners, since a few will be too close to the ones that win in the
+    // neighboring cells.
+    const size_t max_corners = static_cast<size_t>(budget + share);
+    size_t num_kept = 0;
+    for (size_t j = 0; j < corners.size() && num_kept < max_corners; ++j) {
+      bool too_close = false;
+      for (size_t k = 0; k < num_kept && !too_close; ++k) {
+        too_close = cv::norm(corners[j].pt - corners[k].pt) < min_dist;
+      }
+      if (!too_close) {
+        corners[num_kept++] = corners[j];
+      }
+    }
+    corners.resize(num_kept);
+  };
+
+  if (grid_pool_) {
+    grid_pool_->ParallelFor(num_cells, detect_cell);
+  } else {
+    for (int i = 0; i < num_cells; ++i) { detect_cell(i); }
+  }
+
+  // Merge all of the cells strongest first, so that if there are more than num_to_keep corners, the
+  // weakest ones in the whole image are dropped. Each new corner is added to the occupancy bitmap,
+  // so corners in neighboring cells are spaced out like tracked keypoints are.
+  grid_merged_.clear();
+  for (const std::vector<GridCorner>& corners : grid_cell_corners_) {
+    grid_merged_.insert(grid_merged_.end(), corners.begin(), corners.end());
+  }
+  std::sort(grid_merged_.begin(), grid_merged_.end(), stronger);
+
+  new_kp.reserve(num_to_keep);
+  for (const GridCorner& c : grid_merged_) {
+    if ((int)new_kp.size() >= num_to_keep) {
+      break;
+    }
+    if (grid_cell_budget_[c.cell] <= 0 || IsOccupied(c.pt)) {
+      continue;
+    }
+    new_kp.emplace_back(c.pt);
+    --grid_cell_budget_[c.cell];
+    MarkOccupied(c.pt);
   }
 }
 
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include <opencv2/features2d.hpp>
 
 #include "core/macros.hpp"
+#include "core/thread_pool.hpp"
+#include "feature_tracking/fast_detector.hpp"
 #include "params/params_base.hpp"
 #include "vision_core/cv_types.hpp"
 
@@ -34,13 +39,28 @@ class FeatureDetector final {
     bool gftt_use_harris_corner_detector = false;
     double gftt_k = 0.04;
 
+    //============================ FAST ===================================
+    // FAST uses the in-tree FastDetector, scored with the GFTT settings above (quality level,
+    // block size, Harris), and spaced by min_distance_btw_tracked_and_detected_features.
+    int fast_threshold = 20;
+
     //==================== SUBPIXEL CORNER ESTIMATION =====================
-    // NOTE(milo): Subpixel refinement makes feature detection take ~20ms vs 2-5ms without.
-    bool subpixel_corners = false;
-    int subpix_winsize = 10;
-    int subpix_zerozone = -1;
-    int subpix_maxiters = 10;
-    float subpix_epsilon = 0.01;
+    // NOTE(milo): All new keypoints are refined in one batch (see RefineCornersSubpixel). This used
+    // to go through cv::cornerSubPix, which made detection take ~20ms vs 2-5ms without.
+    bool subpixel_corners = true;
+    int subpix_winsize = 10;      // Half-width of the refinement window.
+    int subpix_maxiters = 10;     // Max number of times the window can move.
+
+    //========================== GRID DETECTION ===========================
+    // Split the image into a grid and score corners in each cell (in parallel), instead of running
+    // GFTT over the whole image followed by ANMS. Each cell gets an equal share of
+    // max_features_per_frame, minus the tracked keypoints already in it. The cells' corners are then
+    // merged strongest first, spaced by min_distance_btw_tracked_and_detected_features across cell
+    // borders too, so if there are too many, the weakest ones in the whole image are dropped.
+    bool grid_detection = false;
+    int grid_rows = 4;
+    int grid_cols = 6;
+    int grid_num_threads = 4;
 
    private:
     // Loads in params using a YAML parser.
@@ -54,10 +74,58 @@ class FeatureDetector final {
 
   void Detect(const Image1b& img, const VecPoint2f& tracked_kp, VecPoint2f& new_kp);
 
+ private:
+  // Whole-image GFTT, masked around tracked keypoints, then ANMS.
+  void DetectAnms(const Image1b& img, const VecPoint2f& tracked_kp, VecPoint2f& new_kp);
+
+  // In-tree FAST, masked around tracked keypoints with the occupancy bitmap.
+  void DetectFast(const Image1b& img, const VecPoint2f& tracked_kp, VecPoint2f& new_kp);
+
+  // GFTT in each grid cell, with a per-cell budget. See Params::grid_detection.
+  void DetectGrid(const Image1b& img, const VecPoint2f& tracked_kp, VecPoint2f& new_kp);
+
+  // Marks every occupancy cell that is within min_distance_btw_tracked_and_detected_features of a
+  // tracked keypoint.
+  void BuildOccupancyBitmap(const cv::Size& img_size, const VecPoint2f& tracked_kp);
+
+  // Marks the occupancy cells around one point.
+  void MarkOccupied(const cv::Point2f& pt);
+
+  bool IsOccupied(const cv::Point2f& pt) const
+  {
+    const int ox = static_cast<int>(pt.x) / occupancy_cell_size_;
+    const int oy = static_cast<int>(pt.y) / occupancy_cell_size_;
+    return occupancy_[oy * occupancy_cols_ + ox] != 0;
+  }
+
  private:
   Params params_;
 
   cv::Ptr<cv::Feature2D> feature_detector_;
+  std::unique_ptr<FastDetector> fast_detector_;
+  Image1b fast_mask_;
+
+  // A corner from one grid cell, with its GFTT score (min eigenvalue or Harris response).
+  struct GridCorner final
+  {
+    cv::Point2f pt;
+    float score;
+    int cell;
+  };
+
+  // Grid detection state, reused across calls to avoid reallocating. Each cell has its own buffers,
+  // so that cells can be scored at the same time.
+  std::unique_ptr<ThreadPool> grid_pool_;
+  std::vector<Image1f> grid_cell_scores_;
+  std::vector<Image1f> grid_cell_dilated_;
+  std::vector<std::vector<GridCorner>> grid_cell_corners_;
+  std::vector<GridCorner> grid_merged_;
+  std::vector<int> grid_cell_budget_;
+
+  int occupancy_cell_size_ = 1;
+  int occupancy_rows_ = 0;
+  int occupancy_cols_ = 0;
+  std::vector<uint8_t> occupancy_;
 };
 
 
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <glog/logging.h>
 #include <opencv2/video/tracking.hpp>
 
@@ -16,6 +18,47 @@ void FeatureTracker::Params::LoadParams(const YamlParser& parser)
 }
 
 
+void PredictPixelsFromRotation(const PinholeCamera& cam,
+                               const Matrix3d& ref_R_cur,
+                               const VecPoint2f& px_ref,
+                               VecPoint2f& px_cur)
+{
+  px_cur.resize(px_ref.size());
+
+  // With no rotation, skip the round trip through K so that the guesses are exactly px_ref.
+  if (ref_R_cur == Matrix3d::Identity()) {
+    std::copy(px_ref.begin(), px_ref.end(), px_cur.begin());
+    return;
+  }
+
+  const Matrix3d H = cam.K() * ref_R_cur.transpose() * cam.Kinv();
+
+  for (size_t i = 0; i < px_ref.size(); ++i) {
+    const Vector3d p = H * Vector3d(px_ref[i].x, px_ref[i].y, 1.0);
+
+    // Rays that rotate behind the camera don't have a meaningful guess, so leave them where they are.
+    if (p.z() <= 0) {
+      px_cur[i] = px_ref[i];
+    } else {
+      px_cur[i] = cv::Point2f(static_cast<float>(p.x() / p.z()), static_cast<float>(p.y() / p.z()));
+    }
+  }
+}
+
+
+void FeatureTracker::BuildPyramid(const Image1b& img, ImagePyramid& pyramid) const
+{
+  const cv::Size2i klt_window_size(params_.klt_winsize, params_.klt_winsize);
+
+  // NOTE(milo): Derivatives are needed for both images, since the backward pass swaps them. The
+  // input image is always copied into the first level, since OpenCV would otherwise point the first
+  // level at img (if it has a border, e.g a crop), and later writes into the pyramid would go into
+  // the caller's image.
+  cv::buildOpticalFlowPyramid(img, pyramid, klt_window_size, params_.klt_max_level, true,
+                              cv::BORDER_REFLECT_101, cv::BORDER_CONSTANT, false);
+}
+
+
 void FeatureTracker::Track(const Image1b& ref_img,
                            const Image1b& cur_img,
                            const VecPoint2f& px_ref,
@@ -23,7 +66,37 @@ void FeatureTracker::Track(const Image1b& ref_img,
                            std::vector<uchar>& status,
                            std::vector<float>& error,
                            bool bidirectional,
-                           float fwd_bkw_thresh_px)
+                           float fwd_bkw_thresh_px) const
+{
+  TrackImpl(ref_img, cur_img, cur_img.size(), px_ref, px_cur, status, error, bidirectional, fwd_bkw_thresh_px, nullptr);
+}
+
+
+void FeatureTracker::Track(const ImagePyramid& ref_pyramid,
+                           const ImagePyramid& cur_pyramid,
+                           const VecPoint2f& px_ref,
+                           VecPoint2f& px_cur,
+                           std::vector<uchar>& status,
+                           std::vector<float>& error,
+                           bool bidirectional,
+                           float fwd_bkw_thresh_px,
+                           VecPoint2f* px_ref_bkw) const
+{
+  CHECK(!cur_pyramid.empty()) << "Empty image pyramid, was it built with BuildPyramid()?" << std::endl;
+  TrackImpl(ref_pyramid, cur_pyramid, cur_pyramid.at(0).size(), px_ref, px_cur, status, error, bidirectional, fwd_bkw_thresh_px, px_ref_bkw);
+}
+
+
+void FeatureTracker::TrackImpl(cv::InputArray ref_img,
+                               cv::InputArray cur_img,
+                               const cv::Size& cur_img_size,
+                               const VecPoint2f& px_ref,
+                               VecPoint2f& px_cur,
+                               std::vector<uchar>& status,
+                               std::vector<float>& error,
+                               bool bidirectional,
+                               float fwd_bkw_thresh_px,
+                               VecPoint2f* px_ref_bkw) const
 {
   status.clear();
   error.clear();
@@ -42,7 +115,10 @@ void FeatureTracker::Track(const Image1b& ref_img,
   const cv::Size2i klt_window_size(params_.klt_winsize, params_.klt_winsize);
 
   // If no initial guesses are provided for the optical flow, nitialize px_cur to previous locations.
-  if (px_cur.empty()) {
+  const bool use_initial_flow = !px_cur.empty();
+  if (use_initial_flow) {
+    CHECK_EQ(px_ref.size(), px_cur.size()) << "Need one initial guess per point" << std::endl;
+  } else {
     px_cur = px_ref;
   }
 
@@ -55,27 +131,32 @@ void FeatureTracker::Track(const Image1b& ref_img,
                            klt_window_size,
                            params_.klt_max_level,
                            kTerminationCriteria,
-                           cv::OPTFLOW_USE_INITIAL_FLOW & cv::OPTFLOW_LK_GET_MIN_EIGENVALS,
+                           use_initial_flow ? cv::OPTFLOW_USE_INITIAL_FLOW : 0,
                            0.0001);
 
+  // NOTE(milo): The backward pass always starts from px_cur. Seeding it with px_ref would make the
+  // consistency check pass trivially.
   if (bidirectional) {
-    VecPoint2f px_ref_bkw;
+    VecPoint2f px_ref_bkw_temp;
+    VecPoint2f& px_ref_bkw_out = (px_ref_bkw != nullptr) ? *px_ref_bkw : px_ref_bkw_temp;
+    px_ref_bkw_out.clear();
+
     cv::calcOpticalFlowPyrLK(cur_img,
                             ref_img,
                             px_cur,
-                            px_ref_bkw,
+                            px_ref_bkw_out,
                             status,
                             error,
                             klt_window_size,
                             params_.klt_max_level,
                             kTerminationCriteria,
-                            cv::OPTFLOW_USE_INITIAL_FLOW & cv::OPTFLOW_LK_GET_MIN_EIGENVALS,
+                            0,
                             0.0001);
 
     // Invalidate any points that could be tracked in reverse.
     for (size_t i = 0; i < px_ref.size(); ++i) {
       const cv::Point2f& ref = px_ref.at(i);
-      const cv::Point2f& ref_bkw = px_ref_bkw.at(i);
+      const cv::Point2f& ref_bkw = px_ref_bkw_out.at(i);
       const float dx = ref.x - ref_bkw.x;
       const float dy = ref.y - ref_bkw.y;
       if ((dx*dx + dy*dy) > fwd_bkw_thresh_px*fwd_bkw_thresh_px) {
@@ -87,7 +168,7 @@ void FeatureTracker::Track(const Image1b& ref_img,
   // Invalidate any points that have tracked out of the image.
   for (size_t i = 0; i < px_cur.size(); ++i) {
     const cv::Point2f& pt = px_cur.at(i);
-    if (pt.x <= 0 || pt.x >= cur_img.cols || pt.y <= 0 || pt.y >= cur_img.rows) {
+    if (pt.x <= 0 || pt.x >= cur_img_size.width || pt.y <= 0 || pt.y >= cur_img_size.height) {
       status.at(i) = 0;
     }
   }
@@ -3,14 +3,29 @@
 #include <vector>
 
 #include "core/macros.hpp"
+#include "core/eigen_types.hpp"
 #include "params/params_base.hpp"
 #include "vision_core/cv_types.hpp"
+#include "vision_core/pinhole_camera.hpp"
 
 namespace bm {
 namespace ft {
 
 using namespace core;
 
+// An image pyramid from cv::buildOpticalFlowPyramid (includes the derivatives for each level).
+typedef std::vector<cv::Mat> ImagePyramid;
+
+
+// Predicts where points from the reference image will be in the current image, assuming that the
+// camera only rotated (by ref_R_cur) in between. This is the "infinite homography" K * R^T * K^-1.
+// NOTE(milo): A good initial guess for Track() when the rotation comes from a gyro. Fast rotations
+// move every point by about the same amount regardless of depth, and are what make KLT lose tracks.
+void PredictPixelsFromRotation(const PinholeCamera& cam,
+                               const Matrix3d& ref_R_cur,
+                               const VecPoint2f& px_ref,
+                               VecPoint2f& px_cur);
+
 
 class FeatureTracker final {
  public:
@@ -35,8 +50,9 @@ class FeatureTracker final {
   explicit FeatureTracker(const Params& params) : params_(params) {}
 
   // Track points from ref_img to cur_img using Lucas-Kanade optical flow.
-  // If px_cur is provided, these locations are used as an initial guess for the flow.
-  // Otherwise, points are tracked from their reference locations.
+  // If px_cur is provided (same size as px_ref), these locations are used as an initial guess for
+  // the flow. Otherwise, points are tracked from their reference locations.
+  // NOTE(milo): Doesn't modify the tracker, so it's safe to call Track() from several threads.
   void Track(const Image1b& ref_img,
              const Image1b& cur_img,
              const VecPoint2f& px_ref,
@@ -44,7 +60,38 @@ class FeatureTracker final {
              std::vector<uchar>& status,
              std::vector<float>& error,
              bool bidirectional = false,
-             float fwd_bkw_thresh_px = 5.0);
+             float fwd_bkw_thresh_px = 5.0) const;
+
+  // Builds the pyramid that Track() needs for an image. Building it once per image, instead of
+  // inside of every Track() call, lets one image be tracked against many others for free. If the
+  // pyramid was already built for an image of the same size, its memory is reused. It never points
+  // into img, so it stays valid after the caller reuses img.
+  void BuildPyramid(const Image1b& img, ImagePyramid& pyramid) const;
+
+  // Same as above, but with pyramids from BuildPyramid() instead of images. If px_ref_bkw is given,
+  // the backward pass writes into it instead of a temporary (to reuse its memory across calls).
+  void Track(const ImagePyramid& ref_pyramid,
+             const ImagePyramid& cur_pyramid,
+             const VecPoint2f& px_ref,
+             VecPoint2f& px_cur,
+             std::vector<uchar>& status,
+             std::vector<float>& error,
+             bool bidirectional = false,
+             float fwd_bkw_thresh_px = 5.0,
+             VecPoint2f* px_ref_bkw = nullptr) const;
+
+ private:
+  // cv::calcOpticalFlowPyrLK accepts either images or pyramids, so both versions of Track() use this.
+  void TrackImpl(cv::InputArray ref_img,
+                 cv::InputArray cur_img,
+                 const cv::Size& cur_img_size,
+                 const VecPoint2f& px_ref,
+                 VecPoint2f& px_cur,
+                 std::vector<uchar>& status,
+                 std::vector<float>& error,
+                 bool bidirectional,
+                 float fwd_bkw_thresh_px,
+                 VecPoint2f* px_ref_bkw) const;
 
  private:
   Params params_;
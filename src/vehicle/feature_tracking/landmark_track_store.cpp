@@ -0,0 +1,110 @@
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "feature_tracking/landmark_track_store.hpp"
+
+namespace bm {
+namespace ft {
+
+
+const LandmarkObservation& LandmarkTrackStore::TrackView::at(size_t i) const
+{
+  const size_t size = store_->ring_size_[slot_];
+  CHECK_LT(i, size) << "Observation index out of range" << std::endl;
+
+  // The oldest stored observation is "size" places behind the head.
+  const size_t N = store_->max_obs_per_lmk_;
+  const size_t ring_idx = (store_->ring_head_[slot_] + N - size + i) % N;
+  return store_->ring_[slot_ * N + ring_idx];
+}
+
+
+LandmarkTrackStore::LandmarkTrackStore(size_t max_obs_per_lmk)
+    : max_obs_per_lmk_(max_obs_per_lmk)
+{
+  CHECK_GT(max_obs_per_lmk, 0ul);
+}
+
+
+void LandmarkTrackStore::AddLandmark(const LandmarkObservation& obs)
+{
+  CHECK_EQ(0ul, slot_of_lmk_.count(obs.landmark_id)) << "Landmark is already live: " << obs.landmark_id << std::endl;
+
+  size_t slot;
+  if (!free_slots_.empty()) {
+    slot = free_slots_.back();
+    free_slots_.pop_back();
+  } else {
+    slot = NumSlots();
+    lmk_ids_.emplace_back(0);
+    alive_.emplace_back(0);
+    latest_camera_ids_.emplace_back(0);
+    latest_pixels_.emplace_back(0, 0);
+    latest_disps_.emplace_back(0);
+    num_obs_.emplace_back(0);
+    ring_head_.emplace_back(0);
+    ring_size_.emplace_back(0);
+    ring_.insert(ring_.end(), max_obs_per_lmk_, obs);
+
+    // Every slot can be free at most once, so this keeps Kill() from allocating.
+    free_slots_.reserve(lmk_ids_.capacity());
+  }
+
+  lmk_ids_[slot] = obs.landmark_id;
+  alive_[slot] = 1;
+  num_obs_[slot] = 0;
+  ring_head_[slot] = 0;
+  ring_size_[slot] = 0;
+  slot_of_lmk_.emplace(obs.landmark_id, slot);
+
+  AddObservation(obs);
+}
+
+
+void LandmarkTrackStore::AddObservation(const LandmarkObservation& obs)
+{
+  const auto it = slot_of_lmk_.find(obs.landmark_id);
+  CHECK(it != slot_of_lmk_.end()) << "Tried to add an observation to a dead landmark: " << obs.landmark_id << std::endl;
+  const size_t slot = it->second;
+
+  CHECK(num_obs_[slot] == 0 || obs.camera_id > latest_camera_ids_[slot])
+      << "Observations must be added in order of increasing camera_id" << std::endl;
+
+  // Overwrites the oldest observation once the ring is full.
+  ring_[slot * max_obs_per_lmk_ + ring_head_[slot]] = obs;
+  ring_head_[slot] = (ring_head_[slot] + 1) % max_obs_per_lmk_;
+  ring_size_[slot] = std::min(ring_size_[slot] + 1, max_obs_per_lmk_);
+  ++num_obs_[slot];
+
+  latest_camera_ids_[slot] = obs.camera_id;
+  latest_pixels_[slot] = obs.pixel_location;
+  latest_disps_[slot] = obs.disparity;
+}
+
+
+void LandmarkTrackStore::Kill(uid_t lmk_id)
+{
+  const auto it = slot_of_lmk_.find(lmk_id);
+  if (it == slot_of_lmk_.end()) {
+    return;
+  }
+
+  const size_t slot = it->second;
+  alive_[slot] = 0;
+  ring_size_[slot] = 0;
+  free_slots_.emplace_back(slot);
+  slot_of_lmk_.erase(it);
+}
+
+
+LandmarkTrackStore::TrackView LandmarkTrackStore::at(uid_t lmk_id) const
+{
+  const auto it = slot_of_lmk_.find(lmk_id);
+  CHECK(it != slot_of_lmk_.end()) << "Landmark is not live: " << lmk_id << std::endl;
+  return TrackView(*this, it->second);
+}
+
+
+}
+}
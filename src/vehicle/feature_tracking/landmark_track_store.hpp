@@ -0,0 +1,132 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "core/uid.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/landmark_observation.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+
+// Stores the live landmark tracks of the frontend in flat arrays, with bounded memory.
+//
+// Each landmark occupies a "slot". Slots of dead landmarks go on a free list and are reused, so
+// the number of slots never exceeds the most landmarks that were alive at once. For each slot:
+//  - The latest pixel location, disparity and camera_id are kept in contiguous arrays, so that
+//    finding the landmarks seen in some frame is a linear scan with no hashing or pointer chasing.
+//  - The most recent max_obs_per_lmk observations are kept in a ring. Older ones are dropped, but
+//    still counted in NumObservations().
+//
+// Landmark ids are never reused, and at(lmk_id) / count(lmk_id) work like they do for a map.
+class LandmarkTrackStore final {
+ public:
+  // A read-only view of one landmark's observations (oldest to newest). Only valid until the store
+  // is modified.
+  class TrackView final {
+   public:
+    TrackView(const LandmarkTrackStore& store, size_t slot) : store_(&store), slot_(slot) {}
+
+    uid_t LandmarkId() const { return store_->lmk_ids_[slot_]; }
+
+    // Number of stored observations (at most max_obs_per_lmk).
+    size_t size() const { return store_->ring_size_[slot_]; }
+    bool empty() const { return size() == 0; }
+
+    // Total number of observations since the landmark was created, including dropped ones.
+    size_t NumObservations() const { return store_->num_obs_[slot_]; }
+
+    // Get the i-th stored observation, where i = 0 is the oldest.
+    const LandmarkObservation& at(size_t i) const;
+    const LandmarkObservation& operator[](size_t i) const { return at(i); }
+    const LandmarkObservation& front() const { return at(0); }
+    const LandmarkObservation& back() const { return at(size() - 1); }
+
+   private:
+    const LandmarkTrackStore* store_;
+    size_t slot_;
+  };
+
+  // Iterates over the live landmarks (in slot order).
+  class ConstIterator final {
+   public:
+    ConstIterator(const LandmarkTrackStore& store, size_t slot) : store_(&store), slot_(slot) { SkipDead(); }
+
+    TrackView operator*() const { return TrackView(*store_, slot_); }
+    ConstIterator& operator++() { ++slot_; SkipDead(); return *this; }
+    bool operator!=(const ConstIterator& other) const { return slot_ != other.slot_; }
+    bool operator==(const ConstIterator& other) const { return slot_ == other.slot_; }
+
+   private:
+    void SkipDead() { while (slot_ < store_->NumSlots() && !store_->IsAlive(slot_)) { ++slot_; } }
+
+    const LandmarkTrackStore* store_;
+    size_t slot_;
+  };
+
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(LandmarkTrackStore);
+
+  explicit LandmarkTrackStore(size_t max_obs_per_lmk);
+
+  // Adds a landmark with its first observation (obs.landmark_id must not already be live).
+  void AddLandmark(const LandmarkObservation& obs);
+
+  // Appends an observation to the live landmark obs.landmark_id. Observations must be added in
+  // order of increasing camera_id.
+  void AddObservation(const LandmarkObservation& obs);
+
+  // Kills a landmark and frees its slot. Does nothing if the landmark isn't live.
+  void Kill(uid_t lmk_id);
+
+  // Number of live landmarks, and whether a landmark is live (0 or 1, like a map).
+  size_t size() const { return slot_of_lmk_.size(); }
+  bool empty() const { return slot_of_lmk_.empty(); }
+  size_t count(uid_t lmk_id) const { return slot_of_lmk_.count(lmk_id); }
+
+  // Get the observations of a live landmark.
+  TrackView at(uid_t lmk_id) const;
+
+  ConstIterator begin() const { return ConstIterator(*this, 0); }
+  ConstIterator end() const { return ConstIterator(*this, NumSlots()); }
+
+  //============================ FLAT ARRAY ACCESS =============================
+  // Slots are indexed [0, NumSlots()). Only slots with IsAlive(slot) hold a landmark.
+  size_t NumSlots() const { return lmk_ids_.size(); }
+  bool IsAlive(size_t slot) const { return alive_[slot] != 0; }
+  TrackView Track(size_t slot) const { return TrackView(*this, slot); }
+
+  const std::vector<uid_t>& LandmarkIds() const { return lmk_ids_; }
+  const std::vector<uid_t>& LatestCameraIds() const { return latest_camera_ids_; }
+  const VecPoint2f& LatestPixels() const { return latest_pixels_; }
+  const std::vector<double>& LatestDisparities() const { return latest_disps_; }
+
+  size_t MaxObservationsPerLandmark() const { return max_obs_per_lmk_; }
+
+ private:
+  size_t max_obs_per_lmk_;
+
+  // Structure-of-arrays, one entry per slot.
+  std::vector<uid_t> lmk_ids_;
+  std::vector<uint8_t> alive_;
+  std::vector<uid_t> latest_camera_ids_;
+  VecPoint2f latest_pixels_;
+  std::vector<double> latest_disps_;
+  std::vector<size_t> num_obs_;
+
+  // Ring of the most recent observations, max_obs_per_lmk_ per slot.
+  std::vector<LandmarkObservation> ring_;
+  std::vector<size_t> ring_head_;   // Where the next observation goes.
+  std::vector<size_t> ring_size_;
+
+  std::vector<size_t> free_slots_;
+  std::unordered_map<uid_t, size_t> slot_of_lmk_;
+};
+
+
+}
+}
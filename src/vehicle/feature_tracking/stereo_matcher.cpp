@@ -1,8 +1,15 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 #include <glog/logging.h>
 
 #include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/core/utility.hpp"
 
+#include "vision_core/cross_correlation.hpp"
 #include "feature_tracking/stereo_matcher.hpp"
+#include "feature_tracking/subpixel.hpp"
 
 namespace bm {
 namespace ft {
@@ -16,12 +23,17 @@ void StereoMatcher::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("max_matching_cost", &max_matching_cost);
   parser.GetParam("bidirectional", &bidirectional);
   parser.GetParam("subpixel_refinement", &subpixel_refinement);
+  parser.GetParam("num_threads", &num_threads);
+  parser.GetParam("prior_search_radius", &prior_search_radius);
 }
 
 
-double StereoMatcher::MatchRectified(const Image1b& left_rectified,
-                                     const Image1b& right_rectified,
-                                     const cv::Point2f& left_keypoint)
+bool StereoMatcher::GetTemplateAndStripe(const Image1b& left_rectified,
+                                         const Image1b& right_rectified,
+                                         const cv::Point2f& left_keypoint,
+                                         cv::Rect& template_rect,
+                                         cv::Rect& stripe_rect,
+                                         int& offset_x) const
 {
   // Add +/- 1 extra pixel to the stripe to account for rectification error.
   const int stripe_rows = params_.templ_rows + 2;
@@ -33,10 +45,10 @@ double StereoMatcher::MatchRectified(const Image1b& left_rectified,
 
   // Template exceeds top or bottom of the image, return no match.
   if (templ_topleft_y < 0 || (templ_topleft_y + params_.templ_rows) >= left_rectified.rows) {
-    return -1.0;
+    return false;
   }
 
-  int offset_x = 0;
+  offset_x = 0;
   int templ_topleft_x = rounded_lkp_x - (params_.templ_cols - 1) / 2;
 
   // If the template goes off the left side of hte image, move it to the right until it's inside.
@@ -55,15 +67,14 @@ double StereoMatcher::MatchRectified(const Image1b& left_rectified,
   }
 
   // Grab the local image patch around the keypoint.
-  cv::Rect template_rect = cv::Rect(templ_topleft_x, templ_topleft_y, params_.templ_cols, params_.templ_rows);
-  cv::Mat patch(left_rectified, template_rect);
+  template_rect = cv::Rect(templ_topleft_x, templ_topleft_y, params_.templ_cols, params_.templ_rows);
 
   // Get a horizontal "stripe" from the right image to match against.
   const int stripe_corner_y = rounded_lkp_y - (stripe_rows - 1) / 2;
 
   // Stripe goes off the top/bottom of the image, return no match.
   if (stripe_corner_y < 0 || (stripe_corner_y + stripe_rows) >= right_rectified.rows) {
-    return -1.0;
+    return false;
   }
   int offset_stripe = 0;
   int stripe_corner_x = rounded_lkp_x + (params_.templ_cols - 1) / 2 - params_.max_disp;
@@ -75,7 +86,44 @@ double StereoMatcher::MatchRectified(const Image1b& left_rectified,
     stripe_corner_x = 0;
   }
 
-  cv::Rect stripe_rect = cv::Rect(stripe_corner_x, stripe_corner_y, params_.max_disp, stripe_rows);
+  stripe_rect = cv::Rect(stripe_corner_x, stripe_corner_y, params_.max_disp, stripe_rows);
+
+  // Only happens if the image is narrower than max_disp.
+  if (stripe_rect.br().x > right_rectified.cols) {
+    return false;
+  }
+
+  return true;
+}
+
+
+double StereoMatcher::MatchToDisparity(const cv::Point2f& left_keypoint,
+                                       const cv::Point2f& match_px,
+                                       double matching_cost) const
+{
+  const bool has_good_matching_score = matching_cost < params_.max_matching_cost;
+  const bool match_is_to_the_left = left_keypoint.x >= match_px.x;
+
+  if (has_good_matching_score && match_is_to_the_left) {
+    const float disp = left_keypoint.x - match_px.x;
+    return disp;
+  } else {
+    return -1.0;
+  }
+}
+
+
+double StereoMatcher::MatchRectified(const Image1b& left_rectified,
+                                     const Image1b& right_rectified,
+                                     const cv::Point2f& left_keypoint)
+{
+  cv::Rect template_rect, stripe_rect;
+  int offset_x;
+  if (!GetTemplateAndStripe(left_rectified, right_rectified, left_keypoint, template_rect, stripe_rect, offset_x)) {
+    return -1.0;
+  }
+
+  cv::Mat patch(left_rectified, template_rect);
   cv::Mat stripe(right_rectified, stripe_rect);
 
   cv::Mat result;
@@ -89,30 +137,159 @@ double StereoMatcher::MatchRectified(const Image1b& left_rectified,
   cv::minMaxLoc(result, &minVal, &maxVal, &minLoc, &maxLoc, cv::Mat());
 
   cv::Point matchLoc = minLoc;
-  matchLoc.x += stripe_corner_x + (params_.templ_cols - 1) / 2 + offset_x;
-  matchLoc.y += stripe_corner_y + (params_.templ_rows - 1) / 2;
-  cv::Point2f match_px(matchLoc.x, matchLoc.y);
-
-  // Refine keypoint with subpixel accuracy.
-  if (params_.subpixel_refinement) {
-    static const cv::TermCriteria criteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 40, 0.001);
-    static const cv::Size winSize(10, 10);
-    static const cv::Size zeroZone(-1, -1);
-    std::vector<cv::Point2f> corner;
-    corner.emplace_back(match_px);
-    cv::cornerSubPix(right_rectified, corner, winSize, zeroZone, criteria);
-    match_px = corner.at(0);
-  }
-
-  const bool has_good_matching_score = minVal < params_.max_matching_cost;
-  const bool match_is_to_the_left = left_keypoint.x >= match_px.x;
+  matchLoc.x += stripe_rect.x + (params_.templ_cols - 1) / 2 + offset_x;
+  matchLoc.y += stripe_rect.y + (params_.templ_rows - 1) / 2;
 
-  if (has_good_matching_score && match_is_to_the_left) {
-    const float disp = left_keypoint.x - match_px.x;
-    return disp;
-  } else {
+  // Refine along the epipolar line using the costs on either side of the minimum.
+  float subpixel_x = 0;
+  if (params_.subpixel_refinement && minLoc.x > 0 && minLoc.x < (result.cols - 1)) {
+    subpixel_x = ParabolaSubpixelOffset(result.at<float>(minLoc.y, minLoc.x - 1),
+                                        minVal,
+                                        result.at<float>(minLoc.y, minLoc.x + 1));
+  }
+
+  return MatchToDisparity(left_keypoint, cv::Point2f(matchLoc.x + subpixel_x, matchLoc.y), minVal);
+}
+
+
+// Same normalization (and handling of near-zero windows) as CV_TM_SQDIFF_NORMED in OpenCV.
+static double SqdiffNormed(double wnd_sum2, double cross, double templ_sum2)
+{
+  const double num = std::max(wnd_sum2 - 2.0 * cross + templ_sum2, 0.0);
+  const double t = std::sqrt(wnd_sum2 * templ_sum2);
+
+  if (num < t) {
+    return num / t;
+  } else if (num < t * 1.125) {
+    return (num > 0) ? 1.0 : -1.0;
+  }
+  return 1.0;
+}
+
+
+double StereoMatcher::MatchRectifiedSSD(const Image1b& left_rectified,
+                                        const Image1b& right_rectified,
+                                        const cv::Point2f& left_keypoint,
+                                        double disp_prior,
+                                        int search_radius,
+                                        Scratch& scratch) const
+{
+  cv::Rect template_rect, stripe_rect;
+  int offset_x;
+  if (!GetTemplateAndStripe(left_rectified, right_rectified, left_keypoint, template_rect, stripe_rect, offset_x)) {
+    return -1.0;
+  }
+
+  const int R = template_rect.height;
+  const int C = template_rect.width;
+  const int J = stripe_rect.height - R + 1;   // Vertical candidate positions.
+  const int K = stripe_rect.width - C + 1;    // Horizontal candidate positions.
+
+  if (K <= 0) {
+    return -1.0;
+  }
+
+  // Only search candidates [k_lo, k_hi]. With a prior, that's the ones whose disparity is close.
+  int k_lo = 0;
+  int k_hi = K - 1;
+  const bool use_prior = disp_prior >= 0;
+
+  if (use_prior) {
+    const int k_prior = static_cast<int>(std::round(left_keypoint.x - disp_prior))
+                        - stripe_rect.x - (params_.templ_cols - 1) / 2 - offset_x;
+    k_lo = std::max(0, k_prior - search_radius);
+    k_hi = std::min(K - 1, k_prior + search_radius);
+    if (k_lo > k_hi) {
+      return -1.0;
+    }
+  }
+
+  const int num_k = k_hi - k_lo + 1;
+  const int x_lo = stripe_rect.x + k_lo;      // Image column of the first searched pixel.
+  const int width = num_k + C - 1;            // Number of columns that the searched windows cover.
+
+  // Template energy sum(T^2), and the cross-correlation sum(T * I) for every candidate window.
+  uint64_t templ_sum2 = 0;
+  scratch.cross.assign(J * num_k, 0);
+
+  for (int r = 0; r < R; ++r) {
+    const uint8_t* templ_row = left_rectified.ptr<uint8_t>(template_rect.y + r) + template_rect.x;
+    for (int c = 0; c < C; ++c) {
+      templ_sum2 += static_cast<uint32_t>(templ_row[c]) * templ_row[c];
+    }
+    for (int j = 0; j < J; ++j) {
+      const uint8_t* image_row = right_rectified.ptr<uint8_t>(stripe_rect.y + j + r) + x_lo;
+      CrossCorrelateRow(templ_row, C, image_row, num_k, scratch.cross.data() + j * num_k);
+    }
+  }
+
+  // Window energy sum(I^2) comes from column sums, which slide down one row for each j. Then the
+  // window sum slides across the columns for each k.
+  scratch.col_sq.assign(width, 0);
+  for (int r = 0; r < R; ++r) {
+    const uint8_t* image_row = right_rectified.ptr<uint8_t>(stripe_rect.y + r) + x_lo;
+    for (int x = 0; x < width; ++x) {
+      scratch.col_sq[x] += static_cast<uint32_t>(image_row[x]) * image_row[x];
+    }
+  }
+
+  double min_cost = std::numeric_limits<double>::max();
+  cv::Point min_loc(0, 0);
+
+  // Keep every cost, so that the minimum can be refined with its neighbors afterwards.
+  scratch.cost.resize(J * num_k);
+
+  for (int j = 0; j < J; ++j) {
+    if (j > 0) {
+      const uint8_t* row_out = right_rectified.ptr<uint8_t>(stripe_rect.y + j - 1) + x_lo;
+      const uint8_t* row_in = right_rectified.ptr<uint8_t>(stripe_rect.y + j + R - 1) + x_lo;
+      for (int x = 0; x < width; ++x) {
+        scratch.col_sq[x] += static_cast<uint32_t>(row_in[x]) * row_in[x];
+        scratch.col_sq[x] -= static_cast<uint32_t>(row_out[x]) * row_out[x];
+      }
+    }
+
+    uint64_t wnd_sum2 = 0;
+    for (int c = 0; c < C; ++c) {
+      wnd_sum2 += scratch.col_sq[c];
+    }
+
+    // NOTE(milo): Strict "<" and row-major order match the first minimum that cv::minMaxLoc finds.
+    for (int k = 0; k < num_k; ++k) {
+      if (k > 0) {
+        wnd_sum2 += scratch.col_sq[k + C - 1];
+        wnd_sum2 -= scratch.col_sq[k - 1];
+      }
+      const double cost = SqdiffNormed(static_cast<double>(wnd_sum2),
+                                       static_cast<double>(scratch.cross[j * num_k + k]),
+                                       static_cast<double>(templ_sum2));
+      scratch.cost[j * num_k + k] = cost;
+      if (cost < min_cost) {
+        min_cost = cost;
+        min_loc = cv::Point(k_lo + k, j);
+      }
+    }
+  }
+
+  // If the best match is on the (inner) edge of a narrowed window, the true minimum is probably
+  // outside of it, so let the caller fall back to a full search.
+  if (use_prior && ((min_loc.x == k_lo && k_lo > 0) || (min_loc.x == k_hi && k_hi < (K - 1)))) {
     return -1.0;
   }
+
+  // Refine along the epipolar line using the costs on either side of the minimum.
+  float subpixel_x = 0;
+  const int k_min = min_loc.x - k_lo;
+  if (params_.subpixel_refinement && k_min > 0 && k_min < (num_k - 1)) {
+    const double* cost_row = scratch.cost.data() + min_loc.y * num_k;
+    subpixel_x = ParabolaSubpixelOffset(cost_row[k_min - 1], cost_row[k_min], cost_row[k_min + 1]);
+  }
+
+  const cv::Point2f match_px(
+      min_loc.x + stripe_rect.x + (params_.templ_cols - 1) / 2 + offset_x + subpixel_x,
+      min_loc.y + stripe_rect.y + (params_.templ_rows - 1) / 2);
+
+  return MatchToDisparity(left_keypoint, match_px, min_cost);
 }
 
 
@@ -120,13 +297,90 @@ std::vector<double> StereoMatcher::MatchRectified(const Image1b& left_rectified,
                                                   const Image1b& right_rectified,
                                                   const VecPoint2f& left_keypoints)
 {
-  std::vector<double> out(left_keypoints.size(), -1.0);
+  std::vector<double> out;
+  MatchRectifiedImpl(left_rectified, right_rectified, left_keypoints, nullptr, out);
+  return out;
+}
+
+
+std::vector<double> StereoMatcher::MatchRectified(const Image1b& left_rectified,
+                                                  const Image1b& right_rectified,
+                                                  const VecPoint2f& left_keypoints,
+                                                  const std::vector<double>& disp_priors)
+{
+  std::vector<double> out;
+  MatchRectifiedImpl(left_rectified, right_rectified, left_keypoints, &disp_priors, out);
+  return out;
+}
+
+
+void StereoMatcher::MatchRectified(const Image1b& left_rectified,
+                                   const Image1b& right_rectified,
+                                   const VecPoint2f& left_keypoints,
+                                   std::vector<double>& disps)
+{
+  MatchRectifiedImpl(left_rectified, right_rectified, left_keypoints, nullptr, disps);
+}
+
+
+void StereoMatcher::MatchRectified(const Image1b& left_rectified,
+                                   const Image1b& right_rectified,
+                                   const VecPoint2f& left_keypoints,
+                                   const std::vector<double>& disp_priors,
+                                   std::vector<double>& disps)
+{
+  MatchRectifiedImpl(left_rectified, right_rectified, left_keypoints, &disp_priors, disps);
+}
 
-  for (size_t i = 0; i < left_keypoints.size(); ++i) {
-    out.at(i) = MatchRectified(left_rectified, right_rectified, left_keypoints.at(i));
+
+void StereoMatcher::MatchRectifiedImpl(const Image1b& left_rectified,
+                                       const Image1b& right_rectified,
+                                       const VecPoint2f& left_keypoints,
+                                       const std::vector<double>* disp_priors,
+                                       std::vector<double>& disps)
+{
+  if (disp_priors != nullptr) {
+    CHECK_EQ(left_keypoints.size(), disp_priors->size());
   }
 
-  return out;
+  disps.assign(left_keypoints.size(), -1.0);
+
+  const int N = static_cast<int>(left_keypoints.size());
+  const int num_threads = std::max(1, std::min(params_.num_threads, N));
+
+  if (scratch_.size() < static_cast<size_t>(num_threads)) {
+    scratch_.resize(num_threads);
+  }
+
+  // Each thread gets a contiguous block of keypoints and its own scratch buffers.
+  const auto match_block = [&](int t)
+  {
+    Scratch& scratch = scratch_.at(t);
+    for (int i = (t * N) / num_threads; i < ((t + 1) * N) / num_threads; ++i) {
+      const cv::Point2f& kp = left_keypoints.at(i);
+      const double prior = (disp_priors != nullptr) ? disp_priors->at(i) : -1.0;
+
+      double disp = -1.0;
+      if (prior >= 0) {
+        disp = MatchRectifiedSSD(left_rectified, right_rectified, kp, prior, params_.prior_search_radius, scratch);
+      }
+      if (disp < 0) {
+        disp = MatchRectifiedSSD(left_rectified, right_rectified, kp, -1.0, 0, scratch);
+      }
+      disps.at(i) = disp;
+    }
+  };
+
+  if (num_threads == 1) {
+    match_block(0);
+  } else {
+    cv::parallel_for_(cv::Range(0, num_threads), [&](const cv::Range& range)
+    {
+      for (int t = range.start; t < range.end; ++t) {
+        match_block(t);
+      }
+    }, num_threads);
+  }
 }
 
 
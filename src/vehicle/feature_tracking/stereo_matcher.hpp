@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
 #include "params/params_base.hpp"
@@ -23,7 +24,9 @@ class StereoMatcher final {
     int max_disp = 128;                 // disp = fx * B / depth
     double max_matching_cost = 0.15;    // Maximum matching cost considered valid
     bool bidirectional = false;
-    bool subpixel_refinement = false;
+    bool subpixel_refinement = true;    // Parabola fit to the matching costs along the epipolar line
+    int num_threads = 1;                // Split keypoints across threads when matching a set
+    int prior_search_radius = 4;        // Search +/- this many px around a disparity prior
 
    private:
     void LoadParams(const YamlParser& parser) override;
@@ -39,13 +42,77 @@ class StereoMatcher final {
                         const Image1b& right_rectified,
                         const cv::Point2f& left_keypoint);
 
-  // Match a set of keypoints in the left image (calls member function above).
+  // Match a set of keypoints in the left image. This gives the same result as calling the member
+  // function above for each keypoint, but computes the normalized SSD directly (with SIMD) instead
+  // of going through cv::matchTemplate, and doesn't allocate anything per keypoint.
   std::vector<double> MatchRectified(const Image1b& left_rectified,
                                      const Image1b& right_rectified,
                                      const VecPoint2f& left_keypoints);
 
+  // Same as above, but each keypoint has a disparity prior (e.g from the previous frame), and only
+  // disparities within +/- prior_search_radius of it are searched. If the best match there fails
+  // the cost threshold or lies on the edge of the window, falls back to the full search. Keypoints
+  // with a negative prior always get a full search.
+  std::vector<double> MatchRectified(const Image1b& left_rectified,
+                                     const Image1b& right_rectified,
+                                     const VecPoint2f& left_keypoints,
+                                     const std::vector<double>& disp_priors);
+
+  // Same as the two functions above, but the disparities are written to disps (resized to one per
+  // keypoint), so that callers can reuse its memory from frame to frame.
+  void MatchRectified(const Image1b& left_rectified,
+                      const Image1b& right_rectified,
+                      const VecPoint2f& left_keypoints,
+                      std::vector<double>& disps);
+
+  void MatchRectified(const Image1b& left_rectified,
+                      const Image1b& right_rectified,
+                      const VecPoint2f& left_keypoints,
+                      const std::vector<double>& disp_priors,
+                      std::vector<double>& disps);
+
+ private:
+  // Buffers for matching one keypoint, reused across keypoints (one per thread).
+  struct Scratch final
+  {
+    std::vector<uint32_t> cross;      // sum(T * I) for each candidate window (row-major).
+    std::vector<uint32_t> col_sq;     // Column sums of I^2 for one row of candidate windows.
+    std::vector<double> cost;         // Matching cost for each candidate window (row-major).
+  };
+
+  // Finds the template for left_keypoint and the stripe to search in the right image, exactly like
+  // MatchRectified() does. Returns false if either one goes outside of the image.
+  bool GetTemplateAndStripe(const Image1b& left_rectified,
+                            const Image1b& right_rectified,
+                            const cv::Point2f& left_keypoint,
+                            cv::Rect& template_rect,
+                            cv::Rect& stripe_rect,
+                            int& offset_x) const;
+
+  // Matches every keypoint into disps. If disp_priors is null, every keypoint gets a full search.
+  void MatchRectifiedImpl(const Image1b& left_rectified,
+                          const Image1b& right_rectified,
+                          const VecPoint2f& left_keypoints,
+                          const std::vector<double>* disp_priors,
+                          std::vector<double>& disps);
+
+  // Turns the best match location in the right image into a disparity (or -1 if it's invalid).
+  double MatchToDisparity(const cv::Point2f& left_keypoint,
+                          const cv::Point2f& match_px,
+                          double matching_cost) const;
+
+  // Batched version of MatchRectified() for one keypoint. If disp_prior >= 0, only searches
+  // disparities within +/- search_radius of it (see above).
+  double MatchRectifiedSSD(const Image1b& left_rectified,
+                           const Image1b& right_rectified,
+                           const cv::Point2f& left_keypoint,
+                           double disp_prior,
+                           int search_radius,
+                           Scratch& scratch) const;
+
  private:
   Params params_;
+  std::vector<Scratch> scratch_;
 };
 
 }
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <glog/logging.h>
 
 #include <opencv2/imgproc.hpp>
@@ -21,226 +23,416 @@ void StereoTracker::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("stereo_max_depth", &stereo_max_depth);
   parser.GetParam("stereo_min_depth", &stereo_min_depth);
   parser.GetParam("retrack_frames_k", &retrack_frames_k);
+  parser.GetParam("klt_num_threads", &klt_num_threads);
   parser.GetParam("trigger_keyframe_min_lmks", &trigger_keyframe_min_lmks);
   parser.GetParam("trigger_keyframe_k", &trigger_keyframe_k);
+  parser.GetParam("max_obs_per_lmk", &max_obs_per_lmk);
 
   CHECK(retrack_frames_k >= 1 && retrack_frames_k < 8);
+  CHECK_GE(klt_num_threads, 1);
+  CHECK_GT(max_obs_per_lmk, trigger_keyframe_k);
 }
 
 
-bool StereoTracker::TrackAndTriangulate(const StereoImage1b& stereo_pair, bool force_keyframe)
+StereoTracker::StereoTracker(const Params& params, const StereoCamera& stereo_rig)
+    : params_(params),
+      stereo_rig_(stereo_rig),
+      detector_(params.detector_params),
+      matcher_(params.matcher_params),
+      tracker_(params.tracker_params),
+      pyramid_buffer_(params_.retrack_frames_k + 1),
+      orientation_buffer_(params_.retrack_frames_k),
+      live_tracks_(params_.max_obs_per_lmk)
 {
-  std::unordered_map<int, std::vector<uid_t>> live_lmk_ids_k_ago;
-  std::unordered_map<int, VecPoint2f> live_lmk_pts_k_ago;
-  for (int k = 0; k <= params_.retrack_frames_k; ++k) {
-    live_lmk_ids_k_ago.emplace(k, std::vector<uid_t>());
-    live_lmk_pts_k_ago.emplace(k, VecPoint2f());
+  CHECK_GE(params_.max_obs_per_lmk, 2) << "Need at least 2 observations per landmark to visualize tracks" << std::endl;
+
+  // NOTE(milo): This thread also does work (the first KLT group and detection), so it counts as one
+  // of the threads. There are 2 tasks per group, so more threads than that won't help.
+  const int num_workers = std::min(params_.klt_num_threads, 2 * params_.retrack_frames_k) - 1;
+  if (num_workers > 0) {
+    task_pool_ = std::unique_ptr<ThreadPool>(new ThreadPool(num_workers, "StereoTracker"));
+  }
+
+  // Each group is matched at the same time as the others, so each one needs its own matcher.
+  for (int i = 0; i < params_.retrack_frames_k; ++i) {
+    group_matchers_.emplace_back(new StereoMatcher(params_.matcher_params));
   }
 
-  for (const auto& item : live_tracks_) {
-    const uid_t lmk_id = item.first;
+  group_scratch_.resize(params_.retrack_frames_k + 1);
+  klt_done_.resize(params_.retrack_frames_k);
+  match_done_.resize(params_.retrack_frames_k);
+}
+
 
-    // NOTE(milo): Observations are sorted in order of INCREASING camera_id, so the last
-    // observation is the most recent.
-    const VecLmkObs& observations = item.second;
-    CHECK(!observations.empty());
+bool StereoTracker::TrackAndTriangulate(const StereoImage1b& stereo_pair,
+                                        bool force_keyframe,
+                                        const Matrix3d& prev_R_cur)
+{
+  // NOTE(milo): Everything allocated from the arena is only valid until the end of this function.
+  frame_arena_.Reset();
+  FrameArena& arena = frame_arena_;
+
+  const int num_groups = params_.retrack_frames_k;
+
+  // Count how many landmarks were last seen k frames ago, so that every group can reserve exactly
+  // the memory it needs.
+  // NOTE(milo): The latest observation of every landmark is in a flat array, so this doesn't need
+  // to visit each landmark's observations.
+  const std::vector<uid_t>& latest_camera_ids = live_tracks_.LatestCameraIds();
+  ArenaVector<int> lmk_k_ago{ArenaAllocator<int>(arena)};
+  ArenaVector<size_t> group_sizes{ArenaAllocator<size_t>(arena)};
+  lmk_k_ago.resize(live_tracks_.NumSlots(), -1);
+  group_sizes.resize(num_groups + 1, 0);
+
+  for (size_t slot = 0; slot < live_tracks_.NumSlots(); ++slot) {
+    if (!live_tracks_.IsAlive(slot)) {
+      continue;
+    }
 
     // This landmark was last seen "k" frames ago.
-    const int k = stereo_pair.camera_id - observations.back().camera_id;
+    const int k = stereo_pair.camera_id - latest_camera_ids[slot];
     if (k > params_.retrack_frames_k) {
       continue;
     }
 
-    live_lmk_ids_k_ago.at(k).emplace_back(lmk_id);
-    live_lmk_pts_k_ago.at(k).emplace_back(observations.back().pixel_location);
+    lmk_k_ago[slot] = k;
+    ++group_sizes[k];
   }
 
-  //======================== KANADE-LUCAS OPTICAL FLOW =========================
-  std::vector<uid_t> good_lmk_ids;
-  VecPoint2f good_lmk_pts;
+  ArenaVector<ArenaVector<uid_t>> live_lmk_ids_k_ago{ArenaAllocator<ArenaVector<uid_t>>(arena)};
+  ArenaVector<ArenaVector<double>> live_lmk_disps_k_ago{ArenaAllocator<ArenaVector<double>>(arena)};
+  live_lmk_ids_k_ago.reserve(num_groups + 1);
+  live_lmk_disps_k_ago.reserve(num_groups + 1);
+
+  for (int k = 0; k <= num_groups; ++k) {
+    live_lmk_ids_k_ago.emplace_back(ArenaAllocator<uid_t>(arena));
+    live_lmk_disps_k_ago.emplace_back(ArenaAllocator<double>(arena));
+    live_lmk_ids_k_ago[k].reserve(group_sizes[k]);
+    live_lmk_disps_k_ago[k].reserve(group_sizes[k]);
+    group_scratch_[k].pts_ref.clear();
+  }
 
-  for (int k = 1; k <= params_.retrack_frames_k; ++k) {
-    if (live_lmk_pts_k_ago.at(k).empty()) {
+  for (size_t slot = 0; slot < live_tracks_.NumSlots(); ++slot) {
+    const int k = lmk_k_ago[slot];
+    if (k < 0) {
       continue;
     }
+    live_lmk_ids_k_ago[k].emplace_back(live_tracks_.LandmarkIds()[slot]);
+    live_lmk_disps_k_ago[k].emplace_back(live_tracks_.LatestDisparities()[slot]);
+    group_scratch_[k].pts_ref.emplace_back(live_tracks_.LatestPixels()[slot]);
+  }
+
+  // NOTE(milo): The pyramid buffer has one more slot than KLT needs, so the current pyramid can be
+  // built in place (reusing the memory of the oldest one) while the others are tracked against.
+  ImagePyramid& cur_pyramid = pyramid_buffer_.NextSlot();
+  tracker_.BuildPyramid(stereo_pair.left_image, cur_pyramid);
+
+  const Matrix3d o_R_cur = o_R_prev_ * prev_R_cur;
+
+  // Each group of landmarks (by k) gets its own output slot, so that the groups can be tracked and
+  // matched in any order (or at the same time) and then merged in order of k.
+  // NOTE(milo): The arena isn't thread-safe, so all of the output memory is reserved here.
+  ArenaVector<ArenaVector<uid_t>> good_lmk_ids_k{ArenaAllocator<ArenaVector<uid_t>>(arena)};
+  good_lmk_ids_k.reserve(num_groups);
+  for (int i = 0; i < num_groups; ++i) {
+    good_lmk_ids_k.emplace_back(ArenaAllocator<uid_t>(arena));
+    good_lmk_ids_k[i].reserve(group_sizes[i + 1]);
+  }
+
+  //======================== KANADE-LUCAS OPTICAL FLOW =========================
+  const auto retrack_group = [&](int i)
+  {
+    const int k = i + 1;
+    const Matrix3d ref_R_cur = live_lmk_ids_k_ago[k].empty() ? Matrix3d::Identity() :
+        Matrix3d(orientation_buffer_.Get(k-1).transpose() * o_R_cur);
+    RetrackLandmarks(k, cur_pyramid, ref_R_cur,
+                     live_lmk_ids_k_ago[k],
+                     live_lmk_disps_k_ago[k],
+                     group_scratch_[k],
+                     good_lmk_ids_k[i]);
+  };
+
+  //============================ STEREO MATCHING ===============================
+  // Tracked landmarks don't move much in depth between frames, so only search near their last
+  // disparity (the matcher falls back to a full search if that fails).
+  const auto match_group = [&](int i)
+  {
+    GroupScratch& group = group_scratch_[i + 1];
+    group_matchers_[i]->MatchRectified(stereo_pair.left_image, stereo_pair.right_image,
+                                       group.good_pts, group.good_disp_priors, group.good_disps);
+  };
+
+  // The work for one frame is a small task graph:
+  //   KLT(k) --> stereo matching(k) ---------------------------------------------------> join
+  //   KLT(all k) --> keyframe decision --> detection --> stereo matching(new) --------->
+  // Matching each group starts as soon as its KLT pass is done, and overlaps with the other KLT
+  // passes and detection (which runs on this thread).
+  if (task_pool_) {
+    for (int i = 1; i < num_groups; ++i) {
+      klt_done_[i] = task_pool_->Enqueue([this, i, &retrack_group, &match_group]()
+      {
+        retrack_group(i);
+        match_done_[i] = task_pool_->Enqueue([i, &match_group]() { match_group(i); });
+      });
+    }
 
-    VecPoint2f live_lmk_pts_cur;
-    std::vector<uchar> status;
-    std::vector<float> error;
+    // This thread does the first group itself, instead of waiting.
+    retrack_group(0);
+    match_done_[0] = task_pool_->Enqueue([&match_group]() { match_group(0); });
 
-    tracker_.Track(img_buffer_.Get(k-1),
-                   stereo_pair.left_image,
-                   live_lmk_pts_k_ago.at(k),
-                   live_lmk_pts_cur,
-                   status,
-                   error,
-                   true,
-                   params_.klt_fwd_bwd_tol);
+    for (int i = 1; i < num_groups; ++i) {
+      klt_done_[i].get();
+    }
+  } else {
+    for (int i = 0; i < num_groups; ++i) {
+      retrack_group(i);
+      match_group(i);
+    }
+  }
 
-    // Filter out unsuccessful KLT tracks.
-    std::vector<uid_t> good_lmk_ids_k = SubsetFromMaskCv<uid_t>(live_lmk_ids_k_ago.at(k), status);
-    VecPoint2f good_lmk_pts_k = SubsetFromMaskCv<cv::Point2f>(live_lmk_pts_cur, status);
-    good_lmk_ids.insert(good_lmk_ids.end(), good_lmk_ids_k.begin(), good_lmk_ids_k.end());
-    good_lmk_pts.insert(good_lmk_pts.end(), good_lmk_pts_k.begin(), good_lmk_pts_k.end());
+  // NOTE(milo): This is passed to the detector as a std::vector, so it's a member.
+  VecPoint2f& good_lmk_pts = good_lmk_pts_;
+  good_lmk_pts.clear();
+  for (int i = 0; i < num_groups; ++i) {
+    const VecPoint2f& group_pts = group_scratch_[i + 1].good_pts;
+    good_lmk_pts.insert(good_lmk_pts.end(), group_pts.begin(), group_pts.end());
   }
 
   // Decide if a new keyframe should be initialized.
   // NOTE(milo): If this is the first image, we will have no tracks, triggering a keyframe,
   // causing new keypoints to be detected as desired.
   const bool is_keyframe = force_keyframe ||
-                           ((int)good_lmk_ids.size() < params_.trigger_keyframe_min_lmks) ||
+                           ((int)good_lmk_pts.size() < params_.trigger_keyframe_min_lmks) ||
                            (int)(stereo_pair.camera_id - prev_kf_id_) >= params_.trigger_keyframe_k;
 
   //===================== KEYFRAME FEATURE DETECTION ===========================
-  // If this is a new keyframe, (maybe) detect new keypoints in the left image.
+  // If this is a new keyframe, (maybe) detect new keypoints in the left image, and match them.
+  VecPoint2f& new_left_kps = new_left_kps_;
+  std::vector<double>& new_lmk_disps = new_lmk_disps_;
+  new_left_kps.clear();
+  new_lmk_disps.clear();
+
   if (is_keyframe) {
-    VecPoint2f new_left_kps;
     detector_.Detect(stereo_pair.left_image, good_lmk_pts, new_left_kps);
+    matcher_.MatchRectified(stereo_pair.left_image, stereo_pair.right_image, new_left_kps, new_lmk_disps);
+  }
 
-    // Assign new landmark IDs to the initialized keypoints.
-    std::vector<uid_t> new_lmk_ids(new_left_kps.size());
-    for (size_t i = 0; i < new_left_kps.size(); ++i) {
-      new_lmk_ids.at(i) = AllocateLandmarkId();
+  //================================= JOIN =====================================
+  if (task_pool_) {
+    for (int i = 0; i < num_groups; ++i) {
+      match_done_[i].get();
     }
+  }
 
-    const std::vector<double> new_lmk_disps = matcher_.MatchRectified(
-        stereo_pair.left_image, stereo_pair.right_image, new_left_kps);
+  // NOTE(milo): For now, we consider a track invalid if we can't triangulate w/ stereo.
+  const double min_disp = stereo_rig_.DepthToDisp(params_.stereo_max_depth);
 
-    for (size_t i = 0; i < new_lmk_ids.size(); ++i) {
-      const uid_t lmk_id = new_lmk_ids.at(i);
+  // New landmarks first, then tracked ones in order of k, so that the result doesn't depend on
+  // which tasks finished first.
+  if (is_keyframe) {
+    for (size_t i = 0; i < new_left_kps.size(); ++i) {
+      // Assign new landmark IDs to the initialized keypoints.
+      const uid_t lmk_id = AllocateLandmarkId();
       const cv::Point2f& pt = new_left_kps.at(i);
       const double disp = new_lmk_disps.at(i);
 
-      // NOTE(milo): For now, we consider a track invalid if we can't triangulate w/ stereo.
-      const double min_disp = stereo_rig_.DepthToDisp(params_.stereo_max_depth);
       if (disp <= min_disp) {
         continue;
       }
 
       CHECK_EQ(live_tracks_.count(lmk_id), 0) << "Newly initialized landmark should not exist in live_tracks_" << std::endl;
 
-      // If this is a new landmark, add an empty vector of observations.
-      live_tracks_.emplace(lmk_id, VecLmkObs());
-
-      // Now insert the latest observation.
       const LandmarkObservation lmk_obs(lmk_id, stereo_pair.camera_id, pt, disp, 0.0, 0.0);
-      live_tracks_.at(lmk_id).emplace_back(lmk_obs);
+      live_tracks_.AddLandmark(lmk_obs);
     }
 
     prev_kf_id_ = stereo_pair.camera_id;
-  }
 
-  //============================ STEREO MATCHING ===============================
-  const std::vector<double> good_lmk_disps = matcher_.MatchRectified(
-      stereo_pair.left_image, stereo_pair.right_image, good_lmk_pts);
+    // No group can have more landmarks than there are slots, so frames without new landmarks never
+    // need more memory than this.
+    ReserveFrameMemory(live_tracks_.NumSlots());
+  }
 
-  CHECK_EQ(good_lmk_disps.size(), good_lmk_ids.size());
+  for (int i = 0; i < num_groups; ++i) {
+    const ArenaVector<uid_t>& group_lmk_ids = good_lmk_ids_k[i];
+    const GroupScratch& group = group_scratch_[i + 1];
+    CHECK_EQ(group.good_disps.size(), group_lmk_ids.size());
 
-  for (size_t i = 0; i < good_lmk_ids.size(); ++i) {
-    const uid_t lmk_id = good_lmk_ids.at(i);
-    const cv::Point2f& pt = good_lmk_pts.at(i);
-    const double disp = good_lmk_disps.at(i);
+    for (size_t j = 0; j < group_lmk_ids.size(); ++j) {
+      const uid_t lmk_id = group_lmk_ids.at(j);
+      const cv::Point2f& pt = group.good_pts.at(j);
+      const double disp = group.good_disps.at(j);
 
-    // NOTE(milo): For now, we consider a track invalid if we can't triangulate w/ stereo.
-    const double min_disp = stereo_rig_.DepthToDisp(params_.stereo_max_depth);
-    if (disp <= min_disp) {
-      continue;
-    }
+      if (disp <= min_disp) {
+        continue;
+      }
 
-    // If this is a new landmark, add an empty vector of observations.
-    CHECK_GT(live_tracks_.count(lmk_id), 0) << "Tracked point should already exist in live_tracks_!" << std::endl;
+      CHECK_GT(live_tracks_.count(lmk_id), 0) << "Tracked point should already exist in live_tracks_!" << std::endl;
 
-    // Now insert the latest observation.
-    const LandmarkObservation lmk_obs(lmk_id, stereo_pair.camera_id, pt, disp, 0.0, 0.0);
-    live_tracks_.at(lmk_id).emplace_back(lmk_obs);
+      // Now insert the latest observation.
+      const LandmarkObservation lmk_obs(lmk_id, stereo_pair.camera_id, pt, disp, 0.0, 0.0);
+      live_tracks_.AddObservation(lmk_obs);
+    }
   }
 
   //========================== GARBAGE COLLECTION ==============================
   // Check for any tracks that have haven't been seen in k images and kill them off.
-  // Also kill off any landmarks that have way too many observations so that the memory needed to
-  // store them doesn't blow up.
+  // NOTE(milo): Memory for observations is bounded by max_obs_per_lmk, and dead landmark slots are
+  // reused, so long-lived landmarks don't need to be killed off here.
   KillOffLostLandmarks(stereo_pair.camera_id);
 
   // Housekeeping.
-  img_buffer_.Add(stereo_pair.left_image);
+  pyramid_buffer_.Advance();
+  orientation_buffer_.Add(o_R_cur);
+  o_R_prev_ = o_R_cur;
   prev_camera_id_ = stereo_pair.camera_id;
 
+  // NOTE(milo): Copy the input image rather than keeping a reference to it, since the caller may
+  // reuse its buffer (even if it's refcounted), and pyramid levels are overwritten too. The copy goes
+  // into the same buffer every frame, so GetFeatureTrackSnapshot() has to copy it out again.
+  stereo_pair.left_image.copyTo(prev_left_image_);
+
   return is_keyframe;
 }
 
 
-void StereoTracker::KillOffLostLandmarks(uid_t cur_camera_id)
+void StereoTracker::RetrackLandmarks(int k,
+                                     const ImagePyramid& cur_pyramid,
+                                     const Matrix3d& ref_R_cur,
+                                     const ArenaVector<uid_t>& lmk_ids,
+                                     const ArenaVector<double>& lmk_disps,
+                                     GroupScratch& group,
+                                     ArenaVector<uid_t>& good_lmk_ids) const
+{
+  group.good_pts.clear();
+  group.good_disp_priors.clear();
+
+  if (group.pts_ref.empty()) {
+    return;
+  }
+
+  // Start KLT from where the points would be if the camera had only rotated.
+  PredictPixelsFromRotation(stereo_rig_.LeftCamera(), ref_R_cur, group.pts_ref, group.pts_cur);
+
+  tracker_.Track(pyramid_buffer_.Get(k-1),
+                 cur_pyramid,
+                 group.pts_ref,
+                 group.pts_cur,
+                 group.status,
+                 group.error,
+                 true,
+                 params_.klt_fwd_bwd_tol,
+                 &group.pts_ref_bkw);
+
+  // Filter out unsuccessful KLT tracks.
+  for (size_t i = 0; i < group.status.size(); ++i) {
+    if (group.status[i]) {
+      good_lmk_ids.emplace_back(lmk_ids[i]);
+      group.good_pts.emplace_back(group.pts_cur[i]);
+      group.good_disp_priors.emplace_back(lmk_disps[i]);
+    }
+  }
+}
+
+
+void StereoTracker::ReserveFrameMemory(size_t num_lmks)
 {
-  std::vector<uid_t> lmk_ids_to_kill;
+  // NOTE(milo): The arena holds a few numbers per landmark (ids, disparities, group indices), so
+  // this is a generous upper bound.
+  frame_arena_.Reserve(4096 + 128 * num_lmks);
+
+  for (GroupScratch& group : group_scratch_) {
+    group.pts_ref.reserve(num_lmks);
+    group.pts_cur.reserve(num_lmks);
+    group.pts_ref_bkw.reserve(num_lmks);
+    group.status.reserve(num_lmks);
+    group.error.reserve(num_lmks);
+    group.good_pts.reserve(num_lmks);
+    group.good_disp_priors.reserve(num_lmks);
+    group.good_disps.reserve(num_lmks);
+  }
+  good_lmk_pts_.reserve(num_lmks);
+}
 
-  for (const auto& item : live_tracks_) {
-    const uid_t lmk_id = item.first;
 
-    // NOTE(milo): Observations should be sorted in order of INCREASING camera_id.
-    const VecLmkObs& observations = item.second;
+void StereoTracker::KillOffLostLandmarks(uid_t cur_camera_id)
+{
+  ArenaVector<uid_t> lmk_ids_to_kill{ArenaAllocator<uid_t>(frame_arena_)};
+  lmk_ids_to_kill.reserve(live_tracks_.size());
 
-    // Should never have an landmark with no observations, this is a bug.
-    CHECK(!observations.empty());
+  const std::vector<uid_t>& latest_camera_ids = live_tracks_.LatestCameraIds();
+  for (size_t slot = 0; slot < live_tracks_.NumSlots(); ++slot) {
+    if (!live_tracks_.IsAlive(slot)) {
+      continue;
+    }
 
-    const int frames_since_last_seen = (int)cur_camera_id - observations.back().camera_id;
+    const int frames_since_last_seen = (int)cur_camera_id - latest_camera_ids[slot];
 
     // If this landmark hasn't been observed in retrack_frames_k, it won't be retracked, so kill.
     if (frames_since_last_seen > params_.retrack_frames_k) {
-      lmk_ids_to_kill.emplace_back(lmk_id);
+      lmk_ids_to_kill.emplace_back(live_tracks_.LandmarkIds()[slot]);
     }
   }
 
   for (const uid_t lmk_id : lmk_ids_to_kill) {
-    live_tracks_.erase(lmk_id);
+    live_tracks_.Kill(lmk_id);
   }
 }
 
 
 void StereoTracker::KillLandmark(uid_t lmk_id)
 {
-  if (live_tracks_.count(lmk_id) != 0) {
-    live_tracks_.erase(lmk_id);
-  }
+  live_tracks_.Kill(lmk_id);
 }
 
 
 Image3b StereoTracker::VisualizeFeatureTracks() const
 {
-  VecPoint2f ref_keypoints, cur_keypoints, untracked_ref, untracked_cur;
+  const FeatureTrackSnapshot snapshot = GetFeatureTrackSnapshot();
+  return DrawFeatureTracks(snapshot);
+}
 
-  for (const auto& item : live_tracks_) {
-    const VecLmkObs& lmk_obs = item.second;
 
-    CHECK(!lmk_obs.empty()) << "Landmark should have one or more observations stored" << std::endl;
+FeatureTrackSnapshot StereoTracker::GetFeatureTrackSnapshot() const
+{
+  FeatureTrackSnapshot snapshot;
+  snapshot.image = prev_left_image_.clone();
+
+  const std::vector<uid_t>& latest_camera_ids = live_tracks_.LatestCameraIds();
+  const VecPoint2f& latest_pixels = live_tracks_.LatestPixels();
 
-    const LandmarkObservation& lmk_last_obs = lmk_obs.back();
+  for (size_t slot = 0; slot < live_tracks_.NumSlots(); ++slot) {
+    if (!live_tracks_.IsAlive(slot)) {
+      continue;
+    }
 
-    CHECK_LE(lmk_last_obs.camera_id, prev_camera_id_)
+    CHECK_LE(latest_camera_ids[slot], prev_camera_id_)
         << "Found landmark observation for future camera_id" << std::endl;
 
     // CASE 1: This landmark was seen in the current frame.
-    if (lmk_last_obs.camera_id == prev_camera_id_) {
-      const bool is_new_keypoint = (lmk_obs.size() == 1);
+    if (latest_camera_ids[slot] == prev_camera_id_) {
+      const LandmarkTrackStore::TrackView lmk_obs = live_tracks_.Track(slot);
+      const bool is_new_keypoint = (lmk_obs.NumObservations() == 1);
 
       // CASE 1a: Newly initialized keypoint.
       if (is_new_keypoint) {
-        untracked_cur.emplace_back(lmk_last_obs.pixel_location);
+        snapshot.untracked_cur.emplace_back(latest_pixels[slot]);
 
       // CASE 1b: Tracked from previous location.
       } else {
         CHECK_GE(lmk_obs.size(), 2);
-        cur_keypoints.emplace_back(lmk_last_obs.pixel_location);
+        snapshot.cur_keypoints.emplace_back(latest_pixels[slot]);
         const LandmarkObservation& lmk_lastlast_obs = lmk_obs.at(lmk_obs.size() - 2);
-        ref_keypoints.emplace_back(lmk_lastlast_obs.pixel_location);
+        snapshot.ref_keypoints.emplace_back(lmk_lastlast_obs.pixel_location);
       }
 
     // CASE 2: Landmark not tracked into current frame.
     } else {
-      untracked_ref.emplace_back(lmk_last_obs.pixel_location);
+      snapshot.untracked_ref.emplace_back(latest_pixels[slot]);
     }
   }
 
-  return DrawFeatureTracks(img_buffer_.Head(), ref_keypoints, cur_keypoints, untracked_ref, untracked_cur);
+  return snapshot;
 }
 
 
@@ -1,6 +1,7 @@
 #pragma once
 
-#include <unordered_map>
+#include <future>
+#include <memory>
 
 #include "core/macros.hpp"
 #include "params/params_base.hpp"
@@ -9,10 +10,14 @@
 #include "vision_core/stereo_image.hpp"
 #include "vision_core/stereo_camera.hpp"
 #include "core/sliding_buffer.hpp"
+#include "core/frame_arena.hpp"
+#include "core/thread_pool.hpp"
 #include "vision_core/landmark_observation.hpp"
 #include "feature_tracking/feature_detector.hpp"
 #include "feature_tracking/feature_tracker.hpp"
 #include "feature_tracking/stereo_matcher.hpp"
+#include "feature_tracking/landmark_track_store.hpp"
+#include "feature_tracking/visualization_2d.hpp"
 
 namespace bm {
 namespace ft {
@@ -20,7 +25,7 @@ namespace ft {
 using namespace core;
 
 typedef std::vector<LandmarkObservation> VecLmkObs;
-typedef std::unordered_map<uid_t, VecLmkObs> FeatureTracks;
+typedef LandmarkTrackStore FeatureTracks;
 
 
 class StereoTracker final {
@@ -43,28 +48,35 @@ class StereoTracker final {
     // If set to zero, this means that a track dies as soon as it isn't observed in the current frame.
     int retrack_frames_k = 3; // Retrack points from the previous k frames.
 
+    // Run the per-frame task graph (KLT and stereo matching for each group of landmarks last seen
+    // k = 1, 2, ... frames ago, and keyframe detection) on this many threads. The results are merged
+    // in order of k, so the output is the same as with 1 (serial) thread.
+    int klt_num_threads = 1;
+
     // Trigger a keyframe if we only have 0% of maximum keypoints.
     int trigger_keyframe_min_lmks = 10;
 
     // Trigger a keyframe at least every k frames.
     int trigger_keyframe_k = 10;
 
+    // Only keep this many of the most recent observations for each landmark, so that memory doesn't
+    // grow over long runs. Must be > trigger_keyframe_k, so that the observation from the last
+    // keyframe is always available.
+    int max_obs_per_lmk = 16;
+
    private:
     void LoadParams(const YamlParser& parser) override;
   };
 
   MACRO_DELETE_COPY_CONSTRUCTORS(StereoTracker);
 
-  StereoTracker(const Params& params, const StereoCamera& stereo_rig)
-      : params_(params),
-        stereo_rig_(stereo_rig),
-        detector_(params.detector_params),
-        matcher_(params.matcher_params),
-        tracker_(params.tracker_params),
-        img_buffer_(params_.retrack_frames_k) {}
+  StereoTracker(const Params& params, const StereoCamera& stereo_rig);
 
-  // Returns whether a new keyframe was initialized.
-  bool TrackAndTriangulate(const StereoImage1b& stereo_pair, bool force_keyframe);
+  // Returns whether a new keyframe was initialized. If the rotation of the left camera since the last
+  // call is known (e.g from a gyro), pass it as prev_R_cur to give KLT a better initial guess.
+  bool TrackAndTriangulate(const StereoImage1b& stereo_pair,
+                           bool force_keyframe,
+                           const Matrix3d& prev_R_cur = Matrix3d::Identity());
 
   // Draws current feature tracks:
   // BLUE = Newly detected feature
@@ -72,7 +84,21 @@ class StereoTracker final {
   // RED = Lost tracking (could be revived in a future image)
   Image3b VisualizeFeatureTracks() const;
 
+  // Copies out the current feature tracks and left image, which is much cheaper than drawing them.
+  // The snapshot owns its data, so it can be used after the next call to TrackAndTriangulate().
+  FeatureTrackSnapshot GetFeatureTrackSnapshot() const;
+
   const FeatureTracks& GetLiveTracks() const { return live_tracks_; }
+
+  // Storage for the temporaries of TrackAndTriangulate(), exposed so that tests can check that it
+  // stops growing. Frames that don't add new landmarks (i.e not keyframes) don't grow it once it
+  // fits a whole frame.
+  const FrameArena& GetFrameArena() const { return frame_arena_; }
+
+  // Optical flow pyramids of the last few left images. Each slot is rebuilt in place, so (for the
+  // same image size) their buffers are reused from frame to frame.
+  const SlidingBuffer<ImagePyramid>& GetPyramidBuffer() const { return pyramid_buffer_; }
+
   void KillLandmark(uid_t lmk_id);
 
  private:
@@ -84,6 +110,35 @@ class StereoTracker final {
   // observations are available.
   void KillOffLostLandmarks(uid_t cur_camera_id);
 
+  // Inputs and outputs of FeatureTracker::Track() and StereoMatcher::MatchRectified() for one group
+  // of landmarks. These are passed as std::vectors, so they're kept across frames (to reuse their
+  // memory) instead of in frame_arena_.
+  struct GroupScratch final
+  {
+    VecPoint2f pts_ref;
+    VecPoint2f pts_cur;
+    VecPoint2f pts_ref_bkw;               // Backward KLT pass (for the forward-backward check).
+    std::vector<uchar> status;
+    std::vector<float> error;
+
+    VecPoint2f good_pts;                  // Successfully tracked points.
+    std::vector<double> good_disp_priors; // Disparity when each of them was last seen.
+    std::vector<double> good_disps;       // Disparity in the current frame (from stereo matching).
+  };
+
+  // Reserves room for num_lmks landmarks in frame_arena_, every GroupScratch and good_lmk_pts_.
+  void ReserveFrameMemory(size_t num_lmks);
+
+  // Tracks the landmarks last seen k frames ago (group.pts_ref) into the current image, and keeps
+  // the good ones. good_lmk_ids should have enough capacity reserved for all of the landmarks.
+  void RetrackLandmarks(int k,
+                        const ImagePyramid& cur_pyramid,
+                        const Matrix3d& ref_R_cur,
+                        const ArenaVector<uid_t>& lmk_ids,
+                        const ArenaVector<double>& lmk_disps,
+                        GroupScratch& group,
+                        ArenaVector<uid_t>& good_lmk_ids) const;
+
  private:
   Params params_;
   StereoCamera stereo_rig_;
@@ -96,9 +151,33 @@ class StereoTracker final {
   StereoMatcher matcher_;
   FeatureTracker tracker_;
 
-  SlidingBuffer<Image1b> img_buffer_;
+  // Optical flow pyramids for the last retrack_frames_k left images (plus a slot for the current
+  // one). Each one is built once when its image arrives, and then reused for every forward and
+  // backward KLT pass it's part of.
+  SlidingBuffer<ImagePyramid> pyramid_buffer_;
+
+  // Orientation of the left camera for each image in pyramid_buffer_, relative to an arbitrary frame
+  // "o". Only the relative rotations between them are used.
+  SlidingBuffer<Matrix3d> orientation_buffer_;
+  Matrix3d o_R_prev_ = Matrix3d::Identity();
+
+  // A copy of the most recent left image, for GetFeatureTrackSnapshot(). Reused every frame.
+  Image1b prev_left_image_;
+
+  // Only created if klt_num_threads > 1. The calling thread also does work, so it has one less worker.
+  std::unique_ptr<ThreadPool> task_pool_;
+  std::vector<std::unique_ptr<StereoMatcher>> group_matchers_;
+  std::vector<std::future<void>> klt_done_;
+  std::vector<std::future<void>> match_done_;
 
   FeatureTracks live_tracks_;
+
+  // Temporaries of TrackAndTriangulate() live in the arena, which is reset at the start of each frame.
+  FrameArena frame_arena_;
+  std::vector<GroupScratch> group_scratch_;
+  VecPoint2f good_lmk_pts_;
+  VecPoint2f new_left_kps_;
+  std::vector<double> new_lmk_disps_;
 };
 
 }
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <glog/logging.h>
+
+#include "feature_tracking/subpixel.hpp"
+
+namespace bm {
+namespace ft {
+
+
+float ParabolaSubpixelOffset(double cost_prev, double cost_min, double cost_next)
+{
+  const double curvature = cost_prev - 2.0 * cost_min + cost_next;
+  if (curvature <= 0) {
+    return 0.0f;
+  }
+  const double offset = 0.5 * (cost_prev - cost_next) / curvature;
+  return static_cast<float>(std::max(-0.5, std::min(0.5, offset)));
+}
+
+
+// Sums of the structure tensor terms over one window, relative to its center pixel.
+struct WindowSums final
+{
+  int64_t gxx = 0;
+  int64_t gxy = 0;
+  int64_t gyy = 0;
+  int64_t bx = 0;   // sum(gxx*u + gxy*v)
+  int64_t by = 0;   // sum(gxy*u + gyy*v)
+};
+
+
+static WindowSums SumWindow(const Image1b& img, int cx, int cy, int half_winsize)
+{
+  WindowSums out;
+
+  for (int v = -half_winsize; v <= half_winsize; ++v) {
+    const uint8_t* row = img.ptr<uint8_t>(cy + v) + cx;
+    const uint8_t* row_up = img.ptr<uint8_t>(cy + v - 1) + cx;
+    const uint8_t* row_down = img.ptr<uint8_t>(cy + v + 1) + cx;
+
+    // NOTE(milo): Gradients are in [-255, 255], so every per-row sum fits in an int32 for
+    // half_winsize < 64. Integer sums (unlike float ones) can be reordered, so this vectorizes.
+    int32_t gxx = 0, gxy = 0, gyy = 0, gxxu = 0, gxyu = 0;
+    for (int u = -half_winsize; u <= half_winsize; ++u) {
+      const int32_t gx = static_cast<int32_t>(row[u + 1]) - static_cast<int32_t>(row[u - 1]);
+      const int32_t gy = static_cast<int32_t>(row_down[u]) - static_cast<int32_t>(row_up[u]);
+      gxx += gx * gx;
+      gxy += gx * gy;
+      gyy += gy * gy;
+      gxxu += gx * gx * u;
+      gxyu += gx * gy * u;
+    }
+
+    out.gxx += gxx;
+    out.gxy += gxy;
+    out.gyy += gyy;
+    out.bx += static_cast<int64_t>(gxxu) + static_cast<int64_t>(gxy) * v;
+    out.by += static_cast<int64_t>(gxyu) + static_cast<int64_t>(gyy) * v;
+  }
+
+  return out;
+}
+
+
+void RefineCornersSubpixel(const Image1b& img, int half_winsize, int max_iters, VecPoint2f& corners)
+{
+  CHECK(half_winsize >= 1 && half_winsize < 64) << "half_winsize must be in [1, 64)" << std::endl;
+  CHECK_GE(max_iters, 1);
+
+  // Need one extra pixel around the window for the gradients.
+  const int border = half_winsize + 1;
+
+  for (cv::Point2f& corner : corners) {
+    int cx = static_cast<int>(std::round(corner.x));
+    int cy = static_cast<int>(std::round(corner.y));
+
+    for (int iter = 0; iter < max_iters; ++iter) {
+      if (cx < border || cy < border || cx >= (img.cols - border) || cy >= (img.rows - border)) {
+        break;
+      }
+
+      const WindowSums s = SumWindow(img, cx, cy, half_winsize);
+
+      // Solve [gxx gxy; gxy gyy] * q = [bx; by] for the offset q from the window center.
+      const double det = static_cast<double>(s.gxx) * s.gyy - static_cast<double>(s.gxy) * s.gxy;
+      const double trace = static_cast<double>(s.gxx + s.gyy);
+      if (det <= 1e-6 * trace * trace) {
+        break;
+      }
+
+      const double qx = (static_cast<double>(s.gyy) * s.bx - static_cast<double>(s.gxy) * s.by) / det;
+      const double qy = (static_cast<double>(s.gxx) * s.by - static_cast<double>(s.gxy) * s.bx) / det;
+
+      // Don't let a flat or ambiguous window move the corner further than the window itself.
+      if (std::fabs(qx) > half_winsize || std::fabs(qy) > half_winsize) {
+        break;
+      }
+
+      corner = cv::Point2f(static_cast<float>(cx + qx), static_cast<float>(cy + qy));
+
+      // Done once the estimate is inside the center pixel, otherwise move the window there.
+      const int next_cx = static_cast<int>(std::round(corner.x));
+      const int next_cy = static_cast<int>(std::round(corner.y));
+      if (next_cx == cx && next_cy == cy) {
+        break;
+      }
+      cx = next_cx;
+      cy = next_cy;
+    }
+  }
+}
+
+
+}
+}
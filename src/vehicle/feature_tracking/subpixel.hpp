@@ -0,0 +1,30 @@
+#pragma once
+
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace ft {
+
+using namespace core;
+
+
+// Fits a parabola through the costs at (x-1, x, x+1), where x is a discrete minimum, and returns
+// where its vertex is relative to x (in [-0.5, 0.5]). Returns 0 if the costs aren't convex.
+float ParabolaSubpixelOffset(double cost_prev, double cost_min, double cost_next);
+
+
+// Refines all corners to subpixel accuracy in one call. For each corner, finds the point q that
+// best satisfies dot(grad(p), q - p) = 0 for every pixel p in a (2*half_winsize + 1)^2 window, i.e
+// the same model as cv::cornerSubPix (without the Gaussian weighting).
+//
+// The window is centered on the nearest pixel, and is moved (up to max_iters times) while the
+// estimate is more than half a pixel away from its center. Corners too close to the image border
+// are left where they are.
+//
+// NOTE(milo): Gradients are central differences of the raw image, and all of the window sums are
+// integers, so the inner loop vectorizes and there are no per-corner allocations.
+void RefineCornersSubpixel(const Image1b& img, int half_winsize, int max_iters, VecPoint2f& corners);
+
+
+}
+}
@@ -53,6 +53,16 @@ Image3b DrawFeatureTracks(const Image1b& cur_img,
 }
 
 
+Image3b DrawFeatureTracks(const FeatureTrackSnapshot& snapshot)
+{
+  return DrawFeatureTracks(snapshot.image,
+                           snapshot.ref_keypoints,
+                           snapshot.cur_keypoints,
+                           snapshot.untracked_ref,
+                           snapshot.untracked_cur);
+}
+
+
 Image3b DrawStereoMatches(const Image1b& left,
                           const Image1b& right,
                           const VecPoint2f& keypoints_left,
@@ -24,6 +24,22 @@ Image3b DrawFeatureTracks(const Image1b& cur_img,
                           const VecPoint2f& untracked_cur);
 
 
+// Everything needed to draw the current feature tracks, copied out of a StereoTracker so that it can
+// be drawn later, e.g on a VisualizationSink thread.
+struct FeatureTrackSnapshot final
+{
+  Image1b image;                // Current left image (a copy, owned by the snapshot).
+  VecPoint2f ref_keypoints;     // Tracked landmarks in the previous image...
+  VecPoint2f cur_keypoints;     // ... and in the current image.
+  VecPoint2f untracked_ref;     // Landmarks that weren't tracked into the current image.
+  VecPoint2f untracked_cur;     // Newly detected landmarks.
+};
+
+
+// Same as above, for a snapshot.
+Image3b DrawFeatureTracks(const FeatureTrackSnapshot& snapshot);
+
+
 // Draws matched keypoints in green, and unmatched ones in red.
 // Draws lines between corrspondences in the left/right images.
 Image3b DrawStereoMatches(const Image1b& left,
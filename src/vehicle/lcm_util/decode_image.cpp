@@ -8,51 +8,85 @@
 namespace bm {
 
 
-void DecodeJPG(const vehicle::image_t& msg, cv::Mat& out)
+// Maps DecodeOptions to the cv::imdecode flags.
+static int ImdecodeFlags(bool is_color, const DecodeOptions& options)
 {
-  CHECK_EQ("jpg", msg.encoding) << "Expected JPG image" << std::endl;
+  const bool gray = options.grayscale || !is_color;
+
+  switch (options.scale) {
+    case 1:
+      return gray ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR;
+    case 2:
+      return gray ? cv::IMREAD_REDUCED_GRAYSCALE_2 : cv::IMREAD_REDUCED_COLOR_2;
+    case 4:
+      return gray ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_COLOR_4;
+    case 8:
+      return gray ? cv::IMREAD_REDUCED_GRAYSCALE_8 : cv::IMREAD_REDUCED_COLOR_8;
+    default:
+      LOG(FATAL) << "Unsupported JPG decode scale: " << options.scale << " (must be 1, 2, 4 or 8)" << std::endl;
+      return cv::IMREAD_UNCHANGED;
+  }
+}
 
-  const bool is_color = msg.format == "rgb8" || msg.format == "bgr8";
-  const bool is_gray = msg.format == "mono8";
-  CHECK(is_color || is_gray) << "Unrecognized image format specifier: " << msg.format << std::endl;
 
-  const int buf_size = msg.size;
+static void DecodeJPGBuffer(const std::string& encoding,
+                            const std::string& format,
+                            const uint8_t* buf_data,
+                            int buf_size,
+                            cv::Mat& out,
+                            const DecodeOptions& options)
+{
+  CHECK_EQ("jpg", encoding) << "Expected JPG image" << std::endl;
+
+  const bool is_color = format == "rgb8" || format == "bgr8";
+  const bool is_gray = format == "mono8";
+  CHECK(is_color || is_gray) << "Unrecognized image format specifier: " << format << std::endl;
+
   if (buf_size <= 0) {
     LOG(WARNING) << "Tried to decode an image_t with size <= 0. Probably a mistake in the publisher." << std::endl;
   }
 
-  const uchar* buf_data = msg.data.data();
-  cv::Mat raw_data(1, buf_size, is_color ? CV_8UC3 : CV_8UC1, (void*)buf_data);
-  cv::imdecode(raw_data, is_color ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE, &out);
+  // NOTE(milo): The encoded buffer is just bytes, so wrap it as CV_8UC1 even for color images.
+  // Otherwise imdecode would read 3x past the end of the data block.
+  const cv::Mat raw_data(1, buf_size, CV_8UC1, const_cast<uint8_t*>(buf_data));
+  cv::imdecode(raw_data, ImdecodeFlags(is_color, options), &out);
 
   // Might need to flip channels to convert RBG -> BGR.
-  if (is_color && msg.format == "rgb8") {
+  if (out.channels() == 3 && format == "rgb8") {
     cv::cvtColor(out, out, cv::COLOR_RGB2BGR);
   }
 }
 
 
-void DecodeJPG(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, cv::Mat& out)
+void DecodeJPG(const vehicle::image_t& msg, cv::Mat& out, const DecodeOptions& options)
 {
-  CHECK_EQ("jpg", msg.encoding) << "Expected JPG image" << std::endl;
+  DecodeJPGBuffer(msg.encoding, msg.format, msg.data.data(), msg.size, out, options);
+}
+
+
+void DecodeJPG(const vehicle::mmf_image_t& msg,
+               const uint8_t* buf_data,
+               cv::Mat& out,
+               const DecodeOptions& options)
+{
+  DecodeJPGBuffer(msg.encoding, msg.format, buf_data, msg.size, out, options);
+}
+
+
+cv::Mat WrapRawImage(const vehicle::mmf_image_t& msg, const uint8_t* buf_data)
+{
+  CHECK_EQ("raw", msg.encoding) << "Expected raw image" << std::endl;
 
   const bool is_color = msg.format == "rgb8" || msg.format == "bgr8";
   const bool is_gray = msg.format == "mono8";
   CHECK(is_color || is_gray) << "Unrecognized image format specifier: " << msg.format << std::endl;
 
-  const int buf_size = msg.size;
-  if (buf_size <= 0) {
-    LOG(WARNING) << "Tried to decode an image_t with size <= 0. Probably a mistake in the publisher." << std::endl;
-  }
-
-  // const uchar* buf_data = msg.data.data();
-  cv::Mat raw_data(1, buf_size, is_color ? CV_8UC3 : CV_8UC1, (void*)buf_data);
-  cv::imdecode(raw_data, is_color ? cv::IMREAD_COLOR : cv::IMREAD_GRAYSCALE, &out);
+  const int type = is_color ? CV_8UC3 : CV_8UC1;
+  const size_t row_bytes = static_cast<size_t>(msg.width) * (is_color ? 3 : 1);
+  CHECK_GE(static_cast<size_t>(msg.size), row_bytes * msg.height)
+      << "Raw image data block is too small for its dimensions" << std::endl;
 
-  // Might need to flip channels to convert RBG -> BGR.
-  if (is_color && msg.format == "rgb8") {
-    cv::cvtColor(out, out, cv::COLOR_RGB2BGR);
-  }
+  return cv::Mat(msg.height, msg.width, type, const_cast<uint8_t*>(buf_data), row_bytes);
 }
 
 
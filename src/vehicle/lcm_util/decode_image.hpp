@@ -7,10 +7,35 @@
 
 namespace bm {
 
+
+// Controls how JPG images are decoded. Grayscale decoding only reconstructs the luma channel, and
+// reduced scales (1/2, 1/4, 1/8) are done by libjpeg in the DCT domain. Neither one creates an
+// intermediate color image.
+struct DecodeOptions final
+{
+  DecodeOptions() = default;
+
+  DecodeOptions(bool grayscale, int scale)
+      : grayscale(grayscale), scale(scale) {}
+
+  bool grayscale = false;   // Always output a 1-channel image, even if the JPG has color.
+  int scale = 1;            // Downsample the output by this factor (1, 2, 4 or 8).
+};
+
+
 // https://stackoverflow.com/questions/14727267/opencv-read-jpeg-image-from-buffer
-void DecodeJPG(const vehicle::image_t& msg, cv::Mat& out);
+void DecodeJPG(const vehicle::image_t& msg,
+               cv::Mat& out,
+               const DecodeOptions& options = DecodeOptions());
 
 // Decodes a JPG image from a buffer of uint8_t data.
-void DecodeJPG(const vehicle::mmf_image_t& msg, const uint8_t* buf_data, cv::Mat& out);
+void DecodeJPG(const vehicle::mmf_image_t& msg,
+               const uint8_t* buf_data,
+               cv::Mat& out,
+               const DecodeOptions& options = DecodeOptions());
+
+// Wraps a "raw" encoded image in a cv::Mat header WITHOUT copying. The returned image points into
+// buf_data, so it's only valid as long as that buffer is (and isn't overwritten).
+cv::Mat WrapRawImage(const vehicle::mmf_image_t& msg, const uint8_t* buf_data);
 
 }
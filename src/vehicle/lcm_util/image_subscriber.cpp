@@ -1,15 +1,24 @@
+#include <chrono>
+
 #include <glog/logging.h>
 
+#include <opencv2/imgproc.hpp>
+
 #include "lcm_util/image_subscriber.hpp"
-#include "lcm_util/decode_image.hpp"
+#include "lcm_util/mmf_slot.hpp"
 
 #include "vision_core/image_util.hpp"
 
 namespace bm {
 
 
-ImageSubscriber::ImageSubscriber(lcm::LCM& lcm, const std::string& channel, bool expect_shm)
-    : channel_(channel)
+ImageSubscriber::ImageSubscriber(lcm::LCM& lcm,
+                                 const std::string& channel,
+                                 bool expect_shm,
+                                 const DecodeOptions& decode_options)
+    : channel_(channel),
+      decode_options_(decode_options),
+      stats_("ImageSubscriber", 100)
 {
   if (!lcm.good()) {
     LOG(WARNING) << "Failed to initialize LCM" << std::endl;
@@ -30,52 +39,76 @@ void ImageSubscriber::HandleMmf(const lcm::ReceiveBuffer*,
                                 const std::string&,
                                 const vehicle::mmf_stereo_image_t* msg)
 {
-  const bool ok = IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width)
-               && IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width);
+  const vehicle::mmf_image_t& imgl = msg->img_left;
+  const vehicle::mmf_image_t& imgr = msg->img_right;
+
+  const bool ok = IsSupported(imgl.encoding, imgl.format, imgl.height, imgl.width, true)
+               && IsSupported(imgr.encoding, imgr.format, imgr.height, imgr.width, true);
   if (!ok) { return; }
 
-  const std::string mm_filename = msg->img_left.mm_filename;
+  const std::string mm_filename = imgl.mm_filename;
+
+  if (imgr.mm_filename != mm_filename) {
+    LOG(WARNING) << "Expected same memory-mapped file names for left and right images" << std::endl;
+    return;
+  }
 
   // Open the memory-mapped file if not already open.
   if (mapped_file_.get_name() != mm_filename) {
     LOG(INFO) << "First message, opening MMF: " << mm_filename << std::endl;
     mapped_file_ = ipc::file_mapping(mm_filename.c_str(), ipc::read_only);
     mapped_region_ = ipc::mapped_region(mapped_file_, ipc::read_only);
-    fbuf_.open(mm_filename, std::ios_base::in | std::ios_base::binary);
   }
 
   CHECK_EQ(mm_filename, mapped_file_.get_name())
       << "Message mm_filename doesn't match previous. Did the publisher switch?" << std::endl;
-  CHECK(fbuf_.is_open()) << "File buffer not open, cannot read" << std::endl;
-
-  // Read raw char buffers for both images.
-  const int offl = msg->img_left.offset;
-  const int szl = msg->img_left.size;
 
-  if (offl < 0 || szl <= 0) {
-    LOG(WARNING) << "Got a data buffer for the left image with negative offset or zero size" << std::endl;
+  // NOTE(milo): Both checks have to pass before taking any pointers, since a remap moves the region.
+  if (!CheckMappedBlock(imgl) || !CheckMappedBlock(imgr)) {
     return;
   }
 
-  lbuf_.resize(szl);
-  fbuf_.pubseekpos(offl);
-  fbuf_.sgetn(&lbuf_[0], std::streamsize(szl));
+  const uint8_t* base = static_cast<const uint8_t*>(mapped_region_.get_address());
+  const uint8_t* datal = base + imgl.offset;
+  const uint8_t* datar = base + imgr.offset;
+
+  // If the publisher writes slot headers, make sure that the slots still hold THIS message before
+  // and after we read them. Otherwise the publisher lapped us and the images could be torn.
+  const uint64_t expected_seq = MmfSlotSeqForMessage(msg->header.seq);
+  const MmfSlotHeader* slotl = FindMmfSlotHeader(base, imgl.offset);
+  const MmfSlotHeader* slotr = FindMmfSlotHeader(base, imgr.offset);
 
-  const int offr = msg->img_right.offset;
-  const int szr = msg->img_right.size;
+  const auto slots_valid = [&]() {
+    return (slotl == nullptr || slotl->write_seq.load(std::memory_order_acquire) == expected_seq) &&
+           (slotr == nullptr || slotr->write_seq.load(std::memory_order_acquire) == expected_seq);
+  };
 
-  if (offr < 0 || szr <= 0) {
-    LOG(WARNING) << "Got a data buffer for the right image with negative offset or zero size" << std::endl;
+  if (!slots_valid()) {
+    LOG(WARNING) << "MMF slot was overwritten before it was read, dropping stereo pair "
+                 << msg->header.seq << std::endl;
     return;
   }
 
-  rbuf_.resize(szr);
-  fbuf_.pubseekpos(offr);
-  fbuf_.sgetn(&rbuf_[0], std::streamsize(szr));
+  DecodeMapped(imgl, datal, left_);
+  DecodeMapped(imgr, datar, right_);
+  const int64_t publish_wall_ns = (slotl != nullptr) ? slotl->publish_wall_ns : 0;
 
-  // https://stackoverflow.com/questions/4254615/how-to-cast-vectorunsigned-char-to-char
-  bm::DecodeJPG(msg->img_left, reinterpret_cast<uint8_t*>(lbuf_.data()), left_);
-  bm::DecodeJPG(msg->img_right, reinterpret_cast<uint8_t*>(rbuf_.data()), right_);
+  // Make sure the reads above can't be reordered after the second sequence check.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (!slots_valid()) {
+    LOG(WARNING) << "MMF slot was overwritten while it was read, dropping stereo pair "
+                 << msg->header.seq << std::endl;
+    return;
+  }
+
+  // Publishers that write slot headers tell us when the images were ready, so we can track the
+  // latency from the publisher to our callbacks (e.g StateEstimator::ReceiveStereo).
+  if (publish_wall_ns > 0) {
+    const int64_t now_wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    stats_.Add("mmf_latency", 1e-6 * static_cast<double>(now_wall_ns - publish_wall_ns));
+    stats_.Print("mmf_latency", "ms", 5.0f);
+  }
 
   core::StereoImage1b out(
       msg->header.timestamp,
@@ -93,12 +126,12 @@ void ImageSubscriber::Handle(const lcm::ReceiveBuffer*,
                              const std::string&,
                              const vehicle::stereo_image_t* msg)
 {
-  const bool ok = IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width)
-               && IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width);
+  const bool ok = IsSupported(msg->img_left.encoding, msg->img_left.format, msg->img_left.height, msg->img_left.width, false)
+               && IsSupported(msg->img_right.encoding, msg->img_right.format, msg->img_right.height, msg->img_right.width, false);
   if (!ok) { return; }
 
-  bm::DecodeJPG(msg->img_left, left_);
-  bm::DecodeJPG(msg->img_right, right_);
+  bm::DecodeJPG(msg->img_left, left_, decode_options_);
+  bm::DecodeJPG(msg->img_right, right_, decode_options_);
 
   core::StereoImage1b out(
       msg->header.timestamp,
@@ -114,9 +147,10 @@ void ImageSubscriber::Handle(const lcm::ReceiveBuffer*,
 
 bool ImageSubscriber::IsSupported(const std::string& encoding,
                                   const std::string& format,
-                                  int height, int width)
+                                  int height, int width,
+                                  bool allow_raw)
 {
-  if (encoding != "jpg") {
+  if (encoding != "jpg" && !(allow_raw && encoding == "raw")) {
     LOG(WARNING)
         << "Unsupported encoding:\n  " << encoding
         << "\nchannel:\n  " << channel_ << std::endl;
@@ -139,4 +173,59 @@ bool ImageSubscriber::IsSupported(const std::string& encoding,
   return true;
 }
 
+
+
+bool ImageSubscriber::CheckMappedBlock(const vehicle::mmf_image_t& img)
+{
+  if (img.offset < 0 || img.size <= 0) {
+    LOG(WARNING) << "Got a data buffer with negative offset or zero size" << std::endl;
+    return false;
+  }
+
+  const size_t end = static_cast<size_t>(img.offset) + static_cast<size_t>(img.size);
+
+  // The publisher might have grown the file since we mapped it.
+  if (end > mapped_region_.get_size()) {
+    mapped_region_ = ipc::mapped_region(mapped_file_, ipc::read_only);
+  }
+
+  if (end > mapped_region_.get_size()) {
+    LOG(WARNING) << "Data buffer [" << img.offset << ", " << end << ") is outside of the mapped file ("
+                 << mapped_region_.get_size() << " bytes)" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+
+void ImageSubscriber::DecodeMapped(const vehicle::mmf_image_t& img, const uint8_t* data, cv::Mat& out)
+{
+  if (img.encoding == "jpg") {
+    bm::DecodeJPG(img, data, out, decode_options_);
+    return;
+  }
+
+  // NOTE(milo): The publisher will reuse this slot, and downstream consumers (e.g the stereo queue
+  // in StateEstimator) hold on to images, so the output can't alias the mapping. Instead of a
+  // staging copy, take exactly one pass out of the mapping: a copy (or area resize) for mono8
+  // images, or the gray conversion for color ones.
+  const cv::Mat wrapped = bm::WrapRawImage(img, data);
+  const int scale = decode_options_.scale;
+
+  if (wrapped.channels() == 1) {
+    if (scale > 1) {
+      cv::resize(wrapped, out, cv::Size(wrapped.cols / scale, wrapped.rows / scale), 0, 0, cv::INTER_AREA);
+    } else {
+      wrapped.copyTo(out);
+    }
+  } else {
+    cv::cvtColor(wrapped, out, (img.format == "rgb8") ? cv::COLOR_RGB2GRAY : cv::COLOR_BGR2GRAY);
+    if (scale > 1) {
+      cv::resize(out, out, cv::Size(out.cols / scale, out.rows / scale), 0, 0, cv::INTER_AREA);
+    }
+  }
+}
+
+
 }
@@ -1,7 +1,6 @@
 #pragma once
 
 #include <vector>
-#include <fstream>
 #include <iostream>
 
 #include <opencv2/core/mat.hpp>
@@ -12,7 +11,9 @@
 #include <boost/interprocess/mapped_region.hpp>
 
 #include "core/timestamp.hpp"
+#include "core/stats_tracker.hpp"
 #include "vision_core/stereo_image.hpp"
+#include "lcm_util/decode_image.hpp"
 
 #include "vehicle/stereo_image_t.hpp"
 #include "vehicle/mmf_stereo_image_t.hpp"
@@ -29,10 +30,19 @@ typedef std::function<void(const core::StereoImage3b&)> StereoImage3bCallback;
 class ImageSubscriber final {
  public:
   // Create an image subscriber that listens on "channel". If expect_shm is true, this subscriber
-  // will expect to receive a memory-mapped image (mmf_stereo_image_t).
+  // will expect to receive a memory-mapped image (mmf_stereo_image_t). Slots written by an
+  // MmfStereoPublisher are claimed by sequence number, and dropped if they were reused mid-read.
   // NOTE(milo): An LCM handle must be passed in! Messages are only received if lcm.Spin() is
   // constantly called, which should happen in whatever process owns this ImageSubscriber.
-  ImageSubscriber(lcm::LCM& lcm, const std::string& channel, bool expect_shm = true);
+  //
+  // Since callbacks only receive grayscale images, JPGs are decoded straight to grayscale by
+  // default. Set decode_options.scale to also downsample them while decoding (raw images are
+  // resized to match). NOTE(milo): Only do this if the consumer accounts for the smaller images
+  // (e.g the ObjectMesher does, but the StateEstimator assumes full-resolution calibration).
+  ImageSubscriber(lcm::LCM& lcm,
+                  const std::string& channel,
+                  bool expect_shm = true,
+                  const DecodeOptions& decode_options = DecodeOptions(true, 1));
 
   // Register a callback function that will be called for each decoded image.
   void RegisterCallback(StereoImage1bCallback f) { callbacks_1b_.emplace_back(f); }
@@ -46,26 +56,35 @@ class ImageSubscriber final {
               const std::string&,
               const vehicle::stereo_image_t* msg);
 
-  // Validates the image metadata to make sure it can be decoded.
+  // Validates the image metadata to make sure it can be decoded. The "raw" encoding is only
+  // supported for memory-mapped images.
   bool IsSupported(const std::string& encoding,
                    const std::string& format,
                    int height,
-                   int width);
+                   int width,
+                   bool allow_raw);
+
+  // Checks that the image's data block lies inside of the mapped region. Remaps once in case the
+  // publisher grew the file, which invalidates any pointers into the old region.
+  bool CheckMappedBlock(const vehicle::mmf_image_t& img);
+
+  // Decodes (jpg) or converts (raw) the image straight out of the mapped region into "out".
+  void DecodeMapped(const vehicle::mmf_image_t& img, const uint8_t* data, cv::Mat& out);
 
  private:
   std::string channel_;
+  DecodeOptions decode_options_;
 
   cv::Mat left_;
   cv::Mat right_;
 
+  // NOTE(milo): Images are read directly from the mapping (no read() syscalls or staging copies).
   ipc::file_mapping mapped_file_;
   ipc::mapped_region mapped_region_;
 
-  // https://stackoverflow.com/questions/604431/c-reading-unsigned-char-from-file-stream
-  std::basic_filebuf<char> fbuf_;
-  std::vector<char> lbuf_, rbuf_;
-
   std::vector<StereoImage1bCallback> callbacks_1b_;
+
+  core::StatsTracker stats_;
 };
 
 
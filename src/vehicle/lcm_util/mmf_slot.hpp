@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace bm {
+
+
+// Marks a slot header, so that we can tell it apart from the data of a legacy publisher.
+static constexpr uint32_t kMmfSlotMagic = 0x544f4c53;   // "SLOT" (little endian).
+
+
+// An optional header that a publisher writes directly BEFORE each image data block in a
+// memory-mapped file (i.e at mmf_image_t.offset - sizeof(MmfSlotHeader)). It works like a seqlock:
+//  - while the publisher is writing a slot, write_seq is odd
+//  - when the image for message header.seq is done, write_seq = MmfSlotSeqForMessage(header.seq)
+// A subscriber reads write_seq before and after using the data. If it changed (or didn't match the
+// message to begin with), the publisher reused the slot mid-read and the image should be dropped.
+//
+// The rest of the header describes the image in the slot, and is only valid if write_seq is even.
+struct MmfSlotHeader final
+{
+  uint32_t magic;
+  uint32_t reserved;
+  std::atomic<uint64_t> write_seq;
+
+  int64_t timestamp;          // Same as header_t.timestamp.
+  int64_t seq;                // Same as header_t.seq.
+  int64_t publish_wall_ns;    // System clock time when the slot was finished (for latency).
+  int32_t width;
+  int32_t height;
+  int32_t channels;
+  int32_t size;               // Number of data bytes after this header.
+  char format[8];             // e.g "mono8" (null-terminated).
+  char encoding[8];           // e.g "raw" (null-terminated).
+};
+
+static_assert(sizeof(MmfSlotHeader) == 80, "MmfSlotHeader must match the publisher layout");
+
+
+// The (even) write_seq of a completed slot for the message with this header.seq.
+inline uint64_t MmfSlotSeqForMessage(int64_t msg_seq)
+{
+  return 2 * (static_cast<uint64_t>(msg_seq) + 1);
+}
+
+
+// Returns the slot header in front of the data block at "offset", or nullptr if there isn't one.
+inline const MmfSlotHeader* FindMmfSlotHeader(const uint8_t* base, size_t offset)
+{
+  if (offset < sizeof(MmfSlotHeader) || ((offset - sizeof(MmfSlotHeader)) % alignof(MmfSlotHeader)) != 0) {
+    return nullptr;
+  }
+  const MmfSlotHeader* slot = reinterpret_cast<const MmfSlotHeader*>(base + offset - sizeof(MmfSlotHeader));
+  return (slot->magic == kMmfSlotMagic) ? slot : nullptr;
+}
+
+
+}
@@ -0,0 +1,137 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include <glog/logging.h>
+
+#include "lcm_util/mmf_stereo_publisher.hpp"
+#include "lcm_util/mmf_slot.hpp"
+
+namespace bm {
+
+
+// Round up to a multiple of the slot header alignment, so that every header is aligned.
+static size_t AlignSlotBytes(size_t bytes)
+{
+  const size_t a = alignof(MmfSlotHeader);
+  return ((bytes + a - 1) / a) * a;
+}
+
+
+MmfStereoPublisher::MmfStereoPublisher(lcm::LCM& lcm,
+                                       const std::string& channel,
+                                       const std::string& mm_filename,
+                                       size_t num_slots,
+                                       size_t max_image_bytes)
+    : lcm_(lcm),
+      channel_(channel),
+      mm_filename_(mm_filename),
+      num_slots_(num_slots),
+      max_image_bytes_(max_image_bytes),
+      slot_bytes_(2 * (sizeof(MmfSlotHeader) + AlignSlotBytes(max_image_bytes)))
+{
+  CHECK_GE(num_slots, 2ul) << "Need at least 2 slots, otherwise every new image tears the last one" << std::endl;
+  CHECK_GT(max_image_bytes, 0ul);
+  CHECK_LE(num_slots_ * slot_bytes_, static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+      << "mmf_image_t offsets are int32, so the ring must be smaller than 2GB" << std::endl;
+
+  // Create the file and make it big enough for all of the slots.
+  // https://www.boost.org/doc/libs/1_65_0/doc/html/interprocess/sharedmemorybetweenprocesses.html
+  {
+    std::filebuf fbuf;
+    fbuf.open(mm_filename, std::ios_base::in | std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+    CHECK(fbuf.is_open()) << "Could not create memory-mapped file: " << mm_filename << std::endl;
+    fbuf.pubseekoff(num_slots_ * slot_bytes_ - 1, std::ios_base::beg);
+    fbuf.sputc(0);
+  }
+
+  mapped_file_ = ipc::file_mapping(mm_filename.c_str(), ipc::read_write);
+  mapped_region_ = ipc::mapped_region(mapped_file_, ipc::read_write);
+  CHECK_GE(mapped_region_.get_size(), num_slots_ * slot_bytes_);
+
+  // Mark every slot as empty. A subscriber will never accept write_seq = 0 for any message.
+  uint8_t* base = static_cast<uint8_t*>(mapped_region_.get_address());
+  for (size_t i = 0; i < 2 * num_slots_; ++i) {
+    MmfSlotHeader* header = reinterpret_cast<MmfSlotHeader*>(base + i * (slot_bytes_ / 2));
+    header->magic = kMmfSlotMagic;
+    header->write_seq.store(0);
+  }
+
+  LOG(INFO) << "MmfStereoPublisher writing " << num_slots_ << " slots to: " << mm_filename << std::endl;
+}
+
+
+bool MmfStereoPublisher::Publish(const core::StereoImage1b& stereo_pair)
+{
+  const size_t bytes_left = stereo_pair.left_image.total();
+  const size_t bytes_right = stereo_pair.right_image.total();
+  if (bytes_left > max_image_bytes_ || bytes_right > max_image_bytes_) {
+    LOG(WARNING) << "Stereo pair is too big for the MMF slots (" << bytes_left << " and " << bytes_right
+                 << " bytes, max is " << max_image_bytes_ << ")" << std::endl;
+    return false;
+  }
+
+  const int64_t seq = next_seq_++;
+  const size_t slot_offset = (static_cast<size_t>(seq) % num_slots_) * slot_bytes_;
+
+  vehicle::mmf_stereo_image_t msg;
+  msg.header.timestamp = stereo_pair.timestamp;
+  msg.header.seq = seq;
+  msg.header.frame_id = "";
+
+  WriteImage(stereo_pair.left_image, slot_offset, seq, stereo_pair.timestamp, msg.img_left);
+  WriteImage(stereo_pair.right_image, slot_offset + slot_bytes_ / 2, seq, stereo_pair.timestamp, msg.img_right);
+
+  lcm_.publish(channel_, &msg);
+
+  return true;
+}
+
+
+void MmfStereoPublisher::WriteImage(const core::Image1b& image,
+                                    size_t offset,
+                                    int64_t seq,
+                                    core::timestamp_t timestamp,
+                                    vehicle::mmf_image_t& msg)
+{
+  uint8_t* base = static_cast<uint8_t*>(mapped_region_.get_address());
+  MmfSlotHeader* header = reinterpret_cast<MmfSlotHeader*>(base + offset);
+  uint8_t* data = base + offset + sizeof(MmfSlotHeader);
+
+  const uint64_t write_seq = MmfSlotSeqForMessage(seq);
+
+  // Mark the slot as "being written" before touching the data (see mmf_slot.hpp).
+  header->write_seq.store(write_seq - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  const size_t row_bytes = static_cast<size_t>(image.cols);
+  for (int r = 0; r < image.rows; ++r) {
+    std::memcpy(data + r * row_bytes, image.ptr<uint8_t>(r), row_bytes);
+  }
+
+  header->timestamp = timestamp;
+  header->seq = seq;
+  header->publish_wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  header->width = image.cols;
+  header->height = image.rows;
+  header->channels = 1;
+  header->size = static_cast<int32_t>(row_bytes * image.rows);
+  std::strncpy(header->format, "mono8", sizeof(header->format));
+  std::strncpy(header->encoding, "raw", sizeof(header->encoding));
+
+  header->write_seq.store(write_seq, std::memory_order_release);
+
+  msg.width = image.cols;
+  msg.height = image.rows;
+  msg.channels = 1;
+  msg.format = "mono8";
+  msg.encoding = "raw";
+  msg.mm_filename = mm_filename_;
+  msg.offset = static_cast<int32_t>(offset + sizeof(MmfSlotHeader));
+  msg.size = header->size;
+}
+
+
+}
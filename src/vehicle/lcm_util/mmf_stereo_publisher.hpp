@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+
+#include <lcm/lcm-cpp.hpp>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "core/macros.hpp"
+#include "vision_core/stereo_image.hpp"
+
+#include "vehicle/mmf_stereo_image_t.hpp"
+
+namespace bm {
+
+namespace ipc = boost::interprocess;
+
+
+// Publishes stereo images through a ring of fixed-size slots in a memory-mapped file. Only the
+// metadata (mmf_stereo_image_t) goes over LCM, so an ImageSubscriber with expect_shm = true can
+// receive the images without any copies through the LCM socket.
+//
+// Slot layout (slot k holds the message with header.seq = k mod num_slots):
+//    [ MmfSlotHeader | left image data | MmfSlotHeader | right image data ]
+//
+// Both slot headers act as seqlocks (see mmf_slot.hpp), so a subscriber that falls more than
+// num_slots - 1 messages behind can tell that its slot was reused, instead of reading a torn image.
+class MmfStereoPublisher final {
+ public:
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(MmfStereoPublisher);
+  MACRO_DELETE_COPY_CONSTRUCTORS(MmfStereoPublisher);
+
+  // Creates (or truncates) the memory-mapped file "mm_filename", with room for num_slots stereo
+  // pairs of up to max_image_bytes per image.
+  // NOTE(milo): Use a file in /dev/shm so that the ring lives in memory and not on disk.
+  MmfStereoPublisher(lcm::LCM& lcm,
+                     const std::string& channel,
+                     const std::string& mm_filename,
+                     size_t num_slots,
+                     size_t max_image_bytes);
+
+  // Copies the pair into the next slot as raw "mono8" images and publishes its metadata. Returns
+  // false if the images are too big for a slot.
+  bool Publish(const core::StereoImage1b& stereo_pair);
+
+  size_t NumSlots() const { return num_slots_; }
+
+ private:
+  // Writes one image (and its slot header) at "offset" and fills out the matching message field.
+  void WriteImage(const core::Image1b& image,
+                  size_t offset,
+                  int64_t seq,
+                  core::timestamp_t timestamp,
+                  vehicle::mmf_image_t& msg);
+
+ private:
+  lcm::LCM& lcm_;
+  std::string channel_;
+  std::string mm_filename_;
+
+  size_t num_slots_;
+  size_t max_image_bytes_;
+  size_t slot_bytes_;
+
+  ipc::file_mapping mapped_file_;
+  ipc::mapped_region mapped_region_;
+
+  int64_t next_seq_ = 0;
+};
+
+
+}
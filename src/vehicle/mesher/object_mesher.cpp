@@ -1,7 +1,8 @@
+#include <memory>
+
 #include <glog/logging.h>
 
 #include <opencv2/imgproc.hpp>
-#include <opencv2/highgui.hpp>
 
 #include "core/math_util.hpp"
 #include "core/timer.hpp"
@@ -19,6 +20,7 @@ void ObjectMesher::Params::LoadParams(const YamlParser& parser)
 {
   // Each sub-module has a subtree in the params.yaml.
   tracker_params = StereoTracker::Params(parser.GetNode("StereoTracker"));
+  viz_params = VisualizationSink::Params(parser.GetNode("VisualizationSink"));
 
   parser.GetParam("foreground_ksize", &foreground_ksize);
   parser.GetParam("foreground_min_gradient", &foreground_min_gradient);
@@ -191,15 +193,22 @@ TriangleMesh ObjectMesher::ProcessStereo(const StereoImage1b& stereo_pair, bool
   tracker_.TrackAndTriangulate(stereo_pair, false);
   // LOG(INFO) << "TrackAndTriangulate: " << timer.Tock().milliseconds() << std::endl;
 
+  // NOTE(milo): Visualization only copies out what it needs here, and the drawing happens on the
+  // sink thread. The snapshot owns a copy of the left image, so it's safe to use after the caller
+  // reuses its buffers and after the next frame.
+  FeatureTrackSnapshot tracks_snapshot;
   if (visualize) {
-    const Image3b& viz_tracks = tracker_.VisualizeFeatureTracks();
-    cv::imshow("Visual Navigation (Feature Tracking)", viz_tracks);
+    if (!viz_sink_) {
+      viz_sink_ = std::unique_ptr<VisualizationSink>(new VisualizationSink(params_.viz_params));
+    }
+    tracks_snapshot = tracker_.GetFeatureTrackSnapshot();
+    viz_sink_->Post("Visual Navigation (Feature Tracking)", [tracks_snapshot]() { return DrawFeatureTracks(tracks_snapshot); });
   }
 
   Image1b foreground_mask;
   EstimateForegroundMask(iml, foreground_mask, params_.foreground_ksize, params_.foreground_min_gradient, 4);
 
-  if (visualize) cv::imshow("Foreground Mask", foreground_mask);
+  if (visualize) viz_sink_->Post("Foreground Mask", foreground_mask);
 
   // Build a keypoint graph.
   std::vector<uid_t> lmk_ids;
@@ -218,21 +227,26 @@ TriangleMesh ObjectMesher::ProcessStereo(const StereoImage1b& stereo_pair, bool
     }
   }
 
-  for (auto it = live_tracks.begin(); it != live_tracks.end(); ++it) {
-    const uid_t lmk_id = it->first;
-    const LandmarkObservation& lmk_obs = it->second.back();
+  const std::vector<uid_t>& latest_camera_ids = live_tracks.LatestCameraIds();
+  for (size_t slot = 0; slot < live_tracks.NumSlots(); ++slot) {
+    if (!live_tracks.IsAlive(slot)) {
+      continue;
+    }
 
     // Skip observations from previous frames.
-    if (lmk_obs.camera_id < (stereo_pair.camera_id - params_.tracker_params.retrack_frames_k)) {
+    if (latest_camera_ids[slot] < (stereo_pair.camera_id - params_.tracker_params.retrack_frames_k)) {
       continue;
     }
 
     // Only add vertex if it's been tracked for >= vertex_min_obs frames.
     // The initial detection counts as 1 observation.
-    if ((int)it->second.size() < params_.vertex_min_obs) {
+    const LandmarkTrackStore::TrackView lmk_track = live_tracks.Track(slot);
+    if ((int)lmk_track.NumObservations() < params_.vertex_min_obs) {
       continue;
     }
 
+    const uid_t lmk_id = lmk_track.LandmarkId();
+    const LandmarkObservation& lmk_obs = lmk_track.back();
     lmk_points_list.emplace_back(lmk_obs.pixel_location);
     lmk_points.emplace(lmk_id, lmk_obs.pixel_location);
     lmk_disps.emplace(lmk_id, lmk_obs.disparity);
@@ -324,23 +338,38 @@ TriangleMesh ObjectMesher::ProcessStereo(const StereoImage1b& stereo_pair, bool
       ++c;
     }
 
-    // Draw the output triangles.
-    cv::Mat3b viz_triangles;
-
-    if (visualize) cv::cvtColor(iml, viz_triangles, cv::COLOR_GRAY2BGR);
-
     for (size_t k = 0; k < subdivs.size(); ++k) {
-      if (visualize) DrawDelaunay(k, viz_triangles, subdivs.at(k), vertex_lookup.at(k), vertex_disps);
       BuildTriangleMesh(mesh, k, subdivs.at(k), vertex_lookup.at(k), vertex_disps, params_.stereo_rig, scale_factor);
     }
 
+    // Draw the output triangles. The subdivisions aren't needed anymore, so they're moved to the
+    // sink instead of copied.
     if (visualize) {
-      cv::imshow("Obstacle Avoidance (Object Meshing)", viz_triangles);
+      struct MeshSnapshot
+      {
+        std::vector<cv::Subdiv2D> subdivs;
+        MultiCoordinateMap vertex_lookup;
+        CoordinateMap<double> vertex_disps;
+      };
+
+      std::shared_ptr<MeshSnapshot> mesh_snapshot = std::make_shared<MeshSnapshot>();
+      mesh_snapshot->subdivs = std::move(subdivs);
+      mesh_snapshot->vertex_lookup = std::move(vertex_lookup);
+      mesh_snapshot->vertex_disps = std::move(vertex_disps);
+      const Image1b left_image = tracks_snapshot.image;
+
+      viz_sink_->Post("Obstacle Avoidance (Object Meshing)", [mesh_snapshot, left_image]() -> cv::Mat
+      {
+        Image3b viz_triangles;
+        cv::cvtColor(left_image, viz_triangles, cv::COLOR_GRAY2BGR);
+        for (size_t k = 0; k < mesh_snapshot->subdivs.size(); ++k) {
+          DrawDelaunay(k, viz_triangles, mesh_snapshot->subdivs.at(k), mesh_snapshot->vertex_lookup.at(k), mesh_snapshot->vertex_disps);
+        }
+        return viz_triangles;
+      });
     }
   }
 
-  if (visualize) cv::waitKey(1);
-
   return mesh;
 }
 
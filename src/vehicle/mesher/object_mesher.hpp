@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <unordered_map>
 
 #include <opencv2/imgproc.hpp>
@@ -13,6 +14,7 @@
 #include "core/sliding_buffer.hpp"
 #include "core/grid_lookup.hpp"
 #include "vision_core/landmark_observation.hpp"
+#include "vision_core/visualization_sink.hpp"
 #include "feature_tracking/stereo_tracker.hpp"
 #include "mesher/triangle_mesh.hpp"
 #include "mesher/landmark_graph.hpp"
@@ -90,6 +92,7 @@ class ObjectMesher final {
     MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
 
     StereoTracker::Params tracker_params;
+    VisualizationSink::Params viz_params;
 
     int foreground_ksize = 12;
     float foreground_min_gradient = 25.0;
@@ -118,6 +121,9 @@ class ObjectMesher final {
         tracker_(params.tracker_params, params.stereo_rig),
         lmk_grid_(params_.lmk_grid_rows, params_.lmk_grid_cols) {}
 
+  // If visualize is true, snapshots of the tracks, foreground mask and mesh are posted to a
+  // VisualizationSink, which draws them on its own thread. The sink (and its thread) is only created
+  // the first time that visualize is true.
   TriangleMesh ProcessStereo(const StereoImage1b& stereo_pair, bool visualize = true);
 
  private:
@@ -129,6 +135,8 @@ class ObjectMesher final {
   std::unordered_map<uid_t, VertexData> vertex_data_;
 
   LandmarkGraph graph_;
+
+  std::unique_ptr<VisualizationSink> viz_sink_;
 };
 
 
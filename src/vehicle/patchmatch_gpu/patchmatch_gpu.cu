@@ -8,13 +8,6 @@ namespace bm {
 namespace pm {
 
 
-void PatchmatchGpu::Params::LoadParams(const YamlParser& p)
-{
-  detector_params = ft::FeatureDetector::Params(p.Subtree("FeatureDetector"));
-  matcher_params = ft::StereoMatcher::Params(p.Subtree("StereoMatcher"));
-}
-
-
 template <typename T>
 __device__ __forceinline__
 T GetSubpixel(const cu::PtrStepSz<T> im, float row, float col)
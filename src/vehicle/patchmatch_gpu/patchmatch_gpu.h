@@ -11,6 +11,7 @@
 #include "params/yaml_parser.hpp"
 #include "feature_tracking/feature_detector.hpp"
 #include "feature_tracking/stereo_matcher.hpp"
+#include "stereo_matching/patchmatch_params.hpp"
 
 namespace bm {
 namespace pm {
@@ -76,20 +77,8 @@ void GradientMagnitude(const cu::GpuMat& im,
 
 class PatchmatchGpu final {
  public:
-  struct Params final : public ParamsBase {
-    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
-
-    ft::FeatureDetector::Params detector_params;
-    ft::StereoMatcher::Params matcher_params;
-
-    float cost_alpha = 0.9;
-    int patchmatch_iters = 3;
-    int init_dilate_factor = 4;
-    float cost_improve_factor = 0.8;
-
-   private:
-    void LoadParams(const YamlParser& p) override;
-  };
+  // Shared with stereo::PatchmatchCpu, which doesn't need CUDA.
+  typedef stereo::PatchmatchParams Params;
 
   MACRO_DELETE_COPY_CONSTRUCTORS(PatchmatchGpu);
 
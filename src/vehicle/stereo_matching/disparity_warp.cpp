@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "stereo_matching/disparity_warp.hpp"
+
+namespace bm {
+namespace stereo {
+
+
+void WarpDisparity(const Image1f& disp,
+                   const StereoCamera& stereo_rig,
+                   const Matrix4d& prev_T_cur,
+                   Image1f& warped)
+{
+  CHECK_EQ(stereo_rig.Height(), disp.rows);
+  CHECK_EQ(stereo_rig.Width(), disp.cols);
+
+  // Points are moved from the previous camera frame into the current one.
+  const Matrix3d cur_R_prev = prev_T_cur.block<3, 3>(0, 0).transpose();
+  const Vector3d cur_t_prev = -cur_R_prev * prev_T_cur.block<3, 1>(0, 3);
+
+  const double fx = stereo_rig.fx();
+  const double fy = stereo_rig.fy();
+  const double cx = stereo_rig.cx();
+  const double cy = stereo_rig.cy();
+  const double fx_times_baseline = fx * stereo_rig.Baseline();
+
+  warped.create(disp.size());
+  warped.setTo(-1.0f);
+
+  for (int y = 0; y < disp.rows; ++y) {
+    const float* d_row = disp.ptr<float>(y);
+    for (int x = 0; x < disp.cols; ++x) {
+      const double d = static_cast<double>(d_row[x]);
+      if (d < 0) {
+        continue;
+      }
+
+      const Vector3d ray((x - cx) / fx, (y - cy) / fy, 1.0);
+
+      // Background only rotates (it's too far away for the translation to matter).
+      Vector3d P_cur;
+      if (d > 0) {
+        P_cur = cur_R_prev * (ray * (fx_times_baseline / d)) + cur_t_prev;
+      } else {
+        P_cur = cur_R_prev * ray;
+      }
+
+      if (P_cur.z() <= 1e-6) {
+        continue;
+      }
+
+      const float d_cur = (d > 0) ? static_cast<float>(fx_times_baseline / P_cur.z()) : 0.0f;
+      const double u = fx * P_cur.x() / P_cur.z() + cx;
+      const double v = fy * P_cur.y() / P_cur.z() + cy;
+
+      const int u0 = static_cast<int>(std::floor(u));
+      const int v0 = static_cast<int>(std::floor(v));
+      for (int vi = std::max(v0, 0); vi <= std::min(v0 + 1, disp.rows - 1); ++vi) {
+        float* w_row = warped.ptr<float>(vi);
+        for (int ui = std::max(u0, 0); ui <= std::min(u0 + 1, disp.cols - 1); ++ui) {
+          w_row[ui] = std::max(w_row[ui], d_cur);
+        }
+      }
+    }
+  }
+}
+
+
+}
+}
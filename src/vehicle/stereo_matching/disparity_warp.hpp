@@ -0,0 +1,25 @@
+#pragma once
+
+#include "core/eigen_types.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/stereo_camera.hpp"
+
+namespace bm {
+namespace stereo {
+
+using namespace core;
+
+
+// Moves a disparity map from one camera pose to another, where prev_T_cur is the pose of the current
+// camera in the previous camera's frame. Both use the intrinsics of stereo_rig's left camera (which
+// must have the same resolution as disp). Each pixel is splatted onto the 2x2 pixels around where it
+// lands, and the nearest surface wins. Zero disparities (background) are treated as infinitely far
+// away. Pixels that nothing lands on (e.g newly visible parts of the scene) are set to -1.
+void WarpDisparity(const Image1f& disp,
+                   const StereoCamera& stereo_rig,
+                   const Matrix4d& prev_T_cur,
+                   Image1f& warped);
+
+
+}
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace stereo {
+
+using namespace core;
+
+
+// Truncated intensity + gradient cost from PatchMatch Stereo (Bleyer et al. 2011):
+// cost = alpha * min(mean|Il - Ir|, tau_color) + (1 - alpha) * min(mean|Gl - Gr|, tau_grad)
+struct PatchCostWeights final
+{
+  float alpha = 0.7f;
+  float tau_color = 50.0f;
+  float tau_grad = 20.0f;
+};
+
+
+// A PH x PW patch of intensities and gradients, sampled into stack buffers (row-major). The buffers
+// are padded with zeros to a multiple of 4, so that the SIMD loops don't need a tail.
+template <int PH, int PW>
+struct PatchSamples final
+{
+  static_assert((PH % 2) == 1 && (PW % 2) == 1, "Patch dimensions must be odd");
+
+  static constexpr int kSize = PH * PW;
+  static constexpr int kPadded = (kSize + 3) & ~3;
+
+  alignas(16) float intensity[kPadded];
+  alignas(16) float gradient[kPadded];
+};
+
+
+// Samples the patch centered at (x, y), with bilinear interpolation along x (the same values as
+// cv::getRectSubPix(), without rounding to uint8). The whole patch must be inside the image, and if
+// x isn't an integer, the column to its right too.
+template <int PH, int PW>
+inline void SamplePatch(const Image1b& im, const Image1f& G, float x, int y, PatchSamples<PH, PW>& out)
+{
+  const float left = x - static_cast<float>(PW / 2);
+  const int x0 = static_cast<int>(std::floor(left));
+  const float a = left - static_cast<float>(x0);
+
+  int i = 0;
+
+  // NOTE(milo): At integer positions, don't touch the column to the right, which could be outside
+  // of the image.
+  if (a == 0.0f) {
+    for (int r = 0; r < PH; ++r) {
+      const uint8_t* irow = im.ptr<uint8_t>(y - PH / 2 + r) + x0;
+      const float* grow = G.ptr<float>(y - PH / 2 + r) + x0;
+      for (int c = 0; c < PW; ++c, ++i) {
+        out.intensity[i] = static_cast<float>(irow[c]);
+        out.gradient[i] = grow[c];
+      }
+    }
+  } else {
+    const float b = 1.0f - a;
+    for (int r = 0; r < PH; ++r) {
+      const uint8_t* irow = im.ptr<uint8_t>(y - PH / 2 + r) + x0;
+      const float* grow = G.ptr<float>(y - PH / 2 + r) + x0;
+      for (int c = 0; c < PW; ++c, ++i) {
+        out.intensity[i] = b * static_cast<float>(irow[c]) + a * static_cast<float>(irow[c + 1]);
+        out.gradient[i] = b * grow[c] + a * grow[c + 1];
+      }
+    }
+  }
+
+  for (; i < PatchSamples<PH, PW>::kPadded; ++i) {
+    out.intensity[i] = 0.0f;
+    out.gradient[i] = 0.0f;
+  }
+}
+
+
+// Sum of |a[i] - b[i]| for N floats, where N is a multiple of 4 and both arrays are 16-byte aligned.
+template <int N>
+inline float SumAbsDiff(const float* a, const float* b)
+{
+  static_assert((N % 4) == 0, "N must be a multiple of 4");
+
+#if defined(__SSE2__)
+  const __m128 sign_mask = _mm_set1_ps(-0.0f);
+  __m128 acc = _mm_setzero_ps();
+  for (int i = 0; i < N; i += 4) {
+    const __m128 diff = _mm_sub_ps(_mm_load_ps(a + i), _mm_load_ps(b + i));
+    acc = _mm_add_ps(acc, _mm_andnot_ps(sign_mask, diff));
+  }
+  alignas(16) float lanes[4];
+  _mm_store_ps(lanes, acc);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__ARM_NEON)
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  for (int i = 0; i < N; i += 4) {
+    acc = vaddq_f32(acc, vabdq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+  }
+  return (vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1)) + (vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3));
+#else
+  float lanes[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+  for (int i = 0; i < N; i += 4) {
+    for (int j = 0; j < 4; ++j) {
+      lanes[j] += std::fabs(a[i + j] - b[i + j]);
+    }
+  }
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+}
+
+
+// Cost between two sampled patches (see PatchCostWeights). The zero padding doesn't add anything.
+template <int PH, int PW>
+inline float PatchCost(const PatchSamples<PH, PW>& p1,
+                       const PatchSamples<PH, PW>& p2,
+                       const PatchCostWeights& w)
+{
+  constexpr int N = PatchSamples<PH, PW>::kPadded;
+  const float inv_size = 1.0f / static_cast<float>(PatchSamples<PH, PW>::kSize);
+
+  const float error_color = std::min(inv_size * SumAbsDiff<N>(p1.intensity, p2.intensity), w.tau_color);
+  const float error_grad = std::min(inv_size * SumAbsDiff<N>(p1.gradient, p2.gradient), w.tau_grad);
+
+  return w.alpha * error_color + (1.0f - w.alpha) * error_grad;
+}
+
+
+}
+}
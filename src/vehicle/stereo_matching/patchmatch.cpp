@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <string>
+
 #include <glog/logging.h>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
@@ -12,6 +15,38 @@ void Patchmatch::Params::LoadParams(const YamlParser& p)
 {
   detector_params = ft::FeatureDetector::Params(p.Subtree("FeatureDetector"));
   matcher_params = ft::StereoMatcher::Params(p.Subtree("StereoMatcher"));
+
+  std::string schedule_name;
+  p.GetParam("propagation_schedule", &schedule_name);
+  if (schedule_name == "RASTER") {
+    propagation_schedule = PropagationSchedule::RASTER;
+  } else if (schedule_name == "WAVEFRONT") {
+    propagation_schedule = PropagationSchedule::WAVEFRONT;
+  } else if (schedule_name == "RED_BLACK") {
+    propagation_schedule = PropagationSchedule::RED_BLACK;
+  } else {
+    LOG(FATAL) << "Unsupported propagation schedule: " << schedule_name << std::endl;
+  }
+
+  p.GetParam("propagation_threads", &propagation_threads);
+  p.GetParam("propagation_tile_size", &propagation_tile_size);
+  p.GetParam("red_black_iters", &red_black_iters);
+  p.GetParam("temporal_max_hole_fraction", &temporal_max_hole_fraction);
+
+  CHECK_GE(propagation_threads, 1);
+}
+
+
+Patchmatch::Patchmatch(const Params& params)
+    : params_(params),
+      detector_(params.detector_params),
+      matcher_(params.matcher_params),
+      propagation_pool_(params.propagation_threads > 1 ?
+          new ThreadPool(params.propagation_threads - 1, "Patchmatch") : nullptr),
+      scheduler_(propagation_pool_.get())
+{
+  CHECK_GT(params_.propagation_tile_size, 0);
+  CHECK_GE(params_.red_black_iters, 0);
 }
 
 
@@ -55,6 +90,69 @@ Image1f Patchmatch::Initialize(const Image1b& iml,
 {
   VecPoint2f left_kp;
   detector_.Detect(iml, VecPoint2f(), left_kp);
+  return SparseDisparity(iml, imr, left_kp, downsample_factor);
+}
+
+
+Image1f Patchmatch::Initialize(const Image1b& iml,
+                               const Image1b& imr,
+                               int downsample_factor,
+                               const Image1f& prev_disp,
+                               const StereoCamera& stereo_rig,
+                               const Matrix4d& prev_T_cur)
+{
+  const cv::Size size = iml.size() / downsample_factor;
+  if (prev_disp.size() != size) {
+    return Initialize(iml, imr, downsample_factor);
+  }
+
+  // NOTE(milo): Initialize() divides disparities by 2^downsample_factor, not by downsample_factor, so
+  // convert them to pixels of the downsampled image for the warp.
+  const float to_pixels = std::pow(2.0f, static_cast<float>(downsample_factor)) / downsample_factor;
+  const StereoCamera rig(stereo_rig.LeftCamera().Rescale(size.height, size.width), stereo_rig.Baseline());
+
+  Image1f disps;
+  WarpDisparity(prev_disp * to_pixels, rig, prev_T_cur, disps);
+  disps /= to_pixels;
+
+  const Image1b holes = (disps < 0);
+  const int num_holes = cv::countNonZero(holes);
+
+  // Too much of the scene is new, so it's faster to start over.
+  if (num_holes > params_.temporal_max_hole_fraction * static_cast<double>(disps.total())) {
+    return Initialize(iml, imr, downsample_factor);
+  }
+
+  disps.setTo(0, holes);
+
+  if (num_holes > 0) {
+    VecPoint2f left_kp;
+    detector_.Detect(iml, VecPoint2f(), left_kp);
+
+    // Only match the keypoints that are in the holes, which is usually a small fraction of them.
+    VecPoint2f hole_kp;
+    for (const cv::Point2f& kp : left_kp) {
+      const int x = std::min(size.width - 1, static_cast<int>(std::round(kp.x / downsample_factor)));
+      const int y = std::min(size.height - 1, static_cast<int>(std::round(kp.y / downsample_factor)));
+      if (holes.at<uint8_t>(y, x)) {
+        hole_kp.emplace_back(kp);
+      }
+    }
+
+    if (!hole_kp.empty()) {
+      SparseDisparity(iml, imr, hole_kp, downsample_factor).copyTo(disps, holes);
+    }
+  }
+
+  return disps;
+}
+
+
+Image1f Patchmatch::SparseDisparity(const Image1b& iml,
+                                    const Image1b& imr,
+                                    const VecPoint2f& left_kp,
+                                    int downsample_factor)
+{
   const std::vector<double>& left_kp_disps = matcher_.MatchRectified(iml, imr, left_kp);
 
   // Default to zero disparity (background).
@@ -360,5 +458,389 @@ void Patchmatch::RemoveBackground(const Image1b& iml,
 }
 
 
+// Replaces the disparity of pixel (x, y) with the cheapest of the candidates (usually from its
+// neighbors), if any of them is cheaper than the current one. Ties go to the current disparity, then
+// to the earlier candidate. The reference patch is sampled once by the caller.
+template <int PH, int PW, int N>
+static inline void ChooseBestDisparity(const PatchSamples<PH, PW>& ref,
+                                       const Image1b& imr,
+                                       const Image1f& Gr,
+                                       int x, int y,
+                                       const float (&candidates)[N],
+                                       float* disp_row,
+                                       const PatchCostWeights& w)
+{
+  PatchSamples<PH, PW> cand;
+
+  // Disparities that would put the patch past the left border aren't allowed.
+  const float max_disp = static_cast<float>(x - PW / 2);
+
+  const float d0 = std::fmin(std::fmax(disp_row[x], 0.0f), max_disp);
+  SamplePatch<PH, PW>(imr, Gr, static_cast<float>(x) - d0, y, cand);
+  float cost_best = PatchCost<PH, PW>(ref, cand, w);
+  float dbest = d0;
+
+  for (int i = 0; i < N; ++i) {
+    const float dn = candidates[i];
+    if (dn < 0.0f || dn > max_disp || dn == dbest) {
+      continue;
+    }
+    SamplePatch<PH, PW>(imr, Gr, static_cast<float>(x) - dn, y, cand);
+    const float cost = PatchCost<PH, PW>(ref, cand, w);
+    if (cost < cost_best) {
+      cost_best = cost;
+      dbest = dn;
+    }
+  }
+
+  disp_row[x] = dbest;
+}
+
+
+// Pixels that aren't within patch dimensions of the border (inclusive).
+struct ValidRegion final
+{
+  ValidRegion(const Image1b& im, int patch_height, int patch_width)
+      : x_min(patch_width / 2),
+        y_min(patch_height / 2),
+        x_max(im.cols - patch_width / 2 - 1),
+        y_max(im.rows - patch_height / 2 - 1) {}
+
+  int Width() const { return std::max(0, x_max - x_min + 1); }
+  int Height() const { return std::max(0, y_max - y_min + 1); }
+
+  int x_min, y_min, x_max, y_max;
+};
+
+
+static int NumTiles(int pixels, int tile_size)
+{
+  return (pixels + tile_size - 1) / tile_size;
+}
+
+
+// One raster sweep comparing each pixel with the neighbor at (x_offset, y_offset). Goes top-left to
+// bottom-right if the neighbor is above/left, and the other way otherwise. Horizontal sweeps are
+// split into bands of rows, and vertical ones into bands of columns.
+template <int PH, int PW>
+static void RasterSweep(const Image1b& iml,
+                        const Image1b& imr,
+                        const Image1f& Gl,
+                        const Image1f& Gr,
+                        Image1f& disp,
+                        const PatchCostWeights& w,
+                        int x_offset,
+                        int y_offset,
+                        int band_size,
+                        TileScheduler& scheduler)
+{
+  const ValidRegion region(iml, PH, PW);
+  const bool forward = (x_offset < 0 || y_offset < 0);
+  const bool horizontal = (y_offset == 0);
+
+  const TileScheduler::TileFunction sweep_band = [&](int band_row, int band_col)
+  {
+    // Horizontal sweeps have one column of bands, and vertical sweeps have one row.
+    int x0 = region.x_min, x1 = region.x_max;
+    int y0 = region.y_min, y1 = region.y_max;
+    if (horizontal) {
+      y0 = region.y_min + band_row * band_size;
+      y1 = std::min(region.y_max, y0 + band_size - 1);
+    } else {
+      x0 = region.x_min + band_col * band_size;
+      x1 = std::min(region.x_max, x0 + band_size - 1);
+    }
+
+    const int step = forward ? 1 : -1;
+    const int y_begin = forward ? y0 : y1;
+    const int y_end = forward ? (y1 + 1) : (y0 - 1);
+    const int x_begin = forward ? x0 : x1;
+    const int x_end = forward ? (x1 + 1) : (x0 - 1);
+
+    PatchSamples<PH, PW> ref;
+
+    for (int y = y_begin; y != y_end; y += step) {
+      float* disp_row = disp.ptr<float>(y);
+      const float* neighbor_row = disp.ptr<float>(y + y_offset);
+
+      for (int x = x_begin; x != x_end; x += step) {
+        SamplePatch<PH, PW>(iml, Gl, static_cast<float>(x), y, ref);
+        const float candidates[1] = { neighbor_row[x + x_offset] };
+        ChooseBestDisparity<PH, PW>(ref, imr, Gr, x, y, candidates, disp_row, w);
+      }
+    }
+  };
+
+  if (horizontal) {
+    scheduler.Run(NumTiles(region.Height(), band_size), 1, TileScheduler::Order::ANY, sweep_band);
+  } else {
+    scheduler.Run(1, NumTiles(region.Width(), band_size), TileScheduler::Order::ANY, sweep_band);
+  }
+}
+
+
+// One sweep comparing each pixel with both its left and top neighbors (forward), or its right and
+// bottom neighbors (reverse), in square tiles that run along anti-diagonals.
+template <int PH, int PW>
+static void WavefrontSweep(const Image1b& iml,
+                           const Image1b& imr,
+                           const Image1f& Gl,
+                           const Image1f& Gr,
+                           Image1f& disp,
+                           const PatchCostWeights& w,
+                           bool forward,
+                           int tile_size,
+                           TileScheduler& scheduler)
+{
+  const ValidRegion region(iml, PH, PW);
+  const int side = forward ? -1 : 1;
+
+  const TileScheduler::TileFunction sweep_tile = [&](int tile_row, int tile_col)
+  {
+    const int x0 = region.x_min + tile_col * tile_size;
+    const int y0 = region.y_min + tile_row * tile_size;
+    const int x1 = std::min(region.x_max, x0 + tile_size - 1);
+    const int y1 = std::min(region.y_max, y0 + tile_size - 1);
+
+    const int step = forward ? 1 : -1;
+    const int y_begin = forward ? y0 : y1;
+    const int y_end = forward ? (y1 + 1) : (y0 - 1);
+    const int x_begin = forward ? x0 : x1;
+    const int x_end = forward ? (x1 + 1) : (x0 - 1);
+
+    PatchSamples<PH, PW> ref;
+
+    for (int y = y_begin; y != y_end; y += step) {
+      float* disp_row = disp.ptr<float>(y);
+      const float* vertical_row = disp.ptr<float>(y + side);
+
+      for (int x = x_begin; x != x_end; x += step) {
+        SamplePatch<PH, PW>(iml, Gl, static_cast<float>(x), y, ref);
+        const float candidates[2] = { disp_row[x + side], vertical_row[x] };
+        ChooseBestDisparity<PH, PW>(ref, imr, Gr, x, y, candidates, disp_row, w);
+      }
+    }
+  };
+
+  scheduler.Run(NumTiles(region.Height(), tile_size),
+                NumTiles(region.Width(), tile_size),
+                forward ? TileScheduler::Order::WAVEFRONT_FORWARD : TileScheduler::Order::WAVEFRONT_REVERSE,
+                sweep_tile);
+}
+
+
+// Compares each pixel of one color of a checkerboard with its 4 neighbors (of the other color).
+// Pixels of one color don't read each other, so all of them can be updated at once.
+template <int PH, int PW>
+static void RedBlackPass(const Image1b& iml,
+                         const Image1b& imr,
+                         const Image1f& Gl,
+                         const Image1f& Gr,
+                         Image1f& disp,
+                         const PatchCostWeights& w,
+                         int color,
+                         int band_size,
+                         TileScheduler& scheduler)
+{
+  const ValidRegion region(iml, PH, PW);
+
+  const TileScheduler::TileFunction pass_band = [&](int band_row, int)
+  {
+    const int y0 = region.y_min + band_row * band_size;
+    const int y1 = std::min(region.y_max, y0 + band_size - 1);
+
+    PatchSamples<PH, PW> ref;
+
+    for (int y = y0; y <= y1; ++y) {
+      float* disp_row = disp.ptr<float>(y);
+      const float* above_row = disp.ptr<float>(y - 1);
+      const float* below_row = disp.ptr<float>(y + 1);
+
+      const int x_begin = region.x_min + ((region.x_min + y + color) % 2);
+
+      for (int x = x_begin; x <= region.x_max; x += 2) {
+        SamplePatch<PH, PW>(iml, Gl, static_cast<float>(x), y, ref);
+        const float candidates[4] = { disp_row[x - 1], above_row[x], disp_row[x + 1], below_row[x] };
+        ChooseBestDisparity<PH, PW>(ref, imr, Gr, x, y, candidates, disp_row, w);
+      }
+    }
+  };
+
+  scheduler.Run(NumTiles(region.Height(), band_size), 1, TileScheduler::Order::ANY, pass_band);
+}
+
+
+template <int PH, int PW>
+static void PropagateFast(const Image1b& iml,
+                          const Image1b& imr,
+                          const Image1f& Gl,
+                          const Image1f& Gr,
+                          Image1f& disp,
+                          const PatchCostWeights& w,
+                          const Patchmatch::Params& params,
+                          TileScheduler& scheduler)
+{
+  const int tile_size = params.propagation_tile_size;
+
+  switch (params.propagation_schedule) {
+    case PropagationSchedule::RASTER:
+      // Same order as the CostFunctor2 version: left and top neighbors, then right and bottom.
+      RasterSweep<PH, PW>(iml, imr, Gl, Gr, disp, w, -1, 0, tile_size, scheduler);
+      RasterSweep<PH, PW>(iml, imr, Gl, Gr, disp, w, 0, -1, tile_size, scheduler);
+      RasterSweep<PH, PW>(iml, imr, Gl, Gr, disp, w, 1, 0, tile_size, scheduler);
+      RasterSweep<PH, PW>(iml, imr, Gl, Gr, disp, w, 0, 1, tile_size, scheduler);
+      break;
+    case PropagationSchedule::WAVEFRONT:
+      WavefrontSweep<PH, PW>(iml, imr, Gl, Gr, disp, w, true, tile_size, scheduler);
+      WavefrontSweep<PH, PW>(iml, imr, Gl, Gr, disp, w, false, tile_size, scheduler);
+      break;
+    case PropagationSchedule::RED_BLACK:
+      for (int iter = 0; iter < params.red_black_iters; ++iter) {
+        RedBlackPass<PH, PW>(iml, imr, Gl, Gr, disp, w, 0, tile_size, scheduler);
+        RedBlackPass<PH, PW>(iml, imr, Gl, Gr, disp, w, 1, tile_size, scheduler);
+      }
+      break;
+    default:
+      LOG(FATAL) << "Unknown PropagationSchedule" << std::endl;
+  }
+}
+
+
+template <int PH, int PW>
+static void RemoveBackgroundFast(const Image1b& iml,
+                                 const Image1b& imr,
+                                 const Image1f& Gl,
+                                 const Image1f& Gr,
+                                 Image1f& disp,
+                                 const PatchCostWeights& w,
+                                 float win_by_factor,
+                                 int band_size,
+                                 TileScheduler& scheduler)
+{
+  const ValidRegion region(iml, PH, PW);
+
+  // Every pixel is independent, so this is split into bands of rows.
+  const TileScheduler::TileFunction remove_band = [&](int band_row, int)
+  {
+    const int y0 = region.y_min + band_row * band_size;
+    const int y1 = std::min(region.y_max, y0 + band_size - 1);
+
+    PatchSamples<PH, PW> ref, cand;
+
+    for (int y = y0; y <= y1; ++y) {
+      float* disp_row = disp.ptr<float>(y);
+
+      for (int x = region.x_min; x <= region.x_max; ++x) {
+        SamplePatch<PH, PW>(iml, Gl, static_cast<float>(x), y, ref);
+
+        // Get the cost at current estimated disparity.
+        const float d0 = std::fmin(std::fmax(disp_row[x], 0.0f), static_cast<float>(x - PW / 2));
+        SamplePatch<PH, PW>(imr, Gr, static_cast<float>(x) - d0, y, cand);
+        const float cost_using_current = PatchCost<PH, PW>(ref, cand, w);
+
+        // Get the cost if disparity is set to zero.
+        SamplePatch<PH, PW>(imr, Gr, static_cast<float>(x), y, cand);
+        const float cost_no_disp = PatchCost<PH, PW>(ref, cand, w);
+
+        if (cost_using_current > (cost_no_disp / win_by_factor)) {
+          disp_row[x] = 0;
+        }
+      }
+    }
+  };
+
+  scheduler.Run(NumTiles(region.Height(), band_size), 1, TileScheduler::Order::ANY, remove_band);
+}
+
+
+typedef void (*PropagateFastFn)(const Image1b&, const Image1b&, const Image1f&, const Image1f&,
+                                Image1f&, const PatchCostWeights&, const Patchmatch::Params&,
+                                TileScheduler&);
+typedef void (*RemoveBackgroundFastFn)(const Image1b&, const Image1b&, const Image1f&, const Image1f&,
+                                       Image1f&, const PatchCostWeights&, float, int, TileScheduler&);
+
+
+// The patch size is a template parameter of the kernels above (so that their loops are unrolled),
+// so pick the instantiation for a runtime size. Returns nullptr if it isn't supported.
+template <int PH>
+static PropagateFastFn SelectPropagateFast(int patch_width)
+{
+  switch (patch_width) {
+    case 3: return &PropagateFast<PH, 3>;
+    case 5: return &PropagateFast<PH, 5>;
+    case 7: return &PropagateFast<PH, 7>;
+    default: return nullptr;
+  }
+}
+
+
+static PropagateFastFn SelectPropagateFast(int patch_height, int patch_width)
+{
+  switch (patch_height) {
+    case 3: return SelectPropagateFast<3>(patch_width);
+    case 5: return SelectPropagateFast<5>(patch_width);
+    case 7: return SelectPropagateFast<7>(patch_width);
+    default: return nullptr;
+  }
+}
+
+
+template <int PH>
+static RemoveBackgroundFastFn SelectRemoveBackgroundFast(int patch_width)
+{
+  switch (patch_width) {
+    case 3: return &RemoveBackgroundFast<PH, 3>;
+    case 5: return &RemoveBackgroundFast<PH, 5>;
+    case 7: return &RemoveBackgroundFast<PH, 7>;
+    default: return nullptr;
+  }
+}
+
+
+static RemoveBackgroundFastFn SelectRemoveBackgroundFast(int patch_height, int patch_width)
+{
+  switch (patch_height) {
+    case 3: return SelectRemoveBackgroundFast<3>(patch_width);
+    case 5: return SelectRemoveBackgroundFast<5>(patch_width);
+    case 7: return SelectRemoveBackgroundFast<7>(patch_width);
+    default: return nullptr;
+  }
+}
+
+
+void Patchmatch::Propagate(const Image1b& iml,
+                           const Image1b& imr,
+                           const Image1f& Gl,
+                           const Image1f& Gr,
+                           Image1f& disp,
+                           const PatchCostWeights& cost,
+                           int patch_height,
+                           int patch_width)
+{
+  const PropagateFastFn propagate = SelectPropagateFast(patch_height, patch_width);
+  CHECK(propagate != nullptr) << "Unsupported patch size: " << patch_height << "x" << patch_width << std::endl;
+  CHECK(iml.size() == imr.size() && iml.size() == Gl.size() && iml.size() == Gr.size() && iml.size() == disp.size());
+
+  propagate(iml, imr, Gl, Gr, disp, cost, params_, scheduler_);
+}
+
+
+void Patchmatch::RemoveBackground(const Image1b& iml,
+                                  const Image1b& imr,
+                                  const Image1f& Gl,
+                                  const Image1f& Gr,
+                                  Image1f& disp,
+                                  const PatchCostWeights& cost,
+                                  int patch_height,
+                                  int patch_width,
+                                  float win_by_factor)
+{
+  const RemoveBackgroundFastFn remove_background = SelectRemoveBackgroundFast(patch_height, patch_width);
+  CHECK(remove_background != nullptr) << "Unsupported patch size: " << patch_height << "x" << patch_width << std::endl;
+  CHECK(iml.size() == imr.size() && iml.size() == Gl.size() && iml.size() == Gr.size() && iml.size() == disp.size());
+
+  remove_background(iml, imr, Gl, Gr, disp, cost, win_by_factor, params_.propagation_tile_size, scheduler_);
+}
+
 }
 }
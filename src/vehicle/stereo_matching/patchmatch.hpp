@@ -1,12 +1,18 @@
 #pragma once
 
+#include <memory>
+
 #include "core/macros.hpp"
+#include "core/thread_pool.hpp"
+#include "core/tile_scheduler.hpp"
 #include "params/params_base.hpp"
 #include "params/yaml_parser.hpp"
 #include "vision_core/cv_types.hpp"
 
 #include "feature_tracking/feature_detector.hpp"
 #include "feature_tracking/stereo_matcher.hpp"
+#include "stereo_matching/disparity_warp.hpp"
+#include "stereo_matching/patch_cost.hpp"
 
 namespace bm {
 namespace stereo {
@@ -26,6 +32,25 @@ void ForegroundTextureMask(const Image1b& gray,
                           int downsize = 2);
 
 
+// How the PatchCostWeights version of Patchmatch::Propagate() visits pixels.
+enum class PropagationSchedule
+{
+  // Four raster sweeps, comparing each pixel with its left, top, right and then bottom neighbor
+  // (same as the CostFunctor2 version). Rows (or columns) don't depend on each other, so they're
+  // split across threads, and the result doesn't depend on the number of threads.
+  RASTER,
+
+  // Two sweeps, comparing each pixel with both its left and top neighbors, and then with its right
+  // and bottom neighbors. Tiles run on anti-diagonals, since each one needs the tiles to its left
+  // and above it (below and to its right) to be done. Same result as running it serially.
+  WAVEFRONT,
+
+  // Checkerboard: all of the "red" pixels are compared with their 4 (black) neighbors at once, then
+  // all of the black pixels. Repeated red_black_iters times.
+  RED_BLACK
+};
+
+
 class Patchmatch final {
  public:
   struct Params final : public ParamsBase {
@@ -34,16 +59,22 @@ class Patchmatch final {
     ft::FeatureDetector::Params detector_params;
     ft::StereoMatcher::Params matcher_params;
 
+    PropagationSchedule propagation_schedule = PropagationSchedule::RASTER;
+    int propagation_threads = 1;      // Including the calling thread.
+    int propagation_tile_size = 32;   // Pixels on each side of a tile (or rows/cols in a band).
+    int red_black_iters = 2;
+
+    // The warm start version of Initialize() starts over if more than this fraction of the warped
+    // disparity is missing (e.g after fast motion).
+    float temporal_max_hole_fraction = 0.3;
+
    private:
     void LoadParams(const YamlParser& p) override;
   };
 
   MACRO_DELETE_COPY_CONSTRUCTORS(Patchmatch);
 
-  Patchmatch(const Params& params)
-      : params_(params),
-        detector_(params.detector_params),
-        matcher_(params.matcher_params) {}
+  Patchmatch(const Params& params);
 
   Image1f EstimateDisparity(const Image1b& iml,
                             const Image1b& imr);
@@ -52,8 +83,24 @@ class Patchmatch final {
                      const Image1b& imr,
                      int downsample_factor);
 
+  // Warm start version of Initialize(). prev_disp (the last frame's output, at the same size and scale
+  // as Initialize() returns) is warped into the current frame, where prev_T_cur is the pose of the
+  // current left camera in the previous one's frame (e.g lkf_T_prev.inverse() * lkf_T_cur from two
+  // VoResults). stereo_rig is the full resolution camera. Only the keypoints in newly visible regions
+  // are matched, and any holes left over are background. Since most of the disparity is already
+  // close, callers can run fewer Propagate() iterations (with less noise) after this.
+  Image1f Initialize(const Image1b& iml,
+                     const Image1b& imr,
+                     int downsample_factor,
+                     const Image1f& prev_disp,
+                     const StereoCamera& stereo_rig,
+                     const Matrix4d& prev_T_cur);
+
   void AddNoise(Image1f& disp, float amount, const Image1b& mask);
 
+  // NOTE(milo): The CostFunctor2 versions of Propagate() and RemoveBackground() copy every patch
+  // into a new cv::Mat and call the cost through a std::function. They're kept as a (slow) reference
+  // for trying out new cost functions. Use the PatchCostWeights versions for everything else.
   void Propagate(const Image1b& iml,
                  const Image1b& imr,
                  const Image1f& Gl,
@@ -73,11 +120,44 @@ class Patchmatch final {
                         int patch_width,
                         float win_by_factor = 2.0);
 
+  // Same as above, with the intensity + gradient cost in patch_cost.hpp. Patches are sampled into
+  // stack buffers, so these don't allocate. Patch dimensions can be 3, 5 or 7. Pixels are visited
+  // according to params.propagation_schedule.
+  void Propagate(const Image1b& iml,
+                 const Image1b& imr,
+                 const Image1f& Gl,
+                 const Image1f& Gr,
+                 Image1f& disp,
+                 const PatchCostWeights& cost,
+                 int patch_height,
+                 int patch_width);
+
+  void RemoveBackground(const Image1b& iml,
+                        const Image1b& imr,
+                        const Image1f& Gl,
+                        const Image1f& Gr,
+                        Image1f& disp,
+                        const PatchCostWeights& cost,
+                        int patch_height,
+                        int patch_width,
+                        float win_by_factor = 2.0);
+
+ private:
+  // Sparse disparities at left_kp, dilated and downsampled (see Initialize()).
+  Image1f SparseDisparity(const Image1b& iml,
+                          const Image1b& imr,
+                          const VecPoint2f& left_kp,
+                          int downsample_factor);
+
  private:
   Params params_;
 
   ft::FeatureDetector detector_;
   ft::StereoMatcher matcher_;
+
+  // Only created if propagation_threads > 1.
+  std::unique_ptr<ThreadPool> propagation_pool_;
+  TileScheduler scheduler_;
 };
 
 
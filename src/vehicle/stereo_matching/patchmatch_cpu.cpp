@@ -0,0 +1,528 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <glog/logging.h>
+#include <opencv2/imgproc.hpp>
+
+#include "stereo_matching/patchmatch_cpu.hpp"
+
+namespace bm {
+namespace stereo {
+
+
+// Same patch size as PatchmatchGpu::Match().
+static const int kPatchRadius = 1;
+
+
+#if defined(__SSE2__)
+// Two (intensity, gradient) taps, linearly interpolated along x. p and q point at the pixel to the
+// left of each tap, and its right neighbor is right after it: [I0 G0 I1 G1].
+static inline __m128 SampleTwo(const float* p, const float* q, __m128 a, __m128 b)
+{
+  const __m128 P = _mm_loadu_ps(p);
+  const __m128 Q = _mm_loadu_ps(q);
+  return _mm_add_ps(_mm_mul_ps(b, _mm_movelh_ps(P, Q)), _mm_mul_ps(a, _mm_movehl_ps(Q, P)));
+}
+
+
+static inline __m128 LoadTwo(const float* p, const float* q)
+{
+  const __m128 lo = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(p));
+  return _mm_loadh_pi(lo, reinterpret_cast<const __m64*>(q));
+}
+#elif defined(__ARM_NEON)
+static inline float32x4_t SampleTwo(const float* p, const float* q, float32x4_t a, float32x4_t b)
+{
+  const float32x4_t P = vld1q_f32(p);
+  const float32x4_t Q = vld1q_f32(q);
+  const float32x4_t lo = vcombine_f32(vget_low_f32(P), vget_low_f32(Q));
+  const float32x4_t hi = vcombine_f32(vget_high_f32(P), vget_high_f32(Q));
+  return vmlaq_f32(vmulq_f32(b, lo), a, hi);
+}
+
+
+static inline float32x4_t LoadTwo(const float* p, const float* q)
+{
+  return vcombine_f32(vld1_f32(p), vld1_f32(q));
+}
+#else
+static inline float TapCost(const float* l, const float* r, float a, float alpha)
+{
+  const float ri = (1.0f - a) * r[0] + a * r[2];
+  const float rg = (1.0f - a) * r[1] + a * r[3];
+  return alpha * std::fabs(l[0] - ri) + (1.0f - alpha) * std::fabs(l[1] - rg);
+}
+#endif
+
+
+// Same as L1GradientCost3x3() in patchmatch_gpu.cu: the sum of the weighted intensity and gradient
+// errors over the 4 corners and the center of a 3x3 patch. l and r are the three rows of
+// interleaved (intensity, gradient) pixels around yl, and xr must be in [1, cols - 2].
+static inline float L1GradientCost3x3(const float* const* l,
+                                      const float* const* r,
+                                      int xl,
+                                      float xr,
+                                      float alpha)
+{
+  const int x0 = static_cast<int>(xr);
+  const float a = xr - static_cast<float>(x0);
+
+  const float* l0 = l[0] + 2 * xl;
+  const float* l1 = l[1] + 2 * xl;
+  const float* l2 = l[2] + 2 * xl;
+  const float* r0 = r[0] + 2 * x0;
+  const float* r1 = r[1] + 2 * x0;
+  const float* r2 = r[2] + 2 * x0;
+
+#if defined(__SSE2__)
+  const __m128 va = _mm_set1_ps(a);
+  const __m128 vb = _mm_set1_ps(1.0f - a);
+  const __m128 sign_mask = _mm_set1_ps(-0.0f);
+
+  const __m128 top = _mm_sub_ps(LoadTwo(l0 - 2, l0 + 2), SampleTwo(r0 - 2, r0 + 2, va, vb));
+  const __m128 bottom = _mm_sub_ps(LoadTwo(l2 - 2, l2 + 2), SampleTwo(r2 - 2, r2 + 2, va, vb));
+  const __m128 center = _mm_sub_ps(LoadTwo(l1, l1), SampleTwo(r1, r1, va, vb));
+
+  // The center tap is loaded twice, so only keep one copy of it.
+  const __m128 w = _mm_setr_ps(alpha, 1.0f - alpha, alpha, 1.0f - alpha);
+  const __m128 w_center = _mm_setr_ps(alpha, 1.0f - alpha, 0.0f, 0.0f);
+  const __m128 corners = _mm_add_ps(_mm_andnot_ps(sign_mask, top), _mm_andnot_ps(sign_mask, bottom));
+  const __m128 acc = _mm_add_ps(_mm_mul_ps(w, corners), _mm_mul_ps(w_center, _mm_andnot_ps(sign_mask, center)));
+
+  alignas(16) float lanes[4];
+  _mm_store_ps(lanes, acc);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__ARM_NEON)
+  const float32x4_t va = vdupq_n_f32(a);
+  const float32x4_t vb = vdupq_n_f32(1.0f - a);
+
+  const float32x4_t top = vabdq_f32(LoadTwo(l0 - 2, l0 + 2), SampleTwo(r0 - 2, r0 + 2, va, vb));
+  const float32x4_t bottom = vabdq_f32(LoadTwo(l2 - 2, l2 + 2), SampleTwo(r2 - 2, r2 + 2, va, vb));
+  const float32x4_t center = vabdq_f32(LoadTwo(l1, l1), SampleTwo(r1, r1, va, vb));
+
+  const float w_data[4] = { alpha, 1.0f - alpha, alpha, 1.0f - alpha };
+  const float w_center_data[4] = { alpha, 1.0f - alpha, 0.0f, 0.0f };
+  const float32x4_t acc = vmlaq_f32(vmulq_f32(vld1q_f32(w_data), vaddq_f32(top, bottom)),
+                                    vld1q_f32(w_center_data), center);
+
+  return (vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1)) + (vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3));
+#else
+  return TapCost(l0 - 2, r0 - 2, a, alpha) + TapCost(l0 + 2, r0 + 2, a, alpha) +
+         TapCost(l1, r1, a, alpha) +
+         TapCost(l2 - 2, r2 - 2, a, alpha) + TapCost(l2 + 2, r2 + 2, a, alpha);
+#endif
+}
+
+
+// The right patch for disparity d (fmaxf(x - d, patch_radius) on the GPU). Also clipped on the
+// right, in case d is negative.
+static inline float MatchColumn(int x, float d, float max_xr)
+{
+  return std::min(std::max(static_cast<float>(x) - d, static_cast<float>(kPatchRadius)), max_xr);
+}
+
+
+static void GradientMagnitude(const Image1f& im, Image1f& Gx, Image1f& Gy, Image1f& Gmag)
+{
+  cv::Sobel(im, Gx, CV_32F, 1, 0, 3);
+  cv::Sobel(im, Gy, CV_32F, 0, 1, 3);
+  cv::magnitude(Gx, Gy, Gmag);
+}
+
+
+// Same as AddForegroundNoise() in patchmatch_gpu.cu: background pixels (zero disparity) stay at zero.
+static void AddForegroundNoise(Image1f& disp, const Image1f& unit_noise, float scale)
+{
+  for (int y = 0; y < disp.rows; ++y) {
+    float* d = disp.ptr<float>(y);
+    const float* n = unit_noise.ptr<float>(y);
+    for (int x = 0; x < disp.cols; ++x) {
+      d[x] = (d[x] > 0) ? std::max(d[x] + scale * n[x], 0.0f) : 0.0f;
+    }
+  }
+}
+
+
+PatchmatchCpu::PatchmatchCpu(const Params& params, const Options& options)
+    : params_(params),
+      options_(options),
+      detector_(params.detector_params),
+      matcher_(params.matcher_params),
+      pool_(static_cast<size_t>(std::max(options.num_threads - 1, 0)), "PatchmatchCpu")
+{
+  CHECK_GE(options_.num_threads, 1);
+}
+
+
+void PatchmatchCpu::Prepare(const cv::Size& size)
+{
+  if (size == size_) {
+    return;
+  }
+  size_ = size;
+
+  // Only generate the noise once per image size (same values as the GPU version).
+  unit_noise_ = Image1f(size, 0);
+  cv::RNG rng(123);
+  rng.fill(unit_noise_, cv::RNG::UNIFORM, -1, 1, true);
+
+  // NOTE(milo): The extra column on the right is only ever read with a zero interpolation weight,
+  // but it has to be there (and finite) for the 4-float loads in L1GradientCost3x3().
+  const cv::Size padded(size.width + 1, size.height);
+  for (Image2f* IG : { &IGl_, &IGr_, &IGl_flip_, &IGr_flip_ }) {
+    *IG = Image2f(padded, cv::Vec2f(0, 0));
+  }
+}
+
+
+void PatchmatchCpu::Interleave(const Image1b& im, Image2f& IG)
+{
+  im.convertTo(im_float_, CV_32FC1);
+  GradientMagnitude(im_float_, Gx_, Gy_, Gmag_);
+
+  const cv::Mat channels[2] = { im_float_, Gmag_ };
+  cv::Mat interior = IG.colRange(0, im.cols);
+  cv::merge(channels, 2, interior);
+}
+
+
+void PatchmatchCpu::ParallelBands(int n, const std::function<void(int, int)>& f)
+{
+  if (n <= 0) {
+    return;
+  }
+
+  // A few bands per thread, so that threads that finish early can take more.
+  const int num_bands = std::min(n, 4 * options_.num_threads);
+
+  pool_.ParallelFor(static_cast<size_t>(num_bands), [&](size_t i)
+  {
+    const int begin = static_cast<int>(i * n / num_bands);
+    const int end = static_cast<int>((i + 1) * n / num_bands);
+    f(begin, end);
+  });
+}
+
+
+void PatchmatchCpu::Match(const Image1b& iml,
+                          const Image1b& imr,
+                          Image1f& disp,
+                          Image1f& dispr)
+{
+  CHECK_EQ(iml.size(), imr.size());
+  CHECK(iml.rows > 2 * kPatchRadius && iml.cols > 2 * kPatchRadius) << "Image is too small" << std::endl;
+
+  disp = SparseInit(iml, imr, params_.init_dilate_factor);
+
+  // Run the same thing on the mirrored images to get the right disparity.
+  cv::flip(iml, iml_flip_, 1);
+  cv::flip(imr, imr_flip_, 1);
+  dispr_flip_ = SparseInit(imr_flip_, iml_flip_, params_.init_dilate_factor);
+
+  Refine(iml, imr, 0, disp, dispr);
+
+  disp.copyTo(prev_disp_);
+  dispr.copyTo(prev_dispr_);
+  frames_since_full_match_ = 0;
+}
+
+
+void PatchmatchCpu::Match(const Image1b& iml,
+                          const Image1b& imr,
+                          const StereoCamera& stereo_rig,
+                          const Matrix4d& prev_T_cur,
+                          Image1f& disp,
+                          Image1f& dispr)
+{
+  CHECK_EQ(iml.size(), imr.size());
+
+  if (prev_disp_.size() != iml.size() || frames_since_full_match_ >= options_.temporal_max_frames) {
+    Match(iml, imr, disp, dispr);
+    return;
+  }
+
+  const StereoCamera rig = (stereo_rig.Height() == iml.rows && stereo_rig.Width() == iml.cols) ?
+      stereo_rig : StereoCamera(stereo_rig.LeftCamera().Rescale(iml.rows, iml.cols), stereo_rig.Baseline());
+
+  // The right camera is the left one moved by the baseline along x, so it moves by the same amount
+  // in its own frame.
+  Matrix4d T_left_right = Matrix4d::Identity();
+  T_left_right(0, 3) = rig.Baseline();
+  const Matrix4d prevr_T_curr = T_left_right.inverse() * prev_T_cur * T_left_right;
+
+  WarpDisparity(prev_disp_, rig, prev_T_cur, disp);
+  WarpDisparity(prev_dispr_, rig, prevr_T_curr, dispr_warped_);
+
+  // Too much of the scene is new (fast motion), so it's faster to start over.
+  const double max_holes = options_.temporal_max_hole_fraction * static_cast<double>(disp.total());
+  if (cv::countNonZero(disp < 0) > max_holes || cv::countNonZero(dispr_warped_ < 0) > max_holes) {
+    Match(iml, imr, disp, dispr);
+    return;
+  }
+
+  cv::flip(iml, iml_flip_, 1);
+  cv::flip(imr, imr_flip_, 1);
+  cv::flip(dispr_warped_, dispr_flip_, 1);
+
+  FillHoles(iml, imr, disp);
+  FillHoles(imr_flip_, iml_flip_, dispr_flip_);
+
+  Refine(iml, imr, std::max(0, params_.patchmatch_iters - options_.temporal_patchmatch_iters), disp, dispr);
+
+  disp.copyTo(prev_disp_);
+  dispr.copyTo(prev_dispr_);
+  ++frames_since_full_match_;
+}
+
+
+void PatchmatchCpu::Refine(const Image1b& iml,
+                           const Image1b& imr,
+                           int first_iter,
+                           Image1f& disp,
+                           Image1f& dispr)
+{
+  Prepare(iml.size());
+  Interleave(iml, IGl_);
+  Interleave(imr, IGr_);
+
+  Match(IGl_, IGr_, disp, first_iter);
+
+  cv::Mat IGl_flip = IGl_flip_.colRange(0, iml.cols);
+  cv::Mat IGr_flip = IGr_flip_.colRange(0, iml.cols);
+  cv::flip(IGl_.colRange(0, iml.cols), IGl_flip, 1);
+  cv::flip(IGr_.colRange(0, iml.cols), IGr_flip, 1);
+
+  Match(IGr_flip_, IGl_flip_, dispr_flip_, first_iter);
+  cv::flip(dispr_flip_, dispr, 1);
+
+  MaskOcclusions(disp, dispr);
+}
+
+
+void PatchmatchCpu::FillHoles(const Image1b& iml, const Image1b& imr, Image1f& disp)
+{
+  const Image1b holes = (disp < 0);
+  const int num_holes = cv::countNonZero(holes);
+
+  if (num_holes > options_.temporal_min_hole_fraction * static_cast<double>(disp.total())) {
+    VecPoint2f left_kp;
+    detector_.Detect(iml, VecPoint2f(), left_kp);
+
+    // Only match the keypoints that are in the holes, which is usually a small fraction of them.
+    VecPoint2f hole_kp;
+    for (const cv::Point2f& kp : left_kp) {
+      if (holes(static_cast<int>(std::round(kp.y)), static_cast<int>(std::round(kp.x)))) {
+        hole_kp.emplace_back(kp);
+      }
+    }
+
+    const Image1f sparse = DilatedSparseDisparity(iml, imr, hole_kp, params_.init_dilate_factor);
+    sparse.copyTo(disp, holes);
+  }
+
+  // Anything left is background.
+  disp.setTo(0, disp < 0);
+}
+
+
+void PatchmatchCpu::Match(const Image2f& IGl,
+                          const Image2f& IGr,
+                          Image1f& disp,
+                          int first_iter)
+{
+  CHECK_EQ(IGl.size(), IGr.size());
+  CHECK_EQ(IGl.rows, disp.rows);
+  CHECK_EQ(IGl.cols, disp.cols + 1);
+  CHECK_EQ(IGl.size(), unit_noise_.size() + cv::Size(1, 0)) << "Call Match() with the 8-bit images first" << std::endl;
+  CHECK_GE(first_iter, 0);
+
+  for (int iter = first_iter; iter < params_.patchmatch_iters; ++iter) {
+    AddForegroundNoise(disp, unit_noise_, 32.0f / std::pow(2.0f, static_cast<float>(iter)));
+    PropagateRows(IGl, IGr, disp, 1);
+    PropagateCols(IGl, IGr, disp, 1);
+    PropagateRows(IGl, IGr, disp, -1);
+    PropagateCols(IGl, IGr, disp, -1);
+  }
+
+  MaskBackground(IGl, IGr, disp);
+}
+
+
+void PatchmatchCpu::PropagateRows(const Image2f& IGl, const Image2f& IGr, Image1f& disp, int direction)
+{
+  CHECK(direction == 1 || direction == -1);
+
+  const float alpha = params_.cost_alpha;
+  const int r = kPatchRadius;
+  const float max_xr = static_cast<float>(disp.cols - 1 - r);
+
+  // Same range as the GPU kernel: the first pixel of each sweep is compared with its neighbor in the
+  // border (which is never updated itself), and the last pixel with a full patch is skipped, so it's
+  // only updated by the sweep in the other direction.
+  const int start = (direction > 0) ? r : (disp.cols - r - 1);
+  const int end = (direction > 0) ? (disp.cols - r - 1) : r;
+
+  // Rows don't depend on each other.
+  ParallelBands(disp.rows - 2 * r, [&](int begin, int band_end)
+  {
+    for (int y = r + begin; y < (r + band_end); ++y) {
+      const float* l[3] = { IGl.ptr<float>(y - 1), IGl.ptr<float>(y), IGl.ptr<float>(y + 1) };
+      const float* rr[3] = { IGr.ptr<float>(y - 1), IGr.ptr<float>(y), IGr.ptr<float>(y + 1) };
+      float* d = disp.ptr<float>(y);
+
+      for (int x = start; (direction > 0) ? (x < end) : (x > end); x += direction) {
+        const float d0 = d[x];
+        const float d1 = d[x - direction];
+
+        const float cost0 = L1GradientCost3x3(l, rr, x, MatchColumn(x, d0, max_xr), alpha);
+        const float cost1 = L1GradientCost3x3(l, rr, x, MatchColumn(x, d1, max_xr), alpha);
+
+        // If using the neighboring disp improves cost, use it (and clip to valid range).
+        if (cost1 < cost0) {
+          d[x] = std::min(d1, static_cast<float>(x - r));
+        }
+      }
+    }
+  });
+}
+
+
+void PatchmatchCpu::PropagateCols(const Image2f& IGl, const Image2f& IGr, Image1f& disp, int direction)
+{
+  CHECK(direction == 1 || direction == -1);
+
+  const float alpha = params_.cost_alpha;
+  const int r = kPatchRadius;
+  const float max_xr = static_cast<float>(disp.cols - 1 - r);
+
+  const int start = (direction > 0) ? r : (disp.rows - r - 1);
+  const int end = (direction > 0) ? (disp.rows - r - 1) : r;
+
+  // Columns don't depend on each other. Each thread sweeps a band of columns together, one row at a
+  // time, so that memory is still read along rows.
+  ParallelBands(disp.cols - 2 * r, [&](int begin, int band_end)
+  {
+    for (int y = start; (direction > 0) ? (y < end) : (y > end); y += direction) {
+      const float* l[3] = { IGl.ptr<float>(y - 1), IGl.ptr<float>(y), IGl.ptr<float>(y + 1) };
+      const float* rr[3] = { IGr.ptr<float>(y - 1), IGr.ptr<float>(y), IGr.ptr<float>(y + 1) };
+      float* d = disp.ptr<float>(y);
+      const float* d_prev = disp.ptr<float>(y - direction);
+
+      for (int x = r + begin; x < (r + band_end); ++x) {
+        const float d0 = d[x];
+        const float d1 = d_prev[x];
+
+        const float cost0 = L1GradientCost3x3(l, rr, x, MatchColumn(x, d0, max_xr), alpha);
+        const float cost1 = L1GradientCost3x3(l, rr, x, MatchColumn(x, d1, max_xr), alpha);
+
+        if (cost1 < cost0) {
+          d[x] = std::min(d1, static_cast<float>(x - r));
+        }
+      }
+    }
+  });
+}
+
+
+void PatchmatchCpu::MaskBackground(const Image2f& IGl, const Image2f& IGr, Image1f& disp)
+{
+  const float alpha = params_.cost_alpha;
+  const float improve_factor = params_.cost_improve_factor;
+  const int r = kPatchRadius;
+  const float max_xr = static_cast<float>(disp.cols - 1 - r);
+
+  ParallelBands(disp.rows - 2 * r, [&](int begin, int band_end)
+  {
+    for (int y = r + begin; y < (r + band_end); ++y) {
+      const float* l[3] = { IGl.ptr<float>(y - 1), IGl.ptr<float>(y), IGl.ptr<float>(y + 1) };
+      const float* rr[3] = { IGr.ptr<float>(y - 1), IGr.ptr<float>(y), IGr.ptr<float>(y + 1) };
+      float* d = disp.ptr<float>(y);
+
+      for (int x = r; x < (disp.cols - r); ++x) {
+        const float cost0 = L1GradientCost3x3(l, rr, x, static_cast<float>(x), alpha);
+        const float cost1 = L1GradientCost3x3(l, rr, x, MatchColumn(x, d[x], max_xr), alpha);
+
+        // If the estimated disparity does not improve cost by more than improve_factor, mark as background.
+        if (!(cost1 < improve_factor * cost0)) {
+          d[x] = 0;
+        }
+      }
+    }
+  });
+}
+
+
+void PatchmatchCpu::MaskOcclusions(Image1f& displ, const Image1f& dispr)
+{
+  CHECK_EQ(displ.size(), dispr.size());
+
+  for (int y = 0; y < displ.rows; ++y) {
+    float* dl = displ.ptr<float>(y);
+    const float* dr = dispr.ptr<float>(y);
+
+    for (int x = 0; x < displ.cols; ++x) {
+      const float xr = std::max(static_cast<float>(x) - dl[x], 0.0f);
+      const float d = dr[std::min(static_cast<int>(xr), displ.cols - 1)];
+
+      // If a pixel has higher disparity in the right image, it is occluded in the left.
+      if (d > 1.4f * dl[x] || d < 0.7f * dl[x]) {
+        dl[x] = 0;
+      }
+    }
+  }
+}
+
+
+Image1f PatchmatchCpu::SparseInit(const Image1b& iml,
+                                  const Image1b& imr,
+                                  int dilate_factor)
+{
+  VecPoint2f left_kp;
+  detector_.Detect(iml, VecPoint2f(), left_kp);
+
+  return DilatedSparseDisparity(iml, imr, left_kp, dilate_factor);
+}
+
+
+Image1f PatchmatchCpu::DilatedSparseDisparity(const Image1b& iml,
+                                              const Image1b& imr,
+                                              const VecPoint2f& left_kp,
+                                              int dilate_factor)
+{
+  // Default to zero disparity (background).
+  Image1f disps(iml.size(), 0.0f);
+
+  if (left_kp.empty()) {
+    return disps;
+  }
+
+  const std::vector<double>& left_kp_disps = matcher_.MatchRectified(iml, imr, left_kp);
+
+  // Fill in disparity for sparse keypoints.
+  for (size_t i = 0; i < left_kp_disps.size(); ++i) {
+    const cv::Point2f& kp = left_kp.at(i);
+    const float d = (float)left_kp_disps.at(i);
+
+    // Skip negative disparity (invalid).
+    if (d >= 0) {
+      disps.at<float>(std::round(kp.y), std::round(kp.x)) = (float)d;
+    }
+  }
+
+  const int dilate_size = (int)std::pow(2, dilate_factor) + 1;
+  cv::Mat element = cv::getStructuringElement(
+      cv::MORPH_RECT, cv::Size(2*dilate_size+1, 2*dilate_size+1), cv::Point(dilate_size, dilate_size));
+  cv::dilate(disps, disps, element);
+
+  return disps;
+}
+
+
+}
+}
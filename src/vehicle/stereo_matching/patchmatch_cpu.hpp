@@ -0,0 +1,150 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include "core/eigen_types.hpp"
+#include "core/macros.hpp"
+#include "core/thread_pool.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/stereo_camera.hpp"
+
+#include "feature_tracking/feature_detector.hpp"
+#include "feature_tracking/stereo_matcher.hpp"
+#include "stereo_matching/disparity_warp.hpp"
+#include "stereo_matching/patchmatch_params.hpp"
+
+namespace bm {
+namespace stereo {
+
+using namespace core;
+
+
+// Settings of PatchmatchCpu that PatchmatchGpu doesn't have. These are passed to the constructor
+// separately, so that PatchmatchCpu::Params is exactly PatchmatchGpu::Params.
+struct PatchmatchCpuOptions final {
+  int num_threads = 4;  // Including the calling thread.
+
+  // Warm start (the Match() call with a pose): the previous disparity is warped into the current
+  // frame, and only the last temporal_patchmatch_iters iterations (with the least noise) are run.
+  // Every temporal_max_frames frames, or if more than temporal_max_hole_fraction of the warped
+  // disparity is missing, it falls back to a full Match(). Otherwise, if more than
+  // temporal_min_hole_fraction is missing, a sparse init fills in the holes.
+  int temporal_patchmatch_iters = 1;
+  int temporal_max_frames = 10;
+  float temporal_max_hole_fraction = 0.3;
+  float temporal_min_hole_fraction = 0.01;
+};
+
+
+// CPU port of pm::PatchmatchGpu (patchmatch_gpu/patchmatch_gpu.cu), for machines without CUDA. It
+// runs the same steps: sparse init, row/column propagation with the 3x3 "X" intensity + gradient
+// cost, MaskBackground() and then MaskOcclusions() against the right disparity.
+//
+// NOTE(milo): The GPU kernels split each row (column) into 16 overlapping chunks to keep all of the
+// CUDA threads busy. Here each row (column) is swept from end to end, and rows (columns) are split
+// across threads instead. So results are very close to the GPU version, but not bit-exact.
+class PatchmatchCpu final {
+ public:
+  // Same type as PatchmatchGpu::Params, so that the two backends can't be tuned differently.
+  typedef PatchmatchParams Params;
+  typedef PatchmatchCpuOptions Options;
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(PatchmatchCpu);
+
+  PatchmatchCpu(const Params& params, const Options& options = Options());
+
+ public:
+  // Same as PatchmatchGpu::Match(). Outputs the left disparity (with occlusions masked out) and the
+  // right disparity.
+  void Match(const Image1b& iml,
+             const Image1b& imr,
+             Image1f& disp,
+             Image1f& dispr);
+
+  // Same as above, but starts from the disparities of the previous call (see the temporal params).
+  // prev_T_cur is the pose of the current left camera in the previous one's frame, e.g from
+  // VoResult::lkf_T_cam of two frames with the same keyframe (lkf_T_prev.inverse() * lkf_T_cur), or
+  // from two StateEkf poses. stereo_rig is rescaled if the images are downsampled.
+  void Match(const Image1b& iml,
+             const Image1b& imr,
+             const StereoCamera& stereo_rig,
+             const Matrix4d& prev_T_cur,
+             Image1f& disp,
+             Image1f& dispr);
+
+  // The next Match() with a pose will do a full match (e.g after tracking was lost).
+  void ResetWarmStart() { frames_since_full_match_ = options_.temporal_max_frames; }
+
+  // Propagation and background masking on interleaved (intensity, gradient) images, which have one
+  // extra (zero) column on the right (see Prepare()). Runs iterations [first_iter, patchmatch_iters),
+  // where the noise shrinks with each iteration.
+  void Match(const Image2f& IGl,
+             const Image2f& IGr,
+             Image1f& disp,
+             int first_iter = 0);
+
+  Image1f SparseInit(const Image1b& iml,
+                     const Image1b& imr,
+                     int dilate_factor);
+
+ private:
+  // (Re)allocates the workspaces below if the image size changed.
+  void Prepare(const cv::Size& size);
+
+  // Refines disp and dispr_flip_ (the initial right disparity, mirrored), starting at first_iter. The
+  // mirrored images have to be in iml_flip_ and imr_flip_.
+  void Refine(const Image1b& iml,
+              const Image1b& imr,
+              int first_iter,
+              Image1f& disp,
+              Image1f& dispr);
+
+  // Sparse disparities at the keypoints, dilated (as in SparseInit()).
+  Image1f DilatedSparseDisparity(const Image1b& iml,
+                                 const Image1b& imr,
+                                 const VecPoint2f& left_kp,
+                                 int dilate_factor);
+
+  // Fills the negative disparities in a warped disparity map, with a sparse init if there are enough
+  // of them, or with zero (background).
+  void FillHoles(const Image1b& iml, const Image1b& imr, Image1f& disp);
+
+  // Converts an image to float, and interleaves it with its gradient magnitude into IG.
+  void Interleave(const Image1b& im, Image2f& IG);
+
+  void PropagateRows(const Image2f& IGl, const Image2f& IGr, Image1f& disp, int direction);
+  void PropagateCols(const Image2f& IGl, const Image2f& IGr, Image1f& disp, int direction);
+  void MaskBackground(const Image2f& IGl, const Image2f& IGr, Image1f& disp);
+  void MaskOcclusions(Image1f& displ, const Image1f& dispr);
+
+  // Splits [0, n) into bands, and runs f(begin, end) on each one with the thread pool.
+  void ParallelBands(int n, const std::function<void(int, int)>& f);
+
+ private:
+  Params params_;
+  Options options_;
+
+  ft::FeatureDetector detector_;
+  ft::StereoMatcher matcher_;
+
+  ThreadPool pool_;
+
+  // Pre-allocate these to save on allocation time.
+  cv::Size size_;
+  Image1f unit_noise_;
+  Image1f im_float_, Gx_, Gy_, Gmag_;
+  Image2f IGl_, IGr_, IGl_flip_, IGr_flip_;
+  Image1b iml_flip_, imr_flip_;
+  Image1f dispr_flip_;
+
+  // Outputs of the last Match(), for warm starts.
+  Image1f prev_disp_, prev_dispr_, dispr_warped_;
+  int frames_since_full_match_ = 0;
+};
+
+
+}
+}
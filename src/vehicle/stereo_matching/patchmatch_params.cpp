@@ -0,0 +1,15 @@
+#include "stereo_matching/patchmatch_params.hpp"
+
+namespace bm {
+namespace stereo {
+
+
+void PatchmatchParams::LoadParams(const YamlParser& p)
+{
+  detector_params = ft::FeatureDetector::Params(p.Subtree("FeatureDetector"));
+  matcher_params = ft::StereoMatcher::Params(p.Subtree("StereoMatcher"));
+}
+
+
+}
+}
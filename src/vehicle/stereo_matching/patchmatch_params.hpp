@@ -0,0 +1,36 @@
+#pragma once
+
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+
+#include "feature_tracking/feature_detector.hpp"
+#include "feature_tracking/stereo_matcher.hpp"
+
+namespace bm {
+namespace stereo {
+
+using namespace core;
+
+
+// Settings of the Patchmatch algorithm, used as the Params of both pm::PatchmatchGpu and
+// PatchmatchCpu (which takes its CPU-only settings separately). It doesn't depend on CUDA, so that the
+// CPU version can be built without it.
+struct PatchmatchParams final : public ParamsBase {
+  MACRO_PARAMS_STRUCT_CONSTRUCTORS(PatchmatchParams);
+
+  ft::FeatureDetector::Params detector_params;
+  ft::StereoMatcher::Params matcher_params;
+
+  float cost_alpha = 0.9;
+  int patchmatch_iters = 3;
+  int init_dilate_factor = 4;
+  float cost_improve_factor = 0.8;
+
+ private:
+  void LoadParams(const YamlParser& p) override;
+};
+
+
+}
+}
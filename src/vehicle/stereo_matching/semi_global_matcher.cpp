@@ -0,0 +1,540 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <glog/logging.h>
+
+#include "stereo_matching/semi_global_matcher.hpp"
+
+namespace bm {
+namespace stereo {
+
+
+constexpr float SemiGlobalMatcher::kInvalidDisparity;
+
+// 9x7 census window (62 bits, without the center pixel).
+static const int kCensusRadiusX = 4;
+static const int kCensusRadiusY = 3;
+
+// Cost of matching with a pixel that's outside of the right image (worse than any census distance).
+static const uint8_t kOutsideCost = 64;
+
+static const uint16_t kMaxPathCost = std::numeric_limits<uint16_t>::max();
+
+// Directions of the forward paths (dx, dy), so the previous pixel on the path is (x + dx, y + dy).
+// The backward paths go the opposite way.
+static const int kPathDx[4] = { -1, -1, 0, 1 };
+static const int kPathDy[4] = { 0, -1, -1, -1 };
+
+// Which of the directions above to use, for 8 and 4 paths (only horizontal and vertical).
+static const int kDirections8[4] = { 0, 1, 2, 3 };
+static const int kDirections4[2] = { 0, 2 };
+
+
+void SemiGlobalMatcher::Params::LoadParams(const YamlParser& p)
+{
+  p.GetParam("max_disp", &max_disp);
+  p.GetParam("num_paths", &num_paths);
+  p.GetParam("p1", &p1);
+  p.GetParam("p2", &p2);
+  p.GetParam("lr_max_diff", &lr_max_diff);
+  p.GetParam("subpixel", &subpixel);
+  p.GetParam("region_size", &region_size);
+  p.GetParam("region_margin", &region_margin);
+}
+
+
+static void CensusTransform(const Image1b& im, std::vector<uint64_t>& census)
+{
+  std::fill(census.begin(), census.end(), 0);
+
+  for (int y = kCensusRadiusY; y < (im.rows - kCensusRadiusY); ++y) {
+    const uint8_t* center = im.ptr<uint8_t>(y);
+    uint64_t* out = census.data() + y * im.cols;
+
+    for (int x = kCensusRadiusX; x < (im.cols - kCensusRadiusX); ++x) {
+      uint64_t bits = 0;
+      for (int dy = -kCensusRadiusY; dy <= kCensusRadiusY; ++dy) {
+        const uint8_t* row = im.ptr<uint8_t>(y + dy);
+        for (int dx = -kCensusRadiusX; dx <= kCensusRadiusX; ++dx) {
+          if (dy != 0 || dx != 0) {
+            bits = (bits << 1) | (row[x + dx] < center[x] ? 1 : 0);
+          }
+        }
+      }
+      out[x] = bits;
+    }
+  }
+}
+
+
+static inline uint16_t AddSaturate(uint16_t a, int b)
+{
+  return static_cast<uint16_t>(std::min(static_cast<int>(a) + b, static_cast<int>(kMaxPathCost)));
+}
+
+
+// One step along a path, for w disparities (a multiple of 16):
+// Lp(d) = C(d) + min(Lq(d), Lq(d - 1) + p1, Lq(d + 1) + p1, min(Lq) + p2) - min(Lq)
+// Lq is the previous pixel on the path, and Lq[-1] and Lq[w] must be readable (saturated). The new
+// path costs are written to Lp, and added to S (or assigned, if first). Returns min(Lp).
+static inline uint16_t AggregateStep(const uint8_t* C,
+                                     const uint16_t* Lq,
+                                     uint16_t minq,
+                                     int w,
+                                     int p1,
+                                     int p2,
+                                     uint16_t* Lp,
+                                     uint16_t* S,
+                                     bool first)
+{
+#if defined(__AVX2__)
+  const __m256i vp1 = _mm256_set1_epi16(static_cast<short>(p1));
+  const __m256i vminq = _mm256_set1_epi16(static_cast<short>(minq));
+  const __m256i vminq_p2 = _mm256_set1_epi16(static_cast<short>(AddSaturate(minq, p2)));
+  __m256i vmin = _mm256_set1_epi16(static_cast<short>(kMaxPathCost));
+
+  for (int i = 0; i < w; i += 16) {
+    const __m256i same = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Lq + i));
+    const __m256i prev = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Lq + i - 1));
+    const __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Lq + i + 1));
+
+    const __m256i neighbors = _mm256_adds_epu16(_mm256_min_epu16(prev, next), vp1);
+    const __m256i best = _mm256_min_epu16(_mm256_min_epu16(same, neighbors), vminq_p2);
+
+    const __m256i cost = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(C + i)));
+    const __m256i L = _mm256_adds_epu16(cost, _mm256_subs_epu16(best, vminq));
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(Lp + i), L);
+    vmin = _mm256_min_epu16(vmin, L);
+
+    __m256i* s = reinterpret_cast<__m256i*>(S + i);
+    _mm256_storeu_si256(s, first ? L : _mm256_adds_epu16(_mm256_loadu_si256(s), L));
+  }
+
+  const __m128i vmin8 = _mm_min_epu16(_mm256_castsi256_si128(vmin), _mm256_extracti128_si256(vmin, 1));
+  return static_cast<uint16_t>(_mm_cvtsi128_si32(_mm_minpos_epu16(vmin8)) & 0xFFFF);
+#elif defined(__ARM_NEON)
+  const uint16x8_t vp1 = vdupq_n_u16(static_cast<uint16_t>(p1));
+  const uint16x8_t vminq = vdupq_n_u16(minq);
+  const uint16x8_t vminq_p2 = vdupq_n_u16(AddSaturate(minq, p2));
+  uint16x8_t vmin = vdupq_n_u16(kMaxPathCost);
+
+  for (int i = 0; i < w; i += 8) {
+    const uint16x8_t same = vld1q_u16(Lq + i);
+    const uint16x8_t prev = vld1q_u16(Lq + i - 1);
+    const uint16x8_t next = vld1q_u16(Lq + i + 1);
+
+    const uint16x8_t neighbors = vqaddq_u16(vminq_u16(prev, next), vp1);
+    const uint16x8_t best = vminq_u16(vminq_u16(same, neighbors), vminq_p2);
+
+    const uint16x8_t L = vqaddq_u16(vmovl_u8(vld1_u8(C + i)), vqsubq_u16(best, vminq));
+
+    vst1q_u16(Lp + i, L);
+    vmin = vminq_u16(vmin, L);
+    vst1q_u16(S + i, first ? L : vqaddq_u16(vld1q_u16(S + i), L));
+  }
+
+  uint16_t lanes[8];
+  vst1q_u16(lanes, vmin);
+  return *std::min_element(lanes, lanes + 8);
+#else
+  const uint16_t minq_p2 = AddSaturate(minq, p2);
+  uint16_t min_L = kMaxPathCost;
+
+  for (int i = 0; i < w; ++i) {
+    const uint16_t neighbors = AddSaturate(std::min(Lq[i - 1], Lq[i + 1]), p1);
+    const uint16_t best = std::min(std::min(Lq[i], neighbors), minq_p2);
+    const uint16_t L = AddSaturate(best - minq, C[i]);
+
+    Lp[i] = L;
+    min_L = std::min(min_L, L);
+    S[i] = first ? L : AddSaturate(S[i], L);
+  }
+
+  return min_L;
+#endif
+}
+
+
+// Index of the first minimum of S[0, w), where w is a multiple of 16.
+static inline int Argmin(const uint16_t* S, int w)
+{
+#if defined(__AVX2__)
+  // NOTE(milo): minpos finds the minimum of 8 values (and its index) in one instruction.
+  int best = 0;
+  int best_cost = kMaxPathCost + 1;
+  for (int i = 0; i < w; i += 8) {
+    const int minpos = _mm_cvtsi128_si32(_mm_minpos_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(S + i))));
+    const int cost = minpos & 0xFFFF;
+    if (cost < best_cost) {
+      best_cost = cost;
+      best = i + (minpos >> 16);
+    }
+  }
+  return best;
+#else
+  return static_cast<int>(std::min_element(S, S + w) - S);
+#endif
+}
+
+
+// For the pixel at x (= xr0 + lo) in the left image, the cost of disparity lo + i is a match for
+// xr0 - i in the right image. Keeps the lowest cost (and its disparity) for each right pixel.
+static inline void UpdateRightBest(const uint16_t* S,
+                                   int xr0,
+                                   int lo,
+                                   int w,
+                                   uint16_t* right_cost,
+                                   uint16_t* right_disp)
+{
+  int i = 0;
+
+#if defined(__AVX2__)
+  // Chunks of 16 disparities match 16 consecutive right pixels, in reverse order.
+  const __m256i reverse_bytes = _mm256_setr_epi8(
+      14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1,
+      14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+  const __m256i ramp = _mm256_setr_epi16(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+
+  for (; (i + 16) <= w && (xr0 - i - 15) >= 0; i += 16) {
+    const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(S + i));
+    const __m256i s_rev = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(s, reverse_bytes), 0x4E);
+
+    __m256i* cost = reinterpret_cast<__m256i*>(right_cost + xr0 - i - 15);
+    __m256i* disp = reinterpret_cast<__m256i*>(right_disp + xr0 - i - 15);
+    const __m256i c = _mm256_loadu_si256(cost);
+
+    // s_rev < c, for unsigned values.
+    const __m256i better = _mm256_andnot_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(s_rev, c), s_rev),
+                                               _mm256_set1_epi16(-1));
+    const __m256i d = _mm256_add_epi16(ramp, _mm256_set1_epi16(static_cast<short>(lo + i)));
+
+    _mm256_storeu_si256(cost, _mm256_min_epu16(s_rev, c));
+    _mm256_storeu_si256(disp, _mm256_blendv_epi8(_mm256_loadu_si256(disp), d, better));
+  }
+#endif
+
+  for (; i < w && (xr0 - i) >= 0; ++i) {
+    const int xr = xr0 - i;
+    if (S[i] < right_cost[xr]) {
+      right_cost[xr] = S[i];
+      right_disp[xr] = static_cast<uint16_t>(lo + i);
+    }
+  }
+}
+
+
+// Smallest multiple of 16 that's >= n.
+static int RoundUp16(int n)
+{
+  return (n + 15) & ~15;
+}
+
+
+SemiGlobalMatcher::SemiGlobalMatcher(const Params& params)
+    : params_(params)
+{
+  CHECK(params_.max_disp > 0 && (params_.max_disp % 16) == 0) << "max_disp must be a multiple of 16" << std::endl;
+  CHECK(params_.num_paths == 8 || params_.num_paths == 4) << "num_paths must be 8 or 4" << std::endl;
+  CHECK_GE(params_.p1, 0);
+  CHECK_GE(params_.p2, params_.p1);
+  CHECK_GT(params_.region_size, 0);
+  CHECK_GE(params_.region_margin, 0);
+}
+
+
+void SemiGlobalMatcher::Prepare(int rows, int cols)
+{
+  if (rows == rows_ && cols == cols_) {
+    return;
+  }
+  rows_ = rows;
+  cols_ = cols;
+
+  const size_t num_pixels = static_cast<size_t>(rows) * static_cast<size_t>(cols);
+  census_l_.resize(num_pixels);
+  census_r_.resize(num_pixels);
+  pixel_offset_.resize(num_pixels);
+
+  region_rows_ = (rows + params_.region_size - 1) / params_.region_size;
+  region_cols_ = (cols + params_.region_size - 1) / params_.region_size;
+  region_lo_.resize(region_rows_ * region_cols_);
+  region_width_.resize(region_rows_ * region_cols_);
+  region_min_.resize(region_rows_ * region_cols_);
+  region_max_.resize(region_rows_ * region_cols_);
+
+  // Enough for the full disparity range everywhere, so these never have to grow.
+  costs_.resize(num_pixels * params_.max_disp);
+  aggregated_.resize(num_pixels * params_.max_disp);
+
+  const size_t stride = params_.max_disp + 2;
+  for (int b = 0; b < 2; ++b) {
+    path_costs_[b].resize(4 * cols * stride);
+    path_mins_[b].resize(4 * cols);
+  }
+  shifted_.resize(stride);
+  path_start_.assign(stride, 0);
+
+  left_best_disp_.resize(cols);
+  right_best_cost_.resize(cols);
+  right_best_disp_.resize(cols);
+}
+
+
+void SemiGlobalMatcher::Compute(const Image1b& iml,
+                                const Image1b& imr,
+                                const DisparityRange& range,
+                                Image1f& disp)
+{
+  Prepare(iml.rows, iml.cols);
+
+  const int min_disp = std::max(0, std::min(range.min_disp, params_.max_disp - 1));
+  const int max_disp = std::max(min_disp + 1, std::min(range.max_disp, params_.max_disp));
+  const int width = std::min(RoundUp16(max_disp - min_disp), params_.max_disp);
+
+  std::fill(region_lo_.begin(), region_lo_.end(), std::min(min_disp, params_.max_disp - width));
+  std::fill(region_width_.begin(), region_width_.end(), width);
+
+  ComputeWithWindows(iml, imr, disp);
+}
+
+
+void SemiGlobalMatcher::Compute(const Image1b& iml,
+                                const Image1b& imr,
+                                const VecLandmarkObservation& sparse,
+                                Image1f& disp)
+{
+  Prepare(iml.rows, iml.cols);
+
+  const float no_disp_min = std::numeric_limits<float>::max();
+  const float no_disp_max = -1.0f;
+
+  // Range of sparse disparities in each region, and in the whole image.
+  std::fill(region_min_.begin(), region_min_.end(), no_disp_min);
+  std::fill(region_max_.begin(), region_max_.end(), no_disp_max);
+  float all_min = no_disp_min;
+  float all_max = no_disp_max;
+
+  for (const LandmarkObservation& obs : sparse) {
+    const int x = static_cast<int>(std::round(obs.pixel_location.x));
+    const int y = static_cast<int>(std::round(obs.pixel_location.y));
+    if (obs.disparity < 0 || x < 0 || y < 0 || x >= cols_ || y >= rows_) {
+      continue;
+    }
+    const float d = static_cast<float>(obs.disparity);
+    const int r = RegionIndex(y, x);
+    region_min_.at(r) = std::min(region_min_.at(r), d);
+    region_max_.at(r) = std::max(region_max_.at(r), d);
+    all_min = std::min(all_min, d);
+    all_max = std::max(all_max, d);
+  }
+
+  for (int ry = 0; ry < region_rows_; ++ry) {
+    for (int rx = 0; rx < region_cols_; ++rx) {
+      float lo = no_disp_min;
+      float hi = no_disp_max;
+
+      // Include the neighboring regions, since a surface can continue past the edge of a region.
+      for (int ny = std::max(0, ry - 1); ny <= std::min(region_rows_ - 1, ry + 1); ++ny) {
+        for (int nx = std::max(0, rx - 1); nx <= std::min(region_cols_ - 1, rx + 1); ++nx) {
+          lo = std::min(lo, region_min_.at(ny * region_cols_ + nx));
+          hi = std::max(hi, region_max_.at(ny * region_cols_ + nx));
+        }
+      }
+
+      if (hi < lo) {
+        lo = all_min;
+        hi = all_max;
+      }
+
+      int min_disp = 0;
+      int max_disp = params_.max_disp;
+      if (hi >= lo) {
+        min_disp = std::max(0, static_cast<int>(std::floor(lo)) - params_.region_margin);
+        max_disp = std::min(params_.max_disp, static_cast<int>(std::ceil(hi)) + params_.region_margin + 1);
+        min_disp = std::min(min_disp, params_.max_disp - 1);
+        max_disp = std::max(max_disp, min_disp + 1);
+      }
+
+      const int width = std::min(RoundUp16(max_disp - min_disp), params_.max_disp);
+      region_lo_.at(ry * region_cols_ + rx) = std::min(min_disp, params_.max_disp - width);
+      region_width_.at(ry * region_cols_ + rx) = width;
+    }
+  }
+
+  ComputeWithWindows(iml, imr, disp);
+}
+
+
+void SemiGlobalMatcher::ComputeWithWindows(const Image1b& iml, const Image1b& imr, Image1f& disp)
+{
+  CHECK_EQ(iml.rows, imr.rows);
+  CHECK_EQ(iml.cols, imr.cols);
+
+  size_t offset = 0;
+  for (int y = 0; y < rows_; ++y) {
+    for (int x = 0; x < cols_; ++x) {
+      pixel_offset_[y * cols_ + x] = offset;
+      offset += region_width_[RegionIndex(y, x)];
+    }
+  }
+  volume_size_ = offset;
+
+  CensusTransform(iml, census_l_);
+  CensusTransform(imr, census_r_);
+
+  ComputeCosts();
+  AggregatePaths(true);
+  AggregatePaths(false);
+  SelectDisparities(disp);
+}
+
+
+void SemiGlobalMatcher::ComputeCosts()
+{
+  for (int y = 0; y < rows_; ++y) {
+    const uint64_t* cl = census_l_.data() + y * cols_;
+    const uint64_t* cr = census_r_.data() + y * cols_;
+
+    for (int x = 0; x < cols_; ++x) {
+      const int r = RegionIndex(y, x);
+      const int lo = region_lo_[r];
+      const int w = region_width_[r];
+      uint8_t* C = costs_.data() + pixel_offset_[y * cols_ + x];
+
+      for (int i = 0; i < w; ++i) {
+        const int xr = x - lo - i;
+        C[i] = (xr >= 0) ? static_cast<uint8_t>(__builtin_popcountll(cl[x] ^ cr[xr])) : kOutsideCost;
+      }
+    }
+  }
+}
+
+
+void SemiGlobalMatcher::AggregatePaths(bool forward)
+{
+  const int stride = params_.max_disp + 2;
+  const int step = forward ? 1 : -1;
+  const int p1 = params_.p1;
+  const int p2 = params_.p2;
+
+  const int* directions = (params_.num_paths == 8) ? kDirections8 : kDirections4;
+  const int num_directions = params_.num_paths / 2;
+
+  const int y_begin = forward ? 0 : (rows_ - 1);
+  const int x_begin = forward ? 0 : (cols_ - 1);
+
+  for (int y = y_begin; y >= 0 && y < rows_; y += step) {
+    uint16_t* cur = path_costs_[y & 1].data();
+    const uint16_t* prev = path_costs_[(y + 1) & 1].data();
+    uint16_t* cur_mins = path_mins_[y & 1].data();
+    const uint16_t* prev_mins = path_mins_[(y + 1) & 1].data();
+
+    for (int x = x_begin; x >= 0 && x < cols_; x += step) {
+      const int r = RegionIndex(y, x);
+      const int lo = region_lo_[r];
+      const int w = region_width_[r];
+      const size_t offset = pixel_offset_[y * cols_ + x];
+      const uint8_t* C = costs_.data() + offset;
+      uint16_t* S = aggregated_.data() + offset;
+
+      for (int j = 0; j < num_directions; ++j) {
+        const int k = directions[j];
+        const int qx = x + step * kPathDx[k];
+        const int qy = y + step * kPathDy[k];
+
+        const uint16_t* Lq = path_start_.data() + 1;
+        uint16_t minq = 0;
+
+        if (qx >= 0 && qx < cols_ && qy >= 0 && qy < rows_) {
+          const uint16_t* q_costs = (qy == y) ? cur : prev;
+          const uint16_t* q_mins = (qy == y) ? cur_mins : prev_mins;
+          Lq = q_costs + (k * cols_ + qx) * stride + 1;
+          minq = q_mins[k * cols_ + qx];
+
+          // Move the neighbor's path costs into this pixel's window. Disparities that it didn't
+          // search are saturated, so they're never better than a jump (p2).
+          const int rq = RegionIndex(qy, qx);
+          const int lo_q = region_lo_[rq];
+          const int w_q = region_width_[rq];
+          if (lo_q != lo || w_q != w) {
+            uint16_t* shifted = shifted_.data() + 1;
+            std::fill(shifted_.begin(), shifted_.begin() + w + 2, kMaxPathCost);
+            const int begin = std::max(0, lo_q - lo);
+            const int end = std::min(w, lo_q + w_q - lo);
+            for (int i = begin; i < end; ++i) {
+              shifted[i] = Lq[i + lo - lo_q];
+            }
+            Lq = shifted;
+          }
+        }
+
+        uint16_t* Lp = cur + (k * cols_ + x) * stride + 1;
+        cur_mins[k * cols_ + x] = AggregateStep(C, Lq, minq, w, p1, p2, Lp, S, forward && j == 0);
+        Lp[-1] = kMaxPathCost;
+        Lp[w] = kMaxPathCost;
+      }
+    }
+  }
+}
+
+
+void SemiGlobalMatcher::SelectDisparities(Image1f& disp)
+{
+  disp.create(rows_, cols_);
+
+  for (int y = 0; y < rows_; ++y) {
+    float* out = disp.ptr<float>(y);
+    std::fill(right_best_cost_.begin(), right_best_cost_.end(), kMaxPathCost);
+    std::fill(right_best_disp_.begin(), right_best_disp_.end(), kMaxPathCost);
+
+    for (int x = 0; x < cols_; ++x) {
+      const int r = RegionIndex(y, x);
+      const int lo = region_lo_[r];
+      const int w = region_width_[r];
+      const uint16_t* S = aggregated_.data() + pixel_offset_[y * cols_ + x];
+
+      const int best = Argmin(S, w);
+
+      // The same aggregated costs give the best match for each pixel in the right image.
+      UpdateRightBest(S, x - lo, lo, w, right_best_cost_.data(), right_best_disp_.data());
+
+      left_best_disp_[x] = lo + best;
+      out[x] = static_cast<float>(lo + best);
+
+      if (params_.subpixel && best > 0 && best < (w - 1)) {
+        const float s0 = S[best - 1];
+        const float s1 = S[best];
+        const float s2 = S[best + 1];
+        const float denom = s0 + s2 - 2.0f * s1;
+        if (denom > 0) {
+          out[x] += (s0 - s2) / (2.0f * denom);
+        }
+      }
+    }
+
+    const bool border_row = y < kCensusRadiusY || y >= (rows_ - kCensusRadiusY);
+
+    for (int x = 0; x < cols_; ++x) {
+      const int d = left_best_disp_[x];
+      const int xr = x - d;
+      const bool border = border_row || x < kCensusRadiusX || x >= (cols_ - kCensusRadiusX) || xr < 0;
+
+      if (border || (params_.lr_max_diff >= 0 && std::abs(static_cast<int>(right_best_disp_[xr]) - d) > params_.lr_max_diff)) {
+        out[x] = kInvalidDisparity;
+      }
+    }
+  }
+}
+
+
+}
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "params/yaml_parser.hpp"
+#include "vision_core/cv_types.hpp"
+#include "vision_core/landmark_observation.hpp"
+
+namespace bm {
+namespace stereo {
+
+using namespace core;
+
+
+// Disparities in [min_disp, max_disp).
+struct DisparityRange final
+{
+  DisparityRange() = default;
+  DisparityRange(int min_disp, int max_disp) : min_disp(min_disp), max_disp(max_disp) {}
+
+  int min_disp = 0;
+  int max_disp = 64;
+};
+
+
+// Semi-global matching (Hirschmuller 2008), meant to be kept around and called on every frame.
+//
+// The matching cost is the Hamming distance between 9x7 census transforms. Costs are aggregated
+// along 8 (or 4) paths with saturating 16-bit arithmetic (AVX2 or NEON, with a scalar fallback),
+// and the disparity with the lowest aggregated cost is refined with a parabola. Disparities that
+// fail a left-right consistency check are set to kInvalidDisparity.
+//
+// Each pixel only considers a window of disparities. The window can be the same for the whole
+// image, or it can come from sparse disparities (e.g the landmarks that StereoTracker matched), one
+// window per region of the image. Narrow windows make the cost volume much smaller.
+//
+// NOTE(milo): Buffers are sized for the largest possible cost volume, and only reallocated when the
+// image size changes.
+class SemiGlobalMatcher final {
+ public:
+  static constexpr float kInvalidDisparity = -1.0f;
+
+  struct Params final : public ParamsBase {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    int max_disp = 64;        // Disparities are always in [0, max_disp). Must be a multiple of 16.
+    int num_paths = 8;        // 8 or 4.
+    int p1 = 10;              // Penalty for a disparity change of 1 pixel (in census bits).
+    int p2 = 120;             // Penalty for larger disparity changes.
+    int lr_max_diff = 1;      // Left-right check tolerance in pixels (negative to skip the check).
+    bool subpixel = true;
+
+    // For sparse disparity windows: the image is split into regions of this many pixels on each side,
+    // and each one searches the disparities of the sparse points in and around it, +/- the margin.
+    int region_size = 32;
+    int region_margin = 6;
+
+   private:
+    void LoadParams(const YamlParser& p) override;
+  };
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(SemiGlobalMatcher);
+
+  explicit SemiGlobalMatcher(const Params& params);
+
+  // Searches the same range of disparities for every pixel. The range is widened to a multiple of 16
+  // disparities (within [0, max_disp)).
+  void Compute(const Image1b& iml,
+               const Image1b& imr,
+               const DisparityRange& range,
+               Image1f& disp);
+
+  // Each region searches around the disparities of the observations in and next to it, and regions
+  // without any nearby observations search around all of them. Observations with a negative disparity
+  // are ignored, and their pixel locations must be in the same resolution as the images.
+  void Compute(const Image1b& iml,
+               const Image1b& imr,
+               const VecLandmarkObservation& sparse,
+               Image1f& disp);
+
+  // Number of cost volume entries used on the last call (pixels * window size).
+  size_t CostVolumeSize() const { return volume_size_; }
+
+ private:
+  // (Re)allocates the buffers if the image size changed.
+  void Prepare(int rows, int cols);
+
+  // Matches with the windows in region_lo_ and region_width_.
+  void ComputeWithWindows(const Image1b& iml, const Image1b& imr, Image1f& disp);
+
+  void ComputeCosts();
+
+  // Forward (top-left to bottom-right) or backward paths, summed into aggregated_.
+  void AggregatePaths(bool forward);
+
+  void SelectDisparities(Image1f& disp);
+
+  int RegionIndex(int y, int x) const { return (y / params_.region_size) * region_cols_ + (x / params_.region_size); }
+
+ private:
+  Params params_;
+
+  int rows_ = 0;
+  int cols_ = 0;
+
+  // Census transforms of the left and right images.
+  std::vector<uint64_t> census_l_, census_r_;
+
+  // Disparity window of each region, [lo, lo + width). The width is a multiple of 16.
+  int region_rows_ = 0;
+  int region_cols_ = 0;
+  std::vector<int> region_lo_, region_width_;
+
+  // Range of the sparse disparities in each region, for the Compute() with landmarks.
+  std::vector<float> region_min_, region_max_;
+
+  // Where each pixel's window starts in costs_ and aggregated_.
+  std::vector<size_t> pixel_offset_;
+  size_t volume_size_ = 0;
+
+  std::vector<uint8_t> costs_;
+  std::vector<uint16_t> aggregated_;
+
+  // Path costs for the current and previous rows (for each direction, pixel and disparity), with an
+  // extra (saturated) entry before and after each window. And the minimum of each one.
+  std::vector<uint16_t> path_costs_[2];
+  std::vector<uint16_t> path_mins_[2];
+  std::vector<uint16_t> shifted_;     // A neighbor's path costs, moved into another region's window.
+  std::vector<uint16_t> path_start_;  // All zeros, as the "previous" pixel at the start of a path.
+
+  // Best disparity of each pixel in the left and right images, for the left-right check (one row at
+  // a time).
+  std::vector<int> left_best_disp_;
+  std::vector<uint16_t> right_best_cost_;
+  std::vector<uint16_t> right_best_disp_;
+};
+
+
+}
+}
@@ -13,14 +13,14 @@ Image1f EstimateDisparity(const Image1b& il,
                           int num_disp,
                           int block_size)
 {
-  cv::Ptr<cv::StereoSGBM> sgbm = cv::StereoSGBM::create(0, num_disp, block_size);
-
   const int channels = il.channels();
 
-  // sgbm->setP1(8*channels*block_size*block_size);
-  // sgbm->setP2(32*channels*block_size*block_size);
-  sgbm->setMinDisparity(0);
-  sgbm->setNumDisparities(num_disp);
+  // Smoothness penalties recommended by the OpenCV docs.
+  cv::Ptr<cv::StereoSGBM> sgbm = cv::StereoSGBM::create(
+      0, num_disp, block_size,
+      8*channels*block_size*block_size,
+      32*channels*block_size*block_size);
+
   // sgbm->setUniquenessRatio(10);
   // sgbm->setSpeckleWindowSize(100);
   // sgbm->setSpeckleRange(32);
@@ -9,6 +9,9 @@ namespace stereo {
 
 using namespace core;
 
+// Dense disparity with OpenCV's StereoSGBM. This creates a new matcher on every call. For dense depth
+// on every frame, use SemiGlobalMatcher (semi_global_matcher.hpp), which is owned by the caller, keeps
+// its buffers and can use sparse disparities as a guide.
 Image1f EstimateDisparity(const Image1b& il,
                           const Image1b& ir,
                           int num_disp = 64,
@@ -27,6 +27,20 @@ void ImuManager::Params::LoadParams(const YamlParser& parser)
 ImuManager::ImuManager(const Params& params, const std::string& queue_name)
     : DataManager<ImuMeasurement>(params.max_queue_size, true, queue_name),
       params_(params)
+{
+  InitializePim();
+}
+
+
+ImuManager::ImuManager(const Params& params, const SensorBus<ImuMeasurement>::Ptr& bus)
+    : DataManager<ImuMeasurement>(bus),
+      params_(params)
+{
+  InitializePim();
+}
+
+
+void ImuManager::InitializePim()
 {
   // https://github.com/haidai/gtsam/blob/master/examples/ImuFactorsExample.cpp
   const gtsam::Matrix3 measured_acc_cov = gtsam::I_3x3 * std::pow(params_.accel_noise_sigma, 2);
@@ -102,9 +116,13 @@ PimResult ImuManager::Preintegrate(seconds_t from_time,
   }
 
   // Integrate all measurements <= to_time.
+  // NOTE(milo): Pop them all at once so that we only take the DataManager lock once.
+  std::vector<ImuMeasurement> window;
+  PopUntil(to_time, window);
+
   seconds_t prev_imu_time_sec = earliest_imu_sec;
-  while (!Empty() && Oldest() <= to_time) {
-    imu = Pop();
+  for (const ImuMeasurement& m : window) {
+    imu = m;
     const seconds_t dt = ConvertToSeconds(imu.timestamp) - prev_imu_time_sec;
     CHECK(dt >= 0);
     if (dt > 0) { pim_.integrateMeasurement(imu.a, imu.w, dt); }
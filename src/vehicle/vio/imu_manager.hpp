@@ -86,6 +86,9 @@ class ImuManager final : public DataManager<ImuMeasurement> {
   // Construct with options that control the noise model.
   explicit ImuManager(const Params& params, const std::string& queue_name = "");
 
+  // Construct as a reader of a shared IMU bus (see DataManager).
+  explicit ImuManager(const Params& params, const SensorBus<ImuMeasurement>::Ptr& bus);
+
   // Preintegrate queued IMU measurements, optionally within a time range [from_time, to_time].
   // If not time range is given, all available result are integrated. Integration is reset inside
   // of this function once all IMU measurements are incorporated. Internally, GTSAM converts raw
@@ -99,6 +102,10 @@ class ImuManager final : public DataManager<ImuMeasurement> {
   // Call this after getting a new bias estimate from the smoother update.
   void ResetAndUpdateBias(const ImuBias& bias);
 
+ private:
+  // Set up the preintegration params from params_.
+  void InitializePim();
+
  private:
   Params params_;
   PimC::Params pim_params_;
@@ -109,9 +109,11 @@ void StateEkf::ReapplyImu()
 {
   imu_history_->DiscardBefore(state_.timestamp);
 
-  while (!imu_history_->Empty()) {
-    // NOTE(milo): Don't store these measurements in PredictAndUpdate()! Endless loop!
-    const ImuMeasurement imu = imu_history_->Pop();
+  std::vector<ImuMeasurement> imu_to_reapply;
+  imu_history_->PopUntil(kMaxSeconds, imu_to_reapply);
+
+  // NOTE(milo): Don't store these measurements in PredictAndUpdate()! Endless loop!
+  for (const ImuMeasurement& imu : imu_to_reapply) {
     PredictAndUpdate(imu, false);
   }
 }
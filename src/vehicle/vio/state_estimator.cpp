@@ -1,7 +1,5 @@
 #include <glog/logging.h>
 
-#include <opencv2/highgui.hpp>
-
 #include "core/timer.hpp"
 #include "core/transform_util.hpp"
 #include "vio/state_estimator.hpp"
@@ -16,6 +14,7 @@ void StateEstimator::Params::LoadParams(const YamlParser& parser)
   imu_manager_params = ImuManager::Params(parser.Subtree("ImuManager"));
   smoother_params = FixedLagSmoother::Params(parser.Subtree("FixedLagSmoother"));
   filter_params = StateEkf::Params(parser.Subtree("StateEkf"));
+  viz_params = VisualizationSink::Params(parser.Subtree("VisualizationSink"));
 
   parser.GetParam("max_size_raw_stereo_queue", &max_size_raw_stereo_queue);
   parser.GetParam("max_size_smoother_vo_queue", &max_size_smoother_vo_queue);
@@ -38,6 +37,7 @@ void StateEstimator::Params::LoadParams(const YamlParser& parser)
   parser.GetParam("max_filter_divergence_position", &max_filter_divergence_position);
   parser.GetParam("max_filter_divergence_rotation", &max_filter_divergence_rotation);
   parser.GetParam("show_feature_tracks", &show_feature_tracks);
+  parser.GetParam("frontend_use_imu_prior", &frontend_use_imu_prior);
   parser.GetParam("body_nG_tol", &body_nG_tol);
   parser.GetParam("filter_use_depth", &filter_use_depth);
   parser.GetParam("filter_use_range", &filter_use_range);
@@ -57,14 +57,28 @@ StateEstimator::StateEstimator(const Params& params)
       is_shutdown_(false),
       stereo_frontend_(params_.stereo_frontend_params),
       raw_stereo_queue_(params_.max_size_raw_stereo_queue, true, "raw_stereo_queue"),
-      smoother_imu_manager_(params_.imu_manager_params, "smoother_imu_manager"),
+      imu_bus_(std::make_shared<SensorBus<ImuMeasurement>>(
+          params_.imu_manager_params.max_queue_size, true, "imu_bus")),
+      depth_bus_(std::make_shared<SensorBus<DepthMeasurement>>(
+          std::max(params_.max_size_smoother_depth_queue, params_.max_size_filter_depth_queue), true, "depth_bus")),
+      range_bus_(std::make_shared<SensorBus<RangeMeasurement>>(
+          std::max(params_.max_size_smoother_range_queue, params_.max_size_filter_range_queue), true, "range_bus")),
+      mag_bus_(std::make_shared<SensorBus<MagMeasurement>>(
+          params_.max_size_smoother_mag_queue, true, "mag_bus")),
+      smoother_imu_manager_(params_.imu_manager_params, imu_bus_),
       smoother_vo_queue_(params_.max_size_smoother_vo_queue, true, "smoother_vo_queue"),
-      smoother_depth_manager_(params_.max_size_smoother_depth_queue, true, "smoother_depth_manager"),
-      smoother_range_manager_(params_.max_size_smoother_range_queue, true, "smoother_range_manager"),
-      smoother_mag_manager_(params_.max_size_smoother_mag_queue, true, "smoother_mag_manager"),
-      filter_imu_manager_(params.imu_manager_params, "filter_imu_manager"),
-      filter_depth_manager_(params_.max_size_filter_depth_queue, true, "filter_depth_manager"),
-      filter_range_manager_(params_.max_size_filter_range_queue, true, "filter_range_manager"),
+      smoother_depth_manager_(depth_bus_),
+      smoother_range_manager_(range_bus_),
+      smoother_mag_manager_(mag_bus_),
+      filter_imu_manager_(params_.imu_manager_params, imu_bus_),
+      // NOTE(milo): If the filter doesn't use depth/range, give it an empty private bus, so that its
+      // read cursor doesn't keep measurements alive on the shared bus.
+      filter_depth_manager_(params_.filter_use_depth ? depth_bus_ :
+          std::make_shared<SensorBus<DepthMeasurement>>(1, true, "filter_depth_unused")),
+      filter_range_manager_(params_.filter_use_range ? range_bus_ :
+          std::make_shared<SensorBus<RangeMeasurement>>(1, true, "filter_range_unused")),
+      frontend_imu_manager_(params_.imu_manager_params, params_.frontend_use_imu_prior ? imu_bus_ :
+          std::make_shared<SensorBus<ImuMeasurement>>(1, true, "frontend_imu_unused")),
       stats_("StateEstimator", params_.stats_tracker_k)
 {
   LOG(INFO) << "Constructed StateEstimator!" << std::endl;
@@ -73,6 +87,10 @@ StateEstimator::StateEstimator(const Params& params)
   depth_axis_ = GetGravityAxis(params_.n_gravity, n_gravity_unit);
   depth_sign_ = n_gravity_unit(depth_axis_) >= 0 ? 1.0 : -1.0;
   LOG(INFO) << "Unit GRAVITY/DEPTH axis: " << n_gravity_unit.transpose() << std::endl;
+
+  if (params_.show_feature_tracks) {
+    viz_sink_ = std::unique_ptr<VisualizationSink>(new VisualizationSink(params_.viz_params));
+  }
 }
 
 
@@ -87,34 +105,34 @@ void StateEstimator::ReceiveImu(const ImuMeasurement& imu_data)
   // NOTE(milo): This raw imu_data is expressed in the IMU frame. Internally, the GTSAM IMU
   // preintegration will account for body_P_sensor and convert measurements to the body frame.
   // Also, the StateEKf will account for body_T_imu. So no need to "pre-rotate" these measurements.
-  smoother_imu_manager_.Push(imu_data);
-  filter_imu_manager_.Push(imu_data);
+  imu_bus_->Push(imu_data);
+  NotifyFilterLoop();
 }
 
 
 void StateEstimator::ReceiveDepth(const DepthMeasurement& depth_data)
 {
-  smoother_depth_manager_.Push(depth_data);
+  depth_bus_->Push(depth_data);
   if (params_.filter_use_depth) {
-    filter_depth_manager_.Push(depth_data);
+    NotifyFilterLoop();
   }
 }
 
 
 void StateEstimator::ReceiveRange(const RangeMeasurement& range_data)
 {
-  smoother_range_manager_.Push(range_data);
+  range_bus_->Push(range_data);
 
   // NOTE(milo): Don't send range data to the filter for now. Results in jumpy state estimates.
   if (params_.filter_use_range) {
-    filter_range_manager_.Push(range_data);
+    NotifyFilterLoop();
   }
 }
 
 
 void StateEstimator::ReceiveMag(const MagMeasurement& mag_data)
 {
-  smoother_mag_manager_.Push(mag_data);
+  mag_bus_->Push(mag_data);
 }
 
 
@@ -154,6 +172,11 @@ void StateEstimator::BlockUntilFinished()
 void StateEstimator::Shutdown()
 {
   is_shutdown_.store(true);
+
+  // Interrupt any threads that are blocked waiting for data.
+  raw_stereo_queue_.Shutdown();
+  smoother_vo_queue_.Shutdown();
+  NotifyFilterLoop();
   if (stereo_frontend_thread_.joinable()) {
     stereo_frontend_thread_.join();
   }
@@ -170,29 +193,32 @@ void StateEstimator::StereoFrontendLoop()
 {
   LOG(INFO) << "Started up StereoFrontendLoop() thread" << std::endl;
 
-  if (params_.show_feature_tracks) {
-    cv::namedWindow("StereoTracking", cv::WINDOW_AUTOSIZE);
-  }
+  seconds_t prev_image_time = kMinSeconds;
 
   while (!is_shutdown_) {
-    // If no images waiting to be processed, take a nap.
-    while (raw_stereo_queue_.Empty()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
-      if (is_shutdown_) {
-        LOG(INFO) << "StereoFrontendLoop() exiting" << std::endl;
-        return;
-      }
+    // Sleep until an image arrives. Shutdown() will interrupt this wait.
+    if (!raw_stereo_queue_.WaitUntilNonEmpty(kWaitForDataSec)) {
+      continue;
     }
 
+    const StereoImage1b stereo_pair = raw_stereo_queue_.Pop();
+    const seconds_t image_time = ConvertToSeconds(stereo_pair.timestamp);
+
+    // Only the rotation is predicted, since the velocity isn't known well enough here to be useful.
+    Matrix4d prev_T_cur_prior = Matrix4d::Identity();
+    if (params_.frontend_use_imu_prior && prev_image_time != kMinSeconds) {
+      prev_T_cur_prior.block<3, 3>(0, 0) = PredictCameraRotation(prev_image_time, image_time);
+    }
+    prev_image_time = image_time;
+
     // Process a stereo image pair (KLT tracking, odometry estimation, etc.)
-    // TODO(milo): Use initial odometry estimate other than identity!
-    VoResult result = stereo_frontend_.Track(
-        raw_stereo_queue_.Pop(), Matrix4d::Identity());
-
-    if (params_.show_feature_tracks) {
-      const Image3b& viz = stereo_frontend_.VisualizeFeatureTracks();
-      cv::imshow("StereoTracking", viz);
-      cv::waitKey(1);
+    VoResult result = stereo_frontend_.Track(stereo_pair, prev_T_cur_prior);
+
+    // NOTE(milo): Only the keypoints are copied here. Drawing happens on the sink thread, and frames
+    // that arrive while it's busy are dropped.
+    if (viz_sink_) {
+      const FeatureTrackSnapshot snapshot = stereo_frontend_.GetFeatureTrackSnapshot();
+      viz_sink_->Post("StereoTracking", [snapshot]() { return DrawFeatureTracks(snapshot); });
     }
 
     const bool tracking_failed = (result.status & StereoFrontend::Status::ODOM_ESTIMATION_FAILED) ||
@@ -211,6 +237,31 @@ void StateEstimator::StereoFrontendLoop()
       smoother_vo_queue_.Push(std::move(result));
     }
   }
+
+  LOG(INFO) << "StereoFrontendLoop() exiting" << std::endl;
+}
+
+
+Matrix3d StateEstimator::PredictCameraRotation(seconds_t from_time, seconds_t to_time)
+{
+  // Use the latest bias estimate from the smoother.
+  mutex_smoother_result_.lock();
+  const ImuBias imu_bias = smoother_result_.imu_bias;
+  mutex_smoother_result_.unlock();
+  frontend_imu_manager_.ResetAndUpdateBias(imu_bias);
+
+  const PimResult pim_result = frontend_imu_manager_.Preintegrate(
+      from_time, to_time, params_.allowed_misalignment_imu);
+
+  if (!pim_result.timestamps_aligned) {
+    return Matrix3d::Identity();
+  }
+
+  // NOTE(milo): GTSAM already rotated the measurements into the body frame (using body_P_imu).
+  const Matrix3d prev_R_cur_body = pim_result.pim.deltaRij().matrix();
+  const Matrix3d body_R_cam = params_.body_P_cam.rotation().matrix();
+
+  return body_R_cam.transpose() * prev_R_cur_body * body_R_cam;
 }
 
 
@@ -230,6 +281,18 @@ void StateEstimator::OnSmootherResult(const SmootherResult& new_result)
   }
 
   smoother_update_flag_.store(true); // Tell the filter to sync with this result!
+  NotifyFilterLoop();
+}
+
+
+void StateEstimator::NotifyFilterLoop()
+{
+  // NOTE(milo): The flag must be set while holding the mutex, otherwise the filter thread could
+  // check it right before we notify and miss the wakeup.
+  filter_wakeup_mutex_.lock();
+  filter_has_work_ = true;
+  filter_wakeup_mutex_.unlock();
+  filter_wakeup_cv_.notify_one();
 }
 
 
@@ -297,10 +360,10 @@ void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_bod
 
   //====================================== INITIALIZATION ==========================================
   bool initialized = false;
-  while (!initialized) {
+  while (!initialized && !is_shutdown_) {
     LOG(INFO) << "Will wait " << params_.smoother_init_wait_vision_sec << " seconds for vision" << std::endl;
-    const bool no_vo = WaitForResultOrTimeout<ThreadsafeQueue<VoResult>>(
-        smoother_vo_queue_, params_.smoother_init_wait_vision_sec);
+    const bool no_vo = !smoother_vo_queue_.WaitUntilNonEmpty(params_.smoother_init_wait_vision_sec);
+    if (is_shutdown_) { break; }
 
     smoother_imu_manager_.DiscardBefore(t0);
     const bool no_imu = smoother_imu_manager_.Empty();
@@ -336,7 +399,7 @@ void StateEstimator::SmootherLoop(seconds_t t0, const gtsam::Pose3& P0_world_bod
     const double wait_sec = (smoother_mode_ == SmootherMode::VISION_AVAILABLE) ? \
         params_.max_sec_btw_keyposes + 0.1:       // Add a small epsilon to account for latency.
         0.005;                                    // This should be a tiny delay to process IMU ASAP.
-    const bool did_timeout = WaitForResultOrTimeout<ThreadsafeQueue<VoResult>>(smoother_vo_queue_, wait_sec);
+    const bool did_timeout = !smoother_vo_queue_.WaitUntilNonEmpty(wait_sec);
 
     // Update the smoother mode.
     UpdateSmootherMode(did_timeout ? SmootherMode::VISION_UNAVAILABLE : SmootherMode::VISION_AVAILABLE);
@@ -451,14 +514,32 @@ void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
       ImuBias());
 
   while (!is_shutdown_) {
-    // Clear out any sensor data before the current state.
-    filter_imu_manager_.DiscardBefore(filter.GetTimestamp());
-    filter_depth_manager_.DiscardBefore(filter.GetTimestamp());
-    filter_range_manager_.DiscardBefore(filter.GetTimestamp());
+    // Sleep until a sensor or the smoother tells us there is something to do.
+    Timer idle_timer(true);
+    {
+      std::unique_lock<std::mutex> lock(filter_wakeup_mutex_);
+      filter_wakeup_cv_.wait(lock, [this]{ return filter_has_work_ || is_shutdown_; });
+      filter_has_work_ = false;
+    }
+    const double idle_ms = idle_timer.Elapsed().milliseconds();
+
+    if (is_shutdown_) { break; }
 
-    if ((!filter_imu_manager_.Empty()) ||
-        (!filter_depth_manager_.Empty()) ||
-        (!filter_range_manager_.Empty())) {
+    Timer busy_timer(true);
+
+    // Process all of the sensor data that is ready, in timestamp order. Anything that arrives while
+    // we're busy will set filter_has_work_ again, so it's handled on the next pass.
+    while (!is_shutdown_) {
+      // Clear out any sensor data before the current state.
+      filter_imu_manager_.DiscardBefore(filter.GetTimestamp());
+      filter_depth_manager_.DiscardBefore(filter.GetTimestamp());
+      filter_range_manager_.DiscardBefore(filter.GetTimestamp());
+
+      if (filter_imu_manager_.Empty() &&
+          filter_depth_manager_.Empty() &&
+          filter_range_manager_.Empty()) {
+        break;
+      }
 
       // Figure out which sensor data is next.
       const seconds_t next_imu_timestamp = filter_imu_manager_.Empty() ? kMaxSeconds : filter_imu_manager_.Oldest();
@@ -547,6 +628,9 @@ void StateEstimator::FilterLoop(seconds_t t0, const gtsam::Pose3& P0_world_body)
         cb(state);
       }
     } // end if (do_sync_with_smoother)
+
+    stats_.AddBusyIdle("FilterLoop", busy_timer.Elapsed().milliseconds(), idle_ms);
+    stats_.PrintBusyIdle("FilterLoop", params_.stats_print_interval_sec);
   } // end while (!is_shutdown)
 
   LOG(INFO) << "FilterLoop() exiting" << std::endl;
@@ -1,20 +1,25 @@
 #pragma once
 
 #include <thread>
+#include <memory>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #include "params/params_base.hpp"
 #include "core/macros.hpp"
 #include "core/eigen_types.hpp"
 #include "vision_core/cv_types.hpp"
 #include "core/axis3.hpp"
-#include "core/thread_safe_queue.hpp"
+#include "core/spsc_ring_buffer.hpp"
 #include "vision_core/stereo_image.hpp"
+#include "vision_core/visualization_sink.hpp"
 #include "core/imu_measurement.hpp"
 #include "core/depth_measurement.hpp"
 #include "core/range_measurement.hpp"
 #include "core/mag_measurement.hpp"
 #include "core/data_manager.hpp"
+#include "core/sensor_bus.hpp"
 #include "core/stats_tracker.hpp"
 #include "vio/stereo_frontend.hpp"
 #include "vio/imu_manager.hpp"
@@ -94,7 +99,12 @@ class StateEstimator final {
     double max_filter_divergence_position = 0.5;  // m
     double max_filter_divergence_rotation = 0.2;  // rad
 
+    // Draw the feature tracks on a VisualizationSink, so the frontend thread never waits on the GUI.
     int show_feature_tracks = 0;
+    VisualizationSink::Params viz_params;
+
+    // Preintegrate the gyro between images to predict the camera rotation for the frontend.
+    bool frontend_use_imu_prior = true;
 
     double body_nG_tol = 0.01;  // Treat accelerometer measurements as attitude measurements if they are this close to 1G.
 
@@ -140,6 +150,10 @@ class StateEstimator final {
   // Tracks features from stereo images, and decides what to do with the results.
   void StereoFrontendLoop();
 
+  // Preintegrates IMU measurements to get the rotation of the left camera between two images.
+  // Returns identity if there aren't enough measurements.
+  Matrix3d PredictCameraRotation(seconds_t from_time, seconds_t to_time);
+
   void GetKeyposeAlignedMeasurements(seconds_t from_time,
                                      seconds_t to_time,
                                      PimResult::Ptr& pim_result,
@@ -159,6 +173,9 @@ class StateEstimator final {
   // Updates the smoother_result_ (threadsafe), and calls any stored smoother callbacks.
   void OnSmootherResult(const SmootherResult& result);
 
+  // Wakes up the filter thread when new sensor data or a smoother result is available.
+  void NotifyFilterLoop();
+
   // Central function to change the state of the smoother. If VISION_AVAILABLE, it will try create
   // new keyposes from vision. If VISION_UNAVAILABLE, it will use IMU preintegration to create new
   // keyposes.
@@ -173,19 +190,29 @@ class StateEstimator final {
   double depth_sign_ = 1.0;
 
   StereoFrontend stereo_frontend_;
-  ThreadsafeQueue<StereoImage1b> raw_stereo_queue_;
+  SpscRingBuffer<StereoImage1b> raw_stereo_queue_;
+
+  // Only created if show_feature_tracks is set.
+  std::unique_ptr<VisualizationSink> viz_sink_;
 
   std::thread stereo_frontend_thread_;
   std::thread smoother_thread_;
   std::thread filter_thread_;
 
+  //================================================================================================
+  // Each sensor measurement is stored once. The smoother and filter read from these buses through
+  // their own DataManager (i.e their own read cursor).
+  SensorBus<ImuMeasurement>::Ptr imu_bus_;
+  SensorBus<DepthMeasurement>::Ptr depth_bus_;
+  SensorBus<RangeMeasurement>::Ptr range_bus_;
+  SensorBus<MagMeasurement>::Ptr mag_bus_;
   //================================================================================================
   std::mutex mutex_smoother_result_;
   SmootherMode smoother_mode_ = SmootherMode::VISION_UNAVAILABLE;
   SmootherResult smoother_result_;
   std::atomic_bool smoother_update_flag_{false};
   ImuManager smoother_imu_manager_;
-  ThreadsafeQueue<VoResult> smoother_vo_queue_;
+  SpscRingBuffer<VoResult> smoother_vo_queue_;
   DepthManager smoother_depth_manager_;
   RangeManager smoother_range_manager_;
   MagManager smoother_mag_manager_;
@@ -196,6 +223,13 @@ class StateEstimator final {
   RangeManager filter_range_manager_;
   std::vector<StateStamped::Callback> filter_result_callbacks_;
   //================================================================================================
+  ImuManager frontend_imu_manager_;
+
+  // The filter thread sleeps on this condition variable until it's notified of new work.
+  std::mutex filter_wakeup_mutex_;
+  std::condition_variable filter_wakeup_cv_;
+  bool filter_has_work_ = false;
+  //================================================================================================
 
   StatsTracker stats_;
 };
@@ -1,4 +1,4 @@
-#include <unordered_set>
+#include <algorithm>
 
 #include <glog/logging.h>
 
@@ -43,12 +43,13 @@ StereoFrontend::StereoFrontend(const Params& params)
 
 // Helper function to grab an observation that was observed from query_camera_id.
 // Returns whether or not the query was successful.
-static bool FindObservationFromCameraId(const VecLandmarkObservation& lmk_obs,
+static bool FindObservationFromCameraId(const LandmarkTrackStore::TrackView& lmk_obs,
                                         uid_t query_camera_id,
                                         cv::Point2f& query_lmk_obs,
                                         double& query_lmk_disp)
 {
-  for (const LandmarkObservation& obs : lmk_obs) {
+  for (size_t i = 0; i < lmk_obs.size(); ++i) {
+    const LandmarkObservation& obs = lmk_obs.at(i);
     if (obs.camera_id == query_camera_id) {
       query_lmk_obs = obs.pixel_location;
       query_lmk_disp = obs.disparity;
@@ -65,30 +66,39 @@ VoResult StereoFrontend::Track(const StereoImage1b& stereo_pair,
 {
   VoResult result(stereo_pair.timestamp, timestamp_lkf_, stereo_pair.camera_id, prev_keyframe_id_);
 
-  const bool is_keyframe = tracker_.TrackAndTriangulate(stereo_pair, false);
+  // Use the rotation part of the prior (if any) to predict where tracked points will move.
+  const Matrix3d prev_R_cur = prev_T_cur_prior.block<3, 3>(0, 0);
+  const bool is_keyframe = tracker_.TrackAndTriangulate(stereo_pair, false, prev_R_cur);
 
-  const FeatureTracks& live_tracks = tracker_.GetLiveTracks();
+  // Start odometry from the previous estimate, moved forward by the prior: cur_T_lkf = cur_T_prev * prev_T_lkf.
+  cur_T_lkf_ = prev_T_cur_prior.inverse() * cur_T_lkf_;
 
-  // Get landmarks that were tracked into the current frame.
-  std::vector<uid_t> lmk_ids;
-  std::vector<cv::Point2f> lmk_points;
-  // std::vector<double> lmk_disps;
+  const FeatureTracks& live_tracks = tracker_.GetLiveTracks();
 
-  for (auto it = live_tracks.begin(); it != live_tracks.end(); ++it) {
-    const uid_t lmk_id = it->first;
-    const LandmarkObservation& lmk_obs = it->second.back();
+  // NOTE(milo): Temporaries for this frame come from the arena, so they don't touch the heap.
+  frame_arena_.Reset();
 
-    const size_t num_obs = it->second.size();
+  // Get landmarks that were tracked into the current frame. Remember their slots in the track
+  // store, so that looking up their observations later doesn't need a hash lookup.
+  ArenaVector<size_t> lmk_slots{ArenaAllocator<size_t>(frame_arena_)};
+  ArenaVector<cv::Point2f> lmk_points{ArenaAllocator<cv::Point2f>(frame_arena_)};
 
+  // NOTE(milo): Scan the flat array of latest camera_ids instead of every landmark's observations.
+  const std::vector<uid_t>& latest_camera_ids = live_tracks.LatestCameraIds();
+  for (size_t slot = 0; slot < live_tracks.NumSlots(); ++slot) {
     // Skip observations from previous frames.
-    if (lmk_obs.camera_id != stereo_pair.camera_id) {
+    if (!live_tracks.IsAlive(slot) || latest_camera_ids[slot] != stereo_pair.camera_id) {
       continue;
     }
-    lmk_points.emplace_back(lmk_obs.pixel_location);
-    // lmk_disps.emplace_back(lmk_obs.disparity);
-    lmk_ids.emplace_back(lmk_id);
 
-    result.lmk_obs.emplace_back(lmk_obs);
+    lmk_points.emplace_back(live_tracks.LatestPixels()[slot]);
+    lmk_slots.emplace_back(slot);
+  }
+
+  // NOTE(milo): The result goes to the caller, so it can't come from the arena. Allocate it once.
+  result.lmk_obs.reserve(lmk_slots.size());
+  for (const size_t slot : lmk_slots) {
+    result.lmk_obs.emplace_back(live_tracks.Track(slot).back());
   }
 
   if (result.lmk_obs.empty()) {
@@ -105,41 +115,40 @@ VoResult StereoFrontend::Track(const StereoImage1b& stereo_pair,
 
   //==================== LEAST-SQUARES ODOMETRY OPTIMIZATION ===================
   // Get landmarks that were observed in the current frame AND the previous keyframe.
-  std::vector<Vector3d> lmk_pts_prev_kf_3d;
-  std::vector<Vector2d> lmk_pts_curr_f_2d;
-  std::vector<uid_t> lmk_ids_prev_kf;
-
-  for (size_t i = 0; i < lmk_ids.size(); ++i) {
-    const uid_t lmk_id = lmk_ids.at(i);
-    const VecLmkObs& lmk_obs = live_tracks.at(lmk_id);
+  // NOTE(milo): These are members (cleared every frame) since OptimizeOdometryIterative takes std::vectors.
+  lmk_pts_prev_kf_3d_.clear();
+  lmk_pts_curr_f_2d_.clear();
+  ArenaVector<uid_t> lmk_ids_prev_kf{ArenaAllocator<uid_t>(frame_arena_)};
+  lmk_ids_prev_kf.reserve(lmk_slots.size());
+
+  for (size_t i = 0; i < lmk_slots.size(); ++i) {
+    const LandmarkTrackStore::TrackView lmk_obs = live_tracks.Track(lmk_slots.at(i));
     cv::Point2f pt;
     double disp;
     if (FindObservationFromCameraId(lmk_obs, prev_keyframe_id_, pt, disp)) {
       CHECK_GT(disp, 0);
       const Vector3d p_lkf = stereo_rig_.LeftCamera().Backproject(Vector2d(pt.x, pt.y), stereo_rig_.DispToDepth(disp));
-      lmk_pts_prev_kf_3d.emplace_back(p_lkf);
-      lmk_pts_curr_f_2d.emplace_back(lmk_points.at(i).x, lmk_points.at(i).y);
-      lmk_ids_prev_kf.emplace_back(lmk_id);
+      lmk_pts_prev_kf_3d_.emplace_back(p_lkf);
+      lmk_pts_curr_f_2d_.emplace_back(lmk_points.at(i).x, lmk_points.at(i).y);
+      lmk_ids_prev_kf.emplace_back(lmk_obs.LandmarkId());
     }
   }
 
   // Can only do LM odometry estimation if enough points in the prev keframe and cur frame.
-  if (lmk_pts_prev_kf_3d.size() > 6) {
+  if (lmk_pts_prev_kf_3d_.size() > 6) {
     Matrix6d C_cur_lkf = Matrix6d::Identity();
-    const std::vector<double> lmk_pts_sigma(lmk_pts_curr_f_2d.size(), params_.sigma_tracked_point);
-
-    std::vector<int> lm_inlier_indices, lm_outlier_indices;
+    lmk_pts_sigma_.assign(lmk_pts_curr_f_2d_.size(), params_.sigma_tracked_point);
 
     const int iters = OptimizeOdometryIterative(
-        lmk_pts_prev_kf_3d,
-        lmk_pts_curr_f_2d,
-        lmk_pts_sigma,
+        lmk_pts_prev_kf_3d_,
+        lmk_pts_curr_f_2d_,
+        lmk_pts_sigma_,
         stereo_rig_,
         cur_T_lkf_,
         C_cur_lkf,
         result.avg_reprojection_err,
-        lm_inlier_indices,
-        lm_outlier_indices,
+        lm_inlier_indices_,
+        lm_outlier_indices_,
         params_.lm_max_iters,
         1e-3,
         1e-6,
@@ -152,23 +161,22 @@ VoResult StereoFrontend::Track(const StereoImage1b& stereo_pair,
     result.lkf_T_cam = cur_T_lkf_.inverse();
 
     //======================== REMOVE OUTLIER POINTS =============================
-    std::unordered_set<uid_t> inlier_lmk_ids;
-    for (const int idx : lm_inlier_indices) {
-      const uid_t lmk_id = lmk_ids_prev_kf.at(idx);
-      inlier_lmk_ids.insert(lmk_id);
-    }
-
-    VecLmkObs inlier_obs;
-    for (const LandmarkObservation& lmk_obs : result.lmk_obs) {
-      if (inlier_lmk_ids.count(lmk_obs.landmark_id) != 0) {
-        inlier_obs.emplace_back(lmk_obs);
-      }
+    // NOTE(milo): A sorted vector + binary search instead of a hash set, and filter in place.
+    ArenaVector<uid_t> inlier_lmk_ids{ArenaAllocator<uid_t>(frame_arena_)};
+    inlier_lmk_ids.reserve(lm_inlier_indices_.size());
+    for (const int idx : lm_inlier_indices_) {
+      inlier_lmk_ids.emplace_back(lmk_ids_prev_kf.at(idx));
     }
+    std::sort(inlier_lmk_ids.begin(), inlier_lmk_ids.end());
 
-    std::swap(inlier_obs, result.lmk_obs);
+    result.lmk_obs.erase(std::remove_if(result.lmk_obs.begin(), result.lmk_obs.end(),
+        [&inlier_lmk_ids](const LandmarkObservation& lmk_obs)
+        {
+          return !std::binary_search(inlier_lmk_ids.begin(), inlier_lmk_ids.end(), lmk_obs.landmark_id);
+        }), result.lmk_obs.end());
 
     if (params_.kill_nonrigid_lmks) {
-      for (const int idx : lm_outlier_indices) {
+      for (const int idx : lm_outlier_indices_) {
         const uid_t lmk_id = lmk_ids_prev_kf.at(idx);
         tracker_.KillLandmark(lmk_id);
       }
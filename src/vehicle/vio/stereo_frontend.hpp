@@ -9,6 +9,7 @@
 #include "core/eigen_types.hpp"
 #include "core/uid.hpp"
 #include "core/timestamp.hpp"
+#include "core/frame_arena.hpp"
 #include "vision_core/stereo_image.hpp"
 #include "vision_core/stereo_camera.hpp"
 #include "vision_core/landmark_observation.hpp"
@@ -62,13 +63,18 @@ class StereoFrontend final {
   // Construct with params.
   explicit StereoFrontend(const Params& params);
 
-  // Track and estimate odometry for a new stereo pair.
+  // Track and estimate odometry for a new stereo pair. prev_T_cur_prior is a guess for the motion of
+  // the left camera since the last call (use identity if unknown). Its rotation seeds KLT, and the
+  // whole transform seeds the odometry optimization.
   VoResult Track(const StereoImage1b& stereo_pair,
                  const Matrix4d& prev_T_cur_prior);
 
   // Wrapper around StereoTracker::VisualizeFeatureTracks().
   Image3b VisualizeFeatureTracks() const { return tracker_.VisualizeFeatureTracks(); }
 
+  // Wrapper around StereoTracker::GetFeatureTrackSnapshot().
+  FeatureTrackSnapshot GetFeatureTrackSnapshot() const { return tracker_.GetFeatureTrackSnapshot(); }
+
  private:
   Params params_;
   StereoCamera stereo_rig_;
@@ -79,6 +85,14 @@ class StereoFrontend final {
   timestamp_t timestamp_lkf_ = 0;
 
   Matrix4d cur_T_lkf_ = Matrix4d::Identity();
+
+  // Per-frame temporaries, reused across calls to Track().
+  FrameArena frame_arena_;
+  std::vector<Vector3d> lmk_pts_prev_kf_3d_;
+  std::vector<Vector2d> lmk_pts_curr_f_2d_;
+  std::vector<double> lmk_pts_sigma_;
+  std::vector<int> lm_inlier_indices_;
+  std::vector<int> lm_outlier_indices_;
 };
 
 
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace bm {
+namespace core {
+
+
+// For one row of a template, accumulates the dot product with each of num_positions horizontal
+// shifts of an image row: acc[k] += sum_c templ_row[c] * image_row[k + c].
+// image_row must have at least (num_positions + templ_cols - 1) valid pixels.
+//
+// NOTE(milo): Summing this over all template rows gives the cross-correlation term of the SSD. The
+// products fit in 16 bits, and a uint32 accumulator can't overflow for templates < 66000 pixels.
+inline void CrossCorrelateRow(const uint8_t* templ_row,
+                              int templ_cols,
+                              const uint8_t* image_row,
+                              int num_positions,
+                              uint32_t* acc)
+{
+  int k = 0;
+
+#if defined(__AVX2__)
+  // 16 positions at a time, with the accumulators kept in registers across the template row.
+  for (; (k + 16) <= num_positions; k += 16) {
+    __m256i acc_lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + k));
+    __m256i acc_hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + k + 8));
+
+    for (int c = 0; c < templ_cols; ++c) {
+      const __m256i t = _mm256_set1_epi16(templ_row[c]);
+      const __m256i im = _mm256_cvtepu8_epi16(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(image_row + k + c)));
+
+      // The product is < 2^16, so the low 16 bits are exact (as an unsigned value).
+      const __m256i prod = _mm256_mullo_epi16(im, t);
+      acc_lo = _mm256_add_epi32(acc_lo, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(prod)));
+      acc_hi = _mm256_add_epi32(acc_hi, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(prod, 1)));
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + k), acc_lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + k + 8), acc_hi);
+  }
+#elif defined(__ARM_NEON)
+  // 8 positions at a time.
+  for (; (k + 8) <= num_positions; k += 8) {
+    uint32x4_t acc_lo = vld1q_u32(acc + k);
+    uint32x4_t acc_hi = vld1q_u32(acc + k + 4);
+
+    for (int c = 0; c < templ_cols; ++c) {
+      const uint16x8_t prod = vmull_u8(vld1_u8(image_row + k + c), vdup_n_u8(templ_row[c]));
+      acc_lo = vaddw_u16(acc_lo, vget_low_u16(prod));
+      acc_hi = vaddw_u16(acc_hi, vget_high_u16(prod));
+    }
+
+    vst1q_u32(acc + k, acc_lo);
+    vst1q_u32(acc + k + 4, acc_hi);
+  }
+#endif
+
+  // Leftover positions (or everything, if there's no SIMD support).
+  for (; k < num_positions; ++k) {
+    uint32_t sum = 0;
+    for (int c = 0; c < templ_cols; ++c) {
+      sum += static_cast<uint32_t>(templ_row[c]) * static_cast<uint32_t>(image_row[k + c]);
+    }
+    acc[k] += sum;
+  }
+}
+
+
+}
+}
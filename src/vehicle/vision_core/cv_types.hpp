@@ -10,6 +10,7 @@ typedef cv::Mat3b Image3b;
 
 // 32-bit floating point images
 typedef cv::Mat1f Image1f;
+typedef cv::Mat2f Image2f;
 typedef cv::Mat3f Image3f;
 
 // 64-bit floating point images
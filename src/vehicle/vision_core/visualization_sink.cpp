@@ -0,0 +1,143 @@
+#include <chrono>
+#include <cctype>
+#include <cstdio>
+
+#include <glog/logging.h>
+
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "core/file_utils.hpp"
+#include "vision_core/visualization_sink.hpp"
+
+namespace bm {
+namespace core {
+
+
+void VisualizationSink::Params::LoadParams(const YamlParser& parser)
+{
+  parser.GetParam("headless", &headless);
+  parser.GetParam("output_folder", &output_folder);
+  parser.GetParam("max_rate_hz", &max_rate_hz);
+}
+
+
+VisualizationSink::VisualizationSink(const Params& params)
+    : params_(params)
+{
+  if (params_.headless) {
+    mkdir(params_.output_folder, true);
+    CHECK(Exists(params_.output_folder)) << "Could not create output_folder: " << params_.output_folder << std::endl;
+  }
+
+  thread_ = std::thread(&VisualizationSink::RenderLoop, this);
+}
+
+
+VisualizationSink::~VisualizationSink()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_shutdown_ = true;
+  }
+  cv_.notify_all();
+
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+
+void VisualizationSink::Post(const std::string& window_name, RenderFunction render)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    RenderFunction& waiting = mailbox_[window_name];
+    if (waiting) {
+      ++num_dropped_;
+    }
+    waiting = std::move(render);
+  }
+  cv_.notify_one();
+}
+
+
+void VisualizationSink::Post(const std::string& window_name, const cv::Mat& image)
+{
+  // NOTE(milo): Copying a cv::Mat only bumps its refcount.
+  Post(window_name, [image]() { return image; });
+}
+
+
+void VisualizationSink::RenderLoop()
+{
+  const bool rate_limited = params_.max_rate_hz > 0;
+  const std::chrono::microseconds min_period(rate_limited ? static_cast<int64_t>(1e6 / params_.max_rate_hz) : 0);
+
+  std::map<std::string, RenderFunction> frames;
+
+  while (true) {
+    bool is_shutdown;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return is_shutdown_ || !mailbox_.empty(); });
+      frames.swap(mailbox_);
+      is_shutdown = is_shutdown_;
+    }
+
+    const auto render_time = std::chrono::steady_clock::now();
+
+    for (const auto& item : frames) {
+      const cv::Mat image = item.second();
+      if (image.empty()) {
+        continue;
+      }
+
+      if (params_.headless) {
+        WriteFrame(item.first, image);
+      } else {
+        cv::imshow(item.first, image);
+      }
+      ++num_rendered_;
+    }
+
+    if (!params_.headless && !frames.empty()) {
+      cv::waitKey(1);
+    }
+    frames.clear();
+
+    if (is_shutdown) {
+      break;
+    }
+
+    // Frames that arrive during the rest of this period just replace each other in the mailbox.
+    if (rate_limited) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait_until(lock, render_time + min_period, [this]() { return is_shutdown_; });
+    }
+  }
+}
+
+
+void VisualizationSink::WriteFrame(const std::string& window_name, const cv::Mat& image)
+{
+  // Window names can have spaces and punctuation, which aren't nice in filenames.
+  std::string prefix = window_name;
+  for (char& c : prefix) {
+    if (!std::isalnum(static_cast<unsigned char>(c))) {
+      c = '_';
+    }
+  }
+
+  char suffix[32];
+  std::snprintf(suffix, sizeof(suffix), "_%06zu.png", num_written_[window_name]++);
+
+  const std::string path = Join(params_.output_folder, prefix + suffix);
+  if (!cv::imwrite(path, image)) {
+    LOG(WARNING) << "VisualizationSink failed to write: " << path << std::endl;
+  }
+}
+
+
+}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "core/macros.hpp"
+#include "params/params_base.hpp"
+#include "vision_core/cv_types.hpp"
+
+namespace bm {
+namespace core {
+
+
+// Shows debug images (or writes them to disk) on its own thread, so that drawing, cv::imshow() and
+// cv::waitKey() never hold up a tracking thread.
+//
+// Producers Post() a cheap snapshot of what to draw (e.g keypoints and a refcounted image), and the
+// drawing itself happens on the sink thread. Each window has a mailbox that holds one frame: if a new
+// frame arrives before the waiting one was rendered, the waiting one is dropped.
+class VisualizationSink final {
+ public:
+  struct Params final : public ParamsBase
+  {
+    MACRO_PARAMS_STRUCT_CONSTRUCTORS(Params);
+
+    // Write each frame to output_folder as <window>_<frame>.png instead of showing it (e.g when
+    // there isn't a display).
+    bool headless = false;
+    std::string output_folder = "/tmp/visualization";
+
+    // Render at most this many times per second. If <= 0, render as fast as frames arrive.
+    double max_rate_hz = 15.0;
+
+   private:
+    void LoadParams(const YamlParser& parser) override;
+  };
+
+  // Draws a frame. Runs on the sink thread, so it should only use data that it owns (captured by value).
+  typedef std::function<cv::Mat()> RenderFunction;
+
+  MACRO_DELETE_COPY_CONSTRUCTORS(VisualizationSink);
+  MACRO_DELETE_DEFAULT_CONSTRUCTOR(VisualizationSink);
+
+  explicit VisualizationSink(const Params& params);
+
+  // Renders any frames that are still waiting, then joins the sink thread.
+  ~VisualizationSink();
+
+  // Queue a frame for a window, replacing a waiting one if there is one. Never blocks on rendering.
+  void Post(const std::string& window_name, RenderFunction render);
+
+  // Show an image as-is. It isn't copied, so the caller shouldn't write into it afterwards.
+  void Post(const std::string& window_name, const cv::Mat& image);
+
+  // Frames that were replaced before they were rendered, and frames that were rendered.
+  size_t NumDropped() const { return num_dropped_.load(); }
+  size_t NumRendered() const { return num_rendered_.load(); }
+
+ private:
+  void RenderLoop();
+
+  // Headless mode: write a frame to output_folder.
+  void WriteFrame(const std::string& window_name, const cv::Mat& image);
+
+ private:
+  Params params_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::map<std::string, RenderFunction> mailbox_;
+  bool is_shutdown_ = false;
+
+  std::atomic<size_t> num_dropped_{0};
+  std::atomic<size_t> num_rendered_{0};
+
+  // Only used by the sink thread.
+  std::map<std::string, size_t> num_written_;
+
+  std::thread thread_;
+};
+
+
+}
+}
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 
+#include "core/timer.hpp"
 #include "core/depth_measurement.hpp"
+#include "core/imu_measurement.hpp"
 #include "core/data_manager.hpp"
 #include "core/path_util.hpp"
 
@@ -87,3 +89,186 @@ TEST(DataManagerTest, TestAll)
   EXPECT_EQ(15ul, out.at(1).timestamp);
   EXPECT_EQ(15ul, out.at(2).timestamp);
 }
+
+
+TEST(DataManagerTest, TestRangeQueries)
+{
+  DataManager<DepthMeasurement> m(8, true);
+  for (timestamp_t t = 10; t < 20; ++t) {
+    m.Push(DepthMeasurement(t, 0.1 * t));
+  }
+
+  // Only the 8 newest are kept.
+  EXPECT_EQ(8ul, m.Size());
+  EXPECT_EQ(ConvertToSeconds(12), m.Oldest());
+  EXPECT_EQ(ConvertToSeconds(19), m.Newest());
+
+  EXPECT_EQ(ConvertToSeconds(12), m.FirstAtOrAfter(ConvertToSeconds(5)));
+  EXPECT_EQ(ConvertToSeconds(15), m.FirstAtOrAfter(ConvertToSeconds(15)));
+  EXPECT_EQ(kMaxSeconds, m.FirstAtOrAfter(ConvertToSeconds(20)));
+
+  // Reading a window doesn't remove anything.
+  std::vector<DepthMeasurement> window;
+  m.CopyRange(ConvertToSeconds(14), ConvertToSeconds(16), window);
+  EXPECT_EQ(3ul, window.size());
+  EXPECT_EQ(14ul, window.front().timestamp);
+  EXPECT_EQ(16ul, window.back().timestamp);
+  EXPECT_EQ(8ul, m.Size());
+
+  double sum = 0;
+  const size_t N = m.ForEachInRange(kMinSeconds, kMaxSeconds, [&sum](const DepthMeasurement& d) { sum += d.depth; });
+  EXPECT_EQ(8ul, N);
+  EXPECT_NEAR(0.1 * (12 + 13 + 14 + 15 + 16 + 17 + 18 + 19), sum, 1e-9);
+
+  // Empty window.
+  EXPECT_EQ(0ul, m.ForEachInRange(ConvertToSeconds(16) + 1e-10, ConvertToSeconds(17) - 1e-10, [](const DepthMeasurement&) {}));
+
+  m.DiscardBefore(ConvertToSeconds(17));
+  EXPECT_EQ(3ul, m.Size());
+  EXPECT_EQ(ConvertToSeconds(17), m.Oldest());
+}
+
+
+// Simulates 60 sec of 1 kHz IMU with 10 sec of retention. Every 50 ms the consumer reads the latest
+// window and throws away anything older than 10 sec.
+TEST(DataManagerTest, TestBenchmark1kHz)
+{
+  const timestamp_t dt_ns = 1000000;
+  const size_t retention = 10000;
+  DataManager<ImuMeasurement> m(retention, true);
+
+  double push_ms = 0, window_ms = 0, discard_ms = 0;
+  size_t num_windows = 0, num_read = 0;
+
+  Timer timer(true);
+  for (timestamp_t i = 1; i <= 60000; ++i) {
+    timer.Reset();
+    m.Push(ImuMeasurement(i * dt_ns, Vector3d::Zero(), Vector3d::Ones()));
+    push_ms += timer.Elapsed().milliseconds();
+
+    if (i % 50 == 0) {
+      const seconds_t t = ConvertToSeconds(i * dt_ns);
+      timer.Reset();
+      Vector3d sum_a = Vector3d::Zero();
+      num_read += m.ForEachInRange(t - 0.05, t, [&sum_a](const ImuMeasurement& imu) { sum_a += imu.a; });
+      window_ms += timer.Elapsed().milliseconds();
+
+      timer.Reset();
+      m.DiscardBefore(t - 10.0);
+      discard_ms += timer.Elapsed().milliseconds();
+      ++num_windows;
+    }
+  }
+
+  EXPECT_EQ(retention, m.Size());
+  EXPECT_GE(num_read, 50ul * num_windows);
+
+  printf("[ DataManager 1kHz ] Push: %.3f us, ForEachInRange(50 ms): %.3f us, DiscardBefore: %.3f us\n",
+      1e3 * push_ms / 60000.0, 1e3 * window_ms / num_windows, 1e3 * discard_ms / num_windows);
+}
+
+
+TEST(DataManagerTest, TestSharedBus)
+{
+  SensorBus<DepthMeasurement>::Ptr bus = std::make_shared<SensorBus<DepthMeasurement>>(4, true, "depth_bus");
+  DataManager<DepthMeasurement> fast(bus);
+  DataManager<DepthMeasurement> slow(bus);
+
+  for (timestamp_t t = 1; t <= 3; ++t) {
+    bus->Push(DepthMeasurement(t, 0.1));
+  }
+  EXPECT_EQ(3ul, fast.Size());
+  EXPECT_EQ(3ul, slow.Size());
+  EXPECT_EQ(3ul, bus->StoredSize());
+
+  // Readers have independent cursors, and items are only freed once both have read them.
+  EXPECT_EQ(1ul, fast.Pop().timestamp);
+  EXPECT_EQ(2ul, fast.Pop().timestamp);
+  EXPECT_EQ(1ul, fast.Size());
+  EXPECT_EQ(3ul, slow.Size());
+  EXPECT_EQ(3ul, bus->StoredSize());
+
+  slow.DiscardBefore(ConvertToSeconds(2));
+  EXPECT_EQ(2ul, slow.Size());
+  EXPECT_EQ(2ul, bus->StoredSize());
+  EXPECT_EQ(ConvertToSeconds(2), slow.Oldest());
+  EXPECT_EQ(ConvertToSeconds(3), fast.Oldest());
+
+  // The slow reader holds back the bus, so it misses the oldest item when the bus fills up.
+  for (timestamp_t t = 4; t <= 6; ++t) {
+    bus->Push(DepthMeasurement(t, 0.1));
+  }
+  EXPECT_EQ(4ul, bus->StoredSize());
+  EXPECT_EQ(ConvertToSeconds(3), slow.Oldest());
+  EXPECT_EQ(4ul, fast.Size());
+
+  // A reader that goes away doesn't hold anything back.
+  {
+    DataManager<DepthMeasurement> logger(bus);
+    EXPECT_TRUE(logger.Empty());
+    bus->Push(DepthMeasurement(7, 0.1));
+    EXPECT_EQ(1ul, logger.Size());
+  }
+  std::vector<DepthMeasurement> out;
+  fast.PopUntil(kMaxSeconds, out);
+  slow.PopUntil(kMaxSeconds, out);
+  EXPECT_EQ(0ul, bus->StoredSize());
+}
+
+
+// Compares the old approach (push every IMU measurement into a separate smoother and filter queue)
+// with one shared bus and two readers. The filter reads every measurement as it arrives, and the
+// smoother reads a window every 200 ms (i.e at keyframes).
+TEST(DataManagerTest, TestBenchmarkSharedBus)
+{
+  const timestamp_t dt_ns = 1000000;
+  const int N = 60000;  // 60 sec at 1 kHz.
+  const size_t max_size = 1000;
+
+  DataManager<ImuMeasurement> smoother_copy(max_size, true);
+  DataManager<ImuMeasurement> filter_copy(max_size, true);
+
+  SensorBus<ImuMeasurement>::Ptr bus = std::make_shared<SensorBus<ImuMeasurement>>(max_size, true);
+  DataManager<ImuMeasurement> smoother_reader(bus);
+  DataManager<ImuMeasurement> filter_reader(bus);
+
+  std::vector<ImuMeasurement> window;
+  size_t max_stored_copy = 0, max_stored_bus = 0;
+
+  Timer timer(true);
+  for (int i = 1; i <= N; ++i) {
+    const ImuMeasurement imu(i * dt_ns, Vector3d::Zero(), Vector3d::Ones());
+    smoother_copy.Push(imu);
+    filter_copy.Push(imu);
+    filter_copy.Pop();
+    if (i % 200 == 0) {
+      window.clear();
+      smoother_copy.PopUntil(kMaxSeconds, window);
+    }
+    max_stored_copy = std::max(max_stored_copy, smoother_copy.Size() + filter_copy.Size());
+  }
+  const double copy_ms = timer.Tock().milliseconds();
+
+  for (int i = 1; i <= N; ++i) {
+    const ImuMeasurement imu(i * dt_ns, Vector3d::Zero(), Vector3d::Ones());
+    bus->Push(imu);
+    filter_reader.Pop();
+    if (i % 200 == 0) {
+      window.clear();
+      smoother_reader.PopUntil(kMaxSeconds, window);
+    }
+    max_stored_bus = std::max(max_stored_bus, bus->StoredSize());
+  }
+  const double bus_ms = timer.Tock().milliseconds();
+
+  EXPECT_EQ(199ul, max_stored_bus);
+
+  // Each queue preallocates storage for max_size measurements.
+  const size_t bytes_copy = 2 * NextPowerOfTwo(max_size) * (sizeof(ImuMeasurement) + sizeof(seconds_t));
+  const size_t bytes_bus = NextPowerOfTwo(max_size) * (sizeof(ImuMeasurement) + sizeof(seconds_t));
+
+  printf("[ Separate queues ] %.3f us/measurement, max stored=%zu, allocated=%zu bytes\n",
+      1e3 * copy_ms / N, max_stored_copy, bytes_copy);
+  printf("[ Shared SensorBus ] %.3f us/measurement, max stored=%zu, allocated=%zu bytes\n",
+      1e3 * bus_ms / N, max_stored_bus, bytes_bus);
+}
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "core/frame_arena.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+// NOTE(milo): Count every heap allocation in this test binary, so that tests can check that some
+// code doesn't allocate.
+static std::atomic<size_t> g_num_heap_allocations(0);
+
+void* operator new(size_t bytes)
+{
+  ++g_num_heap_allocations;
+  void* ptr = std::malloc(bytes > 0 ? bytes : 1);
+  if (ptr == nullptr) { throw std::bad_alloc(); }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+
+// Fills some arena containers like a tracking frame would.
+static void FakeFrame(FrameArena& arena, size_t n)
+{
+  arena.Reset();
+
+  ArenaVector<int> ids{ArenaAllocator<int>(arena)};
+  ArenaVector<double> disps{ArenaAllocator<double>(arena)};
+  ArenaVector<ArenaVector<int>> groups{ArenaAllocator<ArenaVector<int>>(arena)};
+
+  for (size_t i = 0; i < n; ++i) {
+    ids.emplace_back(static_cast<int>(i));
+    disps.emplace_back(0.5 * i);
+  }
+
+  groups.reserve(4);
+  for (int k = 0; k < 4; ++k) {
+    groups.emplace_back(ArenaAllocator<int>(arena));
+    groups.back().assign(ids.begin(), ids.end());
+  }
+
+  EXPECT_EQ(n, groups.back().size());
+}
+
+
+TEST(FrameArenaTest, TestAlignment)
+{
+  FrameArena arena(64);
+
+  for (size_t alignment : { 1ul, 2ul, 8ul, 16ul, 64ul }) {
+    void* ptr = arena.Allocate(3, alignment);
+    EXPECT_EQ(0ul, reinterpret_cast<uintptr_t>(ptr) % alignment);
+  }
+
+  // Bigger than the first block.
+  void* big = arena.Allocate(1000, 32);
+  EXPECT_EQ(0ul, reinterpret_cast<uintptr_t>(big) % 32);
+  EXPECT_GT(arena.NumHeapAllocations(), 1ul);
+
+  // After a reset, everything fits in one (merged) block.
+  const size_t capacity = arena.Capacity();
+  arena.Reset();
+  EXPECT_EQ(0ul, arena.BytesUsed());
+  EXPECT_EQ(capacity, arena.Capacity());
+}
+
+
+TEST(FrameArenaTest, TestNoHeapAllocationsInSteadyState)
+{
+  FrameArena arena(256);
+
+  // The first couple of frames can grow the arena.
+  FakeFrame(arena, 1000);
+  FakeFrame(arena, 1000);
+
+  const size_t heap_before = g_num_heap_allocations.load();
+  const size_t arena_before = arena.NumHeapAllocations();
+
+  for (int i = 0; i < 100; ++i) {
+    FakeFrame(arena, 1000);
+  }
+
+  EXPECT_EQ(heap_before, g_num_heap_allocations.load());
+  EXPECT_EQ(arena_before, arena.NumHeapAllocations());
+}
+
+
+TEST(FrameArenaTest, TestReserve)
+{
+  FrameArena arena(256);
+
+  // Reserving less than the capacity doesn't do anything.
+  arena.Reserve(100);
+  EXPECT_EQ(256ul, arena.Capacity());
+  EXPECT_EQ(1ul, arena.NumHeapAllocations());
+
+  arena.Reserve(4096);
+  arena.Reset();
+  EXPECT_EQ(4096ul, arena.Capacity());
+
+  // After the reset, a frame of that size fits without touching the heap.
+  const size_t heap_before = g_num_heap_allocations.load();
+  const size_t arena_before = arena.NumHeapAllocations();
+  arena.Allocate(4000, 8);
+  EXPECT_EQ(heap_before, g_num_heap_allocations.load());
+  EXPECT_EQ(arena_before, arena.NumHeapAllocations());
+}
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <vector>
+
 #include "core/math_util.hpp"
 #include "core/sliding_buffer.hpp"
 
@@ -41,3 +43,29 @@ TEST(SlidingBuffer, Test01)
   EXPECT_EQ(3, sb.Get(1));
   EXPECT_EQ(2, sb.Get(2));
 }
+
+
+TEST(SlidingBuffer, TestNextSlot)
+{
+  SlidingBuffer<std::vector<int>> sb(2);
+
+  sb.NextSlot().assign(4, 1);
+  sb.Advance();
+  EXPECT_EQ(1ul, sb.Added());
+  EXPECT_EQ(1, sb.Head().at(0));
+
+  sb.Add(std::vector<int>(4, 2));
+  EXPECT_EQ(2, sb.Head().at(0));
+  EXPECT_EQ(1, sb.Get(1).at(0));
+
+  // The next slot holds the oldest item, so its memory can be reused.
+  std::vector<int>& next = sb.NextSlot();
+  EXPECT_EQ(1, next.at(0));
+  const int* data = next.data();
+  next.assign(4, 3);
+  sb.Advance();
+
+  EXPECT_EQ(3, sb.Head().at(0));
+  EXPECT_EQ(data, sb.Head().data());
+  EXPECT_EQ(2, sb.Get(1).at(0));
+}
@@ -0,0 +1,192 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "core/timer.hpp"
+#include "core/thread_safe_queue.hpp"
+#include "core/spsc_ring_buffer.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(SpscRingBufferTest, TestSingleThread)
+{
+  // Storage is rounded up to 4 slots, but only 3 items are kept.
+  SpscRingBuffer<int> q(3, true);
+  EXPECT_EQ(4ul, q.Capacity());
+  EXPECT_TRUE(q.Empty());
+
+  q.Push(1);
+  q.Push(2);
+  q.Push(3);
+  EXPECT_EQ(3ul, q.Size());
+  EXPECT_EQ(1, q.PeekFront());
+
+  // PeekFront() moved item 1 into the consumer cache, so it won't be dropped.
+  q.Push(4);
+  EXPECT_EQ(4ul, q.Size());
+
+  // Item 2 should be dropped now.
+  q.Push(5);
+  EXPECT_EQ(4ul, q.Size());
+  EXPECT_EQ(1, q.Pop());
+  EXPECT_EQ(3, q.Pop());
+  EXPECT_EQ(4, q.Pop());
+
+  int item = 0;
+  EXPECT_TRUE(q.PopIfNonEmpty(item));
+  EXPECT_EQ(5, item);
+  EXPECT_FALSE(q.PopIfNonEmpty(item));
+  EXPECT_TRUE(q.Empty());
+
+  // Dropping the newest item instead.
+  SpscRingBuffer<int> q2(2, false);
+  EXPECT_TRUE(q2.Push(1));
+  EXPECT_TRUE(q2.Push(2));
+  EXPECT_FALSE(q2.Push(3));
+  EXPECT_EQ(1, q2.Pop());
+  EXPECT_EQ(2, q2.Pop());
+}
+
+
+TEST(SpscRingBufferTest, TestProducerConsumer)
+{
+  const int N = 100000;
+  SpscRingBuffer<int> q(64, false);
+
+  std::thread producer([&q, N]() {
+    for (int i = 0; i < N; ++i) {
+      while (!q.Push(i)) { std::this_thread::yield(); }
+    }
+  });
+
+  // Items must arrive in order with none missing.
+  for (int i = 0; i < N; ++i) {
+    ASSERT_TRUE(q.WaitUntilNonEmpty(1.0));
+    ASSERT_EQ(i, q.Pop());
+  }
+
+  producer.join();
+  EXPECT_TRUE(q.Empty());
+}
+
+
+TEST(SpscRingBufferTest, TestDropOldestConcurrent)
+{
+  const int N = 100000;
+  SpscRingBuffer<std::vector<int>> q(16, true);
+
+  std::thread producer([&q, N]() {
+    for (int i = 0; i < N; ++i) {
+      q.Push(std::vector<int>(8, i));
+    }
+  });
+
+  // Some items will be dropped, but the ones we get should be intact and in order.
+  int prev = -1;
+  while (prev < (N - 1)) {
+    if (!q.WaitUntilNonEmpty(1.0)) { break; }
+    const std::vector<int> item = q.Pop();
+    ASSERT_EQ(8ul, item.size());
+    ASSERT_GT(item.front(), prev);
+    ASSERT_EQ(item.front(), item.back());
+    prev = item.front();
+  }
+
+  producer.join();
+  EXPECT_EQ(N - 1, prev);
+}
+
+
+// Checks that WaitPop() times out, wakes up when an item arrives, and is interrupted by Shutdown().
+TEST(SpscRingBufferTest, TestWaitAndShutdown)
+{
+  SpscRingBuffer<int> q(10, true);
+
+  int item = 0;
+  Timer timer(true);
+  EXPECT_FALSE(q.WaitPop(item, 0.05));
+  EXPECT_GE(timer.Elapsed().seconds(), 0.04);
+
+  std::thread producer([&q]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.Push(123);
+  });
+  EXPECT_TRUE(q.WaitPop(item, 5.0));
+  EXPECT_EQ(123, item);
+  producer.join();
+
+  std::thread stopper([&q]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.Shutdown();
+  });
+  timer.Reset();
+  EXPECT_FALSE(q.WaitUntilNonEmpty(5.0));
+  EXPECT_LT(timer.Elapsed().seconds(), 1.0);
+  stopper.join();
+
+  // Waits return immediately after shutdown.
+  EXPECT_FALSE(q.WaitPop(item, 5.0));
+}
+
+
+// Measures throughput by sending items from a producer to a consumer at full speed, then measures
+// the p99 hand-off latency by sending timestamped items one at a time.
+template <typename QueueType>
+static void BenchmarkQueue(QueueType& q, const std::string& name)
+{
+  typedef std::chrono::steady_clock::time_point Clocktime;
+
+  const int N = 200000;
+  Timer timer(true);
+  std::thread producer([&q, N]() {
+    for (int i = 0; i < N; ++i) {
+      q.Push(Clocktime());
+    }
+  });
+
+  Clocktime t;
+  for (int i = 0; i < N; ++i) {
+    while (!q.PopIfNonEmpty(t)) { std::this_thread::yield(); }
+  }
+  const double elapsed_sec = timer.Elapsed().seconds();
+  producer.join();
+
+  // Only one item is in flight at a time, so this doesn't include time spent waiting in a backlog.
+  const int M = 20000;
+  std::vector<double> latency_us(M);
+  std::atomic<int> num_popped{0};
+
+  std::thread paced_producer([&q, &num_popped, M]() {
+    for (int i = 0; i < M; ++i) {
+      while (num_popped.load() < i) { std::this_thread::yield(); }
+      q.Push(std::chrono::steady_clock::now());
+    }
+  });
+
+  for (int i = 0; i < M; ++i) {
+    while (!q.PopIfNonEmpty(t)) { std::this_thread::yield(); }
+    latency_us.at(i) = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t).count();
+    num_popped.store(i + 1);
+  }
+  paced_producer.join();
+
+  std::sort(latency_us.begin(), latency_us.end());
+  printf("[ %s ] %.2f M items/sec, p50=%.3f us, p99=%.3f us\n", name.c_str(),
+      1e-6 * N / elapsed_sec, latency_us.at(M / 2), latency_us.at(99 * M / 100));
+}
+
+
+TEST(SpscRingBufferTest, TestBenchmark)
+{
+  // Large enough that nothing is dropped at full speed.
+  ThreadsafeQueue<std::chrono::steady_clock::time_point> mutex_queue(0, true);
+  SpscRingBuffer<std::chrono::steady_clock::time_point> ring_queue(1 << 18, true);
+
+  BenchmarkQueue(mutex_queue, "ThreadsafeQueue");
+  BenchmarkQueue(ring_queue, "SpscRingBuffer");
+}
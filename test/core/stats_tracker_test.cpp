@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "core/timer.hpp"
+#include "core/stats_tracker.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+// A loop like StateEstimator::FilterLoop(): sleeps on a condition variable until there is work, then
+// records how long it was idle and busy. Each wakeup is acknowledged before the next one is sent, so
+// the number of loops is exact.
+TEST(StatsTrackerTest, TestBusyIdle)
+{
+  StatsTracker stats("StatsTrackerTest", 10);
+
+  const BusyIdleCounter empty = stats.GetBusyIdle("Loop");
+  EXPECT_EQ(0, empty.num_loops);
+  EXPECT_EQ(0, empty.busy_ms);
+  EXPECT_EQ(0, empty.idle_ms);
+  EXPECT_EQ(0, empty.BusyFraction());
+
+  std::mutex mutex;
+  std::condition_variable wakeup_cv, done_cv;
+  bool has_work = false;
+  bool is_shutdown = false;
+  int num_done = 0;
+
+  const int busy_ms = 5;
+
+  std::thread worker([&]() {
+    while (true) {
+      Timer idle_timer(true);
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeup_cv.wait(lock, [&]{ return has_work || is_shutdown; });
+        if (is_shutdown) { break; }
+        has_work = false;
+      }
+      const double idle_ms = idle_timer.Elapsed().milliseconds();
+
+      Timer busy_timer(true);
+      std::this_thread::sleep_for(std::chrono::milliseconds(busy_ms));
+      stats.AddBusyIdle("Loop", busy_timer.Elapsed().milliseconds(), idle_ms);
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++num_done;
+      }
+      done_cv.notify_one();
+    }
+  });
+
+  const int num_wakeups = 4;
+  for (int i = 0; i < num_wakeups; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      has_work = true;
+    }
+    wakeup_cv.notify_one();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&]{ return num_done == (i + 1); });
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    is_shutdown = true;
+  }
+  wakeup_cv.notify_one();
+  worker.join();
+
+  const BusyIdleCounter counter = stats.GetBusyIdle("Loop");
+  EXPECT_EQ(num_wakeups, counter.num_loops);
+  EXPECT_GE(counter.busy_ms, 0.9 * num_wakeups * busy_ms);
+  EXPECT_GT(counter.idle_ms, 0);
+  EXPECT_GT(counter.BusyFraction(), 0);
+  EXPECT_LT(counter.BusyFraction(), 1);
+
+  // Other names are counted separately.
+  EXPECT_EQ(0, stats.GetBusyIdle("OtherLoop").num_loops);
+
+  // Printing resets the counter.
+  stats.PrintBusyIdle("Loop");
+  EXPECT_EQ(0, stats.GetBusyIdle("Loop").num_loops);
+  EXPECT_EQ(0, stats.GetBusyIdle("Loop").busy_ms);
+
+  stats.AddBusyIdle("Loop", 1.0, 3.0);
+  EXPECT_EQ(1, stats.GetBusyIdle("Loop").num_loops);
+  EXPECT_DOUBLE_EQ(0.25, stats.GetBusyIdle("Loop").BusyFraction());
+}
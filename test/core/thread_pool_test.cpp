@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <vector>
+
+#include "core/thread_pool.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(ThreadPoolTest, TestEnqueue)
+{
+  ThreadPool pool(2, "test");
+  EXPECT_EQ(2ul, pool.NumThreads());
+
+  std::atomic<int> count(0);
+  std::vector<std::future<void>> futures;
+  for (int i = 0; i < 100; ++i) {
+    futures.emplace_back(pool.Enqueue([&count]() { ++count; }));
+  }
+
+  for (std::future<void>& f : futures) {
+    f.wait();
+  }
+  EXPECT_EQ(100, count.load());
+}
+
+
+TEST(ThreadPoolTest, TestParallelFor)
+{
+  // Zero workers means that everything runs on the calling thread.
+  for (size_t num_threads : { 0ul, 1ul, 3ul }) {
+    ThreadPool pool(num_threads);
+
+    std::vector<int> out(1000, 0);
+    pool.ParallelFor(out.size(), [&out](size_t i) { out.at(i) = static_cast<int>(i * i); });
+
+    for (size_t i = 0; i < out.size(); ++i) {
+      EXPECT_EQ(static_cast<int>(i * i), out.at(i));
+    }
+
+    // Nothing to do should return right away.
+    pool.ParallelFor(0, [](size_t) { FAIL(); });
+  }
+}
+
+
+TEST(ThreadPoolTest, TestNestedParallelFor)
+{
+  ThreadPool pool(2);
+
+  // Every worker is busy with an outer task here, so the inner loops can only finish if the
+  // calling thread does their work.
+  std::vector<std::vector<int>> out(4, std::vector<int>(50, 0));
+  pool.ParallelFor(out.size(), [&pool, &out](size_t i)
+  {
+    pool.ParallelFor(out.at(i).size(), [&out, i](size_t j) { out.at(i).at(j) = static_cast<int>(i + j); });
+  });
+
+  for (size_t i = 0; i < out.size(); ++i) {
+    for (size_t j = 0; j < out.at(i).size(); ++j) {
+      EXPECT_EQ(static_cast<int>(i + j), out.at(i).at(j));
+    }
+  }
+}
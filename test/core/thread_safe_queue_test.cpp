@@ -0,0 +1,41 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "core/timer.hpp"
+#include "core/thread_safe_queue.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+// Checks that WaitPop() times out, wakes up when an item arrives, and is interrupted by Shutdown().
+TEST(ThreadsafeQueueTest, TestWaitAndShutdown)
+{
+  ThreadsafeQueue<int> q(10, true);
+
+  int item = 0;
+  Timer timer(true);
+  EXPECT_FALSE(q.WaitPop(item, 0.05));
+  EXPECT_GE(timer.Elapsed().seconds(), 0.04);
+
+  std::thread producer([&q]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.Push(123);
+  });
+  EXPECT_TRUE(q.WaitPop(item, 5.0));
+  EXPECT_EQ(123, item);
+  producer.join();
+
+  std::thread stopper([&q]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    q.Shutdown();
+  });
+  timer.Reset();
+  EXPECT_FALSE(q.WaitUntilNonEmpty(5.0));
+  EXPECT_LT(timer.Elapsed().seconds(), 1.0);
+  stopper.join();
+
+  // Waits return immediately after shutdown.
+  EXPECT_FALSE(q.WaitPop(item, 5.0));
+}
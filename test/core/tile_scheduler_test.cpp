@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "core/tile_scheduler.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+TEST(TileSchedulerTest, TestEachTileOnce)
+{
+  ThreadPool pool(3);
+
+  for (ThreadPool* p : { static_cast<ThreadPool*>(nullptr), &pool }) {
+    TileScheduler scheduler(p);
+
+    for (TileScheduler::Order order : { TileScheduler::Order::ANY,
+                                        TileScheduler::Order::WAVEFRONT_FORWARD,
+                                        TileScheduler::Order::WAVEFRONT_REVERSE }) {
+      const int rows = 7;
+      const int cols = 11;
+      std::vector<std::atomic<int>> count(rows * cols);
+      for (std::atomic<int>& c : count) { c.store(0); }
+
+      scheduler.Run(rows, cols, order, [&count, cols](int r, int c) { ++count.at(r * cols + c); });
+
+      for (const std::atomic<int>& c : count) {
+        EXPECT_EQ(1, c.load());
+      }
+    }
+
+    // Nothing to do should return right away.
+    scheduler.Run(0, 5, TileScheduler::Order::ANY, [](int, int) { FAIL(); });
+  }
+}
+
+
+TEST(TileSchedulerTest, TestWavefrontDependencies)
+{
+  ThreadPool pool(3);
+  TileScheduler scheduler(&pool);
+
+  const int rows = 9;
+  const int cols = 13;
+
+  // Each tile checks that the tiles it depends on are already done.
+  for (int trial = 0; trial < 20; ++trial) {
+    std::vector<std::atomic<bool>> done(rows * cols);
+    for (std::atomic<bool>& d : done) { d.store(false); }
+    std::atomic<int> num_violations(0);
+
+    scheduler.Run(rows, cols, TileScheduler::Order::WAVEFRONT_FORWARD, [&](int r, int c)
+    {
+      if ((r > 0 && !done.at((r - 1) * cols + c)) || (c > 0 && !done.at(r * cols + c - 1))) {
+        ++num_violations;
+      }
+      done.at(r * cols + c) = true;
+    });
+    EXPECT_EQ(0, num_violations.load());
+
+    for (std::atomic<bool>& d : done) { d.store(false); }
+
+    scheduler.Run(rows, cols, TileScheduler::Order::WAVEFRONT_REVERSE, [&](int r, int c)
+    {
+      if ((r < (rows - 1) && !done.at((r + 1) * cols + c)) || (c < (cols - 1) && !done.at(r * cols + c + 1))) {
+        ++num_violations;
+      }
+      done.at(r * cols + c) = true;
+    });
+    EXPECT_EQ(0, num_violations.load());
+  }
+}
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+
+#include "feature_tracking/fast_detector.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+
+
+// A noisy image with some flat regions, so that there are corners and non-corners everywhere.
+static Image1b MakeTestImage(int rows, int cols)
+{
+  Image1b img(rows, cols, 0);
+  uint32_t state = 12345;
+  for (int y = 0; y < rows; ++y) {
+    for (int x = 0; x < cols; ++x) {
+      state = state * 1103515245u + 12345u;
+      const bool flat = ((x / 16) + (y / 16)) % 3 == 0;
+      img(y, x) = flat ? 128 : static_cast<uint8_t>(state >> 24);
+    }
+  }
+  return img;
+}
+
+
+// Straightforward FAST-9: look for 9 contiguous brighter (or darker) pixels on the circle.
+static bool IsCornerBruteForce(const Image1b& img, int x, int y, int threshold)
+{
+  static const int cx[16] = { 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3, -3, -3, -2, -1 };
+  static const int cy[16] = { -3, -3, -2, -1, 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3 };
+
+  const int c = img(y, x);
+  for (int sign = -1; sign <= 1; sign += 2) {
+    for (int start = 0; start < 16; ++start) {
+      int run = 0;
+      for (int i = 0; i < 9; ++i) {
+        const int j = (start + i) % 16;
+        const int v = img(y + cy[j], x + cx[j]);
+        if ((sign > 0 && v > c + threshold) || (sign < 0 && v < c - threshold)) { ++run; }
+      }
+      if (run == 9) { return true; }
+    }
+  }
+  return false;
+}
+
+
+static bool PointLess(const cv::Point2f& a, const cv::Point2f& b)
+{
+  return (a.y != b.y) ? (a.y < b.y) : (a.x < b.x);
+}
+
+
+TEST(FastDetectorTest, TestMatchesBruteForce)
+{
+  const Image1b img = MakeTestImage(120, 203);
+  const int threshold = 30;
+
+  // No quality threshold or spacing, so every FAST corner is returned.
+  FastDetector detector(threshold, 0.0, 0, 3, false, 0.04);
+
+  Image1b mask(img.rows, img.cols, 0);
+  for (int y = 0; y < img.rows; ++y) {
+    for (int x = 0; x < img.cols / 2; ++x) {
+      mask(y, x) = 255;
+    }
+  }
+
+  for (const bool use_mask : { false, true }) {
+    VecPoint2f expected;
+    for (int y = 3; y < img.rows - 3; ++y) {
+      for (int x = 3; x < img.cols - 3; ++x) {
+        if ((!use_mask || mask(y, x) != 0) && IsCornerBruteForce(img, x, y, threshold)) {
+          expected.emplace_back(x, y);
+        }
+      }
+    }
+    ASSERT_FALSE(expected.empty());
+
+    VecPoint2f corners;
+    detector.Detect(img, use_mask ? mask : Image1b(), 1000000, corners);
+
+    std::sort(corners.begin(), corners.end(), PointLess);
+    EXPECT_EQ(expected, corners);
+  }
+}
+
+
+TEST(FastDetectorTest, TestSelection)
+{
+  const Image1b img = MakeTestImage(120, 203);
+  const int min_distance = 8;
+  const int max_corners = 50;
+
+  FastDetector detector(30, 0.01, min_distance, 5, false, 0.04);
+
+  VecPoint2f corners;
+  detector.Detect(img, Image1b(), max_corners, corners);
+  EXPECT_EQ(max_corners, (int)corners.size());
+
+  for (size_t i = 0; i < corners.size(); ++i) {
+    for (size_t j = i + 1; j < corners.size(); ++j) {
+      const float dx = corners[i].x - corners[j].x;
+      const float dy = corners[i].y - corners[j].y;
+      EXPECT_GE(dx*dx + dy*dy, min_distance * min_distance);
+    }
+  }
+
+  // Scratch buffers are reused, so a second call should give the same result.
+  VecPoint2f corners2;
+  detector.Detect(img, Image1b(), max_corners, corners2);
+  EXPECT_EQ(corners, corners2);
+}
@@ -1,11 +1,15 @@
 #include <gtest/gtest.h>
 #include <glog/logging.h>
 
+#include <numeric>
+
 #include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
 
 #include "vision_core/cv_types.hpp"
 #include "core/timer.hpp"
 #include "feature_tracking/feature_detector.hpp"
+#include "feature_tracking/subpixel.hpp"
 #include "feature_tracking/visualization_2d.hpp"
 #include "dataset/euroc_dataset.hpp"
 
@@ -74,3 +78,207 @@ TEST(DetectorTest, TestDetectSequence)
   dataset.Playback(5.0f, false);
   LOG(INFO) << "DONE" << std::endl;
 }
+
+
+// Fraction of coverage_rows x coverage_cols cells that contain at least one keypoint.
+static double SpatialCoverage(const VecPoint2f& kps, const cv::Size& size, int coverage_rows, int coverage_cols)
+{
+  std::vector<uint8_t> covered(coverage_rows * coverage_cols, 0);
+  for (const cv::Point2f& kp : kps) {
+    const int cx = std::min(coverage_cols - 1, static_cast<int>(kp.x * coverage_cols / size.width));
+    const int cy = std::min(coverage_rows - 1, static_cast<int>(kp.y * coverage_rows / size.height));
+    covered.at(cy * coverage_cols + cx) = 1;
+  }
+  return std::accumulate(covered.begin(), covered.end(), 0.0) / covered.size();
+}
+
+
+// Compares whole-image GFTT + ANMS to grid detection at 752x480 (the Farmsim resolution). The target
+// for grid detection is < 3 ms per keyframe. Like the other benchmarks, the time is only printed,
+// since it depends on the machine (and on grid_num_threads cores being free).
+TEST(DetectorTest, TestBenchmarkGridDetection)
+{
+  Image1b img = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  ASSERT_FALSE(img.empty());
+  cv::resize(img, img, cv::Size(752, 480));
+
+  FeatureDetector::Params params;
+  FeatureDetector detector_anms(params);
+
+  params.grid_detection = true;
+  FeatureDetector detector_grid(params);
+
+  // Pretend that half of the ANMS keypoints are already being tracked.
+  VecPoint2f all_kp;
+  detector_anms.Detect(img, VecPoint2f(), all_kp);
+  const VecPoint2f tracked_kp(all_kp.begin(), all_kp.begin() + all_kp.size() / 2);
+
+  VecPoint2f anms_kp, grid_kp;
+  const int iters = 100;
+
+  Timer timer(true);
+  for (int i = 0; i < iters; ++i) {
+    detector_anms.Detect(img, tracked_kp, anms_kp);
+  }
+  const double ms_anms = timer.Tock().milliseconds() / iters;
+
+  timer.Reset();
+  for (int i = 0; i < iters; ++i) {
+    detector_grid.Detect(img, tracked_kp, grid_kp);
+  }
+  const double ms_grid = timer.Tock().milliseconds() / iters;
+
+  // New keypoints shouldn't be close to tracked ones (allowing for the coarse occupancy cells).
+  const double min_dist = 0.75 * params.min_distance_btw_tracked_and_detected_features;
+  for (const cv::Point2f& kp : grid_kp) {
+    for (const cv::Point2f& tkp : tracked_kp) {
+      ASSERT_GT(cv::norm(kp - tkp), min_dist);
+    }
+  }
+
+  // New keypoints should be spaced out from each other too, including across cell borders.
+  for (size_t i = 0; i < grid_kp.size(); ++i) {
+    for (size_t j = i + 1; j < grid_kp.size(); ++j) {
+      ASSERT_GT(cv::norm(grid_kp.at(i) - grid_kp.at(j)), min_dist);
+    }
+  }
+
+  EXPECT_LE(grid_kp.size(), params.max_features_per_frame - tracked_kp.size());
+
+  VecPoint2f anms_all(tracked_kp), grid_all(tracked_kp);
+  anms_all.insert(anms_all.end(), anms_kp.begin(), anms_kp.end());
+  grid_all.insert(grid_all.end(), grid_kp.begin(), grid_kp.end());
+  const double coverage_anms = SpatialCoverage(anms_all, img.size(), 12, 16);
+  const double coverage_grid = SpatialCoverage(grid_all, img.size(), 12, 16);
+  EXPECT_GE(coverage_grid, 0.95 * coverage_anms);
+
+  printf("[ FeatureDetector ] ANMS: %zu kp, %.3f ms, coverage=%.2f | Grid: %zu kp, %.3f ms, coverage=%.2f (target < 3 ms: %s)\n",
+      anms_kp.size(), ms_anms, coverage_anms, grid_kp.size(), ms_grid, coverage_grid, ms_grid < 3.0 ? "met" : "NOT met");
+}
+
+
+// When there are more corners than max_features_per_frame, the weakest ones in the whole image
+// should be dropped, not the ones from the last cells.
+TEST(DetectorTest, TestGridTruncatesByScore)
+{
+  // One square per cell, with contrast increasing from the first cell to the last.
+  const int rows = 4, cols = 6, cell_size = 100;
+  Image1b img = Image1b::zeros(rows * cell_size, cols * cell_size);
+  for (int i = 0; i < rows * cols; ++i) {
+    const cv::Point center((i % cols) * cell_size + cell_size / 2, (i / cols) * cell_size + cell_size / 2);
+    cv::rectangle(img, center - cv::Point(15, 15), center + cv::Point(15, 15), cv::Scalar(10 + 10 * i), -1);
+  }
+
+  FeatureDetector::Params params;
+  params.grid_detection = true;
+  params.grid_rows = rows;
+  params.grid_cols = cols;
+  params.subpixel_corners = false;
+  params.max_features_per_frame = rows * cols / 2;
+  FeatureDetector detector(params);
+
+  VecPoint2f new_kp;
+  detector.Detect(img, VecPoint2f(), new_kp);
+  ASSERT_EQ(params.max_features_per_frame, (int)new_kp.size());
+
+  // The strongest corners are all in the bottom half of the image.
+  for (const cv::Point2f& kp : new_kp) {
+    EXPECT_GE(kp.y, rows * cell_size / 2);
+  }
+}
+
+
+// Compares the in-tree FAST detector to GFTT + ANMS, with and without tracked keypoints masking
+// out parts of the image.
+TEST(DetectorTest, TestBenchmarkFastVsGftt)
+{
+  Image1b img = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  ASSERT_FALSE(img.empty());
+  cv::resize(img, img, cv::Size(752, 480));
+
+  FeatureDetector::Params params;
+  FeatureDetector detector_gftt(params);
+
+  params.algorithm = FeatureAlgorithm::FAST;
+  FeatureDetector detector_fast(params);
+
+  VecPoint2f all_kp;
+  detector_gftt.Detect(img, VecPoint2f(), all_kp);
+  const VecPoint2f tracked_kp(all_kp.begin(), all_kp.begin() + all_kp.size() / 2);
+
+  const int iters = 100;
+  Timer timer(false);
+
+  for (const VecPoint2f& tracked : { VecPoint2f(), tracked_kp }) {
+    VecPoint2f gftt_kp, fast_kp;
+
+    timer.Reset();
+    for (int i = 0; i < iters; ++i) {
+      detector_gftt.Detect(img, tracked, gftt_kp);
+    }
+    const double ms_gftt = timer.Tock().milliseconds() / iters;
+
+    timer.Reset();
+    for (int i = 0; i < iters; ++i) {
+      detector_fast.Detect(img, tracked, fast_kp);
+    }
+    const double ms_fast = timer.Tock().milliseconds() / iters;
+
+    EXPECT_GT(fast_kp.size(), 0ul);
+    EXPECT_LE(fast_kp.size(), params.max_features_per_frame - tracked.size());
+
+    printf("[ FeatureDetector ] %zu tracked | GFTT: %zu kp, %.3f ms | FAST: %zu kp, %.3f ms\n",
+        tracked.size(), gftt_kp.size(), ms_gftt, fast_kp.size(), ms_fast);
+  }
+}
+
+
+// Compares batched subpixel refinement to calling cv::cornerSubPix for one keypoint at a time.
+TEST(DetectorTest, TestBenchmarkSubpixel)
+{
+  Image1b img = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  ASSERT_FALSE(img.empty());
+  cv::resize(img, img, cv::Size(752, 480));
+
+  FeatureDetector::Params params;
+  params.subpixel_corners = false;
+  FeatureDetector detector(params);
+
+  VecPoint2f kp;
+  detector.Detect(img, VecPoint2f(), kp);
+  ASSERT_FALSE(kp.empty());
+
+  const cv::TermCriteria criteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 10, 0.01);
+  const int iters = 50;
+
+  VecPoint2f kp_cv, kp_batch;
+
+  Timer timer(true);
+  for (int i = 0; i < iters; ++i) {
+    kp_cv = kp;
+    for (cv::Point2f& pt : kp_cv) {
+      VecPoint2f one = { pt };
+      cv::cornerSubPix(img, one, cv::Size(10, 10), cv::Size(-1, -1), criteria);
+      pt = one.at(0);
+    }
+  }
+  const double ms_cv = timer.Tock().milliseconds() / iters;
+
+  timer.Reset();
+  for (int i = 0; i < iters; ++i) {
+    kp_batch = kp;
+    RefineCornersSubpixel(img, 10, 10, kp_batch);
+  }
+  const double ms_batch = timer.Tock().milliseconds() / iters;
+
+  // The models are the same except for cv::cornerSubPix's Gaussian weighting, so they should mostly agree.
+  double total_diff = 0;
+  for (size_t i = 0; i < kp.size(); ++i) {
+    total_diff += cv::norm(kp_cv.at(i) - kp_batch.at(i));
+  }
+  const double avg_diff = total_diff / kp.size();
+  EXPECT_LT(avg_diff, 0.5);
+
+  printf("[ FeatureDetector ] Subpixel refinement of %zu kp: cv::cornerSubPix=%.3f ms batched=%.3f ms (avg diff %.3f px)\n",
+      kp.size(), ms_cv, ms_batch, avg_diff);
+}
@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 #include <glog/logging.h>
 
+#include <cmath>
+
 #include <opencv2/highgui.hpp>
 
 #include "vision_core/cv_types.hpp"
@@ -38,3 +40,183 @@ TEST(TrackerTest, TestTrackLR)
   cv::imshow("Tracker", viz);
   cv::waitKey(0);
 }
+
+
+TEST(TrackerTest, TestPrebuiltPyramids)
+{
+  FeatureDetector::Params dopt;
+  FeatureTracker::Params topt;
+  FeatureDetector detector(dopt);
+  FeatureTracker tracker(topt);
+  const Image1b iml = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  const Image1b imr = cv::imread("./resources/farmsim_01_right.png", cv::IMREAD_GRAYSCALE);
+
+  VecPoint2f empty_kp, left_kp;
+  detector.Detect(iml, empty_kp, left_kp);
+
+  VecPoint2f right_kp;
+  std::vector<uchar> status;
+  std::vector<float> error;
+  Timer timer(true);
+  tracker.Track(iml, imr, left_kp, right_kp, status, error, true);
+  const double ms_images = timer.Tock().milliseconds();
+
+  // Tracking with prebuilt pyramids should give exactly the same result.
+  ImagePyramid pyrl, pyrr;
+  timer.Reset();
+  tracker.BuildPyramid(iml, pyrl);
+  tracker.BuildPyramid(imr, pyrr);
+  const double ms_build = timer.Tock().milliseconds();
+
+  VecPoint2f right_kp_pyr;
+  std::vector<uchar> status_pyr;
+  std::vector<float> error_pyr;
+  timer.Reset();
+  tracker.Track(pyrl, pyrr, left_kp, right_kp_pyr, status_pyr, error_pyr, true);
+  const double ms_pyramids = timer.Tock().milliseconds();
+
+  ASSERT_EQ(right_kp.size(), right_kp_pyr.size());
+  for (size_t i = 0; i < right_kp.size(); ++i) {
+    EXPECT_EQ(status.at(i), status_pyr.at(i));
+    if (status.at(i)) {
+      EXPECT_NEAR(right_kp.at(i).x, right_kp_pyr.at(i).x, 1e-3);
+      EXPECT_NEAR(right_kp.at(i).y, right_kp_pyr.at(i).y, 1e-3);
+    }
+  }
+
+  printf("[ FeatureTracker ] images=%.3f ms build pyramids=%.3f ms prebuilt pyramids=%.3f ms\n",
+      ms_images, ms_build, ms_pyramids);
+}
+
+
+TEST(TrackerTest, TestPredictPixelsFromRotation)
+{
+  const PinholeCamera cam(400.0, 400.0, 320.0, 240.0, 480, 640);
+  const VecPoint2f px_ref = { cv::Point2f(320, 240), cv::Point2f(100, 50) };
+
+  // No rotation should leave the points exactly where they are.
+  VecPoint2f px_cur;
+  PredictPixelsFromRotation(cam, Matrix3d::Identity(), px_ref, px_cur);
+  ASSERT_EQ(px_ref.size(), px_cur.size());
+  EXPECT_EQ(px_ref.at(0), px_cur.at(0));
+  EXPECT_EQ(px_ref.at(1), px_cur.at(1));
+
+  // Yawing the camera right (about +y) moves the principal point left by fx * tan(angle).
+  const double angle = 0.1;
+  const Matrix3d ref_R_cur = AngleAxisd(angle, Vector3d::UnitY()).toRotationMatrix();
+  PredictPixelsFromRotation(cam, ref_R_cur, px_ref, px_cur);
+  EXPECT_NEAR(320.0 - 400.0 * std::tan(angle), px_cur.at(0).x, 1e-3);
+  EXPECT_NEAR(240.0, px_cur.at(0).y, 1e-3);
+
+  // Rotating back should undo the prediction.
+  VecPoint2f px_back;
+  PredictPixelsFromRotation(cam, ref_R_cur.transpose(), px_cur, px_back);
+  EXPECT_NEAR(px_ref.at(1).x, px_back.at(1).x, 1e-3);
+  EXPECT_NEAR(px_ref.at(1).y, px_back.at(1).y, 1e-3);
+}
+
+
+// Compares KLT with and without a gyro-predicted initial guess on consecutive Farmsim images.
+// NOTE(milo): OpenCV doesn't report iterations or pyramid levels per point, so this reports how far
+// KLT had to move each point from its initial guess, and the pyramid level that distance requires.
+TEST(TrackerTest, TestBenchmarkGyroPrior)
+{
+  LOG(WARNING) << "This test has a hardcoded path! May not work." << std::endl;
+
+  const std::string toplevel_folder = "/home/milo/datasets/Unity3D/farmsim/euroc_test1";
+  dataset::EurocDataset dataset(toplevel_folder);
+
+  std::vector<StereoImage1b> stereo_pairs;
+  std::vector<ImuMeasurement> imu_data;
+  dataset::StereoCallback1b stereo_cb = [&stereo_pairs](const StereoImage1b& p) { stereo_pairs.emplace_back(p); };
+  dataset::ImuCallback imu_cb = [&imu_data](const ImuMeasurement& m) { imu_data.emplace_back(m); };
+  dataset.RegisterStereoCallback(stereo_cb);
+  dataset.RegisterImuCallback(imu_cb);
+
+  while (stereo_pairs.size() < 300 && dataset.Step(false)) {}
+  ASSERT_GE(stereo_pairs.size(), 2ul);
+
+  // NOTE(milo): In Farmsim, the IMU, body and camera frames all have the same orientation.
+  const PinholeCamera cam(336.135986, 336.135986, 335.5, 187.5, 376, 672);
+
+  FeatureDetector::Params dopt;
+  FeatureTracker::Params topt;
+  FeatureDetector detector(dopt);
+  FeatureTracker tracker(topt);
+
+  // Pyramid level needed to find a point that is "dist" pixels from its initial guess.
+  const auto level_needed = [&topt](double dist)
+  {
+    int level = 0;
+    while (dist > 0.5 * topt.klt_winsize && level < topt.klt_max_level) {
+      dist *= 0.5;
+      ++level;
+    }
+    return level;
+  };
+
+  size_t num_points = 0;
+  size_t num_tracked_zero = 0, num_tracked_gyro = 0;
+  double sum_dist_zero = 0, sum_dist_gyro = 0;
+  double sum_level_zero = 0, sum_level_gyro = 0;
+  size_t imu_idx = 0;
+
+  for (size_t i = 1; i < stereo_pairs.size(); ++i) {
+    const Image1b& ref_img = stereo_pairs.at(i-1).left_image;
+    const Image1b& cur_img = stereo_pairs.at(i).left_image;
+
+    // Integrate the gyro between the two images.
+    Matrix3d ref_R_cur = Matrix3d::Identity();
+    for (; imu_idx < imu_data.size() && imu_data.at(imu_idx).timestamp <= stereo_pairs.at(i).timestamp; ++imu_idx) {
+      if (imu_idx == 0 || imu_data.at(imu_idx - 1).timestamp < stereo_pairs.at(i-1).timestamp) {
+        continue;
+      }
+      const ImuMeasurement& m = imu_data.at(imu_idx);
+      const double dt = ConvertToSeconds(m.timestamp - imu_data.at(imu_idx - 1).timestamp);
+      const double angle = m.w.norm() * dt;
+      if (angle > 0) {
+        ref_R_cur = ref_R_cur * AngleAxisd(angle, m.w.normalized()).toRotationMatrix();
+      }
+    }
+
+    VecPoint2f empty_kp, ref_kp;
+    detector.Detect(ref_img, empty_kp, ref_kp);
+    if (ref_kp.empty()) {
+      continue;
+    }
+
+    VecPoint2f px_zero, px_guess, px_gyro;
+    std::vector<uchar> status_zero, status_gyro;
+    std::vector<float> error;
+    tracker.Track(ref_img, cur_img, ref_kp, px_zero, status_zero, error, true);
+
+    PredictPixelsFromRotation(cam, ref_R_cur, ref_kp, px_guess);
+    px_gyro = px_guess;
+    tracker.Track(ref_img, cur_img, ref_kp, px_gyro, status_gyro, error, true);
+
+    for (size_t j = 0; j < ref_kp.size(); ++j) {
+      ++num_points;
+      if (status_zero.at(j)) {
+        ++num_tracked_zero;
+        const double dist = cv::norm(px_zero.at(j) - ref_kp.at(j));
+        sum_dist_zero += dist;
+        sum_level_zero += level_needed(dist);
+      }
+      if (status_gyro.at(j)) {
+        ++num_tracked_gyro;
+        const double dist = cv::norm(px_gyro.at(j) - px_guess.at(j));
+        sum_dist_gyro += dist;
+        sum_level_gyro += level_needed(dist);
+      }
+    }
+  }
+
+  ASSERT_GT(num_points, 0ul);
+  printf("[ FeatureTracker ] %zu points over %zu frames\n", num_points, stereo_pairs.size() - 1);
+  printf("[ FeatureTracker ] zero motion guess: survival=%.1f%% mean correction=%.2f px mean level needed=%.2f\n",
+      100.0 * num_tracked_zero / num_points, sum_dist_zero / std::max(1ul, num_tracked_zero),
+      sum_level_zero / std::max(1ul, num_tracked_zero));
+  printf("[ FeatureTracker ] gyro guess:        survival=%.1f%% mean correction=%.2f px mean level needed=%.2f\n",
+      100.0 * num_tracked_gyro / num_points, sum_dist_gyro / std::max(1ul, num_tracked_gyro),
+      sum_level_gyro / std::max(1ul, num_tracked_gyro));
+}
@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+
+#include "feature_tracking/landmark_track_store.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+
+
+static LandmarkObservation MakeObs(core::uid_t lmk_id, core::uid_t camera_id)
+{
+  return LandmarkObservation(lmk_id, camera_id, cv::Point2f(camera_id, lmk_id), 10.0 + camera_id, 0.0, 0.0);
+}
+
+
+TEST(LandmarkTrackStoreTest, TestRingOfObservations)
+{
+  LandmarkTrackStore store(3);
+  EXPECT_TRUE(store.empty());
+
+  store.AddLandmark(MakeObs(7, 0));
+  EXPECT_EQ(1ul, store.size());
+  EXPECT_EQ(1ul, store.count(7));
+  EXPECT_EQ(0ul, store.count(8));
+  EXPECT_EQ(1ul, store.at(7).size());
+
+  for (core::uid_t cam = 1; cam < 5; ++cam) {
+    store.AddObservation(MakeObs(7, cam));
+  }
+
+  // Only the last 3 observations are kept, but all of them are counted.
+  const LandmarkTrackStore::TrackView track = store.at(7);
+  EXPECT_EQ(7ul, track.LandmarkId());
+  ASSERT_EQ(3ul, track.size());
+  EXPECT_EQ(5ul, track.NumObservations());
+  EXPECT_EQ(2ul, track.front().camera_id);
+  EXPECT_EQ(3ul, track.at(1).camera_id);
+  EXPECT_EQ(4ul, track.back().camera_id);
+
+  // The latest observation is mirrored in the flat arrays.
+  EXPECT_EQ(4ul, store.LatestCameraIds().at(0));
+  EXPECT_EQ(14.0, store.LatestDisparities().at(0));
+  EXPECT_EQ(cv::Point2f(4, 7), store.LatestPixels().at(0));
+}
+
+
+TEST(LandmarkTrackStoreTest, TestSlotReuse)
+{
+  LandmarkTrackStore store(4);
+
+  for (core::uid_t lmk_id = 0; lmk_id < 5; ++lmk_id) {
+    store.AddLandmark(MakeObs(lmk_id, 0));
+  }
+  EXPECT_EQ(5ul, store.NumSlots());
+
+  store.Kill(1);
+  store.Kill(3);
+  store.Kill(100);    // Not live, should do nothing.
+  EXPECT_EQ(3ul, store.size());
+  EXPECT_EQ(0ul, store.count(1));
+
+  // Iteration skips the dead slots.
+  std::vector<core::uid_t> live_ids;
+  for (const LandmarkTrackStore::TrackView track : store) {
+    live_ids.emplace_back(track.LandmarkId());
+  }
+  EXPECT_EQ(std::vector<core::uid_t>({ 0, 2, 4 }), live_ids);
+
+  // New landmarks reuse the freed slots, and don't inherit any old observations.
+  store.AddLandmark(MakeObs(5, 1));
+  store.AddLandmark(MakeObs(6, 1));
+  store.AddLandmark(MakeObs(7, 1));
+  EXPECT_EQ(6ul, store.NumSlots());
+  EXPECT_EQ(6ul, store.size());
+  EXPECT_EQ(1ul, store.at(5).size());
+  EXPECT_EQ(1ul, store.at(6).NumObservations());
+  EXPECT_EQ(1ul, store.at(6).back().camera_id);
+
+  // Churning through many landmarks shouldn't grow the store.
+  for (core::uid_t lmk_id = 8; lmk_id < 1000; ++lmk_id) {
+    store.Kill(lmk_id - 1);
+    store.AddLandmark(MakeObs(lmk_id, lmk_id));
+  }
+  EXPECT_EQ(6ul, store.NumSlots());
+  EXPECT_EQ(6ul, store.size());
+}
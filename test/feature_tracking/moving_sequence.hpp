@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include <glog/logging.h>
+#include <opencv2/imgcodecs.hpp>
+
+#include "vision_core/cv_types.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "vision_core/stereo_image.hpp"
+#include "core/uid.hpp"
+
+namespace bm {
+namespace ft {
+
+
+// A moving camera, made from the farmsim stereo pair: each frame is a crop of both images, and the
+// crop slides around smoothly (up to ~2 px per frame). Both images are cropped the same way, so they
+// stay rectified. The crops point into the original images, like images that wrap a buffer.
+inline std::vector<core::StereoImage1b> MakeMovingSequence(int num_frames, core::StereoCamera& stereo_rig)
+{
+  const core::Image1b iml = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  const core::Image1b imr = cv::imread("./resources/farmsim_01_right.png", cv::IMREAD_GRAYSCALE);
+  CHECK(!iml.empty() && !imr.empty()) << "Couldn't load the farmsim images" << std::endl;
+
+  const int border_x = 16;
+  const int border_y = 12;
+  const cv::Size crop_size(iml.cols - 2 * border_x, iml.rows - 2 * border_y);
+
+  const core::PinholeCamera camera_model(336.135986, 336.135986, 335.5 - border_x, 187.5 - border_y,
+                                         crop_size.height, crop_size.width);
+  stereo_rig = core::StereoCamera(camera_model, 0.2);
+
+  std::vector<core::StereoImage1b> sequence;
+  for (int i = 0; i < num_frames; ++i) {
+    const int x = border_x + static_cast<int>(std::round((border_x - 2) * std::sin(2.0 * M_PI * i / 48.0)));
+    const int y = border_y + static_cast<int>(std::round((border_y - 2) * std::sin(2.0 * M_PI * i / 30.0)));
+    const cv::Rect crop(cv::Point(x, y), crop_size);
+    sequence.emplace_back(0, static_cast<core::uid_t>(i), iml(crop), imr(crop));
+  }
+
+  return sequence;
+}
+
+
+}
+}
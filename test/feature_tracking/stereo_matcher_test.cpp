@@ -1,8 +1,11 @@
 #include <gtest/gtest.h>
 #include <glog/logging.h>
 
+#include <cmath>
+
 #include <opencv2/highgui.hpp>
 
+#include "core/timer.hpp"
 #include "feature_tracking/visualization_2d.hpp"
 #include "feature_tracking/feature_detector.hpp"
 #include "feature_tracking/stereo_matcher.hpp"
@@ -68,3 +71,162 @@ TEST(MatcherTest, TestSequence)
   dataset.Playback(5.0f, false);
   LOG(INFO) << "DONE" << std::endl;
 }
+
+
+// Returns the disparities from calling the single-keypoint (cv::matchTemplate) version in a loop.
+static std::vector<double> MatchEachKeypoint(StereoMatcher& matcher,
+                                             const Image1b& iml,
+                                             const Image1b& imr,
+                                             const VecPoint2f& left_keypoints)
+{
+  std::vector<double> out(left_keypoints.size(), -1.0);
+  for (size_t i = 0; i < left_keypoints.size(); ++i) {
+    out.at(i) = matcher.MatchRectified(iml, imr, left_keypoints.at(i));
+  }
+  return out;
+}
+
+
+TEST(MatcherTest, TestBatchedMatchesTemplate)
+{
+  // NOTE(milo): Compare integer disparities here, see TestBatchedSubpixel for the refined ones.
+  StereoMatcher::Params opt;
+  opt.subpixel_refinement = false;
+  StereoMatcher matcher(opt);
+
+  opt.num_threads = 4;
+  StereoMatcher matcher_mt(opt);
+
+  FeatureDetector::Params dopt;
+  FeatureDetector detector(dopt);
+
+  const Image1b iml = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  const Image1b imr = cv::imread("./resources/farmsim_01_right.png", cv::IMREAD_GRAYSCALE);
+
+  VecPoint2f empty_kp, left_keypoints;
+  detector.Detect(iml, empty_kp, left_keypoints);
+  ASSERT_FALSE(left_keypoints.empty());
+
+  const std::vector<double> expected = MatchEachKeypoint(matcher, iml, imr, left_keypoints);
+  const std::vector<double> disp = matcher.MatchRectified(iml, imr, left_keypoints);
+  const std::vector<double> disp_mt = matcher_mt.MatchRectified(iml, imr, left_keypoints);
+
+  ASSERT_EQ(expected.size(), disp.size());
+  ASSERT_EQ(expected.size(), disp_mt.size());
+
+  // NOTE(milo): cv::matchTemplate accumulates in float, so a near-tie could go either way.
+  size_t num_same = 0;
+  for (size_t i = 0; i < expected.size(); ++i) {
+    num_same += (std::fabs(expected.at(i) - disp.at(i)) < 1e-3) ? 1 : 0;
+    EXPECT_EQ(disp.at(i), disp_mt.at(i));
+  }
+  EXPECT_GE(num_same, static_cast<size_t>(0.98 * expected.size()));
+}
+
+
+
+// With subpixel refinement, both versions fit a parabola to the same costs, so they should agree
+// up to cv::matchTemplate's float precision.
+TEST(MatcherTest, TestBatchedSubpixel)
+{
+  StereoMatcher::Params opt;
+  opt.subpixel_refinement = true;
+  StereoMatcher matcher(opt);
+
+  FeatureDetector::Params dopt;
+  FeatureDetector detector(dopt);
+
+  const Image1b iml = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  const Image1b imr = cv::imread("./resources/farmsim_01_right.png", cv::IMREAD_GRAYSCALE);
+
+  VecPoint2f empty_kp, left_keypoints;
+  detector.Detect(iml, empty_kp, left_keypoints);
+  ASSERT_FALSE(left_keypoints.empty());
+
+  const std::vector<double> expected = MatchEachKeypoint(matcher, iml, imr, left_keypoints);
+  const std::vector<double> disp = matcher.MatchRectified(iml, imr, left_keypoints);
+  ASSERT_EQ(expected.size(), disp.size());
+
+  size_t num_same = 0;
+  size_t num_fractional = 0;
+  for (size_t i = 0; i < expected.size(); ++i) {
+    num_same += (std::fabs(expected.at(i) - disp.at(i)) < 0.01) ? 1 : 0;
+    num_fractional += (disp.at(i) >= 0 && std::fabs(disp.at(i) - std::round(disp.at(i))) > 1e-3) ? 1 : 0;
+  }
+  EXPECT_GE(num_same, static_cast<size_t>(0.98 * expected.size()));
+  EXPECT_GT(num_fractional, 0ul);
+}
+
+TEST(MatcherTest, TestBenchmark)
+{
+  StereoMatcher::Params opt;
+  StereoMatcher matcher(opt);
+
+  opt.num_threads = 4;
+  StereoMatcher matcher_mt(opt);
+
+  FeatureDetector::Params dopt;
+  FeatureDetector detector(dopt);
+
+  const Image1b iml = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  const Image1b imr = cv::imread("./resources/farmsim_01_right.png", cv::IMREAD_GRAYSCALE);
+
+  VecPoint2f empty_kp, left_keypoints;
+  detector.Detect(iml, empty_kp, left_keypoints);
+
+  const int iters = 50;
+
+  Timer timer(true);
+  for (int i = 0; i < iters; ++i) {
+    MatchEachKeypoint(matcher, iml, imr, left_keypoints);
+  }
+  const double ms_template = timer.Tock().milliseconds() / iters;
+
+  timer.Reset();
+  for (int i = 0; i < iters; ++i) {
+    matcher.MatchRectified(iml, imr, left_keypoints);
+  }
+  const double ms_batched = timer.Tock().milliseconds() / iters;
+
+  timer.Reset();
+  for (int i = 0; i < iters; ++i) {
+    matcher_mt.MatchRectified(iml, imr, left_keypoints);
+  }
+  const double ms_batched_mt = timer.Tock().milliseconds() / iters;
+
+  printf("[ StereoMatcher ] %zu keypoints: matchTemplate=%.3f ms batched=%.3f ms batched (4 threads)=%.3f ms\n",
+      left_keypoints.size(), ms_template, ms_batched, ms_batched_mt);
+}
+
+
+TEST(MatcherTest, TestDisparityPriors)
+{
+  StereoMatcher::Params opt;
+  StereoMatcher matcher(opt);
+
+  FeatureDetector::Params dopt;
+  FeatureDetector detector(dopt);
+
+  const Image1b iml = cv::imread("./resources/farmsim_01_left.png", cv::IMREAD_GRAYSCALE);
+  const Image1b imr = cv::imread("./resources/farmsim_01_right.png", cv::IMREAD_GRAYSCALE);
+
+  VecPoint2f empty_kp, left_keypoints;
+  detector.Detect(iml, empty_kp, left_keypoints);
+
+  Timer timer(true);
+  const std::vector<double> disp_full = matcher.MatchRectified(iml, imr, left_keypoints);
+  const double ms_full = timer.Tock().milliseconds();
+
+  // Using the full search result as the prior should give the same answer, with less work.
+  timer.Reset();
+  const std::vector<double> disp_prior = matcher.MatchRectified(iml, imr, left_keypoints, disp_full);
+  const double ms_prior = timer.Tock().milliseconds();
+
+  ASSERT_EQ(disp_full.size(), disp_prior.size());
+  for (size_t i = 0; i < disp_full.size(); ++i) {
+    EXPECT_EQ(disp_full.at(i), disp_prior.at(i));
+  }
+
+  printf("[ StereoMatcher ] %zu keypoints: full search=%.3f ms with priors=%.3f ms\n",
+      left_keypoints.size(), ms_full, ms_prior);
+}
@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <opencv2/core.hpp>
+
+#include "vision_core/stereo_camera.hpp"
+#include "feature_tracking/stereo_tracker.hpp"
+#include "feature_tracking/moving_sequence.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+
+
+// NOTE(milo): This file is its own test binary (ft_alloc_gtest_all), since it replaces the global
+// operator new. Allocations are only counted while g_count_allocations is set. cv::Mat buffers are
+// counted separately with a cv::MatAllocator (they don't go through operator new).
+static std::atomic<bool> g_count_allocations(false);
+static std::atomic<size_t> g_num_new_allocations(0);
+static std::atomic<size_t> g_num_mat_allocations(0);
+
+void* operator new(size_t bytes)
+{
+  if (g_count_allocations.load()) {
+    ++g_num_new_allocations;
+  }
+  void* ptr = std::malloc(bytes > 0 ? bytes : 1);
+  if (ptr == nullptr) { throw std::bad_alloc(); }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+
+// Counts new cv::Mat buffers, and leaves the actual allocation to OpenCV's default allocator.
+class CountingMatAllocator final : public cv::MatAllocator {
+ public:
+  cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                         int flags, cv::UMatUsageFlags usage_flags) const override
+  {
+    if (data == nullptr && g_count_allocations.load()) {
+      ++g_num_mat_allocations;
+    }
+    return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage_flags);
+  }
+
+  bool allocate(cv::UMatData* u, int access_flags, cv::UMatUsageFlags usage_flags) const override
+  {
+    return cv::Mat::getStdAllocator()->allocate(u, access_flags, usage_flags);
+  }
+
+  void deallocate(cv::UMatData* u) const override
+  {
+    cv::Mat::getStdAllocator()->deallocate(u);
+  }
+};
+
+
+// The start of the buffer behind every level of every pyramid slot. If a slot is rebuilt in place,
+// these stay the same (only which slot is the head changes).
+static std::vector<const uchar*> PyramidBuffers(const StereoTracker& tracker)
+{
+  const SlidingBuffer<ImagePyramid>& pyramids = tracker.GetPyramidBuffer();
+
+  std::vector<const uchar*> buffers;
+  for (int k = 0; k < static_cast<int>(std::min(pyramids.Size(), pyramids.Added())); ++k) {
+    for (const cv::Mat& level : pyramids.Get(k)) {
+      buffers.emplace_back(level.datastart);
+    }
+  }
+
+  std::sort(buffers.begin(), buffers.end());
+  return buffers;
+}
+
+
+// Tracks a moving sequence. After a warmup, the tracker's own storage (the frame arena, which holds
+// every ArenaVector, and the pyramid slots) must not grow or move on frames that aren't keyframes
+// (keyframes add landmarks, which is allowed to grow it). Heap allocations through operator new and
+// new cv::Mat buffers are also counted and printed. Those include temporaries inside of OpenCV (e.g
+// the optical flow object and derivative buffers of cv::calcOpticalFlowPyrLK), and with more than
+// one thread, the std::function and std::future state of every ThreadPool task.
+static void CheckSteadyStateMemory(const StereoTracker::Params& params)
+{
+  StereoCamera stereo_rig;
+  const std::vector<StereoImage1b> sequence = MakeMovingSequence(150, stereo_rig);
+
+  StereoTracker tracker(params, stereo_rig);
+
+  CountingMatAllocator mat_allocator;
+  cv::MatAllocator* prev_allocator = cv::Mat::getDefaultAllocator();
+  cv::Mat::setDefaultAllocator(&mat_allocator);
+
+  const size_t num_warmup = 30;
+  size_t num_checked = 0;
+  size_t total_new = 0, max_new = 0;
+  size_t total_mat = 0, max_mat = 0;
+
+  for (size_t i = 0; i < sequence.size(); ++i) {
+    const size_t arena_allocations_before = tracker.GetFrameArena().NumHeapAllocations();
+    const size_t arena_capacity_before = tracker.GetFrameArena().Capacity();
+    const std::vector<const uchar*> pyramids_before = PyramidBuffers(tracker);
+
+    g_num_new_allocations = 0;
+    g_num_mat_allocations = 0;
+
+    g_count_allocations = true;
+    const bool is_keyframe = tracker.TrackAndTriangulate(sequence.at(i), false);
+    g_count_allocations = false;
+
+    if (i < num_warmup || is_keyframe) {
+      continue;
+    }
+
+    EXPECT_EQ(arena_allocations_before, tracker.GetFrameArena().NumHeapAllocations()) << "Frame " << i;
+    EXPECT_EQ(arena_capacity_before, tracker.GetFrameArena().Capacity()) << "Frame " << i;
+    EXPECT_EQ(pyramids_before, PyramidBuffers(tracker)) << "Frame " << i;
+
+    total_new += g_num_new_allocations.load();
+    total_mat += g_num_mat_allocations.load();
+    max_new = std::max(max_new, g_num_new_allocations.load());
+    max_mat = std::max(max_mat, g_num_mat_allocations.load());
+    ++num_checked;
+  }
+
+  cv::Mat::setDefaultAllocator(prev_allocator);
+
+  EXPECT_GT(num_checked, (sequence.size() - num_warmup) / 2);
+  EXPECT_FALSE(tracker.GetLiveTracks().empty());
+
+  const double n = static_cast<double>(std::max(num_checked, 1ul));
+  printf("[ StereoTracker ] klt_num_threads=%d: %zu non-keyframes checked, operator new: %.1f/frame (max %zu), "
+         "cv::Mat buffers: %.1f/frame (max %zu)\n", params.klt_num_threads, num_checked,
+         total_new / n, max_new, total_mat / n, max_mat);
+}
+
+
+TEST(StereoTrackerAllocTest, TestSteadyStateMemory)
+{
+  StereoTracker::Params params;
+  params.klt_num_threads = 1;
+  CheckSteadyStateMemory(params);
+}
+
+
+TEST(StereoTrackerAllocTest, TestSteadyStateMemoryParallel)
+{
+  StereoTracker::Params params;
+  params.klt_num_threads = 4;
+  CheckSteadyStateMemory(params);
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+
+#include <opencv2/highgui.hpp>
+
+#include "core/timer.hpp"
+#include "vision_core/pinhole_camera.hpp"
+#include "vision_core/stereo_camera.hpp"
+#include "feature_tracking/stereo_tracker.hpp"
+#include "feature_tracking/moving_sequence.hpp"
+#include "dataset/euroc_dataset.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+
+
+// Checks that two trackers have exactly the same live tracks (same landmarks, same observations).
+static void ExpectSameTracks(const FeatureTracks& expected, const FeatureTracks& actual)
+{
+  ASSERT_EQ(expected.size(), actual.size());
+
+  for (const LandmarkTrackStore::TrackView obs_expected : expected) {
+    ASSERT_EQ(1ul, actual.count(obs_expected.LandmarkId()));
+    const LandmarkTrackStore::TrackView obs_actual = actual.at(obs_expected.LandmarkId());
+    ASSERT_EQ(obs_expected.size(), obs_actual.size());
+
+    for (size_t i = 0; i < obs_expected.size(); ++i) {
+      EXPECT_EQ(obs_expected.at(i).camera_id, obs_actual.at(i).camera_id);
+      EXPECT_EQ(obs_expected.at(i).pixel_location, obs_actual.at(i).pixel_location);
+      EXPECT_EQ(obs_expected.at(i).disparity, obs_actual.at(i).disparity);
+    }
+  }
+}
+
+
+// Runs the per-frame task graph on 1 and 4 threads, on a moving sequence made from the in-repo
+// farmsim images. With 4 threads, the Match tasks are enqueued from inside of the KLT tasks on the
+// workers, and keyframe detection runs alongside them. Keyframes are triggered often, so that frames
+// with detection (and new landmarks) are covered too.
+TEST(StereoTrackerTest, TestParallelTaskGraphMatchesSerial)
+{
+  StereoCamera stereo_rig;
+  const std::vector<StereoImage1b> sequence = MakeMovingSequence(60, stereo_rig);
+
+  StereoTracker::Params params;
+  params.retrack_frames_k = 4;
+  params.trigger_keyframe_k = 3;
+
+  params.klt_num_threads = 1;
+  StereoTracker serial(params, stereo_rig);
+
+  params.klt_num_threads = 4;
+  StereoTracker parallel(params, stereo_rig);
+
+  int num_keyframes = 0;
+  size_t max_live_tracks = 0;
+
+  for (const StereoImage1b& stereo_pair : sequence) {
+    const bool kf_serial = serial.TrackAndTriangulate(stereo_pair, false);
+    const bool kf_parallel = parallel.TrackAndTriangulate(stereo_pair, false);
+
+    ASSERT_EQ(kf_serial, kf_parallel) << "frame " << stereo_pair.camera_id;
+    ExpectSameTracks(serial.GetLiveTracks(), parallel.GetLiveTracks());
+    if (HasFatalFailure()) { return; }
+
+    num_keyframes += kf_serial ? 1 : 0;
+    max_live_tracks = std::max(max_live_tracks, serial.GetLiveTracks().size());
+  }
+
+  // Make sure that both kinds of frames were compared, and that there was something to track.
+  EXPECT_GT(num_keyframes, 10);
+  EXPECT_LT(num_keyframes, static_cast<int>(sequence.size()));
+  EXPECT_GT(max_live_tracks, 50ul);
+}
+
+
+// Checks that the parallel KLT gives exactly the same tracks as the serial one, and compares their
+// frontend latency on Farmsim data.
+TEST(StereoTrackerTest, TestBenchmarkParallelKLT)
+{
+  LOG(WARNING) << "This test has a hardcoded path! May not work." << std::endl;
+
+  const std::string toplevel_folder = "/home/milo/datasets/Unity3D/farmsim/euroc_test1";
+  dataset::EurocDataset dataset(toplevel_folder);
+
+  std::vector<StereoImage1b> stereo_pairs;
+  dataset::StereoCallback1b stereo_cb = [&stereo_pairs](const StereoImage1b& stereo_pair)
+  {
+    stereo_pairs.emplace_back(stereo_pair);
+  };
+  dataset.RegisterStereoCallback(stereo_cb);
+
+  const size_t max_frames = 300;
+  while (stereo_pairs.size() < max_frames && dataset.Step(false)) {}
+  ASSERT_FALSE(stereo_pairs.empty());
+
+  const PinholeCamera camera_model(415.876509, 415.876509, 375.5, 239.5, 480, 752);
+  const StereoCamera stereo_rig(camera_model, 0.2);
+
+  StereoTracker::Params params;
+  params.retrack_frames_k = 4;
+
+  params.klt_num_threads = 1;
+  StereoTracker serial(params, stereo_rig);
+
+  params.klt_num_threads = 4;
+  StereoTracker parallel(params, stereo_rig);
+
+  double ms_serial = 0;
+  double ms_parallel = 0;
+  Timer timer(false);
+
+  for (const StereoImage1b& stereo_pair : stereo_pairs) {
+    timer.Reset();
+    const bool kf_serial = serial.TrackAndTriangulate(stereo_pair, false);
+    ms_serial += timer.Tock().milliseconds();
+
+    timer.Reset();
+    const bool kf_parallel = parallel.TrackAndTriangulate(stereo_pair, false);
+    ms_parallel += timer.Tock().milliseconds();
+
+    // Results should be identical, not just close.
+    ASSERT_EQ(kf_serial, kf_parallel);
+    ExpectSameTracks(serial.GetLiveTracks(), parallel.GetLiveTracks());
+    if (HasFatalFailure()) { return; }
+  }
+
+  const double n = static_cast<double>(stereo_pairs.size());
+  printf("[ StereoTracker ] %zu frames (retrack_frames_k=%d): serial=%.3f ms/frame parallel (4 threads)=%.3f ms/frame\n",
+      stereo_pairs.size(), params.retrack_frames_k, ms_serial / n, ms_parallel / n);
+}
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "feature_tracking/subpixel.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace ft;
+
+
+// An image that is bright for x > corner_x AND y > corner_y, rendered with area coverage so that
+// the corner can be anywhere within a pixel.
+static Image1b MakeCornerImage(int rows, int cols, float corner_x, float corner_y)
+{
+  Image1b img(rows, cols, 0);
+  for (int y = 0; y < rows; ++y) {
+    const float cov_y = std::max(0.0f, std::min(1.0f, y + 0.5f - corner_y));
+    for (int x = 0; x < cols; ++x) {
+      const float cov_x = std::max(0.0f, std::min(1.0f, x + 0.5f - corner_x));
+      img(y, x) = static_cast<uint8_t>(std::round(40.0f + 160.0f * cov_x * cov_y));
+    }
+  }
+  return img;
+}
+
+
+TEST(SubpixelTest, TestParabolaOffset)
+{
+  // Samples of (x - 0.3)^2 at x = -1, 0, 1.
+  EXPECT_NEAR(0.3f, ParabolaSubpixelOffset(1.69, 0.09, 0.49), 1e-5);
+  EXPECT_NEAR(-0.3f, ParabolaSubpixelOffset(0.49, 0.09, 1.69), 1e-5);
+
+  // Symmetric, flat, and concave costs don't move.
+  EXPECT_EQ(0.0f, ParabolaSubpixelOffset(1.0, 0.5, 1.0));
+  EXPECT_EQ(0.0f, ParabolaSubpixelOffset(1.0, 1.0, 1.0));
+  EXPECT_EQ(0.0f, ParabolaSubpixelOffset(0.5, 1.0, 0.5));
+
+  // Never more than half a pixel.
+  EXPECT_EQ(0.5f, ParabolaSubpixelOffset(10.0, 0.0, 0.0));
+}
+
+
+TEST(SubpixelTest, TestRefineCorners)
+{
+  const float true_x[] = { 30.0f, 30.3f, 30.5f, 29.8f, 31.2f };
+  const float true_y[] = { 40.0f, 40.6f, 39.7f, 40.25f, 40.9f };
+
+  for (size_t i = 0; i < 5; ++i) {
+    const Image1b img = MakeCornerImage(80, 70, true_x[i], true_y[i]);
+
+    // Start from a couple of pixels away.
+    VecPoint2f corners = { cv::Point2f(true_x[i] + 2, true_y[i] - 1), cv::Point2f(true_x[i], true_y[i]) };
+    RefineCornersSubpixel(img, 5, 10, corners);
+
+    for (const cv::Point2f& c : corners) {
+      EXPECT_NEAR(true_x[i], c.x, 0.15);
+      EXPECT_NEAR(true_y[i], c.y, 0.15);
+    }
+  }
+
+  // Corners near the border, or in a flat region, are left alone.
+  const Image1b flat(50, 50, 100);
+  VecPoint2f corners = { cv::Point2f(1.2f, 1.7f), cv::Point2f(25.3f, 24.6f) };
+  const VecPoint2f original = corners;
+  RefineCornersSubpixel(flat, 5, 10, corners);
+  EXPECT_EQ(original, corners);
+}
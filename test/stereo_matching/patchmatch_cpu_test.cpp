@@ -0,0 +1,235 @@
+#include "gtest/gtest.h"
+
+#include <thread>
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "core/timer.hpp"
+#include "stereo_matching/patchmatch_cpu.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace stereo;
+
+
+// Same matcher settings as the PatchmatchGpu tests.
+static PatchmatchCpu::Params DefaultParams(float max_disp)
+{
+  PatchmatchCpu::Params params;
+
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = max_disp;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+
+  params.cost_alpha = 0.9;
+  params.patchmatch_iters = 3;
+
+  return params;
+}
+
+
+// A view of a wide random texture starting at column offset, and a right image that's shifted by a
+// constant disparity.
+static void MakeStereoPair(const Image1b& texture, int offset, int cols, int true_disp, Image1b& il, Image1b& ir)
+{
+  il = texture.colRange(offset, offset + cols).clone();
+  ir = texture.colRange(offset + true_disp, offset + true_disp + cols).clone();
+}
+
+
+TEST(PatchmatchCpuTest, TestConstantDisparity)
+{
+  // Random texture, and a right image that's shifted by a constant disparity.
+  const int true_disp = 8;
+  Image1b il(240, 376);
+  cv::RNG rng(123);
+  rng.fill(il, cv::RNG::UNIFORM, 0, 255);
+  cv::GaussianBlur(il, il, cv::Size(5, 5), 0);
+
+  Image1b ir(il.size(), 0);
+  il(cv::Rect(true_disp, 0, il.cols - true_disp, il.rows)).copyTo(ir(cv::Rect(0, 0, il.cols - true_disp, il.rows)));
+
+  Image1f disp_one_thread;
+
+  for (int num_threads : { 1, 4 }) {
+    PatchmatchCpu::Options options;
+    options.num_threads = num_threads;
+    PatchmatchCpu pm(DefaultParams(64), options);
+
+    Image1f disp, dispr;
+    pm.Match(il, ir, disp, dispr);
+
+    ASSERT_EQ(il.size(), disp.size());
+    ASSERT_EQ(il.size(), dispr.size());
+
+    // Away from the left border (which isn't visible in the right image), most pixels should be found.
+    const Image1f inner = disp(cv::Rect(2 * true_disp, 4, il.cols - 4 * true_disp, il.rows - 8));
+    const int num_correct = cv::countNonZero(cv::abs(inner - true_disp) < 1.0f);
+    EXPECT_GT(num_correct, static_cast<int>(inner.total() / 2));
+
+    // Rows (and columns) are independent, so the number of threads shouldn't change anything.
+    if (num_threads == 1) {
+      disp_one_thread = disp.clone();
+    } else {
+      EXPECT_EQ(0, cv::countNonZero(disp != disp_one_thread));
+    }
+  }
+}
+
+
+TEST(PatchmatchCpuTest, TestWarpDisparity)
+{
+  const StereoCamera stereo_rig(PinholeCamera(200, 200, 188, 120, 240, 376), 0.2);
+  const float true_disp = 8;
+  Image1f disp(240, 376, true_disp);
+
+  Image1f warped;
+  WarpDisparity(disp, stereo_rig, Matrix4d::Identity(), warped);
+  EXPECT_EQ(0, cv::countNonZero(warped != disp));
+
+  // Moving right makes the scene shift left by 3 pixels, and exposes a few columns on the right.
+  const int shift = 3;
+  Matrix4d prev_T_cur = Matrix4d::Identity();
+  prev_T_cur(0, 3) = stereo_rig.Baseline() * shift / true_disp;
+  WarpDisparity(disp, stereo_rig, prev_T_cur, warped);
+
+  const Image1f inner = warped.colRange(0, disp.cols - shift);
+  EXPECT_EQ(0, cv::countNonZero(cv::abs(inner - true_disp) > 1e-3));
+  EXPECT_EQ(0, cv::countNonZero(warped.colRange(disp.cols - 1, disp.cols) >= 0));
+}
+
+
+TEST(PatchmatchCpuTest, TestWarmStart)
+{
+  const int true_disp = 8;
+  const int shift = 4;
+  Image1b texture(240, 376 + true_disp + 2 * shift);
+  cv::RNG rng(123);
+  rng.fill(texture, cv::RNG::UNIFORM, 0, 255);
+  cv::GaussianBlur(texture, texture, cv::Size(5, 5), 0);
+
+  const StereoCamera stereo_rig(PinholeCamera(200, 200, 188, 120, 240, 376), 0.2);
+  Matrix4d prev_T_cur = Matrix4d::Identity();
+  prev_T_cur(0, 3) = stereo_rig.Baseline() * shift / true_disp;
+
+  PatchmatchCpu pm(DefaultParams(64));
+
+  // The first call doesn't have a previous disparity, so it does a full match.
+  Image1b il, ir;
+  Image1f disp, dispr;
+  MakeStereoPair(texture, 0, 376, true_disp, il, ir);
+  pm.Match(il, ir, stereo_rig, prev_T_cur, disp, dispr);
+
+  // Then the camera moves right, and the texture moves left.
+  for (int frame = 1; frame <= 2; ++frame) {
+    MakeStereoPair(texture, frame * shift, 376, true_disp, il, ir);
+    pm.Match(il, ir, stereo_rig, prev_T_cur, disp, dispr);
+
+    ASSERT_EQ(il.size(), disp.size());
+    ASSERT_EQ(il.size(), dispr.size());
+
+    const Image1f inner = disp(cv::Rect(2 * true_disp, 4, il.cols - 4 * true_disp, il.rows - 8));
+    const int num_correct = cv::countNonZero(cv::abs(inner - true_disp) < 1.0f);
+    EXPECT_GT(num_correct, static_cast<int>(inner.total() / 2)) << frame;
+  }
+}
+
+
+TEST(PatchmatchCpuTest, TestBenchmark)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+
+  // 376x240, the resolution we run dense stereo at on the vehicle.
+  const int downsample_factor = 2;
+  cv::resize(il, il, il.size() / downsample_factor);
+  cv::resize(ir, ir, ir.size() / downsample_factor);
+
+  const int trials = 10;
+
+  for (int num_threads : { 1, 2, 4 }) {
+    PatchmatchCpu::Options options;
+    options.num_threads = num_threads;
+    PatchmatchCpu pm(DefaultParams(128.0f / downsample_factor), options);
+
+    Image1f disp, dispr;
+    pm.Match(il, ir, disp, dispr);  // Warm up (allocates the workspaces).
+
+    Timer timer(true);
+    for (int i = 0; i < trials; ++i) {
+      pm.Match(il, ir, disp, dispr);
+    }
+    const double ms = timer.Tock().milliseconds() / trials;
+
+    printf("PatchmatchCpu %dx%d threads=%d: %.1f ms (%.1f Hz) foreground=%.1f%%\n",
+        il.cols, il.rows, num_threads, ms, 1000.0 / ms, 100.0 * cv::countNonZero(disp) / disp.total());
+
+    // The target is >= 10 Hz at 376x240 on 4 cores. Only checked if there really are 4 cores.
+    if (num_threads == 4 && std::thread::hardware_concurrency() >= 4) {
+      EXPECT_GE(1000.0 / ms, 10.0);
+    }
+  }
+}
+
+
+// Tracks a camera that moves right by 1 px per frame over a fronto-parallel textured plane, with a
+// full Match() on every frame (cold) and with the warm start. Both should end up with the same error
+// against the true disparity, so that the times are compared at equal quality.
+TEST(PatchmatchCpuTest, TestBenchmarkWarmStart)
+{
+  const int true_disp = 8;
+  const int num_frames = 30;
+  const int cols = 376, rows = 240;
+  Image1b texture(rows, cols + true_disp + num_frames);
+  cv::RNG rng(123);
+  rng.fill(texture, cv::RNG::UNIFORM, 0, 255);
+  cv::GaussianBlur(texture, texture, cv::Size(5, 5), 0);
+
+  const StereoCamera stereo_rig(PinholeCamera(200, 200, cols / 2, rows / 2, rows, cols), 0.2);
+  Matrix4d prev_T_cur = Matrix4d::Identity();
+  prev_T_cur(0, 3) = stereo_rig.Baseline() / true_disp;
+
+  // Fraction of pixels within 1 px of the true disparity (away from the left border).
+  const auto fraction_correct = [&](const Image1f& disp)
+  {
+    const Image1f inner = disp(cv::Rect(2 * true_disp, 4, cols - 4 * true_disp, rows - 8));
+    return static_cast<double>(cv::countNonZero(cv::abs(inner - true_disp) < 1.0f)) / inner.total();
+  };
+
+  PatchmatchCpu pm_cold(DefaultParams(64));
+  PatchmatchCpu pm_warm(DefaultParams(64));
+
+  Image1b il, ir;
+  Image1f disp, dispr;
+  double ms_cold = 0, ms_warm = 0;
+  double correct_cold = 0, correct_warm = 0;
+
+  for (int frame = 0; frame < num_frames; ++frame) {
+    MakeStereoPair(texture, frame, cols, true_disp, il, ir);
+
+    Timer timer(true);
+    pm_cold.Match(il, ir, disp, dispr);
+    ms_cold += timer.Tock().milliseconds();
+    correct_cold += fraction_correct(disp);
+
+    timer.Reset();
+    pm_warm.Match(il, ir, stereo_rig, prev_T_cur, disp, dispr);
+    ms_warm += timer.Tock().milliseconds();
+    correct_warm += fraction_correct(disp);
+  }
+
+  ms_cold /= num_frames;
+  ms_warm /= num_frames;
+  correct_cold /= num_frames;
+  correct_warm /= num_frames;
+
+  printf("PatchmatchCpu %dx%d cold: %.1f ms, %.1f%% correct | warm start: %.1f ms, %.1f%% correct (%.2fx faster)\n",
+      cols, rows, ms_cold, 100.0 * correct_cold, ms_warm, 100.0 * correct_warm, ms_cold / ms_warm);
+
+  EXPECT_GE(correct_warm, correct_cold - 0.02);
+}
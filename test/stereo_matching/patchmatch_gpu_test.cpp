@@ -11,6 +11,7 @@
 #include "core/file_utils.hpp"
 #include "vision_core/image_util.hpp"
 #include "patchmatch_gpu/patchmatch_gpu.h"
+#include "stereo_matching/patchmatch_cpu.hpp"
 #include "dataset/euroc_dataset.hpp"
 
 using namespace bm;
@@ -136,3 +137,56 @@ TEST(PatchmatchGpuTest, Sequence)
   dataset.Playback(20.0f, false);
   LOG(INFO) << "DONE" << std::endl;
 }
+
+
+// The CPU and GPU versions should find the same foreground, with nearly the same disparities. They
+// aren't bit-exact, since the GPU splits rows and columns into chunks (see patchmatch_cpu.hpp).
+TEST(PatchmatchGpuTest, TestParityWithCpu)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+
+  const int downsample_factor = 2;
+  cv::resize(il, il, il.size() / downsample_factor);
+  cv::resize(ir, ir, ir.size() / downsample_factor);
+
+  // The exact same Params go into both backends.
+  PatchmatchGpu::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128.0f / downsample_factor;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  params.matcher_params.subpixel_refinement = false;
+  params.cost_alpha = 0.9;
+  params.patchmatch_iters = 3;
+
+  stereo::PatchmatchCpu pm_cpu(params);
+  PatchmatchGpu pm_gpu(params);
+
+  Image1f disp_cpu, dispr_cpu, disp_gpu, dispr_gpu;
+  pm_cpu.Match(il, ir, disp_cpu, dispr_cpu);
+  pm_gpu.Match(il, ir, disp_gpu, dispr_gpu);
+
+  ASSERT_EQ(disp_gpu.size(), disp_cpu.size());
+  ASSERT_EQ(dispr_gpu.size(), dispr_cpu.size());
+
+  const Image1b fg_cpu = (disp_cpu > 0);
+  const Image1b fg_gpu = (disp_gpu > 0);
+  const int num_fg_cpu = cv::countNonZero(fg_cpu);
+  const int num_fg_gpu = cv::countNonZero(fg_gpu);
+  const int num_fg_both = cv::countNonZero(fg_cpu & fg_gpu);
+  ASSERT_GT(num_fg_gpu, 0);
+
+  // Most of the foreground should be the same.
+  EXPECT_GT(num_fg_both, 0.9 * num_fg_gpu);
+  EXPECT_GT(num_fg_both, 0.9 * num_fg_cpu);
+
+  // Where both have a disparity, it should almost always be within a pixel.
+  const Image1b close = (cv::abs(disp_cpu - disp_gpu) < 1.0f) & fg_cpu & fg_gpu;
+  const double fraction_close = static_cast<double>(cv::countNonZero(close)) / std::max(1, num_fg_both);
+  EXPECT_GT(fraction_close, 0.9);
+
+  printf("PatchmatchGpu vs. PatchmatchCpu: foreground cpu=%d gpu=%d both=%d, within 1px=%.1f%%\n",
+      num_fg_cpu, num_fg_gpu, num_fg_both, 100.0 * fraction_close);
+}
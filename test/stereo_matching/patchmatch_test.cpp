@@ -45,6 +45,19 @@ static float L1GradientCostFunction(const Image1b& pl,
 }
 
 
+// Same cost as PatchCostWeights, through the (slow) CostFunctor2 interface.
+static float L1GradientCostReference(const Image1b& pl,
+                                     const Image1b& pr,
+                                     const Image1f& gl,
+                                     const Image1f& gr)
+{
+  const PatchCostWeights w;
+  const float error_color = std::fmin(L1CostFunction<Image1b>(pl, pr), w.tau_color);
+  const float error_grad = std::fmin(L1CostFunction<Image1f>(gl, gr), w.tau_grad);
+  return w.alpha * error_color + (1 - w.alpha) * error_grad;
+}
+
+
 static void ComputeGradient(const Image1b& im, Image1f& gmag)
 {
   cv::Mat Dx;
@@ -64,6 +77,35 @@ static void ComputeGradient(const Image1b& im, Image1f& gmag)
 }
 
 
+// Mean cost (see PatchCostWeights) of the 5x5 patches at each pixel's disparity, for pixels that
+// aren't background (zero disparity). Lower is better.
+static double MeanPatchCost(const Image1b& iml,
+                            const Image1b& imr,
+                            const Image1f& Gl,
+                            const Image1f& Gr,
+                            const Image1f& disp)
+{
+  PatchSamples<5, 5> ref, cand;
+  double sum = 0;
+  int count = 0;
+
+  for (int y = 2; y < (iml.rows - 2); ++y) {
+    for (int x = 2; x < (iml.cols - 2); ++x) {
+      const float d = std::fmin(disp(y, x), static_cast<float>(x - 2));
+      if (d <= 0) {
+        continue;
+      }
+      SamplePatch<5, 5>(iml, Gl, static_cast<float>(x), y, ref);
+      SamplePatch<5, 5>(imr, Gr, static_cast<float>(x) - d, y, cand);
+      sum += PatchCost<5, 5>(ref, cand, PatchCostWeights());
+      ++count;
+    }
+  }
+
+  return sum / std::max(1, count);
+}
+
+
 static Image1b Normalize1b(const Image1f& im)
 {
   double minVal, maxVal;
@@ -113,6 +155,19 @@ static Image3b VisualizeDisp(const Image1f& disp, int max_disp, int pm_downsampl
 }
 
 
+TEST(PatchmatchTest, TestLoadParams)
+{
+  const Patchmatch::Params params("./resources/config/Patchmatch.yaml");
+
+  EXPECT_EQ(PropagationSchedule::WAVEFRONT, params.propagation_schedule);
+  EXPECT_EQ(4, params.propagation_threads);
+  EXPECT_EQ(32, params.propagation_tile_size);
+  EXPECT_EQ(2, params.red_black_iters);
+  EXPECT_FLOAT_EQ(0.25, params.temporal_max_hole_fraction);
+  EXPECT_EQ(11, params.matcher_params.templ_rows);
+}
+
+
 TEST(PatchmatchTest, Test01)
 {
   // Image1b il = cv::imread("./resources/farmsim_01_left.png", CV_LOAD_IMAGE_GRAYSCALE);
@@ -186,3 +241,209 @@ TEST(PatchmatchTest, Test01)
 
   cv::waitKey(0);
 }
+
+
+TEST(PatchmatchTest, TestFastPropagateMatchesReference)
+{
+  // Random texture, and a right image that's shifted by a constant disparity.
+  const int true_disp = 6;
+  Image1b il(60, 80);
+  cv::RNG rng(123);
+  rng.fill(il, cv::RNG::UNIFORM, 0, 255);
+  cv::GaussianBlur(il, il, cv::Size(3, 3), 0);
+
+  Image1b ir(il.size(), 0);
+  il(cv::Rect(true_disp, 0, il.cols - true_disp, il.rows)).copyTo(ir(cv::Rect(0, 0, il.cols - true_disp, il.rows)));
+
+  Image1f Gl, Gr;
+  ComputeGradient(il, Gl);
+  ComputeGradient(ir, Gr);
+
+  // Integer disparities, so that both versions sample the same pixel values.
+  Image1f disp0(il.size(), 0.0f);
+  for (int y = 0; y < disp0.rows; ++y) {
+    for (int x = 0; x < disp0.cols; ++x) {
+      disp0(y, x) = static_cast<float>(rng.uniform(0, 12));
+    }
+  }
+
+  Patchmatch pm{Patchmatch::Params()};
+
+  for (int patch_size : { 3, 5 }) {
+    Image1f disp_reference = disp0.clone();
+    Image1f disp_fast = disp0.clone();
+
+    pm.Propagate(il, ir, Gl, Gr, disp_reference, L1GradientCostReference, patch_size, patch_size);
+    pm.Propagate(il, ir, Gl, Gr, disp_fast, PatchCostWeights(), patch_size, patch_size);
+
+    // Only near-ties (summed in a different order) can go differently.
+    const int num_different = cv::countNonZero(cv::abs(disp_reference - disp_fast) > 1e-3);
+    EXPECT_LT(num_different, disp0.rows * disp0.cols / 100);
+
+    pm.RemoveBackground(il, ir, Gl, Gr, disp_reference, L1GradientCostReference, patch_size, patch_size, 1.5);
+    pm.RemoveBackground(il, ir, Gl, Gr, disp_fast, PatchCostWeights(), patch_size, patch_size, 1.5);
+    EXPECT_LT(cv::countNonZero(cv::abs(disp_reference - disp_fast) > 1e-3), disp0.rows * disp0.cols / 100);
+  }
+}
+
+
+TEST(PatchmatchTest, TestInitializeWarmStart)
+{
+  const int true_disp = 8;
+  const int shift = 4;
+  Image1b texture(240, 376 + true_disp + shift);
+  cv::RNG rng(123);
+  rng.fill(texture, cv::RNG::UNIFORM, 0, 255);
+  cv::GaussianBlur(texture, texture, cv::Size(5, 5), 0);
+
+  // The camera moved right, so the texture moved left by shift pixels (at full resolution).
+  const Image1b il = texture.colRange(shift, shift + 376).clone();
+  const Image1b ir = texture.colRange(shift + true_disp, shift + true_disp + 376).clone();
+
+  const StereoCamera stereo_rig(PinholeCamera(200, 200, 188, 120, 240, 376), 0.2);
+  Matrix4d prev_T_cur = Matrix4d::Identity();
+  prev_T_cur(0, 3) = stereo_rig.Baseline() * shift / true_disp;
+
+  Patchmatch pm{Patchmatch::Params()};
+
+  // Same size and scale as Initialize() returns.
+  const int downsample_factor = 2;
+  const float init_disp = true_disp / std::pow(2.0f, downsample_factor);
+  const Image1f prev_disp(il.size() / downsample_factor, init_disp);
+
+  const Image1f disp = pm.Initialize(il, ir, downsample_factor, prev_disp, stereo_rig, prev_T_cur);
+  ASSERT_EQ(prev_disp.size(), disp.size());
+
+  // Everything that was visible before keeps its disparity, and nothing is left missing.
+  const Image1f inner = disp.colRange(0, disp.cols - shift / downsample_factor);
+  EXPECT_EQ(0, cv::countNonZero(cv::abs(inner - init_disp) > 1e-3));
+  EXPECT_EQ(0, cv::countNonZero(disp < 0));
+
+  // Without a previous disparity of the right size, it's the same as a full Initialize().
+  const Image1f disp_full = pm.Initialize(il, ir, downsample_factor, Image1f(), stereo_rig, prev_T_cur);
+  EXPECT_EQ(0, cv::countNonZero(disp_full != pm.Initialize(il, ir, downsample_factor)));
+}
+
+
+TEST(PatchmatchTest, TestBenchmarkFastPropagate)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  cv::resize(il, il, il.size() / 2);
+  cv::resize(ir, ir, ir.size() / 2);
+
+  Patchmatch::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+  Patchmatch pm(params);
+
+  Image1f disp0 = pm.Initialize(il, ir, 1);
+  pm.AddNoise(disp0, 8.0, disp0 > 0);
+
+  Image1f Gl, Gr;
+  ComputeGradient(il, Gl);
+  ComputeGradient(ir, Gr);
+
+  for (int patch_size : { 3, 5 }) {
+    Image1f disp_reference = disp0.clone();
+    Image1f disp_fast = disp0.clone();
+
+    Timer timer(true);
+    pm.Propagate(il, ir, Gl, Gr, disp_reference, L1GradientCostReference, patch_size, patch_size);
+    const double ms_reference = timer.Tock().milliseconds();
+
+    timer.Reset();
+    pm.Propagate(il, ir, Gl, Gr, disp_fast, PatchCostWeights(), patch_size, patch_size);
+    const double ms_fast = timer.Tock().milliseconds();
+
+    // The fast version doesn't round interpolated patches to uint8, so allow some differences here.
+    const double mean_abs_diff = cv::mean(cv::abs(disp_reference - disp_fast))[0];
+
+    printf("Propagate %dx%d (%dx%d image): reference=%.1f ms fast=%.1f ms (%.1fx) mean |disp diff|=%.3f px\n",
+        patch_size, patch_size, il.cols, il.rows, ms_reference, ms_fast, ms_reference / ms_fast, mean_abs_diff);
+  }
+}
+
+
+TEST(PatchmatchTest, TestBenchmarkPropagationSchedules)
+{
+  Image1b il = cv::imread("./resources/caddy_32_left.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/caddy_32_right.jpg", CV_LOAD_IMAGE_GRAYSCALE);
+  cv::resize(il, il, il.size() / 2);
+  cv::resize(ir, ir, ir.size() / 2);
+
+  Patchmatch::Params params;
+  params.matcher_params.templ_cols = 31;
+  params.matcher_params.templ_rows = 11;
+  params.matcher_params.max_disp = 128;
+  params.matcher_params.max_matching_cost = 0.15;
+  params.matcher_params.bidirectional = true;
+
+  Image1f disp0;
+  {
+    Patchmatch pm(params);
+    disp0 = pm.Initialize(il, ir, 1);
+    pm.AddNoise(disp0, 8.0, disp0 > 0);
+  }
+
+  Image1f Gl, Gr;
+  ComputeGradient(il, Gl);
+  ComputeGradient(ir, Gr);
+
+  struct Config
+  {
+    const char* name;
+    PropagationSchedule schedule;
+    int threads;
+  };
+
+  // The first one is the baseline (serial raster sweeps).
+  const std::vector<Config> configs = {
+    { "RASTER", PropagationSchedule::RASTER, 1 },
+    { "RASTER", PropagationSchedule::RASTER, 4 },
+    { "WAVEFRONT", PropagationSchedule::WAVEFRONT, 1 },
+    { "WAVEFRONT", PropagationSchedule::WAVEFRONT, 4 },
+    { "RED_BLACK", PropagationSchedule::RED_BLACK, 1 },
+    { "RED_BLACK", PropagationSchedule::RED_BLACK, 4 },
+  };
+
+  const int iters = 3;
+  Image1f disp_baseline, disp_one_thread;
+  double ms_baseline = 0;
+
+  printf("Propagation schedules (%dx%d, %d iters, 5x5 patches). Initial cost=%.3f\n",
+      il.cols, il.rows, iters, MeanPatchCost(il, ir, Gl, Gr, disp0));
+
+  for (const Config& config : configs) {
+    params.propagation_schedule = config.schedule;
+    params.propagation_threads = config.threads;
+    Patchmatch pm(params);
+
+    Image1f disp = disp0.clone();
+    Timer timer(true);
+    for (int i = 0; i < iters; ++i) {
+      pm.Propagate(il, ir, Gl, Gr, disp, PatchCostWeights(), 5, 5);
+    }
+    const double ms = timer.Tock().milliseconds();
+
+    if (disp_baseline.empty()) {
+      disp_baseline = disp.clone();
+      ms_baseline = ms;
+    }
+
+    // Same schedule with more threads should give exactly the same result.
+    if (config.threads == 1) {
+      disp_one_thread = disp.clone();
+    } else {
+      EXPECT_EQ(0, cv::countNonZero(disp != disp_one_thread)) << config.name;
+    }
+
+    const double agree = static_cast<double>(cv::countNonZero(cv::abs(disp - disp_baseline) < 1.0)) / disp.total();
+
+    printf("  %-10s threads=%d: %.1f ms (%.2fx) cost=%.3f agree_with_baseline=%.1f%%\n",
+        config.name, config.threads, ms, ms_baseline / ms, MeanPatchCost(il, ir, Gl, Gr, disp), 100.0 * agree);
+  }
+}
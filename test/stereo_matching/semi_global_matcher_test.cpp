@@ -0,0 +1,139 @@
+#include "gtest/gtest.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "core/timer.hpp"
+#include "stereo_matching/semi_global_matcher.hpp"
+#include "stereo_matching/stereo_matching.hpp"
+
+using namespace bm;
+using namespace core;
+using namespace stereo;
+
+
+// Random texture, and a right image where each row is shifted by 8 + slope * y pixels.
+static void MakeStereoPair(int rows, int cols, float slope, Image1b& il, Image1b& ir)
+{
+  il = Image1b(rows, cols);
+  cv::RNG rng(123);
+  rng.fill(il, cv::RNG::UNIFORM, 0, 255);
+  cv::GaussianBlur(il, il, cv::Size(3, 3), 0);
+
+  ir = Image1b(rows, cols, 0);
+  for (int y = 0; y < rows; ++y) {
+    const int d = 8 + static_cast<int>(slope * y);
+    il.row(y).colRange(d, cols).copyTo(ir.row(y).colRange(0, cols - d));
+  }
+}
+
+
+// Fraction of pixels (away from the borders) within 1 pixel of the true disparity.
+static double FractionCorrect(const Image1f& disp, float slope)
+{
+  int num_correct = 0;
+  int num_pixels = 0;
+  for (int y = 8; y < (disp.rows - 8); ++y) {
+    const int d = 8 + static_cast<int>(slope * y);
+    for (int x = 64; x < (disp.cols - 8); ++x) {
+      num_correct += (std::fabs(disp(y, x) - d) < 1.0f) ? 1 : 0;
+      ++num_pixels;
+    }
+  }
+  return static_cast<double>(num_correct) / num_pixels;
+}
+
+
+TEST(SemiGlobalMatcherTest, TestConstantDisparity)
+{
+  Image1b il, ir;
+  MakeStereoPair(120, 200, 0.0f, il, ir);
+
+  for (int num_paths : { 4, 8 }) {
+    SemiGlobalMatcher::Params params;
+    params.num_paths = num_paths;
+    SemiGlobalMatcher sgm(params);
+
+    Image1f disp;
+    sgm.Compute(il, ir, DisparityRange(0, 64), disp);
+    EXPECT_GT(FractionCorrect(disp, 0.0f), 0.95) << num_paths;
+    EXPECT_EQ(il.total() * 64, sgm.CostVolumeSize());
+
+    // The first few columns aren't visible in the right image, so the left-right check removes them.
+    const Image1f occluded = disp(cv::Rect(4, 8, 4, il.rows - 16));
+    EXPECT_GT(cv::countNonZero(occluded == SemiGlobalMatcher::kInvalidDisparity), 0.8 * occluded.total());
+
+    // A narrower range finds the same thing with a smaller cost volume.
+    Image1f disp_narrow;
+    sgm.Compute(il, ir, DisparityRange(4, 12), disp_narrow);
+    EXPECT_GT(FractionCorrect(disp_narrow, 0.0f), 0.95) << num_paths;
+    EXPECT_EQ(il.total() * 16, sgm.CostVolumeSize());
+  }
+}
+
+
+TEST(SemiGlobalMatcherTest, TestSparseWindows)
+{
+  const float slope = 0.25f;
+  Image1b il, ir;
+  MakeStereoPair(160, 220, slope, il, ir);
+
+  SemiGlobalMatcher sgm{SemiGlobalMatcher::Params()};
+
+  Image1f disp_full;
+  sgm.Compute(il, ir, DisparityRange(0, 64), disp_full);
+  const size_t full_size = sgm.CostVolumeSize();
+
+  // A grid of sparse disparities, like the landmarks from StereoTracker.
+  VecLandmarkObservation sparse;
+  for (int y = 10; y < il.rows; y += 25) {
+    for (int x = 20; x < il.cols; x += 30) {
+      sparse.emplace_back(0, 0, cv::Point2f(x, y), 8 + static_cast<int>(slope * y), 1.0, 1.0);
+    }
+  }
+  sparse.emplace_back(0, 0, cv::Point2f(5, 5), -1.0, 1.0, 1.0);  // Invalid, should be skipped.
+
+  Image1f disp_sparse;
+  sgm.Compute(il, ir, sparse, disp_sparse);
+  EXPECT_LT(sgm.CostVolumeSize(), full_size);
+  EXPECT_GT(FractionCorrect(disp_sparse, slope), 0.9);
+
+  // Without any sparse disparities, every pixel searches the full range.
+  sgm.Compute(il, ir, VecLandmarkObservation(), disp_sparse);
+  EXPECT_EQ(full_size, sgm.CostVolumeSize());
+}
+
+
+TEST(SemiGlobalMatcherTest, TestBenchmark)
+{
+  Image1b il = cv::imread("./resources/images/fsl1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  Image1b ir = cv::imread("./resources/images/fsr1.png", CV_LOAD_IMAGE_GRAYSCALE);
+  cv::resize(il, il, il.size() / 2);
+  cv::resize(ir, ir, ir.size() / 2);
+
+  const int trials = 10;
+
+  Timer timer(true);
+  for (int i = 0; i < trials; ++i) {
+    EstimateDisparity(il, ir, 64, 3);
+  }
+  printf("EstimateDisparity (StereoSGBM) %dx%d: %.1f ms\n", il.cols, il.rows, timer.Tock().milliseconds() / trials);
+
+  for (int num_paths : { 4, 8 }) {
+    SemiGlobalMatcher::Params params;
+    params.num_paths = num_paths;
+    SemiGlobalMatcher sgm(params);
+
+    Image1f disp;
+    sgm.Compute(il, ir, DisparityRange(0, 64), disp);  // Warm up (allocates the buffers).
+
+    timer.Reset();
+    for (int i = 0; i < trials; ++i) {
+      sgm.Compute(il, ir, DisparityRange(0, 64), disp);
+    }
+    printf("SemiGlobalMatcher %dx%d paths=%d: %.1f ms valid=%.1f%%\n",
+        il.cols, il.rows, num_paths, timer.Tock().milliseconds() / trials,
+        100.0 * cv::countNonZero(disp >= 0) / disp.total());
+  }
+}
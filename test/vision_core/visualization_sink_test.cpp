@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+
+#include <future>
+
+#include "core/file_utils.hpp"
+#include "vision_core/visualization_sink.hpp"
+
+using namespace bm;
+using namespace core;
+
+
+static VisualizationSink::Params HeadlessParams(const std::string& output_folder)
+{
+  VisualizationSink::Params params;
+  params.headless = true;
+  params.output_folder = output_folder;
+  params.max_rate_hz = 0;
+  return params;
+}
+
+
+TEST(VisualizationSinkTest, TestDropIfBusy)
+{
+  const std::string folder = "/tmp/visualization_sink_test_drop";
+  rmdir(folder);
+
+  std::promise<void> started, release;
+  std::shared_future<void> release_future = release.get_future().share();
+  {
+    VisualizationSink sink(HeadlessParams(folder));
+
+    // Block the sink thread inside of a render.
+    sink.Post("busy", [&started, release_future]() {
+      started.set_value();
+      release_future.wait();
+      return cv::Mat(Image1b(4, 4, 0));
+    });
+    started.get_future().wait();
+
+    // Only the newest of these should be rendered, and Post() shouldn't wait for the sink.
+    for (int i = 0; i < 5; ++i) {
+      sink.Post("tracks", Image1b(4, 4, i));
+    }
+    EXPECT_EQ(4ul, sink.NumDropped());
+
+    release.set_value();
+  }
+
+  // The destructor renders waiting frames before returning.
+  EXPECT_TRUE(Exists(Join(folder, "busy_000000.png")));
+  EXPECT_TRUE(Exists(Join(folder, "tracks_000000.png")));
+  EXPECT_FALSE(Exists(Join(folder, "tracks_000001.png")));
+
+  rmdir(folder);
+}
+
+
+TEST(VisualizationSinkTest, TestHeadlessFilenames)
+{
+  const std::string folder = "/tmp/visualization_sink_test_names";
+  rmdir(folder);
+
+  {
+    VisualizationSink sink(HeadlessParams(folder));
+    sink.Post("Foreground Mask", Image1b(8, 8, 255));
+  }
+
+  EXPECT_TRUE(Exists(Join(folder, "Foreground_Mask_000000.png")));
+
+  rmdir(folder);
+}